@@ -19,26 +19,53 @@ static const char* program_name = NULL;
 static void
 print_usage(FILE* stream, int exit_code) {
   fprintf(stream, "Usage: %s [OPTION...] input_file [output_file]\n", program_name);
+  fprintf(stream, "       %s [OPTION...] --archive output_file input_file...\n", program_name);
+  fprintf(stream, "       %s [OPTION...] --verify input_file [source_mzML]\n", program_name);
   fprintf(stream, "Compresses mass spec raw data with high efficiency.\n\n");
   fprintf(stream, "MSCompress version %s %s\n", VERSION, STATUS);
   fprintf(stream, "Supports msz versions %s-%s\n", MIN_SUPPORT, MAX_SUPPORT);
   fprintf(stream, "Options:\n");
   fprintf(stream, "  -v, --verbose                 Run in verbose mode.\n");
   fprintf(stream, "  -t, --threads num             Set amount of threads to use. (default: auto)\n");
-  fprintf(stream, "  -z, --mz-lossy type           Enable mz lossy compression (cast, log, delta(16, 32), vbr). (disabled by default)\n");
-  fprintf(stream, "  -i, --int-lossy type          Enable int lossy compression (cast, log, delta(16, 32), vbr). (disabled by default)\n");
+  fprintf(stream, "  -z, --mz-lossy type           Enable mz lossy compression (cast, log, delta(16, 32), vbr, abs, ppm, sparse, grid). (disabled by default)\n");
+  fprintf(stream, "  -i, --int-lossy type          Enable int lossy compression (cast, log, delta(16, 32), vbr, rel, sparse). (disabled by default)\n");
+  fprintf(stream, "                                sparse (-z and -i) losslessly removes zero-intensity runs of profile spectra.\n");
+  fprintf(stream, "                                grid (-z) losslessly codes m/z against reference grids shared by consecutive scans.\n");
   fprintf(stream, " --mz-scale-factor factor       Set mz scale factors for delta transform or threshold for vbr.\n");
+  fprintf(stream, "                                Maximum error for abs (m/z, default: 0.001) or ppm (default: 1).\n");
   fprintf(stream, " --int-scale-factor factor      Set int scale factors for log transform or threshold for vbr\n");
+  fprintf(stream, "                                Maximum relative error for rel (default: 0.01).\n");
   fprintf(stream, " --extract-indices [range]      Extract indices from mzML file (eg. [1-3,5-6]). (disabled by default)\n");
   fprintf(stream, " --extract-scans [range]        Extract scans from mzML file (eg. [1-3,5-6]). (disabled by default)\n");
   fprintf(stream, " --ms-level level               Extract specified ms level (1, 2, n). (disabled by default)\n");
   fprintf(stream, " --extract-only                 Only output extracted mzML, no compression (disabled by default)\n");
-  fprintf(stream, " --target-xml-format type       Set target xml compression format (zstd, none). (default: zstd)\n");
+  fprintf(stream, " --list                         List the spectra of an msz file (index, scan, ms level, retention time in seconds,\n"
+                  "                                precursor m/z and charge, isolation window) without decompressing it.\n");
+  fprintf(stream, " --query terms                  Write the spectra of an msz file matching all terms as mzML, decompressing\n"
+                  "                                only the divisions holding them. Terms separated by ';':\n"
+                  "                                rt=lo-hi (retention time in seconds), ms=level (1, 2, n), scans=[range],\n"
+                  "                                mz=lo-hi (precursor m/z) (eg. \"rt=600-1200;ms=2;mz=400-500\").\n");
+ fprintf(stream, " --archive output_file          Compress all input mzML files into one archive. The XML of the runs is\n"
+                  "                                compressed against the XML of the first run (with zstd, the default).\n");
+  fprintf(stream, " --run name|index               Run of an archive to decompress, query or list (see --list).\n"
+                  "                                --list without --run lists the runs of an archive.\n");
+ fprintf(stream, " --transcode                    Rewrite an msz file with the target formats and zstd level given, block by block.\n"
+                  "                                -z/-i re-transform m/z and intensity arrays stored losslessly.\n");
+ fprintf(stream, " --verify                       Decompress an msz file over all threads without writing it, checking its blocks\n"
+                  "                                and checksum, and compare it to source_mzML if given.\n");
+  fprintf(stream, " --target-xml-format type       Set target xml compression format (zstd, struct, none). (default: zstd)\n");
   fprintf(stream, " --target-mz-format type        Set target mz compression format (zstd, none). (default: zstd)\n");
   fprintf(stream, " --target-inten-format type     Set target inten compression format (zstd, none). (default: zstd)\n");
   fprintf(stream, " --zstd-compression-level level Set zstd compression level (1-22). (default: 3)\n");
+  fprintf(stream, " --zlib-level level             Set deflate level used to restore zlib binaries (0-9).\n");
+  fprintf(stream, "                                Lower levels decompress faster but change the restored binaries.\n"
+                  "                                (default: restore the original parameters)\n");
+  fprintf(stream, " --zlib-strategy type           Set deflate strategy used to restore zlib binaries\n");
+  fprintf(stream, "                                (default, filtered, huffman, rle, fixed). (default: restore the original parameters)\n");
   fprintf(stream, "  -b, --blocksize size          Set maximum blocksize (xKB, xMB, xGB). (default: 100MB)\n");
-  fprintf(stream, "  -c, --checksum                Enable checksum generation. (disabled by default)\n");
+  fprintf(stream, " --max-memory size              Bound the memory of the divisions in flight (xKB, xMB, xGB). Fewer divisions\n"
+                  "                                run at once, and compression makes them smaller, to fit. (default: no limit)\n");
+  fprintf(stream, "  -c, --checksum                Store a checksum of the input, verified on decompression. (disabled by default)\n");
   fprintf(stream, "  -h, --help                    Show this help message.\n");
   fprintf(stream, "  -V, --version                 Show version information.\n\n");
   fprintf(stream, "Arguments:\n");
@@ -47,6 +74,34 @@ print_usage(FILE* stream, int exit_code) {
   exit(exit_code);
 }
 
+static void
+list_spectra(char* input_map, long input_filesize, FILE* stream)
+{
+  footer_t* footer;
+  toc_t* toc;
+  divisions_t* divisions;
+  int n_divisions = 0;
+
+  check_format_version(input_map, "list_spectra");
+
+  parse_footer(&footer, input_map, input_filesize, &toc, &divisions, &n_divisions);
+  read_metadata(input_map, footer, divisions);
+
+  fprintf(stream, "index\tscan\tms_level\trt(s)\tprecursor_mz\tcharge\tisolation_target\tisolation_lower\tisolation_upper\n");
+  for (int i = 0; i < divisions->n_divisions; i++) {
+    division_t* div = divisions->divisions[i];
+    for (long j = 0; j < div->mz->total_spec; j++) {
+      if (div->indices[j] < 0) // padding spectrum of an extraction
+        continue;
+      fprintf(stream, "%ld\t%ld\t%ld\t%g\t%.6f\t%ld\t%.6f\t%g\t%g\n",
+              div->indices[j], div->scans[j], div->ms_levels[j], div->ret_times[j], div->precursor_mzs[j],
+              div->charges[j], div->isolation_targets[j], div->isolation_lower[j], div->isolation_upper[j]);
+    }
+  }
+  dealloc_toc(toc);
+  dealloc_read_divisions(divisions);
+}
+
 static int 
 parse_arguments(int argc, char* argv[], struct Arguments* arguments) {
   int i;
@@ -59,6 +114,10 @@ parse_arguments(int argc, char* argv[], struct Arguments* arguments) {
     return 1;
   }
 
+  arguments->input_files = malloc(sizeof(char*) * argc);
+  if (arguments->input_files == NULL)
+    return 1;
+
   for (i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
       arguments->verbose = 1;
@@ -91,8 +150,19 @@ parse_arguments(int argc, char* argv[], struct Arguments* arguments) {
         print_usage(stderr, 1);
       }
       arguments->blocksize = blksize;
+    } else if (strcmp(argv[i], "--max-memory") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "%s\n", "Missing size for --max-memory.");
+        return 1;
+      }
+      long max_mem = parse_blocksize(argv[++i]);
+      if (max_mem <= 0) {
+        fprintf(stderr, "%s\n", "Unkown size suffix. (KB, MB, GB)");
+        print_usage(stderr, 1);
+      }
+      arguments->max_memory = max_mem;
     } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--checksum") == 0) {
-      // enable checksum generation (not implemented)
+      arguments->checksum = 1;
     } else if (strcmp(argv[i], "--mz-scale-factor") == 0) {
       if (i + 1 >= argc) {
         fprintf(stderr, "%s\n", "Missing scale factor for mz compression.");
@@ -141,6 +211,36 @@ parse_arguments(int argc, char* argv[], struct Arguments* arguments) {
     else if (strcmp(argv[i], "--extract-only") == 0) {
       arguments->extract_only = 1;
     }
+    else if (strcmp(argv[i], "--list") == 0) {
+      arguments->list = 1;
+    }
+    else if (strcmp(argv[i], "--query") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "%s\n", "Missing query terms.");
+        return 1;
+      }
+      if (set_query(arguments, argv[++i]) != 0) return 1;
+    }
+    else if (strcmp(argv[i], "--archive") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "%s\n", "Missing archive output file.");
+        return 1;
+      }
+      arguments->archive = argv[++i];
+    }
+    else if (strcmp(argv[i], "--run") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "%s\n", "Missing run name or index.");
+        return 1;
+      }
+      arguments->run = argv[++i];
+    }
+    else if (strcmp(argv[i], "--transcode") == 0) {
+      arguments->transcode = 1;
+    }
+    else if (strcmp(argv[i], "--verify") == 0) {
+      arguments->verify = 1;
+    }
     else if (strcmp(argv[i], "--target-xml-format") == 0) {
       if (i + 1 >= argc) {
         fprintf(stderr, "%s\n", "Missing target xml format.");
@@ -175,23 +275,48 @@ parse_arguments(int argc, char* argv[], struct Arguments* arguments) {
       }
       arguments->zstd_compression_level = num;
     }  
-    else if (arguments->input_file == NULL) {
-      arguments->input_file = argv[i];
+    else if (strcmp(argv[i], "--zlib-level") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "%s\n", "Missing zlib compression level.");
+        return 1;
+      }
+      if (set_zlib_compression_level(arguments, argv[++i]) != 0) return 1;
+    }
+    else if (strcmp(argv[i], "--zlib-strategy") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "%s\n", "Missing zlib strategy.");
+        return 1;
+      }
+      if (set_zlib_strategy(arguments, argv[++i]) != 0) return 1;
     }
-    else if (arguments->output_file == NULL) {
-      arguments->output_file = argv[i];
-    } 
     else {
-      fprintf(stderr, "%s\n", "Too many arguments.");
-      return 1;
+      arguments->input_files[arguments->n_input_files++] = argv[i];
     }
   }
 
+  if (arguments->archive == NULL && arguments->n_input_files > 2) {
+    fprintf(stderr, "%s\n", "Too many arguments.");
+    return 1;
+  }
+  if (arguments->n_input_files > 0)
+    arguments->input_file = arguments->input_files[0];
+  if (arguments->archive == NULL && arguments->n_input_files > 1)
+    arguments->output_file = arguments->input_files[1];
+  if (arguments->verify) { // --verify writes nothing, its second file is the mzML to compare to
+    arguments->verify_source = arguments->output_file;
+    arguments->output_file = NULL;
+  }
+
   if (arguments->input_file == NULL) {
     fprintf(stderr, "%s\n", "Missing input file.");
     return 1;
   }
 
+  if (arguments->transcode && arguments->output_file == NULL) {
+    fprintf(stderr, "%s\n", "--transcode requires an output file.");
+    return 1;
+  }
+
   return 0;
 }
 
@@ -207,6 +332,7 @@ main(int argc, char* argv[])
     data_format_t* df;
 
     void* input_map = NULL;
+    void* file_map = NULL; // mapping of the input, input_map being a run within it for archives
     size_t input_filesize = 0;
     int operation = -1;
     
@@ -214,6 +340,7 @@ main(int argc, char* argv[])
       print_usage(stderr, 1);
 
     verbose = arguments.verbose;    
+    max_memory = arguments.max_memory;
 
     abs_start = get_time();
 
@@ -223,8 +350,61 @@ main(int argc, char* argv[])
 
     prepare_threads(&arguments); // Populate threads variable if not set.
 
+    if(arguments.archive)
+    {
+      if(open_output_file(arguments.archive) < 0)
+        error("Error in opening archive %s.\n", arguments.archive);
+
+      archive_mzml(arguments.input_files, arguments.n_input_files, &arguments, fds[1]);
+
+      close_file(fds[1]);
+      print("\n=== Operation finished in %1.4fs ===\n", get_time() - abs_start);
+      exit(0);
+    }
+
     // Open file descriptors and mmap.
-    operation = prepare_fds(arguments.input_file, &arguments.output_file, NULL, &input_map, &input_filesize, &fds);
+    if(arguments.list || arguments.verify)
+    {
+      operation = prepare_fds(arguments.input_file, NULL, NULL, &input_map, &input_filesize, &fds);
+      if(operation != DECOMPRESS && operation != ARCHIVE)
+        error("%s requires an msz file.\n", arguments.list ? "--list" : "--verify");
+    }
+    else
+      operation = prepare_fds(arguments.input_file, &arguments.output_file, NULL, &input_map, &input_filesize, &fds);
+
+    file_map = input_map;
+    if(operation == ARCHIVE && arguments.run != NULL)
+    {
+      // A run is an msz within the archive.
+      input_map = open_run(file_map, input_filesize, arguments.run, &input_filesize);
+      operation = DECOMPRESS;
+    }
+    else if(operation == ARCHIVE && !arguments.list)
+      error("An archive requires --run (name or index) or --list.\n");
+
+    if(arguments.list && operation == DECOMPRESS)
+      operation = LIST;
+
+    if(arguments.query != NULL)
+    {
+      if(operation != DECOMPRESS)
+        error("--query requires an msz file.\n");
+      operation = QUERY;
+    }
+
+    if(arguments.transcode)
+    {
+      if(operation != DECOMPRESS)
+        error("--transcode requires an msz file.\n");
+      operation = TRANSCODE;
+    }
+
+    if(arguments.verify)
+    {
+      if(operation != DECOMPRESS)
+        error("--verify requires an msz file.\n");
+      operation = VERIFY;
+    }
 
     if(arguments.extract_only)
       operation = EXTRACT;
@@ -284,7 +464,39 @@ main(int argc, char* argv[])
                 &divisions);
           
           extract_mzml((char*)input_map, divisions, fds[1]);
+          break;
       };
+      case LIST:
+      {
+          list_spectra((char*)input_map, input_filesize, stdout);
+          break;
+      }
+      case TRANSCODE:
+      {
+          print("\nTranscoding...\n");
+
+          transcode_msz((char*)input_map, input_filesize, &arguments, fds[1]);
+          break;
+      }
+      case VERIFY:
+      {
+          print("\nVerifying...\n");
+
+          verify_msz((char*)input_map, input_filesize, &arguments);
+          break;
+      }
+      case ARCHIVE:
+      {
+          list_runs(input_map, input_filesize, stdout);
+          break;
+      }
+      case QUERY:
+      {
+          print("\nQuerying...\n");
+
+          query_msz((char*)input_map, input_filesize, arguments.query, &arguments, fds[1]);
+          break;
+      }
     }
     print("\nCleaning up...\n");
 
@@ -294,10 +506,11 @@ main(int argc, char* argv[])
 
     // dealloc_df(df);
 
-    remove_mapping(input_map, fds[0]);
+    remove_mapping(file_map, fds[0]);
 
     close_file(fds[0]);
-    close_file(fds[1]);
+    if(fds[1] >= 0)
+      close_file(fds[1]);
     print("\tClosed file descriptors\n");
 
     abs_stop = get_time();
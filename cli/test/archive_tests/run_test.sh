@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# All mzML files go into one archive, each run restored by index and by name
+tput sgr0;
+echo "Testing archive of" *.mzML "..."
+../../mscompress --archive ./test.msza *.mzML
+if [ $(../../mscompress --list ./test.msza | wc -l) -eq $(( $(ls *.mzML | wc -l) + 1 )) ]; then
+    tput setab 2; echo "Archive list test passed"; tput sgr0;
+else
+    tput setab 1; echo "Archive list test failed"; tput sgr0;
+fi
+
+run=0
+for i in *.mzML; do
+    ../../mscompress --run $run ./test.msza ./test_index.mzML
+    ../../mscompress --run "$i" ./test.msza ./test_name.mzML
+    cmp -s "$i" ./test_index.mzML && cmp -s "$i" ./test_name.mzML
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "Archive test $i (run $run) passed"; tput sgr0;
+    else
+        tput setab 1; echo "Archive test $i (run $run) failed"; tput sgr0;
+    fi
+    rm -f ./test_index.mzML ./test_name.mzML
+    run=$(( run + 1 ))
+done
+rm -f ./test.msza
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Workers free their arenas on teardown: round trips with small blocks over several threads must not leak (LeakSanitizer)
+LSAN=$(gcc -print-file-name=liblsan.so 2>/dev/null)
+if [ ! -f "$LSAN" ]; then
+    echo "liblsan.so not found, arena tests skipped."
+    exit 0
+fi
+
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    for mode in "" "--mz-lossy sparse --int-lossy sparse" "--mz-lossy abs --int-lossy rel"; do
+        LD_PRELOAD=$LSAN ../../mscompress --threads 4 --blocksize 64KB $mode "$i" ./test.msz > /dev/null
+        compress=$?
+        LD_PRELOAD=$LSAN ../../mscompress --threads 4 ./test.msz ./test.mzML > /dev/null
+        decompress=$?
+        LD_PRELOAD=$LSAN ../../mscompress --threads 4 --verify ./test.msz > /dev/null
+        verify=$?
+        if [ -z "$mode" ] || [ "${mode#*sparse}" != "$mode" ]; then
+            cmp -s "$i" ./test.mzML
+        else
+            python3 ../validate.py "$i" ./test.mzML 0.001 0.01 abs rel
+        fi
+        restored=$?
+        if [ $compress -eq 0 ] && [ $decompress -eq 0 ] && [ $verify -eq 0 ] && [ $restored -eq 0 ]; then
+            tput setab 2; echo "Arena test $i (${mode:-lossless}) passed"; tput sgr0;
+        else
+            tput setab 1; echo "Arena test $i (${mode:-lossless}) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML
+    done
+done
@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# 64-bit m/z arrays cast to 32-bit stay within float rounding (2^-24 relative)
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress --mz-lossy cast "$i" ./test.msz
+    ../../mscompress ./test.msz ./test.mzML
+    python3 ../validate.py "$i" ./test.mzML 6e-8 0 rel abs
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "cast test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "cast test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test.mzML
+done
@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# -c checksums computed over all threads are verified on decompression
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    for threads in 1 4; do
+        ../../mscompress --threads $threads -c "$i" ./test.msz
+        ../../mscompress --threads $threads ./test.msz ./test.mzML && cmp -s "$i" ./test.mzML &&
+            ../../mscompress --verify ./test.msz | grep -q "checksum verified"
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "Checksum test $i ($threads threads) passed"; tput sgr0;
+        else
+            tput setab 1; echo "Checksum test $i ($threads threads) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML
+    done
+done
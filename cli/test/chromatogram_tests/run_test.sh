@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# Chromatogram streams stay exact, also under lossy m/z and intensity modes
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress "$i" ./test.msz
+    ../../mscompress ./test.msz ./test.mzML
+    cmp -s "$i" ./test.mzML
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "Chromatogram lossless test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "Chromatogram lossless test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test.mzML
+
+    ../../mscompress --mz-lossy abs --int-lossy rel "$i" ./test.msz
+    ../../mscompress ./test.msz ./test.mzML
+    python3 ../validate_arrays.py "$i" ./test.mzML
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "Chromatogram lossy test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "Chromatogram lossy test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test.mzML
+done
@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# Reference grid coding with one division and with several
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    for threads in 1 4; do
+        ../../mscompress --threads $threads --mz-lossy grid "$i" ./test.msz
+        ../../mscompress --threads $threads ./test.msz ./test.mzML
+        cmp -s "$i" ./test.mzML
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "grid test $i ($threads threads) passed"; tput sgr0;
+        else
+            tput setab 1; echo "grid test $i ($threads threads) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML
+    done
+done
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# A stale indexedmzML offset index (comment inserted before <run) falls back to scanning
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    sed '0,/<run /s//<!-- stale index --><run /' "$i" > ./test_stale.mzML
+    for index in valid stale; do
+        input="$i"
+        [ $index = stale ] && input=./test_stale.mzML
+        ../../mscompress "$input" ./test.msz
+        ../../mscompress ./test.msz ./test.mzML
+        ../../mscompress --list ./test.msz > ./test_$index.tsv
+        cmp -s "$input" ./test.mzML && cmp -s ./test_valid.tsv ./test_$index.tsv
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "Index test $i ($index index) passed"; tput sgr0;
+        else
+            tput setab 1; echo "Index test $i ($index index) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML
+    done
+    rm -f ./test_stale.mzML ./test_valid.tsv ./test_stale.tsv
+done
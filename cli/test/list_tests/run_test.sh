@@ -0,0 +1,15 @@
+#!/bin/bash
+
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress "$i" ./test.msz
+    ../../mscompress --list ./test.msz > ./test.tsv
+    python3 ../validate_list.py "$i" ./test.tsv
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "List test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "List test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test.tsv
+done
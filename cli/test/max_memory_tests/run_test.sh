@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# --max-memory budgets smaller than one division
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    for budget in 1MB 16MB; do
+        ../../mscompress --threads 8 --max-memory $budget "$i" ./test.msz
+        ../../mscompress --threads 8 --max-memory $budget ./test.msz ./test.mzML
+        cmp -s "$i" ./test.mzML && ../../mscompress --threads 8 --max-memory $budget --verify ./test.msz "$i" > /dev/null
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "Max memory test $i ($budget) passed"; tput sgr0;
+        else
+            tput setab 1; echo "Max memory test $i ($budget) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML
+    done
+done
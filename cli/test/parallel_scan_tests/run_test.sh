@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Chunked mzML scan: any thread count finds the same spectra
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress --threads 1 "$i" ./test.msz
+    ../../mscompress --list ./test.msz > ./test_1.tsv
+    for threads in 2 3 8; do
+        ../../mscompress --threads $threads "$i" ./test.msz
+        ../../mscompress --threads $threads ./test.msz ./test.mzML
+        ../../mscompress --list ./test.msz > ./test.tsv
+        cmp -s "$i" ./test.mzML && cmp -s ./test_1.tsv ./test.tsv
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "Parallel scan test $i ($threads threads) passed"; tput sgr0;
+        else
+            tput setab 1; echo "Parallel scan test $i ($threads threads) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML ./test.tsv
+    done
+    rm -f ./test_1.tsv
+done
@@ -0,0 +1,19 @@
+#!/bin/bash
+
+# Error-bounded m/z quantization stays within the abs and ppm bounds
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    for mode in "abs 0.001 abs" "abs 0.01 abs" "ppm 1 ppm" "ppm 5 ppm"; do
+        set -- $mode
+        ../../mscompress --mz-lossy $1 --mz-scale-factor $2 "$i" ./test.msz
+        ../../mscompress ./test.msz ./test.mzML
+        python3 ../validate.py "$i" ./test.mzML $2 0 $3 abs
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "$1 test $i ($2) passed"; tput sgr0;
+        else
+            tput setab 1; echo "$1 test $i ($2) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML
+    done
+done
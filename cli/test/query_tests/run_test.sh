@@ -0,0 +1,18 @@
+#!/bin/bash
+
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress "$i" ./test.msz
+    for query in "rt=60-300" "rt=0-600;ms=2" "ms=1"; do
+        ../../mscompress --query "$query" ./test.msz ./test.mzML
+        python3 ../validate_query.py "$i" ./test.mzML "$query"
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "Query test $i \"$query\" passed"; tput sgr0;
+        else
+            tput setab 1; echo "Query test $i \"$query\" failed"; tput sgr0;
+        fi
+        rm -f ./test.mzML
+    done
+    rm -f ./test.msz
+done
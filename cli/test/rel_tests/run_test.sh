@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# Relative intensity quantization stays within its bound
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    for bound in 0.01 0.05; do
+        ../../mscompress --int-lossy rel --int-scale-factor $bound "$i" ./test.msz
+        ../../mscompress ./test.msz ./test.mzML
+        python3 ../validate.py "$i" ./test.mzML 0 $bound abs rel
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "rel test $i ($bound) passed"; tput sgr0;
+        else
+            tput setab 1; echo "rel test $i ($bound) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML
+    done
+done
@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Zero-run elimination
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress --mz-lossy sparse --int-lossy sparse "$i" ./test.msz
+    ../../mscompress ./test.msz ./test.mzML
+    cmp -s "$i" ./test.mzML
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "sparse test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "sparse test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test.mzML
+done
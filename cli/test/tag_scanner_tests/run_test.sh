@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Tag scanner with LF and CRLF line endings
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    sed 's/$/\r/' "$i" > ./test_crlf.mzML
+    for endings in LF CRLF; do
+        input="$i"
+        [ $endings = CRLF ] && input=./test_crlf.mzML
+        ../../mscompress "$input" ./test.msz
+        ../../mscompress ./test.msz ./test.mzML
+        cmp -s "$input" ./test.mzML
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "Tag scanner test $i ($endings) passed"; tput sgr0;
+        else
+            tput setab 1; echo "Tag scanner test $i ($endings) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML
+    done
+    rm -f ./test_crlf.mzML
+done
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# A one-byte change to a block fails its table of contents checksum
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress "$i" ./test.msz
+    ../../mscompress --verify ./test.msz "$i" > /dev/null
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "TOC test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "TOC test $i failed"; tput sgr0;
+    fi
+
+    # Flip the low bit of a byte a third of the way into the blocks
+    pos=$(( $(stat -c %s ./test.msz) / 3 ))
+    byte=$(od -An -tu1 -j $pos -N1 ./test.msz | tr -d ' ')
+    printf "\\$(printf %03o $(( byte ^ 1 )))" | dd of=./test.msz bs=1 seek=$pos conv=notrunc 2> /dev/null
+    ../../mscompress --verify ./test.msz > /dev/null 2>&1
+    verify=$?
+    ../../mscompress ./test.msz ./test.mzML > /dev/null 2>&1
+    decompress=$?
+    if [ $verify -ne 0 ] && [ $decompress -ne 0 ]; then
+        tput setab 2; echo "TOC corruption test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "TOC corruption test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test.mzML
+done
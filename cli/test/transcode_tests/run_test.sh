@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# --transcode to another zstd level and XML codec, and to error-bounded modes
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress "$i" ./test.msz
+    ../../mscompress --transcode --zstd-compression-level 9 --target-xml-format struct ./test.msz ./test_out.msz
+    ../../mscompress ./test_out.msz ./test.mzML
+    cmp -s "$i" ./test.mzML
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "Transcode lossless test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "Transcode lossless test $i failed"; tput sgr0;
+    fi
+    rm -f ./test_out.msz ./test.mzML
+
+    ../../mscompress --transcode --mz-lossy abs --int-lossy rel ./test.msz ./test_out.msz
+    ../../mscompress ./test_out.msz ./test.mzML
+    python3 ../validate.py "$i" ./test.mzML 0.001 0.01 abs rel
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "Transcode lossy test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "Transcode lossy test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test_out.msz ./test.mzML
+done
@@ -1,147 +1,108 @@
-import struct
 import sys
 
 from lxml import etree
 import base64
 import zlib
-import struct
-import pandas as pd
 import numpy as np
-import traceback
+
+# usage: validate.py org.mzML test.mzML mz_tolerance int_tolerance [mz_error int_error]
+#
+# Compares the m/z and intensity arrays of the spectra of two mzML files. Without mz_error and int_error,
+# tolerances are relative and exceeding them is only reported. With mz_error and int_error (abs, rel or ppm),
+# tolerances are in that unit and exceeding them fails the test, as for the error bounded lossy modes.
+
+MZ_ARRAY = 'MS:1000514'
+INT_ARRAY = 'MS:1000515'
 
 
 def get_tree(path):
-    mzml_file = open(path)
+    mzml_file = open(path, 'rb')
     tree = etree.parse(mzml_file)
     return tree
 
 
-def get_encoding(tree):
-    root = tree.getroot()
-    nodes = tree.findall('//mzML/run/spectrumList/spectrum/binaryDataArrayList/binaryDataArray/cvParam',
-                         namespaces=root.nsmap)
-    for node in nodes:
-        accession = node.attrib['accession']
-        if accession == 'MS:1000574':
-            return 'zlib'
-        elif accession == 'MS:1000576':
-            return 'nocomp'
-
-def get_datatype(tree):
-    root = tree.getroot()
-    nodes = tree.findall('//mzML/run/spectrumList/spectrum/binaryDataArrayList/binaryDataArray/cvParam',
-                         namespaces=root.nsmap)
-    for node in nodes:
-        accession = node.attrib['accession']
-        if accession == 'MS:1000523':
-            return 8 # 64 bit (double)
-        elif accession == 'MS:1000521':
-            return 4 # 32 bit (float)
-
-
-def get_binaries(tree):
-    root = tree.getroot()
-    binaries = []
-    for binary in tree.findall(
-            '//mzML/run/spectrumList/spectrum/binaryDataArrayList/binaryDataArray/binary',
-            namespaces=root.nsmap):
-        binaries.append(base64.b64decode(binary.text))
-    return binaries
-
-
-def unpack_floats(data, sizeof_):
-    res = []
-    fun = None
-
-    def f(i):
-        res.append(struct.unpack('f', i)[0])
-    def d(i):
-        res.append(struct.unpack('<d', i)[0])
+def get_encoding(params):
+    if 'MS:1000574' in params:
+        return 'zlib'
+    elif 'MS:1000576' in params:
+        return 'nocomp'
+    print('invalid encoding_type')
+    exit(-1)
 
-    if sizeof_ == 8:
-        fun = d
-    elif sizeof_ == 4:
-        fun = f
-    else:
-        print('invalid encoding size')
-        exit(-1)
 
-    for i in range(0, int(len(data)), sizeof_):
-        fun(data[i:i + sizeof_])
-    return res
+def get_datatype(params):
+    if 'MS:1000523' in params:
+        return np.dtype('<f8')  # 64 bit (double)
+    elif 'MS:1000521' in params:
+        return np.dtype('<f4')  # 32 bit (float)
+    print('invalid encoding size')
+    exit(-1)
 
 
-def unpack_all(l, encoding_type, sizeof_):
-    mz = []
-    intensity = []
-    fun = None
-
-    if encoding_type == 'zlib':
-        fun = zlib.decompress
-    elif encoding_type == 'nocomp':
-        def fun(arr): return arr
-    else:
-        print('invalid encoding_type')
-        exit(-1)
+def get_binaries(tree):
+    """Returns the m/z and intensity arrays of every spectrum, each decoded with its own encoding and type."""
+    binaries = {'mz': [], 'int': []}
+    for spectrum in tree.getroot().iter('{*}spectrum'):
+        for array in spectrum.iter('{*}binaryDataArray'):
+            params = [p.attrib['accession'] for p in array.iterfind('{*}cvParam')]
+            if MZ_ARRAY in params:
+                kind = 'mz'
+            elif INT_ARRAY in params:
+                kind = 'int'
+            else:
+                continue
+            data = base64.b64decode(array.findtext('{*}binary') or '')
+            if get_encoding(params) == 'zlib':
+                data = zlib.decompress(data)
+            binaries[kind].append(np.frombuffer(data, dtype=get_datatype(params)).astype(np.float64))
+    return binaries
 
-    for i in range(0, len(l), 2):
-        for b in unpack_floats(fun(l[i]), sizeof_):
-            mz.append(b)
-        for b in unpack_floats(fun(l[i + 1]), sizeof_):
-            intensity.append(b)
 
-    return {'mz': mz, 'int': intensity}
+def max_error(org, test, unit):
+    diff = np.abs(test - org)
+    if unit == 'abs':
+        return diff.max(initial=0)
+    with np.errstate(divide='ignore', invalid='ignore'):
+        rel = np.where(diff == 0, 0, diff / np.abs(org))
+    return rel.max(initial=0) * (1e6 if unit == 'ppm' else 1)
 
 
 if __name__ == "__main__":
-    test = sys.argv[1]
-    org = sys.argv[2]
+    org = sys.argv[1]
+    test = sys.argv[2]
     mz_tolerance = float(sys.argv[3])
     int_tolerance = float(sys.argv[4])
-
-    test_tree = get_tree(test)
-    org_tree = get_tree(org)
-
-    test_binaries = unpack_all(get_binaries(test_tree), get_encoding(test_tree), get_datatype(test_tree))
-    org_binaries = unpack_all(get_binaries(org_tree), get_encoding(org_tree), get_datatype(org_tree))
-
-    # number of binaries should be the same
-    if len(test_binaries) != len(org_binaries):
-        print("mismatched number of binaries. org {}, test {}".format(len(test_binaries), len(org_binaries)))
-        exit(-1)
-
-    test_df = pd.DataFrame(test_binaries, columns=['mz', 'int'])
-    org_df = pd.DataFrame(org_binaries, columns=['mz', 'int'])
-    test_df = test_df.rename({'mz': 'test_mz', 'int': 'test_int'}, axis='columns')
-    org_df = org_df.rename({'mz': 'org_mz', 'int': 'org_int'}, axis='columns')
-
-    df = test_df.join(org_df)
-
-    # check if the count of mz and int is consistent between test and original
-    if df['test_mz'].count() != df['org_mz'].count():
-        print("mismatched mz count. org {}, test {}".format(df['test_mz'].count(), df['org_mz'].count()))
-        exit(-1)
-    if df['test_int'].count() != df['org_int'].count():
-        print("mismatched mz count. org {}, test {}".format(df['test_mz'].count(), df['org_mz'].count()))
-        exit(-1)
-
-    # check for invalid values
-    if df.isnull().values.any():
-        print("null values found.")
-        exit(-1)
-    if np.isinf(df).values.sum() > 0:
-        print("inf values found.")
-        exit(-1)
-
-    df['%mz_diff'] = abs(df['test_mz'] - df['org_mz']) / df['org_mz']
-    df['%int_diff'] = abs(df['test_int'] - df['org_int']) / df['org_mz']
-
-    mz_diff_max = df['%mz_diff'].describe()['max']
-    if mz_diff_max > mz_tolerance:
-        print('mz tolerance of {} surpassed. (mz max diff: {})'.format(mz_tolerance, mz_diff_max))
-
-    int_diff_max = df['%int_diff'].describe()['max']
-    if int_diff_max > int_tolerance:
-        print('int tolerance of {} surpassed. (int max diff: {})'.format(int_tolerance, int_diff_max))
-
-    exit(0)
+    strict = len(sys.argv) > 6
+    units = {'mz': sys.argv[5] if strict else 'rel', 'int': sys.argv[6] if strict else 'rel'}
+    tolerances = {'mz': mz_tolerance, 'int': int_tolerance}
+
+    org_binaries = get_binaries(get_tree(org))
+    test_binaries = get_binaries(get_tree(test))
+
+    failed = False
+    for kind in ['mz', 'int']:
+        # number of arrays and values should be the same
+        if len(org_binaries[kind]) != len(test_binaries[kind]):
+            print("mismatched number of {} arrays. org {}, test {}".format(kind, len(org_binaries[kind]), len(test_binaries[kind])))
+            exit(-1)
+
+        org_values = np.concatenate(org_binaries[kind] or [np.empty(0)])
+        test_values = np.concatenate(test_binaries[kind] or [np.empty(0)])
+        if [len(a) for a in org_binaries[kind]] != [len(a) for a in test_binaries[kind]]:
+            print("mismatched {} count. org {}, test {}".format(kind, len(org_values), len(test_values)))
+            exit(-1)
+
+        # check for invalid values
+        if np.isnan(test_values).any() or np.isnan(org_values).any():
+            print("null values found.")
+            exit(-1)
+        if np.isinf(test_values).any() or np.isinf(org_values).any():
+            print("inf values found.")
+            exit(-1)
+
+        diff_max = max_error(org_values, test_values, units[kind])
+        if diff_max > tolerances[kind]:
+            print('{} tolerance of {} {} surpassed. ({} max diff: {})'.format(kind, tolerances[kind], units[kind], kind, diff_max))
+            failed = failed or strict
+
+    exit(-1 if failed else 0)
@@ -0,0 +1,38 @@
+import sys
+
+from lxml import etree
+
+# usage: validate_arrays.py org.mzML test.mzML
+#
+# Checks that the binaries lossy modes leave untouched are restored exactly: the arrays of each spectrum
+# other than m/z and intensity, and the arrays of each chromatogram.
+
+MZ_ARRAY = 'MS:1000514'
+INT_ARRAY = 'MS:1000515'
+
+
+def get_untouched(path):
+    binaries = []
+    for element in etree.parse(open(path, 'rb')).getroot().iter('{*}spectrum', '{*}chromatogram'):
+        for array in element.iter('{*}binaryDataArray'):
+            params = [p.attrib['accession'] for p in array.iterfind('{*}cvParam')]
+            if element.tag.endswith('spectrum') and (MZ_ARRAY in params or INT_ARRAY in params):
+                continue
+            binaries.append((element.attrib['id'], array.findtext('{*}binary') or ''))
+    return binaries
+
+
+if __name__ == "__main__":
+    org = get_untouched(sys.argv[1])
+    test = get_untouched(sys.argv[2])
+
+    if len(org) != len(test):
+        print("mismatched number of arrays. org {}, test {}".format(len(org), len(test)))
+        exit(-1)
+
+    for (org_id, org_binary), (test_id, test_binary) in zip(org, test):
+        if org_id != test_id or org_binary != test_binary:
+            print("mismatched array of {}".format(org_id))
+            exit(-1)
+
+    exit(0)
@@ -0,0 +1,46 @@
+import sys
+
+from lxml import etree
+
+# usage: validate_list.py org.mzML list.tsv
+#
+# Compares the output of mscompress --list to the spectra of the mzML: one row per spectrum, in order,
+# with its ms level and its scan start time converted to seconds.
+
+MS_LEVEL = 'MS:1000511'
+SCAN_START_TIME = 'MS:1000016'
+UNIT_SCALE = {'UO:0000010': 1, 'UO:0000031': 60}  # second, minute
+
+
+def get_spectra(path):
+    spectra = []
+    for spectrum in etree.parse(open(path, 'rb')).getroot().iter('{*}spectrum'):
+        ms_level, rt = 0, 0.0
+        for param in spectrum.iter('{*}cvParam'):
+            accession = param.attrib['accession']
+            if accession == MS_LEVEL and not ms_level:
+                ms_level = int(param.attrib['value'])
+            elif accession == SCAN_START_TIME and not rt:
+                rt = float(param.attrib['value']) * UNIT_SCALE.get(param.attrib.get('unitAccession'), 1)
+        spectra.append((ms_level, rt))
+    return spectra
+
+
+if __name__ == "__main__":
+    spectra = get_spectra(sys.argv[1])
+    rows = [line.rstrip('\n').split('\t') for line in open(sys.argv[2])]
+
+    if rows[0][3] != 'rt(s)':
+        print("missing retention time unit. header {}".format(rows[0]))
+        exit(-1)
+    rows = rows[1:]
+    if len(rows) != len(spectra):
+        print("mismatched number of spectra. org {}, list {}".format(len(spectra), len(rows)))
+        exit(-1)
+
+    for i, (row, (ms_level, rt)) in enumerate(zip(rows, spectra)):
+        if int(row[0]) != i or int(row[2]) != ms_level or abs(float(row[3]) - rt) > 1e-5 * max(1, abs(rt)):
+            print("mismatched spectrum {}. org ms level {} rt {}, list {}".format(i, ms_level, rt, row))
+            exit(-1)
+
+    exit(0)
@@ -0,0 +1,67 @@
+import sys
+
+from lxml import etree
+import numpy as np
+
+# usage: validate_query.py org.mzML result.mzML terms
+#
+# Checks the output of mscompress --query: it must hold exactly the spectra of the mzML matching the
+# rt (seconds), ms and mz (precursor m/z) terms, in order, with their binaries unchanged.
+
+MS_LEVEL = 'MS:1000511'
+SCAN_START_TIME = 'MS:1000016'
+SELECTED_ION_MZ = 'MS:1000744'
+UNIT_SCALE = {'UO:0000010': 1, 'UO:0000031': 60}  # second, minute
+
+
+def first_value(spectrum, accession):
+    for param in spectrum.iter('{*}cvParam'):
+        if param.attrib['accession'] == accession:
+            return param.attrib['value'], param.attrib.get('unitAccession')
+    return None, None
+
+
+def matches(spectrum, terms):
+    level, _ = first_value(spectrum, MS_LEVEL)
+    level = int(level or 0)
+    if 'ms' in terms and terms['ms'] != ('n' if level > 2 else str(level)):
+        return False
+    if 'rt' in terms:
+        value, unit = first_value(spectrum, SCAN_START_TIME)
+        # stored as 32-bit floats in seconds, compared against the window rounded the same way
+        rt = np.float32(float(value or 0) * UNIT_SCALE.get(unit, 1))
+        lo, hi = (np.float32(x) for x in terms['rt'].split('-'))
+        if rt < lo or rt > hi:
+            return False
+    if 'mz' in terms:
+        value, _ = first_value(spectrum, SELECTED_ION_MZ)
+        lo, hi = (float(x) for x in terms['mz'].split('-'))
+        if not lo <= float(value or 0) <= hi:
+            return False
+    return True
+
+
+def get_spectra(path):
+    return list(etree.parse(open(path, 'rb')).getroot().iter('{*}spectrum'))
+
+
+def get_binaries(spectrum):
+    return [b.text for b in spectrum.iter('{*}binary')]
+
+
+if __name__ == "__main__":
+    org = get_spectra(sys.argv[1])
+    result = get_spectra(sys.argv[2])
+    terms = dict(term.strip().split('=') for term in sys.argv[3].split(';'))
+
+    expected = [s for s in org if matches(s, terms)]
+    if [s.attrib['id'] for s in expected] != [s.attrib['id'] for s in result]:
+        print("mismatched spectra. expected {}, result {}".format(len(expected), len(result)))
+        exit(-1)
+
+    for e, r in zip(expected, result):
+        if get_binaries(e) != get_binaries(r):
+            print("mismatched binaries of spectrum {}".format(e.attrib['id']))
+            exit(-1)
+
+    exit(0)
@@ -0,0 +1,19 @@
+#!/bin/bash
+
+# --verify alone, against its source, against an altered source, writing no output
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress "$i" ./test.msz
+    sed '0,/version="/s//VERSION="/' "$i" > ./test_other.mzML
+    ../../mscompress --verify ./test.msz > /dev/null &&
+        ../../mscompress --verify ./test.msz "$i" | grep -q "identical to source" &&
+        ! ../../mscompress --verify ./test.msz ./test_other.mzML > /dev/null 2>&1 &&
+        [ ! -e ./test.mzML ]
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "Verify test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "Verify test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test_other.mzML
+done
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# More divisions than ring slots, so producers outrun the writer, and with --max-memory holding batches until it catches up
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    for threads in 2 3; do
+        slots=2
+        while [ $slots -lt $threads ]; do slots=$((slots * 2)); done
+        for budget in "" "--max-memory 1MB"; do
+            divisions=$(../../mscompress -v --threads $threads --blocksize 64KB $budget "$i" ./test.msz 2>&1 | sed -n 's/^Using \([0-9]*\) divisions.*/\1/p')
+            ../../mscompress --threads $threads $budget ./test.msz ./test.mzML
+            cmp -s "$i" ./test.mzML
+            if [ $? -eq 0 ] && [ "${divisions:-0}" -gt $slots ]; then
+                tput setab 2; echo "Writer ring test $i ($threads threads, $divisions divisions, $slots slots${budget:+, $budget}) passed"; tput sgr0;
+            else
+                tput setab 1; echo "Writer ring test $i ($threads threads, ${divisions:-0} divisions, $slots slots${budget:+, $budget}) failed"; tput sgr0;
+            fi
+            rm -f ./test.msz ./test.mzML
+        done
+    done
+done
@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Structural XML coding
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress --target-xml-format struct "$i" ./test.msz
+    ../../mscompress ./test.msz ./test.mzML
+    cmp -s "$i" ./test.mzML
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "XML struct test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "XML struct test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test.mzML
+done
@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# zlib binaries written at any level are re-deflated with their recorded parameters
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    for mode in "" "--mz-lossy sparse --int-lossy sparse" "--mz-lossy grid"; do
+        ../../mscompress $mode "$i" ./test.msz
+        ../../mscompress ./test.msz ./test.mzML
+        cmp -s "$i" ./test.mzML
+        if [ $? -eq 0 ]; then
+            tput setab 2; echo "zlib params test $i (${mode:-lossless}) passed"; tput sgr0;
+        else
+            tput setab 1; echo "zlib params test $i (${mode:-lossless}) failed"; tput sgr0;
+        fi
+        rm -f ./test.msz ./test.mzML
+    done
+done
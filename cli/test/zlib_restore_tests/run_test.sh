@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# Buffers sized from recorded lengths when binaries are deflated anew (--zlib-level, lossy)
+for i in *.mzML; do
+    tput sgr0;
+    echo "Testing $i..."
+    ../../mscompress "$i" ./test.msz
+    ../../mscompress --zlib-level 1 ./test.msz ./test.mzML
+    python3 ../validate.py "$i" ./test.mzML 0 0 abs abs
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "zlib level test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "zlib level test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test.mzML
+
+    ../../mscompress --int-lossy rel "$i" ./test.msz
+    ../../mscompress ./test.msz ./test.mzML
+    python3 ../validate.py "$i" ./test.mzML 0 0.01 abs rel
+    if [ $? -eq 0 ]; then
+        tput setab 2; echo "zlib lossy restore test $i passed"; tput sgr0;
+    else
+        tput setab 1; echo "zlib lossy restore test $i failed"; tput sgr0;
+    fi
+    rm -f ./test.msz ./test.mzML
+done
@@ -37,12 +37,13 @@ namespace mscompress {
         switch(source_compression) {
             case _zlib_:
             {
-                z_stream* z = alloc_z_stream();
+                z_stream* z = alloc_inflate_z_stream();
                 zlib_block_t* decmp_output = zlib_alloc(0);
                 if(decmp_output == NULL) {
                     throw std::runtime_error("Error in zlib_alloc");
                 }
                 ZLIB_TYPE decmp_size = (ZLIB_TYPE)zlib_decompress(z, (Bytef*)dest, decmp_output, out_len);
+                dealloc_inflate_z_stream(z);
                 dest = (char*)decmp_output->buff;
                 out_len = decmp_size;
                 break;
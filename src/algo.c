@@ -7,10 +7,94 @@
 #include <zstd.h>
 #include "mscompress.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* 
     @section Decoding functions
 */
 
+static void
+algo_record_zlib_params(algo_args* a_args)
+/**
+ * @brief Stores the deflate parameters reproducing the source zlib stream of a lossless binary
+ *        in its header (see decode_zlib_fun). If no parameters reproduce it, the binary is replaced
+ *        by the original zlib stream (left in a_args->tmp) and marked ZLIB_PARAMS_RAW.
+ *        After ZLIB_PARAMS_MAX_MISSES consecutive misses, streams are stored as-is without searching.
+ * 
+ * @param args Pointer to algo_args struct.
+ */
+{
+    char* decoded = *a_args->dest;
+    ZLIB_TYPE len = *(ZLIB_TYPE*)decoded;
+    int params = ZLIB_PARAMS_RAW;
+
+    if(a_args->zlib_misses < ZLIB_PARAMS_MAX_MISSES)
+        params = zlib_find_params(a_args->deflate_z,
+                                  (Bytef*)decoded + ZLIB_HEADER_SIZE, len,
+                                  (Bytef*)a_args->tmp->mem, a_args->tmp->size,
+                                  a_args->zlib_params);
+
+    if(params != ZLIB_PARAMS_RAW)
+    {
+        *(ZLIB_PARAMS_TYPE*)(decoded + ZLIB_SIZE_OFFSET) = params;
+        a_args->zlib_params = params;
+        a_args->zlib_misses = 0;
+        return;
+    }
+
+    a_args->zlib_misses++;
+
+    // Keep the original stream
+    char* raw = scratch_alloc(ZLIB_HEADER_SIZE + a_args->tmp->size);
+    if(raw == NULL)
+        error("algo_record_zlib_params: malloc failed");
+
+    len = a_args->tmp->size;
+    memcpy(raw, &len, ZLIB_SIZE_OFFSET);
+    *(ZLIB_PARAMS_TYPE*)(raw + ZLIB_SIZE_OFFSET) = ZLIB_PARAMS_RAW;
+    memcpy(raw + ZLIB_HEADER_SIZE, a_args->tmp->mem, len);
+
+    scratch_free(decoded);
+
+    *a_args->dest = raw;
+    *a_args->dest_len = ZLIB_HEADER_SIZE + len;
+}
+
+static void
+algo_decode_source(algo_args* a_args, char** decoded, size_t* decoded_len)
+/**
+ * @brief Decodes the source binary of a lossy transform and records its length in a_args->decoded_len,
+ *        which bounds the length of the binary deflated anew on decompression (see restored_length).
+ */
+{
+    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, decoded, decoded_len, a_args->tmp, a_args->expected_len);
+    a_args->decoded_len = *decoded_len;
+}
+
+static int
+algo_decode_empty(algo_args* a_args, char* decoded, size_t decoded_len, size_t header_size)
+/**
+ * @brief Stores an array of no elements (e.g. an empty zlib binary) of the legacy transforms as a zeroed
+ *        length header of header_size bytes, restored by algo_encode_empty.
+ *
+ * @return 1 if the array was empty, 0 otherwise.
+ */
+{
+    if(decoded_len != 0)
+        return 0;
+
+    scratch_free(decoded);
+
+    *a_args->dest = scratch_calloc(1, header_size);
+    if(*a_args->dest == NULL)
+        error("algo_decode_empty: malloc failed");
+    *a_args->dest_len = header_size;
+
+    return 1;
+}
+
 void
 algo_decode_lossless (void* args)
 /**
@@ -30,10 +114,14 @@ algo_decode_lossless (void* args)
     #endif
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, a_args->dest, a_args->dest_len, a_args->tmp);
+    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, a_args->dest, a_args->dest_len, a_args->tmp, a_args->expected_len);
 
     /* Lossless, don't touch anything */
 
+    // zlib binaries: record how to recreate the original deflate stream
+    if(a_args->deflate_z != NULL)
+        algo_record_zlib_params(a_args);
+
     return;
 }
 
@@ -47,7 +135,10 @@ algo_decode_cast32_64d (void* args)
     size_t decoded_len = 0;
 
     // Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(float)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -58,7 +149,7 @@ algo_decode_cast32_64d (void* args)
             error("algo_decode_cast32_64d: Unknown data format");
     #endif
     len = decoded_len / sizeof(double);
-    res = malloc((len + 1) * sizeof(float)); // Allocate space for result and leave room for header
+    res = scratch_alloc((len + 1) * sizeof(float)); // Allocate space for result and leave room for header
     
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -91,7 +182,10 @@ algo_decode_cast16_32f (void* args)
     size_t decoded_len = 0;
 
     // Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -103,7 +197,7 @@ algo_decode_cast16_32f (void* args)
     #endif
     len = decoded_len / sizeof(float);
 
-    res = calloc(1, (len * sizeof(uint16_t)) + sizeof(uint16_t)); // Allocate space for result and leave room for header
+    res = scratch_calloc(1, (len * sizeof(uint16_t)) + sizeof(uint16_t)); // Allocate space for result and leave room for header
 
     uint16_t* tmp = res + 1; // Skip header
 
@@ -144,7 +238,10 @@ algo_decode_cast16_64d (void* args)
     size_t decoded_len = 0;
 
     // Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -156,7 +253,7 @@ algo_decode_cast16_64d (void* args)
     #endif
     len = decoded_len / sizeof(double);
 
-    res = calloc(1, (len * sizeof(uint16_t)) + sizeof(uint16_t)); // Allocate space for result and leave room for header
+    res = scratch_calloc(1, (len * sizeof(uint16_t)) + sizeof(uint16_t)); // Allocate space for result and leave room for header
 
     uint16_t* tmp = res + 1; // Skip header
 
@@ -204,7 +301,10 @@ algo_decode_log_2_transform_32f (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -220,7 +320,7 @@ algo_decode_log_2_transform_32f (void* args)
     size_t res_len = (len + 1) * sizeof(uint16_t);
 
     // Perform log2 transform
-    res = calloc(1, res_len); // Allocate space for result and leave room for header
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -238,7 +338,7 @@ algo_decode_log_2_transform_32f (void* args)
     }    
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -260,7 +360,10 @@ algo_decode_log_2_transform_64d (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -274,7 +377,7 @@ algo_decode_log_2_transform_64d (void* args)
     len = decoded_len / sizeof(double);
 
     // Perform log2 transform
-    res = malloc((len + 1) * sizeof(uint16_t)); // Allocate space for result and leave room for header
+    res = scratch_alloc((len + 1) * sizeof(uint16_t)); // Allocate space for result and leave room for header
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -293,7 +396,7 @@ algo_decode_log_2_transform_64d (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -315,7 +418,10 @@ algo_decode_delta16_transform_32f (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -331,7 +437,7 @@ algo_decode_delta16_transform_32f (void* args)
     size_t res_len = (len * sizeof(uint16_t)) + sizeof(uint16_t) + sizeof(float);
 
     // Perform delta transform
-    res = calloc(1, res_len); // Allocate space for result and leave room for header and first value
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -358,7 +464,7 @@ algo_decode_delta16_transform_32f (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -380,7 +486,10 @@ algo_decode_delta16_transform_64d (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -396,7 +505,7 @@ algo_decode_delta16_transform_64d (void* args)
     size_t res_len = (len * sizeof(uint16_t)) + sizeof(uint16_t) + sizeof(double);
 
     // Perform delta transform
-    res = malloc(res_len); // Allocate space for result and leave room for header and first value
+    res = scratch_alloc(res_len); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -429,7 +538,7 @@ algo_decode_delta16_transform_64d (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -451,7 +560,10 @@ algo_decode_delta24_transform_32f (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -467,7 +579,7 @@ algo_decode_delta24_transform_32f (void* args)
     size_t res_len = (len * 3 * sizeof(uint8_t)) + sizeof(uint16_t) + sizeof(float);
 
     // Perform delta transform
-    res = calloc(res_len, 1); // Allocate space for result and leave room for header and first value
+    res = scratch_calloc(res_len, 1); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -505,7 +617,7 @@ algo_decode_delta24_transform_32f (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -527,7 +639,10 @@ algo_decode_delta24_transform_64d (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -543,7 +658,7 @@ algo_decode_delta24_transform_64d (void* args)
     size_t res_len = (len * 3 * sizeof(uint8_t)) + sizeof(uint16_t) + sizeof(double);
 
     // Perform delta transform
-    res = calloc(res_len, 1); // Allocate space for result and leave room for header and first value
+    res = scratch_calloc(res_len, 1); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -581,7 +696,7 @@ algo_decode_delta24_transform_64d (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -603,7 +718,10 @@ algo_decode_delta32_transform_32f (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -619,7 +737,7 @@ algo_decode_delta32_transform_32f (void* args)
     size_t res_len = (len * sizeof(uint32_t)) + sizeof(uint16_t) + sizeof(float);
 
     // Perform delta transform
-    res = calloc(1, res_len); // Allocate space for result and leave room for header and first value
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -643,7 +761,7 @@ algo_decode_delta32_transform_32f (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -665,7 +783,10 @@ algo_decode_delta32_transform_64d (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -681,7 +802,7 @@ algo_decode_delta32_transform_64d (void* args)
     size_t res_len = (len * sizeof(uint32_t)) + sizeof(uint16_t) + sizeof(double);
 
     // Perform delta transform
-    res = calloc(1, res_len); // Allocate space for result and leave room for header and first value
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -707,7 +828,7 @@ algo_decode_delta32_transform_64d (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -729,7 +850,10 @@ algo_decode_vdelta16_transform_32f (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -745,7 +869,7 @@ algo_decode_vdelta16_transform_32f (void* args)
     size_t res_len = (len * sizeof(uint16_t)) + sizeof(uint16_t) + sizeof(float) + sizeof(float);
 
     // Perform delta transform
-    res = calloc(1, res_len); // Allocate space for result and leave room for header and first value
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -755,7 +879,7 @@ algo_decode_vdelta16_transform_32f (void* args)
     float* f = (float*)(decoded);
     uint16_t* tmp = (uint16_t*)(res + 1); // Ignore header in first 4 bytes
 
-    float* diff_arr = (float*)malloc(len*sizeof(float));
+    float* diff_arr = (float*)scratch_alloc(len*sizeof(float));
     diff_arr[0] = f[0];
 
     double diff_max = 0;
@@ -791,7 +915,7 @@ algo_decode_vdelta16_transform_32f (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -813,7 +937,10 @@ algo_decode_vdelta16_transform_64d (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -829,7 +956,7 @@ algo_decode_vdelta16_transform_64d (void* args)
     size_t res_len = (len * sizeof(uint16_t)) + sizeof(uint16_t) + sizeof(float) + sizeof(float);
 
     // Perform delta transform
-    res = calloc(1, res_len); // Allocate space for result and leave room for header and first value
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -839,7 +966,7 @@ algo_decode_vdelta16_transform_64d (void* args)
     double* f = (double*)(decoded);
     uint16_t* tmp = (uint16_t*)(res + 1); // Ignore header in first 4 bytes
 
-    double* diff_arr = (double*)malloc(len*sizeof(double));
+    double* diff_arr = (double*)scratch_alloc(len*sizeof(double));
     diff_arr[0] = f[0];
 
     double diff_max = 0;
@@ -875,7 +1002,7 @@ algo_decode_vdelta16_transform_64d (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -897,7 +1024,10 @@ algo_decode_vdelta24_transform_32f (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -913,7 +1043,7 @@ algo_decode_vdelta24_transform_32f (void* args)
     size_t res_len = (len * 3 * sizeof(uint8_t)) + sizeof(uint16_t) + sizeof(float) + sizeof(float);
 
     // Perform delta transform
-    res = calloc(1, res_len); // Allocate space for result and leave room for header and first value
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -923,7 +1053,7 @@ algo_decode_vdelta24_transform_32f (void* args)
     float* f = (float*)(decoded);
     uint16_t* tmp = (uint16_t*)(res + 1); // Ignore header in first 4 bytes
 
-    double* diff_arr = (double*)malloc(len*sizeof(double));
+    double* diff_arr = (double*)scratch_alloc(len*sizeof(double));
     diff_arr[0] = f[0];
 
     double diff_max = 0;
@@ -969,7 +1099,7 @@ algo_decode_vdelta24_transform_32f (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -991,7 +1121,10 @@ algo_decode_vdelta24_transform_64d (void* args)
     size_t decoded_len = 0;
 
     //Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint16_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint16_t len;
@@ -1007,7 +1140,7 @@ algo_decode_vdelta24_transform_64d (void* args)
     size_t res_len = (len * 3 * sizeof(uint8_t)) + sizeof(uint16_t) + sizeof(float) + sizeof(float);
 
     // Perform delta transform
-    res = calloc(1, res_len); // Allocate space for result and leave room for header and first value
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header and first value
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1017,7 +1150,7 @@ algo_decode_vdelta24_transform_64d (void* args)
     double* f = (double*)(decoded);
     uint16_t* tmp = (uint16_t*)(res + 1); // Ignore header in first 4 bytes
 
-    double* diff_arr = (double*)malloc(len*sizeof(double));
+    double* diff_arr = (double*)scratch_alloc(len*sizeof(double));
     diff_arr[0] = f[0];
 
     double diff_max = 0;
@@ -1063,7 +1196,7 @@ algo_decode_vdelta24_transform_64d (void* args)
     }
 
     // Free decoded buffer
-    free(decoded);
+    scratch_free(decoded);
 
     // Store length of array in first 4 bytes
     memcpy(res, &len, sizeof(uint16_t));
@@ -1085,7 +1218,10 @@ algo_decode_vbr_32f (void* args)
     size_t decoded_len = 0;
 
     // Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint32_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint32_t len;
@@ -1120,7 +1256,7 @@ algo_decode_vbr_32f (void* args)
 
     uint32_t res_len = (int)ceil(len/4*num_bits/8) + sizeof(uint32_t) + sizeof(float) + sizeof(uint32_t) + 1;
 
-    res = calloc(1, res_len); // Allocate space for result and leave room for header
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header
     
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1201,7 +1337,10 @@ algo_decode_vbr_64d (void* args)
     size_t decoded_len = 0;
 
     // Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint32_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint32_t len;
@@ -1236,7 +1375,7 @@ algo_decode_vbr_64d (void* args)
 
     uint32_t res_len = (int)ceil(len/4*num_bits/8) + sizeof(uint32_t) + sizeof(double) + sizeof(uint32_t);
 
-    res = calloc(1, res_len); // Allocate space for result and leave room for header
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header
     
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1317,7 +1456,10 @@ algo_decode_bitpack_32f (void* args)
     size_t decoded_len = 0;
 
     // Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint32_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint32_t len;
@@ -1343,7 +1485,7 @@ algo_decode_bitpack_32f (void* args)
 
     uint32_t res_len = expected_bytes + header_size;
 
-    res = calloc(1, res_len); // Allocate space for result and leave room for header
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header
     
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1405,7 +1547,10 @@ algo_decode_bitpack_64d (void* args)
     size_t decoded_len = 0;
 
     // Decode using specified encoding format
-    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, &decoded, &decoded_len, a_args->tmp);
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    if(algo_decode_empty(a_args, decoded, decoded_len, sizeof(uint32_t)))
+        return;
 
     // Deternmine length of data based on data format
     uint32_t len;
@@ -1431,7 +1576,7 @@ algo_decode_bitpack_64d (void* args)
 
     uint32_t res_len = expected_bytes + header_size;
 
-    res = calloc(1, res_len); // Allocate space for result and leave room for header
+    res = scratch_calloc(1, res_len); // Allocate space for result and leave room for header
     
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1467,26 +1612,1226 @@ algo_decode_bitpack_64d (void* args)
         tmp_res[i / 8] &= ~(1 << (i % 8));
     }
 
-    // Store header
+    // Store header
+
+    // Store length of array in first 4 bytes
+    memcpy(res, &len, sizeof(uint32_t));
+    // Store num bits in next byte
+    memcpy(res + sizeof(uint32_t), &num_bits, sizeof(uint8_t));
+    // Store number of bytes in next 4 bytes
+    memcpy(res + sizeof(uint32_t) + sizeof(uint8_t), &bytes_used, sizeof(uint32_t));
+
+    // Return result
+    *a_args->dest = res;
+    *a_args->dest_len = header_size + bytes_used;
+
+    return;
+}
+
+/*
+    Integer coding helpers (abs, ppm, rel, sparse, grid)
+
+    Signed values are zigzag mapped (0, -1, 1, -2, ... to 0, 1, 2, 3, ...) so small magnitudes give small codes.
+    Codes are then written as LEB128 varints (7 bits per byte, high bit set on all but the last byte) or
+    bitpacked with a fixed width, least significant bits first.
+*/
+
+#define VARINT_MAX_SIZE 10 // bytes of a 64-bit varint
+
+static inline uint64_t
+zigzag_encode(int64_t d)
+{
+    return ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+}
+
+static inline int64_t
+zigzag_decode(uint64_t z)
+{
+    return (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+}
+
+static inline uint8_t*
+varint_put(uint8_t* p, uint64_t v)
+{
+    while(v >= 0x80)
+    {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline uint8_t*
+varint_get(uint8_t* p, uint64_t* v)
+{
+    uint64_t r = 0;
+    int shift = 0;
+    do
+    {
+        r |= (uint64_t)(*p & 0x7F) << shift;
+        shift += 7;
+    } while(*p++ & 0x80);
+    *v = r;
+    return p;
+}
+
+static inline size_t
+varint_size(uint64_t v)
+{
+    size_t s = 1;
+    while(v >= 0x80)
+    {
+        v >>= 7;
+        s++;
+    }
+    return s;
+}
+
+struct bit_writer
+{
+    uint8_t* p;
+    uint64_t acc;
+    int acc_bits;
+};
+
+static inline void
+bit_put(struct bit_writer* w, uint64_t v, int bits)
+/**
+ * @brief Appends the low bits of v (bits <= 56).
+ */
+{
+    w->acc |= v << w->acc_bits;
+    w->acc_bits += bits;
+    while(w->acc_bits >= 8)
+    {
+        *w->p++ = (uint8_t)w->acc;
+        w->acc >>= 8;
+        w->acc_bits -= 8;
+    }
+}
+
+static inline uint8_t*
+bit_flush(struct bit_writer* w)
+/**
+ * @brief Writes the remaining bits, padded to a byte.
+ * 
+ * @return Pointer past the packed values.
+ */
+{
+    if(w->acc_bits > 0)
+        *w->p++ = (uint8_t)w->acc;
+    w->acc = 0;
+    w->acc_bits = 0;
+    return w->p;
+}
+
+struct bit_reader
+{
+    uint8_t* p;
+    uint64_t acc;
+    int acc_bits;
+};
+
+static inline uint64_t
+bit_get(struct bit_reader* r, int bits)
+/**
+ * @brief Reads the next value of bits width (bits <= 56) written by bit_put.
+ */
+{
+    while(r->acc_bits < bits)
+    {
+        r->acc |= (uint64_t)(*r->p++) << r->acc_bits;
+        r->acc_bits += 8;
+    }
+    uint64_t v = r->acc & ((bits == 0) ? 0 : (UINT64_MAX >> (64 - bits)));
+    r->acc >>= bits;
+    r->acc_bits -= bits;
+    return v;
+}
+
+/*
+    Error-bounded quantization (abs, ppm)
+
+    Values are mapped to integer indices q = round(x / step) (abs) or q = round(ln(x) / step) (ppm), so the
+    reconstruction error is bounded by step/2 in the linear or log domain. Indices are delta coded, zigzag
+    mapped and bitpacked with the smallest width holding every delta of the array, then left to zstd.
+    Each array is verified with the exact arithmetic used on decompression. If it exceeds the bound (float
+    rounding of 32-bit sources), the step is halved up to QUANT_MAX_TRIES times before the array is stored verbatim.
+
+    Array layout:
+        | len (uint32_t) | bits (uint8_t) | max error (float) | step (double) | q0 (int64_t) | packed deltas |
+    len == 0 is stored as the length alone. bits == QUANT_VERBATIM stores the source values after the header.
+*/
+
+#define QUANT_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint8_t) + sizeof(float) + sizeof(double) + sizeof(int64_t))
+#define QUANT_VERBATIM    0xFF
+#define QUANT_MAX_BITS    56
+#define QUANT_MAX_TRIES   4
+#define QUANT_MAX_INDEX   ((double)(1LL << 61))
+
+static inline double
+quant_value(int64_t q, double step, int ppm)
+{
+    return ppm ? exp((double)q * step) : (double)q * step;
+}
+
+static int
+quant_try(double* x, uint32_t len, int ppm, int accession, double step, double bound, int64_t* q, uint8_t* bits, double* max_err)
+/**
+ * @brief Quantizes x with the given step and verifies the reconstruction against bound.
+ * 
+ * @return 1 if every value is within bound (q, bits and max_err are set), 0 otherwise.
+ */
+{
+    uint64_t max_zz = 0;
+    double err, y, r;
+
+    *max_err = 0;
+
+    for(uint32_t i = 0; i < len; i++)
+    {
+        if(!isfinite(x[i]) || (ppm && x[i] <= 0))
+            return 0;
+
+        y = (ppm ? log(x[i]) : x[i]) / step;
+        if(fabs(y) > QUANT_MAX_INDEX)
+            return 0;
+
+        q[i] = llround(y);
+
+        // Reconstruct exactly as algo_encode_quant does
+        r = quant_value(q[i], step, ppm);
+        if(accession == _32f_)
+            r = (double)(float)r;
+
+        err = fabs(x[i] - r);
+        if(ppm)
+            err = err / x[i] * 1e6;
+        if(!(err <= bound))
+            return 0;
+        if(err > *max_err)
+            *max_err = err;
+
+        if(i > 0)
+        {
+            uint64_t zz = zigzag_encode(q[i] - q[i-1]);
+            if(zz > max_zz)
+                max_zz = zz;
+        }
+    }
+
+    *bits = 0;
+    while(*bits < 64 && (max_zz >> *bits) != 0)
+        (*bits)++;
+
+    return *bits <= QUANT_MAX_BITS;
+}
+
+static void
+algo_decode_quant(algo_args* a_args, int ppm, int accession)
+/**
+ * @brief Quantizes an m/z array so that every value is within a_args->scale_factor of the source,
+ *        either in absolute units (ppm == 0) or in parts per million (ppm == 1). See layout above.
+ *        The largest error introduced is stored with the array and accumulated in a_args->max_error.
+ * 
+ * @param args Pointer to algo_args struct.
+ * 
+ * @param ppm 1 to bound the relative error in ppm, 0 to bound the absolute error.
+ * 
+ * @param accession Source data format (_32f_ or _64d_).
+ */
+{
+    char* decoded = NULL;
+    size_t decoded_len = 0;
+
+    // Decode using specified encoding format
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    #ifdef ERROR_CHECK
+        if(a_args->src_format != accession) // non-essential check, but useful for debugging
+            error("algo_decode_quant: Unknown data format");
+    #endif
+
+    size_t format_size = get_format_size(accession);
+
+    if(decoded_len / format_size > UINT32_MAX)
+        error("algo_decode_quant: decoded_len > UINT32_MAX");
+
+    uint32_t len = (uint32_t)(decoded_len / format_size);
+
+    if(len == 0)
+    {
+        char* res = scratch_alloc(sizeof(uint32_t));
+        if(res == NULL)
+            error("algo_decode_quant: malloc failed");
+        memcpy(res, &len, sizeof(uint32_t));
+        scratch_free(decoded);
+        *a_args->dest = res;
+        *a_args->dest_len = sizeof(uint32_t);
+        return;
+    }
+
+    double* x = (double*)decoded;
+    if(accession == _32f_)
+    {
+        x = scratch_alloc(len * sizeof(double));
+        if(x == NULL)
+            error("algo_decode_quant: malloc failed");
+        for(uint32_t i = 0; i < len; i++)
+            x[i] = ((float*)decoded)[i];
+    }
+
+    int64_t* q = scratch_alloc(len * sizeof(int64_t));
+    if(q == NULL)
+        error("algo_decode_quant: malloc failed");
+
+    // Stay strictly below the requested bound, which was rounded to a float
+    double bound = (double)a_args->scale_factor * (1.0 - FLT_EPSILON);
+    double step = ppm ? 2.0 * log1p(bound * 1e-6) : 2.0 * bound;
+    double max_err = 0;
+    uint8_t bits = QUANT_VERBATIM;
+
+    for(int t = 0; t < QUANT_MAX_TRIES && step > 0; t++, step /= 2)
+    {
+        if(quant_try(x, len, ppm, accession, step, bound, q, &bits, &max_err))
+            break;
+        bits = QUANT_VERBATIM;
+    }
+
+    size_t body_len = (bits == QUANT_VERBATIM) ? decoded_len : (((size_t)(len - 1) * bits) + 7) / 8;
+    size_t res_len = QUANT_HEADER_SIZE + body_len;
+
+    uint8_t* res = scratch_alloc(res_len);
+    if(res == NULL)
+        error("algo_decode_quant: malloc failed");
+
+    float max_err_f = (float)max_err;
+    int64_t q0 = (bits == QUANT_VERBATIM) ? 0 : q[0];
+    uint8_t* p = res;
+
+    memcpy(p, &len, sizeof(uint32_t));     p += sizeof(uint32_t);
+    memcpy(p, &bits, sizeof(uint8_t));     p += sizeof(uint8_t);
+    memcpy(p, &max_err_f, sizeof(float));  p += sizeof(float);
+    memcpy(p, &step, sizeof(double));      p += sizeof(double);
+    memcpy(p, &q0, sizeof(int64_t));       p += sizeof(int64_t);
+
+    if(bits == QUANT_VERBATIM)
+        memcpy(p, decoded, decoded_len);
+    else
+    {
+        struct bit_writer w = {p, 0, 0};
+        for(uint32_t i = 1; i < len; i++)
+            bit_put(&w, zigzag_encode(q[i] - q[i-1]), bits);
+        p = bit_flush(&w);
+
+        if(max_err > a_args->max_error)
+            a_args->max_error = max_err;
+    }
+
+    if(x != (double*)decoded)
+        scratch_free(x);
+    scratch_free(q);
+    scratch_free(decoded);
+
+    // Return result
+    *a_args->dest = (char*)res;
+    *a_args->dest_len = res_len;
+}
+
+void
+algo_decode_abs_32f (void* args)
+{
+    algo_decode_quant((algo_args*)args, 0, _32f_);
+}
+
+void
+algo_decode_abs_64d (void* args)
+{
+    algo_decode_quant((algo_args*)args, 0, _64d_);
+}
+
+void
+algo_decode_ppm_32f (void* args)
+{
+    algo_decode_quant((algo_args*)args, 1, _32f_);
+}
+
+void
+algo_decode_ppm_64d (void* args)
+{
+    algo_decode_quant((algo_args*)args, 1, _64d_);
+}
+
+/*
+    Relative error-bounded intensity quantization (rel)
+
+    Positive intensities are quantized uniformly in the log2 domain with a step of 2*log2(1 + 0.95*r), so
+    every reconstructed value is within a relative error r of the source. Zeros get code 0 and are kept exact.
+    Codes are bitpacked with the smallest width holding the largest code of the array.
+    log2/exp2 use polynomial approximations (SSE2 when available, with a scalar path performing the same
+    float operations); the 5% margin on r absorbs their error. algo.c is built with -ffp-contract=off so the
+    compiler does not fuse these multiply-adds into FMA on some targets only, which would let files compressed
+    on one machine decompress to different values on another. Each array is verified against r with the
+    decompression arithmetic, halving the step on failure and falling back to storing the array verbatim.
+
+    Array layout:
+        | len (uint32_t) | bits (uint8_t) | lmin (float) | step (float) | packed codes |
+    bits == REL_VERBATIM stores the source values after the header.
+*/
+
+#define REL_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint8_t) + sizeof(float) + sizeof(float))
+#define REL_VERBATIM    0xFF
+#define REL_MAX_BITS    24
+#define REL_MAX_TRIES   4
+#define REL_MARGIN      0.95
+
+/* Minimax fits of log2(1 + t) and 2^t for t in [0, 1) */
+#define REL_LOG2_C0  2.443438688715105e-06f
+#define REL_LOG2_C1  1.4424535036087036f
+#define REL_LOG2_C2 -0.717312753200531f
+#define REL_LOG2_C3  0.4545084834098816f
+#define REL_LOG2_C4 -0.2726975679397583f
+#define REL_LOG2_C5  0.11761308461427689f
+#define REL_LOG2_C6 -0.02456853538751602f
+
+#define REL_EXP2_C0  0.9999998807907104f
+#define REL_EXP2_C1  0.693154513835907f
+#define REL_EXP2_C2  0.240141823887825f
+#define REL_EXP2_C3  0.05586033686995506f
+#define REL_EXP2_C4  0.008949590846896172f
+#define REL_EXP2_C5  0.001893754000775516f
+
+static inline float
+rel_log2f(float x)
+{
+    union { float f; int32_t i; } u = { x };
+    float e = (float)(((u.i >> 23) & 0xFF) - 127);
+    u.i = (u.i & 0x007FFFFF) | 0x3F800000;
+    float t = u.f - 1.0f;
+    float p = REL_LOG2_C6;
+    p = p * t + REL_LOG2_C5;
+    p = p * t + REL_LOG2_C4;
+    p = p * t + REL_LOG2_C3;
+    p = p * t + REL_LOG2_C2;
+    p = p * t + REL_LOG2_C1;
+    p = p * t + REL_LOG2_C0;
+    return e + p;
+}
+
+static inline float
+rel_exp2f(float y)
+{
+    union { float f; int32_t i; } u;
+    y = y < -126.0f ? -126.0f : y;
+    y = y > 127.0f ? 127.0f : y;
+    int32_t yi = (int32_t)y;
+    if((float)yi > y)
+        yi -= 1;
+    float t = y - (float)yi;
+    float p = REL_EXP2_C5;
+    p = p * t + REL_EXP2_C4;
+    p = p * t + REL_EXP2_C3;
+    p = p * t + REL_EXP2_C2;
+    p = p * t + REL_EXP2_C1;
+    p = p * t + REL_EXP2_C0;
+    u.f = p;
+    u.i += yi << 23;
+    return u.f;
+}
+
+#ifdef __SSE2__
+static inline __m128
+rel_log2_ps(__m128 x)
+{
+    __m128i i = _mm_castps_si128(x);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(i, 23), _mm_set1_epi32(0xFF)), _mm_set1_epi32(127)));
+    __m128 t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(i, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000))), _mm_set1_ps(1.0f));
+    __m128 p = _mm_set1_ps(REL_LOG2_C6);
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_LOG2_C5));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_LOG2_C4));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_LOG2_C3));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_LOG2_C2));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_LOG2_C1));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_LOG2_C0));
+    return _mm_add_ps(e, p);
+}
+
+static inline __m128
+rel_exp2_ps(__m128 y)
+{
+    y = _mm_min_ps(_mm_max_ps(y, _mm_set1_ps(-126.0f)), _mm_set1_ps(127.0f));
+    __m128i yi = _mm_cvttps_epi32(y);
+    yi = _mm_add_epi32(yi, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(yi), y))); // floor: subtract 1 where truncated up
+    __m128 t = _mm_sub_ps(y, _mm_cvtepi32_ps(yi));
+    __m128 p = _mm_set1_ps(REL_EXP2_C5);
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_EXP2_C4));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_EXP2_C3));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_EXP2_C2));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_EXP2_C1));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(REL_EXP2_C0));
+    return _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(p), _mm_slli_epi32(yi, 23)));
+}
+#endif
+
+static void
+rel_log2_array(const float* x, float* l, uint32_t len)
+{
+    uint32_t i = 0;
+#ifdef __SSE2__
+    for(; i + 4 <= len; i += 4)
+        _mm_storeu_ps(l + i, rel_log2_ps(_mm_loadu_ps(x + i)));
+#endif
+    for(; i < len; i++)
+        l[i] = rel_log2f(x[i]);
+}
+
+static void
+rel_values(const uint32_t* codes, float* out, uint32_t len, float lmin, float step)
+/**
+ * @brief Reconstructs intensities from codes: 0 for code 0, 2^(lmin + (code - 1) * step) otherwise.
+ */
+{
+    uint32_t i = 0;
+#ifdef __SSE2__
+    __m128 vmin = _mm_set1_ps(lmin), vstep = _mm_set1_ps(step);
+    __m128i one = _mm_set1_epi32(1), zero = _mm_setzero_si128();
+    for(; i + 4 <= len; i += 4)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i*)(codes + i));
+        __m128 y = _mm_add_ps(vmin, _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(c, one)), vstep));
+        __m128 v = rel_exp2_ps(y);
+        v = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(c, zero)), v);
+        _mm_storeu_ps(out + i, v);
+    }
+#endif
+    for(; i < len; i++)
+        out[i] = codes[i] == 0 ? 0.0f : rel_exp2f(lmin + (float)(int32_t)(codes[i] - 1) * step);
+}
+
+static int
+rel_try(const double* x, const float* l, uint32_t len, float lmin, float step, double r, uint32_t* codes, float* recon, uint8_t* bits, double* max_err)
+/**
+ * @brief Quantizes the log2 intensities l with the given step and verifies the reconstruction against r.
+ * 
+ * @return 1 if every value is within r (codes, bits and max_err are set), 0 otherwise.
+ */
+{
+    float inv_step = 1.0f / step;
+    uint32_t max_code = 0;
+    double err;
+
+    for(uint32_t i = 0; i < len; i++)
+    {
+        if(x[i] > 0)
+        {
+            float c = (l[i] - lmin) * inv_step + 0.5f;
+            if(!(c < (float)(1 << REL_MAX_BITS)))
+                return 0;
+            codes[i] = (uint32_t)c + 1;
+            if(codes[i] > max_code)
+                max_code = codes[i];
+        }
+        else
+            codes[i] = 0;
+    }
+
+    // Reconstruct exactly as algo_encode_rel does
+    rel_values(codes, recon, len, lmin, step);
+
+    *max_err = 0;
+    for(uint32_t i = 0; i < len; i++)
+    {
+        if(x[i] == 0)
+            continue;
+        err = fabs((double)recon[i] - x[i]) / x[i];
+        if(!(err <= r))
+            return 0;
+        if(err > *max_err)
+            *max_err = err;
+    }
+
+    *bits = 0;
+    while((max_code >> *bits) != 0)
+        (*bits)++;
+
+    return 1;
+}
+
+static void
+algo_decode_rel(algo_args* a_args, int accession)
+/**
+ * @brief Quantizes an intensity array so that every value is within a relative error of
+ *        a_args->scale_factor (eg. 0.01 for 1%) of the source. See layout above.
+ * 
+ * @param args Pointer to algo_args struct.
+ * 
+ * @param accession Source data format (_32f_ or _64d_).
+ */
+{
+    char* decoded = NULL;
+    size_t decoded_len = 0;
+
+    // Decode using specified encoding format
+    algo_decode_source(a_args, &decoded, &decoded_len);
+
+    #ifdef ERROR_CHECK
+        if(a_args->src_format != accession) // non-essential check, but useful for debugging
+            error("algo_decode_rel: Unknown data format");
+    #endif
+
+    size_t format_size = get_format_size(accession);
+
+    if(decoded_len / format_size > UINT32_MAX)
+        error("algo_decode_rel: decoded_len > UINT32_MAX");
+
+    uint32_t len = (uint32_t)(decoded_len / format_size);
+
+    double* x = scratch_alloc((len + 1) * sizeof(double));
+    float* xf = scratch_alloc((len + 1) * sizeof(float));
+    float* l = scratch_alloc((len + 1) * sizeof(float));
+    float* recon = scratch_alloc((len + 1) * sizeof(float));
+    uint32_t* codes = scratch_alloc((len + 1) * sizeof(uint32_t));
+
+    if(x == NULL || xf == NULL || l == NULL || recon == NULL || codes == NULL)
+        error("algo_decode_rel: malloc failed");
+
+    // Only finite, non-negative intensities within float range can be quantized
+    uint8_t bits = 0;
+    for(uint32_t i = 0; i < len; i++)
+    {
+        x[i] = (accession == _32f_) ? (double)((float*)decoded)[i] : ((double*)decoded)[i];
+        if(!(x[i] >= 0 && x[i] <= FLT_MAX))
+            bits = REL_VERBATIM;
+        xf[i] = (float)x[i];
+    }
+
+    double r = (double)a_args->scale_factor * (1.0 - FLT_EPSILON);
+    float step = (float)(2.0 * log2(1.0 + REL_MARGIN * r));
+    float lmin = 0;
+    double max_err = 0;
+
+    if(bits != REL_VERBATIM)
+    {
+        rel_log2_array(xf, l, len);
+
+        lmin = FLT_MAX;
+        for(uint32_t i = 0; i < len; i++)
+            if(x[i] > 0 && l[i] < lmin)
+                lmin = l[i];
+        if(lmin == FLT_MAX)
+            lmin = 0; // no positive values, all codes are 0
+
+        bits = REL_VERBATIM;
+        for(int t = 0; t < REL_MAX_TRIES && step > 0; t++, step /= 2)
+            if(rel_try(x, l, len, lmin, step, r, codes, recon, &bits, &max_err))
+                break;
+            else
+                bits = REL_VERBATIM;
+    }
+
+    size_t body_len = (bits == REL_VERBATIM) ? decoded_len : (((size_t)len * bits) + 7) / 8;
+    size_t res_len = REL_HEADER_SIZE + body_len;
+
+    uint8_t* res = scratch_alloc(res_len);
+    if(res == NULL)
+        error("algo_decode_rel: malloc failed");
+
+    uint8_t* p = res;
+
+    memcpy(p, &len, sizeof(uint32_t));  p += sizeof(uint32_t);
+    memcpy(p, &bits, sizeof(uint8_t));  p += sizeof(uint8_t);
+    memcpy(p, &lmin, sizeof(float));    p += sizeof(float);
+    memcpy(p, &step, sizeof(float));    p += sizeof(float);
+
+    if(bits == REL_VERBATIM)
+        memcpy(p, decoded, decoded_len);
+    else
+    {
+        struct bit_writer w = {p, 0, 0};
+        for(uint32_t i = 0; i < len; i++)
+            bit_put(&w, codes[i], bits);
+        p = bit_flush(&w);
+
+        if(max_err > a_args->max_error)
+            a_args->max_error = max_err;
+    }
+
+    scratch_free(x);
+    scratch_free(xf);
+    scratch_free(l);
+    scratch_free(recon);
+    scratch_free(codes);
+    scratch_free(decoded);
+
+    // Return result
+    *a_args->dest = (char*)res;
+    *a_args->dest_len = res_len;
+}
+
+void
+algo_decode_rel_32f (void* args)
+{
+    algo_decode_rel((algo_args*)args, _32f_);
+}
+
+void
+algo_decode_rel_64d (void* args)
+{
+    algo_decode_rel((algo_args*)args, _64d_);
+}
+
+/*
+    Sparse zero-run transform (sparse)
+
+    Profile spectra are mostly zero-intensity points. Runs of zero intensity (bit pattern 0) are replaced by
+    (gap, length) descriptors. The intensity stream drops the zeros. The m/z stream uses the runs of the paired
+    intensity array and stores the m/z samples within them as zigzag varints of the delta-of-delta of their
+    bit patterns, which are small for a regularly sampled grid. Values outside runs are kept as-is, so the
+    transform is lossless. zlib deflate parameters are recorded as in the lossless mode (see algo_record_zlib_params).
+
+    Array layout (after the source binary header, see decode_zlib_fun and decode_no_comp_fun_w_header):
+        | mode (uint8_t) | value size (uint8_t) | n_runs | (gap, length) * n_runs | values outside runs | run values |
+    Counts are LEB128 varints. SPARSE_DENSE stores the array as-is after the value size.
+*/
+
+#define SPARSE_DENSE  0 // array stored as-is
+#define SPARSE_ZEROS  1 // run values are zeros (intensity)
+#define SPARSE_DELTAS 2 // run values are delta-of-delta coded (m/z)
+
+static inline uint64_t
+sparse_load(const uint8_t* arr, int64_t i, size_t fs)
+{
+    uint64_t v = 0;
+    if(i >= 0)
+        memcpy(&v, arr + i * fs, fs);
+    return v;
+}
+
+static size_t
+sparse_header_size(int source_compression)
+{
+    return source_compression == _zlib_ ? ZLIB_HEADER_SIZE : ZLIB_SIZE_OFFSET;
+}
+
+static uint32_t
+sparse_find_runs(const uint8_t* arr, size_t n, size_t fs, uint32_t* runs)
+/**
+ * @brief Finds the runs of zero values (bit pattern 0) in arr.
+ * 
+ * @param runs Output (start, length) pairs. Must hold n + 1 entries.
+ * 
+ * @return Number of runs.
+ */
+{
+    uint32_t n_runs = 0;
+    size_t i = 0;
+
+    while(i < n)
+    {
+        if(sparse_load(arr, i, fs) != 0)
+        {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while(i < n && sparse_load(arr, i, fs) == 0)
+            i++;
+        runs[2 * n_runs] = (uint32_t)start;
+        runs[2 * n_runs + 1] = (uint32_t)(i - start);
+        n_runs++;
+    }
+    return n_runs;
+}
+
+static size_t
+sparse_encode(const uint8_t* arr, size_t n, size_t fs, const uint32_t* runs, uint32_t n_runs, uint8_t mode, uint8_t* out)
+/**
+ * @brief Writes the sparse layout of arr (see above) to out.
+ * 
+ * @return Number of bytes written.
+ */
+{
+    uint8_t* p = out;
+    uint32_t r;
+    size_t i = 0;
+
+    *p++ = mode;
+    *p++ = (uint8_t)fs;
+    p = varint_put(p, n_runs);
+
+    for(r = 0; r < n_runs; r++)
+    {
+        p = varint_put(p, runs[2 * r] - i);
+        p = varint_put(p, runs[2 * r + 1]);
+        i = runs[2 * r] + runs[2 * r + 1];
+    }
+
+    // Values outside runs
+    i = 0;
+    for(r = 0; r <= n_runs; r++)
+    {
+        size_t end = (r < n_runs) ? runs[2 * r] : n;
+        memcpy(p, arr + i * fs, (end - i) * fs);
+        p += (end - i) * fs;
+        if(r < n_runs)
+            i = end + runs[2 * r + 1];
+    }
+
+    // Values within runs
+    if(mode == SPARSE_DELTAS)
+        for(r = 0; r < n_runs; r++)
+            for(i = runs[2 * r]; i < runs[2 * r] + runs[2 * r + 1]; i++)
+            {
+                int64_t d = (int64_t)(sparse_load(arr, i, fs) - sparse_load(arr, (int64_t)i - 1, fs));
+                int64_t d_prev = (int64_t)(sparse_load(arr, (int64_t)i - 1, fs) - sparse_load(arr, (int64_t)i - 2, fs));
+                int64_t dd = d - d_prev;
+                p = varint_put(p, zigzag_encode(dd));
+            }
+
+    return p - out;
+}
+
+static uint8_t*
+sparse_decode(uint8_t* p, size_t n_bytes, uint8_t* arr)
+/**
+ * @brief Restores an array of n_bytes written by sparse_encode into arr.
+ * 
+ * @return Pointer past the sparse layout.
+ */
+{
+    uint8_t mode = *p++;
+    size_t fs = *p++;
+
+    if(mode == SPARSE_DENSE)
+    {
+        memcpy(arr, p, n_bytes);
+        return p + n_bytes;
+    }
+
+    size_t n = n_bytes / fs;
+
+    uint64_t n_runs, gap, len;
+    p = varint_get(p, &n_runs);
+
+    uint64_t* runs = scratch_alloc((n_runs * 2 + 1) * sizeof(uint64_t));
+    if(runs == NULL)
+        error("sparse_decode: malloc failed");
+
+    size_t i = 0, in_runs = 0;
+    for(uint64_t r = 0; r < n_runs; r++)
+    {
+        p = varint_get(p, &gap);
+        p = varint_get(p, &len);
+        runs[2 * r] = i + gap;
+        runs[2 * r + 1] = len;
+        i += gap + len;
+        in_runs += len;
+    }
+
+    uint8_t* values = p;                        // values outside runs
+    uint8_t* deltas = p + (n - in_runs) * fs;   // values within runs
+    size_t r = 0;
+
+    for(i = 0; i < n; i++)
+    {
+        if(r < n_runs && i >= runs[2 * r] + runs[2 * r + 1])
+            r++;
+        if(r < n_runs && i >= runs[2 * r])
+        {
+            if(mode == SPARSE_DELTAS)
+            {
+                uint64_t z;
+                deltas = varint_get(deltas, &z);
+                int64_t dd = zigzag_decode(z);
+                uint64_t prev = sparse_load(arr, (int64_t)i - 1, fs);
+                uint64_t v = prev + (prev - sparse_load(arr, (int64_t)i - 2, fs)) + (uint64_t)dd;
+                memcpy(arr + i * fs, &v, fs);
+            }
+            else
+                memset(arr + i * fs, 0, fs);
+        }
+        else
+        {
+            memcpy(arr + i * fs, values, fs);
+            values += fs;
+        }
+    }
+
+    scratch_free(runs);
+
+    return mode == SPARSE_DELTAS ? deltas : values;
+}
+
+void
+algo_decode_sparse (void* args)
+/**
+ * @brief Sparse zero-run transform (see above). The m/z stream uses the runs of the paired intensity
+ *        binary (a_args->paired_src), the intensity stream its own.
+ * 
+ * @param args Pointer to algo_args struct.
+ * 
+ * @return void
+ */
+{
+    // Parse args
+    algo_args* a_args = (algo_args*)args;
+
+    // Decode using specified encoding format (with header, as lossless)
+    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, a_args->dest, a_args->dest_len, a_args->tmp, a_args->expected_len);
+
+    // zlib binaries: record how to recreate the original deflate stream
+    if(a_args->deflate_z != NULL)
+        algo_record_zlib_params(a_args);
+
+    size_t hs = sparse_header_size(a_args->source_compression);
+    uint8_t* decoded = (uint8_t*)*a_args->dest;
+
+    if(a_args->source_compression == _zlib_ && *(ZLIB_PARAMS_TYPE*)(decoded + ZLIB_SIZE_OFFSET) == ZLIB_PARAMS_RAW)
+        return; // original stream kept as-is
+
+    size_t fs = get_format_size(a_args->src_format);
+    ZLIB_TYPE n_bytes = *(ZLIB_TYPE*)decoded;
+    size_t n = (fs > 0 && n_bytes % fs == 0) ? n_bytes / fs : 0; // n == 0 stores the array as-is
+    uint8_t* arr = decoded + hs;
+
+    uint32_t* runs = scratch_alloc((n + 1) * sizeof(uint32_t));
+    if(runs == NULL)
+        error("algo_decode_sparse: malloc failed");
+
+    uint32_t n_runs = 0;
+    uint8_t mode = SPARSE_ZEROS;
+
+    if(a_args->paired_dec_fun != NULL) // m/z: runs of the paired intensity array
+    {
+        mode = SPARSE_DELTAS;
+        if(a_args->paired_src != NULL)
+        {
+            char* paired = NULL;
+            size_t paired_len = 0;
+            a_args->paired_dec_fun(a_args->z, a_args->paired_src, a_args->paired_src_len, &paired, &paired_len, a_args->tmp, a_args->paired_expected_len);
+
+            size_t paired_fs = get_format_size(a_args->paired_format);
+            if(paired_fs > 0 && *(ZLIB_TYPE*)paired / paired_fs == n)
+                n_runs = sparse_find_runs((uint8_t*)paired + sparse_header_size(a_args->paired_compression), n, paired_fs, runs);
+
+            scratch_free(paired);
+        }
+    }
+    else
+        n_runs = sparse_find_runs(arr, n, fs, runs);
+
+    uint8_t* res = scratch_alloc(hs + 2 + VARINT_MAX_SIZE * (1 + 2 * (size_t)n_runs) + n_bytes + n * VARINT_MAX_SIZE);
+    if(res == NULL)
+        error("algo_decode_sparse: malloc failed");
+
+    memcpy(res, decoded, hs);
+
+    size_t res_len = (n_runs > 0) ? sparse_encode(arr, n, fs, runs, n_runs, mode, res + hs) : 0;
+
+    if(n_runs == 0 || res_len >= 2 + n_bytes)
+    {
+        res[hs] = SPARSE_DENSE;
+        res[hs + 1] = (uint8_t)fs;
+        memcpy(res + hs + 2, arr, n_bytes);
+        res_len = 2 + n_bytes;
+    }
+
+    scratch_free(runs);
+    scratch_free(decoded);
+
+    // Return result
+    *a_args->dest = (char*)res;
+    *a_args->dest_len = hs + res_len;
+}
+
+/*
+    Reference grid transform (grid)
+
+    Profile runs of TOF and Orbitrap instruments sample m/z on the same or nearly the same grid scan after
+    scan. Each division keeps up to GRID_REFS reference arrays. An m/z array close to a reference is stored
+    as its start index in that reference followed by the changes of its bit pattern residuals against the
+    reference, or the start index alone if it matches exactly. The reference continues its end steps, so
+    arrays may start before or run past it. Other arrays are stored as-is and replace the least recently
+    used reference. Arrays of a division are compressed and decompressed in the same order, so references
+    are stored only once, as the array that introduced them. The transform is lossless. zlib deflate
+    parameters are recorded as in the lossless mode.
+
+    Array layout (after the source binary header, see decode_zlib_fun and decode_no_comp_fun_w_header):
+        GRID_NEW:   | mode (uint8_t) | value size (uint8_t) | array |
+        GRID_REF:   | mode (uint8_t) | value size (uint8_t) | reference (uint8_t) | start | residual changes |
+        GRID_EXACT: | mode (uint8_t) | value size (uint8_t) | reference (uint8_t) | start |
+    start and residual changes are zigzag LEB128 varints.
+*/
+
+#define GRID_NEW   0 // array stored as-is, becomes a reference
+#define GRID_REF   1 // residuals against a reference
+#define GRID_EXACT 2 // equal to a range of a reference
+
+#define GRID_REFS  4 // references kept per division
+
+struct grid_refs
+{
+    uint8_t* arr[GRID_REFS];
+    size_t n[GRID_REFS];      // number of values
+    size_t fs[GRID_REFS];     // value size
+    uint64_t used[GRID_REFS]; // clock of last use, 0 if empty
+    uint64_t clock;
+};
+
+static struct grid_refs*
+grid_get_refs(algo_args* a_args)
+{
+    if(a_args->grid == NULL)
+    {
+        a_args->grid = calloc(1, sizeof(struct grid_refs));
+        if(a_args->grid == NULL)
+            error("grid_get_refs: calloc failed");
+    }
+    return a_args->grid;
+}
+
+void
+dealloc_grid_refs(struct grid_refs* grid)
+/**
+ * @brief Frees the reference grids of a division. grid may be NULL.
+ */
+{
+    if(grid == NULL)
+        return;
+    for(int r = 0; r < GRID_REFS; r++)
+        free(grid->arr[r]);
+    free(grid);
+}
+
+static void
+grid_store(struct grid_refs* g, const uint8_t* arr, size_t n, size_t fs)
+/**
+ * @brief Stores arr as a reference, replacing the least recently used one.
+ */
+{
+    int r, lru = 0;
+
+    for(r = 1; r < GRID_REFS; r++)
+        if(g->used[r] < g->used[lru])
+            lru = r;
+
+    uint8_t* copy = realloc(g->arr[lru], n * fs);
+    if(copy == NULL)
+        error("grid_store: realloc failed");
+
+    memcpy(copy, arr, n * fs);
+    g->arr[lru] = copy;
+    g->n[lru] = n;
+    g->fs[lru] = fs;
+    g->used[lru] = ++g->clock;
+}
+
+static inline uint64_t
+grid_predict(const struct grid_refs* g, int r, int64_t j)
+/**
+ * @brief Bit pattern of reference r at index j. Indices outside the reference continue its first or last step,
+ *        so arrays covering a slightly wider range than the reference still get small residuals.
+ */
+{
+    const uint8_t* ref = g->arr[r];
+    int64_t n = (int64_t)g->n[r];
+    size_t fs = g->fs[r];
+
+    if(j >= 0 && j < n)
+        return sparse_load(ref, j, fs);
+    if(n < 2)
+        return sparse_load(ref, 0, fs);
+    if(j < 0)
+        return sparse_load(ref, 0, fs) + (uint64_t)j * (sparse_load(ref, 1, fs) - sparse_load(ref, 0, fs));
+    return sparse_load(ref, n - 1, fs) + (uint64_t)(j - n + 1) * (sparse_load(ref, n - 1, fs) - sparse_load(ref, n - 2, fs));
+}
+
+static inline int64_t
+grid_residual(const uint8_t* arr, size_t i, const struct grid_refs* g, int r, int64_t j)
+{
+    return (int64_t)(sparse_load(arr, i, g->fs[r]) - grid_predict(g, r, j));
+}
+
+static inline uint64_t
+grid_code(const uint8_t* arr, size_t i, const struct grid_refs* g, int r, int64_t start)
+/**
+ * @brief Zigzag code of the change in residual from value i - 1 to value i. A recalibrated grid
+ *        (slightly scaled or shifted) has smoothly varying residuals, so these stay small.
+ */
+{
+    int64_t d = grid_residual(arr, i, g, r, start + (int64_t)i);
+    if(i > 0)
+        d -= grid_residual(arr, i - 1, g, r, start + (int64_t)i - 1);
+    if(g->fs[r] < sizeof(uint64_t)) // wrap to the value size, as the decoder stores only fs bytes
+        d = (int64_t)((uint64_t)d << (64 - 8 * g->fs[r])) >> (64 - 8 * g->fs[r]);
+    return zigzag_encode(d);
+}
+
+static int64_t
+grid_find_start(const struct grid_refs* g, int r, uint64_t first)
+/**
+ * @brief Finds the index of reference r closest to first, extrapolating beyond its ends.
+ *        Bit patterns of non-negative floating point values sort like the values themselves.
+ */
+{
+    const uint8_t* ref = g->arr[r];
+    size_t ref_n = g->n[r], fs = g->fs[r];
+    size_t lo = 0, hi = ref_n;
+
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if(sparse_load(ref, mid, fs) < first)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if(ref_n >= 2 && (lo == 0 || lo == ref_n)) // outside the reference: continue its step
+    {
+        uint64_t edge = sparse_load(ref, lo ? ref_n - 1 : 0, fs);
+        uint64_t step = lo ? edge - sparse_load(ref, ref_n - 2, fs) : sparse_load(ref, 1, fs) - edge;
+        if(step == 0 || (int64_t)step < 0)
+            return lo ? (int64_t)ref_n - 1 : 0;
+        return lo ? (int64_t)(ref_n - 1 + (first - edge + step / 2) / step) : -(int64_t)((edge - first + step / 2) / step);
+    }
+
+    if(lo > 0 && (lo == ref_n || first - sparse_load(ref, lo - 1, fs) < sparse_load(ref, lo, fs) - first))
+        lo--;
+
+    return (int64_t)lo;
+}
+
+static size_t
+grid_cost(const uint8_t* arr, size_t n, const struct grid_refs* g, int r, int64_t start, size_t limit)
+/**
+ * @brief Size of the residuals of arr against reference r from start, or limit if not smaller.
+ */
+{
+    size_t cost = 0;
+    for(size_t i = 0; i < n && cost < limit; i++)
+        cost += varint_size(grid_code(arr, i, g, r, start));
+    return cost < limit ? cost : limit;
+}
+
+void
+algo_decode_grid (void* args)
+/**
+ * @brief Reference grid transform (see above).
+ * 
+ * @param args Pointer to algo_args struct.
+ * 
+ * @return void
+ */
+{
+    // Parse args
+    algo_args* a_args = (algo_args*)args;
+
+    // Decode using specified encoding format (with header, as lossless)
+    a_args->dec_fun(a_args->z, *a_args->src, a_args->src_len, a_args->dest, a_args->dest_len, a_args->tmp, a_args->expected_len);
+
+    // zlib binaries: record how to recreate the original deflate stream
+    if(a_args->deflate_z != NULL)
+        algo_record_zlib_params(a_args);
+
+    size_t hs = sparse_header_size(a_args->source_compression);
+    uint8_t* decoded = (uint8_t*)*a_args->dest;
+
+    if(a_args->source_compression == _zlib_ && *(ZLIB_PARAMS_TYPE*)(decoded + ZLIB_SIZE_OFFSET) == ZLIB_PARAMS_RAW)
+        return; // original stream kept as-is
+
+    struct grid_refs* g = grid_get_refs(a_args);
+
+    size_t fs = get_format_size(a_args->src_format);
+    ZLIB_TYPE n_bytes = *(ZLIB_TYPE*)decoded;
+    size_t n = (fs > 0 && n_bytes % fs == 0) ? n_bytes / fs : 0; // n == 0 stores the array as-is
+    uint8_t* arr = decoded + hs;
+
+    // Pick the reference with the smallest residuals. Only worth it if they take less than half the array.
+    int best = -1;
+    int64_t best_start = 0;
+    size_t best_cost = n_bytes / 2;
+
+    for(int r = 0; r < GRID_REFS && n > 0; r++)
+    {
+        if(g->used[r] == 0 || g->fs[r] != fs)
+            continue;
+        int64_t start = grid_find_start(g, r, sparse_load(arr, 0, fs));
+        size_t cost = grid_cost(arr, n, g, r, start, best_cost);
+        if(cost < best_cost)
+        {
+            best = r;
+            best_start = start;
+            best_cost = cost;
+        }
+    }
+
+    uint8_t* res = scratch_alloc(hs + 3 + VARINT_MAX_SIZE + n_bytes);
+    if(res == NULL)
+        error("algo_decode_grid: malloc failed");
+
+    memcpy(res, decoded, hs);
+
+    int exact = (best >= 0);
+    for(size_t i = 0; exact && i < n; i++)
+        exact = (grid_residual(arr, i, g, best, best_start + (int64_t)i) == 0);
+
+    uint8_t* p = res + hs;
+    *p++ = (best < 0) ? GRID_NEW : (exact ? GRID_EXACT : GRID_REF);
+    *p++ = (uint8_t)fs;
+
+    if(best < 0)
+    {
+        memcpy(p, arr, n_bytes);
+        p += n_bytes;
+        if(n > 0)
+            grid_store(g, arr, n, fs);
+    }
+    else
+    {
+        *p++ = (uint8_t)best;
+        p = varint_put(p, zigzag_encode(best_start));
+        if(!exact)
+            for(size_t i = 0; i < n; i++)
+                p = varint_put(p, grid_code(arr, i, g, best, best_start));
+        g->used[best] = ++g->clock;
+    }
 
-    // Store length of array in first 4 bytes
-    memcpy(res, &len, sizeof(uint32_t));
-    // Store num bits in next byte
-    memcpy(res + sizeof(uint32_t), &num_bits, sizeof(uint8_t));
-    // Store number of bytes in next 4 bytes
-    memcpy(res + sizeof(uint32_t) + sizeof(uint8_t), &bytes_used, sizeof(uint32_t));
+    scratch_free(decoded);
 
     // Return result
-    *a_args->dest = res;
-    *a_args->dest_len = header_size + bytes_used;
-
-    return;
+    *a_args->dest = (char*)res;
+    *a_args->dest_len = p - res;
 }
 
 /*
     @section Encoding functions
 */
 
+static int
+algo_encode_empty(algo_args* a_args, size_t header_size)
+/**
+ * @brief Restores an array stored by algo_decode_empty: a length header of header_size zero bytes.
+ *
+ * @return 1 if the array was empty, 0 otherwise.
+ */
+{
+    static const char empty[8] = {0};
+    char* src = (char*)empty;
+
+    if(memcmp(*a_args->src, empty, header_size) != 0)
+        return 0;
+
+    // Encode using specified encoding format
+    a_args->enc_fun(a_args->z, &src, 0, a_args->dest, a_args->dest_len);
+
+    // Move to next array
+    *a_args->src += header_size;
+
+    return 1;
+}
+
 void
 algo_encode_lossless (void* args)
 /**
@@ -1507,6 +2852,10 @@ algo_encode_lossless (void* args)
 
     /* Lossless, don't touch anything */
 
+    // zlib binaries: restore the deflate parameters recorded by algo_decode_lossless
+    if(a_args->zlib_params == ZLIB_AUTO)
+        zlib_set_params(a_args->z, *(ZLIB_PARAMS_TYPE*)(*a_args->src + ZLIB_SIZE_OFFSET));
+
     // Encode using specified encoding format
     a_args->enc_fun(a_args->z, a_args->src, a_args->src_len, a_args->dest, a_args->dest_len);
 
@@ -1531,6 +2880,9 @@ algo_encode_cast32_64d (void* args)
             error("algo_encode_cast32: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(float)))
+        return;
+
     // Cast 32-bit to 64-bit 
     
     // Get source array 
@@ -1551,7 +2903,7 @@ algo_encode_cast32_64d (void* args)
     #endif
 
     // Allocate buffer
-    void* res = malloc(sizeof(double) * len);
+    void* res = scratch_alloc(sizeof(double) * len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1593,6 +2945,9 @@ algo_encode_cast16_32f (void* args)
             error("algo_encode_cast16_32f: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Cast 16-bit to 64-bit 
     
     // Get source array 
@@ -1613,7 +2968,7 @@ algo_encode_cast16_32f (void* args)
     #endif
 
     // Allocate buffer
-    void* res = malloc(sizeof(float) * len);
+    void* res = scratch_alloc(sizeof(float) * len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1659,6 +3014,9 @@ algo_encode_cast16_64d (void* args)
             error("algo_encode_cast32: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Cast 32-bit to 64-bit 
     
     // Get source array 
@@ -1679,7 +3037,7 @@ algo_encode_cast16_64d (void* args)
     #endif
 
     // Allocate buffer
-    void* res = malloc(sizeof(double) * len);
+    void* res = scratch_alloc(sizeof(double) * len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1718,6 +3076,9 @@ algo_encode_log_2_transform_32f (void* args)
             error("algo_encode_log_2_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -1736,7 +3097,7 @@ algo_encode_log_2_transform_32f (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(float);
-    float* res = malloc(res_len);
+    float* res = scratch_alloc(res_len);
     
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1767,6 +3128,9 @@ algo_encode_log_2_transform_64d (void* args)
             error("algo_encode_log_2_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -1785,7 +3149,7 @@ algo_encode_log_2_transform_64d (void* args)
 
    // Allocate buffer
     size_t res_len = len * sizeof(double);
-    double* res = malloc(res_len);
+    double* res = scratch_alloc(res_len);
     if(res == NULL)
         error("algo_encode_log_2_transform: malloc failed");
     // Perform log2 transform
@@ -1812,6 +3176,9 @@ algo_encode_delta16_transform_32f (void* args)
             error("algo_encode_delta_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -1833,7 +3200,7 @@ algo_encode_delta16_transform_32f (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(float);
-    float* res = malloc(res_len);
+    float* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1865,6 +3232,9 @@ algo_encode_delta16_transform_64d (void* args)
             error("algo_encode_delta_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -1886,7 +3256,7 @@ algo_encode_delta16_transform_64d (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(double);
-    double* res = malloc(res_len);
+    double* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1918,6 +3288,9 @@ algo_encode_vdelta16_transform_32f (void* args)
             error("algo_encode_vdelta16_transform_32f: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -1943,7 +3316,7 @@ algo_encode_vdelta16_transform_32f (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(float);
-    float* res = malloc(res_len);
+    float* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -1975,6 +3348,9 @@ algo_encode_vdelta16_transform_64d (void* args)
             error("algo_encode_delta_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -2000,7 +3376,7 @@ algo_encode_vdelta16_transform_64d (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(double);
-    double* res = malloc(res_len);
+    double* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2032,6 +3408,9 @@ algo_encode_vdelta24_transform_32f (void* args)
             error("algo_encode_vdelta24_transform_32f: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -2057,7 +3436,7 @@ algo_encode_vdelta24_transform_32f (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(float);
-    float* res = malloc(res_len);
+    float* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2100,6 +3479,9 @@ algo_encode_vdelta24_transform_64d (void* args)
             error("algo_encode_delta_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -2125,7 +3507,7 @@ algo_encode_vdelta24_transform_64d (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(double);
-    double* res = malloc(res_len);
+    double* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2168,6 +3550,9 @@ algo_encode_delta24_transform_32f (void* args)
             error("algo_encode_delta_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -2189,7 +3574,7 @@ algo_encode_delta24_transform_32f (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(float);
-    float* res = malloc(res_len);
+    float* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2232,6 +3617,9 @@ algo_encode_delta24_transform_64d (void* args)
             error("algo_encode_delta_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -2253,7 +3641,7 @@ algo_encode_delta24_transform_64d (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(double);
-    double* res = malloc(res_len);
+    double* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2296,6 +3684,9 @@ algo_encode_delta32_transform_32f (void* args)
             error("algo_encode_delta_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -2317,7 +3708,7 @@ algo_encode_delta32_transform_32f (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(float);
-    float* res = malloc(res_len);
+    float* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2349,6 +3740,9 @@ algo_encode_delta32_transform_64d (void* args)
             error("algo_encode_delta_transform: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint16_t)))
+        return;
+
     // Get array length
     uint16_t len = *(uint16_t*)(*a_args->src);
 
@@ -2370,7 +3764,7 @@ algo_encode_delta32_transform_64d (void* args)
 
     // Allocate buffer
     size_t res_len = len * sizeof(double);
-    double* res = malloc(res_len);
+    double* res = scratch_alloc(res_len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2409,6 +3803,9 @@ algo_encode_vbr_32f (void* args)
             error("algo_encode_vbr_32f: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint32_t)))
+        return;
+
     // Cast 32-bit to 64-bit 
     
     // Get source array 
@@ -2430,7 +3827,7 @@ algo_encode_vbr_32f (void* args)
     #endif
 
     // Allocate buffer
-    void* res = calloc(1, len);
+    void* res = scratch_calloc(1, len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2509,6 +3906,9 @@ algo_encode_vbr_64d (void* args)
             error("algo_encode_vbr_64d: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint32_t)))
+        return;
+
     // Cast 32-bit to 64-bit 
     
     // Get source array 
@@ -2530,7 +3930,7 @@ algo_encode_vbr_64d (void* args)
     #endif
 
     // Allocate buffer
-    void* res = calloc(1, len);
+    void* res = scratch_calloc(1, len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2609,6 +4009,9 @@ algo_encode_bitpack_32f (void* args)
             error("algo_encode_bitpack_32f: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint32_t)))
+        return;
+
     // Cast 32-bit to 64-bit 
     
     // Get source array 
@@ -2630,7 +4033,7 @@ algo_encode_bitpack_32f (void* args)
     #endif
 
     // Allocate buffer
-    void* res = calloc(1, len);
+    void* res = scratch_calloc(1, len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2702,6 +4105,9 @@ algo_encode_bitpack_64d (void* args)
             error("algo_encode_vbr_64d: args is NULL");
     #endif
 
+    if(algo_encode_empty(a_args, sizeof(uint32_t)))
+        return;
+
     // Cast 32-bit to 64-bit 
     
     // Get source array 
@@ -2723,7 +4129,7 @@ algo_encode_bitpack_64d (void* args)
     #endif
 
     // Allocate buffer
-    void* res = calloc(1, len);
+    void* res = scratch_calloc(1, len);
 
     #ifdef ERROR_CHECK
         if(res == NULL)
@@ -2777,6 +4183,347 @@ algo_encode_bitpack_64d (void* args)
     return;
 }
 
+static void
+algo_encode_quant(algo_args* a_args, int ppm, int accession)
+/**
+ * @brief Reconstructs an array stored by algo_decode_quant and encodes it.
+ * 
+ * @param args Pointer to algo_args struct.
+ * 
+ * @param ppm 1 if the array was quantized in the log domain, 0 otherwise.
+ * 
+ * @param accession Target data format (_32f_ or _64d_).
+ */
+{
+    #ifdef ERROR_CHECK
+        if(a_args == NULL)
+            error("algo_encode_quant: args is NULL");
+        if(a_args->src_format != accession) // non-essential check, but useful for debugging
+            error("algo_encode_quant: Unknown data format");
+    #endif
+
+    uint8_t* p = (uint8_t*)(*a_args->src);
+
+    uint32_t len;
+    memcpy(&len, p, sizeof(uint32_t));
+
+    size_t format_size = get_format_size(accession);
+    size_t res_len = len * format_size;
+
+    char* res = scratch_alloc(res_len > 0 ? res_len : 1);
+    if(res == NULL)
+        error("algo_encode_quant: malloc failed");
+
+    if(len == 0)
+        p += sizeof(uint32_t);
+    else
+    {
+        uint8_t bits;
+        double step;
+        int64_t q;
+
+        p += sizeof(uint32_t);
+        memcpy(&bits, p, sizeof(uint8_t));  p += sizeof(uint8_t);
+        p += sizeof(float);                 // max error, informational
+        memcpy(&step, p, sizeof(double));   p += sizeof(double);
+        memcpy(&q, p, sizeof(int64_t));     p += sizeof(int64_t);
+
+        if(bits == QUANT_VERBATIM)
+        {
+            memcpy(res, p, res_len);
+            p += res_len;
+        }
+        else
+        {
+            struct bit_reader rd = {p, 0, 0};
+
+            for(uint32_t i = 0; i < len; i++)
+            {
+                if(i > 0)
+                    q += zigzag_decode(bit_get(&rd, bits));
+                if(accession == _32f_)
+                    ((float*)res)[i] = (float)quant_value(q, step, ppm);
+                else
+                    ((double*)res)[i] = quant_value(q, step, ppm);
+            }
+            p = rd.p;
+        }
+    }
+
+    // Encode using specified encoding format
+    char* enc_src = res;
+    a_args->enc_fun(a_args->z, &enc_src, res_len, a_args->dest, a_args->dest_len);
+
+    // Move to next array
+    *a_args->src = (char*)p;
+
+    scratch_free(res);
+}
+
+void
+algo_encode_abs_32f (void* args)
+{
+    algo_encode_quant((algo_args*)args, 0, _32f_);
+}
+
+void
+algo_encode_abs_64d (void* args)
+{
+    algo_encode_quant((algo_args*)args, 0, _64d_);
+}
+
+void
+algo_encode_ppm_32f (void* args)
+{
+    algo_encode_quant((algo_args*)args, 1, _32f_);
+}
+
+void
+algo_encode_ppm_64d (void* args)
+{
+    algo_encode_quant((algo_args*)args, 1, _64d_);
+}
+
+static void
+algo_encode_rel(algo_args* a_args, int accession)
+/**
+ * @brief Reconstructs an intensity array stored by algo_decode_rel and encodes it.
+ * 
+ * @param args Pointer to algo_args struct.
+ * 
+ * @param accession Target data format (_32f_ or _64d_).
+ */
+{
+    #ifdef ERROR_CHECK
+        if(a_args == NULL)
+            error("algo_encode_rel: args is NULL");
+        if(a_args->src_format != accession) // non-essential check, but useful for debugging
+            error("algo_encode_rel: Unknown data format");
+    #endif
+
+    uint8_t* p = (uint8_t*)(*a_args->src);
+
+    uint32_t len;
+    uint8_t bits;
+    float lmin, step;
+
+    memcpy(&len, p, sizeof(uint32_t));  p += sizeof(uint32_t);
+    memcpy(&bits, p, sizeof(uint8_t));  p += sizeof(uint8_t);
+    memcpy(&lmin, p, sizeof(float));    p += sizeof(float);
+    memcpy(&step, p, sizeof(float));    p += sizeof(float);
+
+    size_t format_size = get_format_size(accession);
+    size_t res_len = len * format_size;
+
+    char* res = scratch_alloc(res_len > 0 ? res_len : 1);
+    if(res == NULL)
+        error("algo_encode_rel: malloc failed");
+
+    if(bits == REL_VERBATIM)
+    {
+        memcpy(res, p, res_len);
+        p += res_len;
+    }
+    else
+    {
+        uint32_t* codes = scratch_alloc((len + 1) * sizeof(uint32_t));
+        if(codes == NULL)
+            error("algo_encode_rel: malloc failed");
+
+        struct bit_reader rd = {p, 0, 0};
+
+        for(uint32_t i = 0; i < len; i++)
+            codes[i] = (uint32_t)bit_get(&rd, bits);
+        p = rd.p;
+
+        if(accession == _32f_)
+            rel_values(codes, (float*)res, len, lmin, step);
+        else
+        {
+            float* recon = scratch_alloc((len + 1) * sizeof(float));
+            if(recon == NULL)
+                error("algo_encode_rel: malloc failed");
+            rel_values(codes, recon, len, lmin, step);
+            for(uint32_t i = 0; i < len; i++)
+                ((double*)res)[i] = (double)recon[i];
+            scratch_free(recon);
+        }
+
+        scratch_free(codes);
+    }
+
+    // Encode using specified encoding format
+    char* enc_src = res;
+    a_args->enc_fun(a_args->z, &enc_src, res_len, a_args->dest, a_args->dest_len);
+
+    // Move to next array
+    *a_args->src = (char*)p;
+
+    scratch_free(res);
+}
+
+void
+algo_encode_rel_32f (void* args)
+{
+    algo_encode_rel((algo_args*)args, _32f_);
+}
+
+void
+algo_encode_rel_64d (void* args)
+{
+    algo_encode_rel((algo_args*)args, _64d_);
+}
+
+void
+algo_encode_sparse (void* args)
+/**
+ * @brief Restores a binary stored by algo_decode_sparse and encodes it.
+ * 
+ * @param args Pointer to algo_args struct.
+ * 
+ * @return void
+ */
+{
+    // Parse args
+    algo_args* a_args = (algo_args*)args;
+
+    #ifdef ERROR_CHECK
+        if(a_args == NULL)
+            error("algo_encode_sparse: args is NULL");
+    #endif
+
+    size_t hs = sparse_header_size(a_args->source_compression);
+    uint8_t* p = (uint8_t*)*a_args->src;
+    ZLIB_PARAMS_TYPE params = 0;
+
+    if(a_args->source_compression == _zlib_)
+    {
+        params = *(ZLIB_PARAMS_TYPE*)(p + ZLIB_SIZE_OFFSET);
+        if(params == ZLIB_PARAMS_RAW) // original stream kept as-is
+        {
+            a_args->enc_fun(a_args->z, a_args->src, a_args->src_len, a_args->dest, a_args->dest_len);
+            return;
+        }
+    }
+
+    ZLIB_TYPE n_bytes = *(ZLIB_TYPE*)p;
+
+    char* res = scratch_alloc(hs + n_bytes + 1);
+    if(res == NULL)
+        error("algo_encode_sparse: malloc failed");
+
+    memcpy(res, p, hs);
+    p = sparse_decode(p + hs, n_bytes, (uint8_t*)res + hs);
+
+    // zlib binaries: restore the deflate parameters recorded by algo_decode_sparse
+    if(a_args->zlib_params == ZLIB_AUTO)
+        zlib_set_params(a_args->z, params);
+
+    // Encode using specified encoding format
+    char* enc_src = res;
+    a_args->enc_fun(a_args->z, &enc_src, a_args->src_len, a_args->dest, a_args->dest_len);
+
+    // Move to next array
+    *a_args->src = (char*)p;
+
+    scratch_free(res);
+}
+
+void
+algo_encode_grid (void* args)
+/**
+ * @brief Restores a binary stored by algo_decode_grid and encodes it.
+ * 
+ * @param args Pointer to algo_args struct.
+ * 
+ * @return void
+ */
+{
+    // Parse args
+    algo_args* a_args = (algo_args*)args;
+
+    #ifdef ERROR_CHECK
+        if(a_args == NULL)
+            error("algo_encode_grid: args is NULL");
+    #endif
+
+    size_t hs = sparse_header_size(a_args->source_compression);
+    uint8_t* p = (uint8_t*)*a_args->src;
+    ZLIB_PARAMS_TYPE params = 0;
+
+    if(a_args->source_compression == _zlib_)
+    {
+        params = *(ZLIB_PARAMS_TYPE*)(p + ZLIB_SIZE_OFFSET);
+        if(params == ZLIB_PARAMS_RAW) // original stream kept as-is
+        {
+            a_args->enc_fun(a_args->z, a_args->src, a_args->src_len, a_args->dest, a_args->dest_len);
+            return;
+        }
+    }
+
+    struct grid_refs* g = grid_get_refs(a_args);
+
+    ZLIB_TYPE n_bytes = *(ZLIB_TYPE*)p;
+
+    char* res = scratch_alloc(hs + n_bytes + 1);
+    if(res == NULL)
+        error("algo_encode_grid: malloc failed");
+
+    memcpy(res, p, hs);
+    p += hs;
+
+    uint8_t mode = *p++;
+    size_t fs = *p++;
+    uint8_t* arr = (uint8_t*)res + hs;
+
+    if(mode == GRID_NEW)
+    {
+        memcpy(arr, p, n_bytes);
+        p += n_bytes;
+        if(n_bytes > 0)
+            grid_store(g, arr, n_bytes / fs, fs);
+    }
+    else
+    {
+        int r = *p++;
+        uint64_t z;
+        size_t n = n_bytes / fs;
+        p = varint_get(p, &z);
+        int64_t start = zigzag_decode(z);
+        uint64_t residual = 0;
+
+        #ifdef ERROR_CHECK
+            if(r >= GRID_REFS || g->used[r] == 0 || g->fs[r] != fs)
+                error("algo_encode_grid: invalid reference %d", r);
+        #endif
+
+        for(size_t i = 0; i < n; i++)
+        {
+            if(mode == GRID_REF)
+            {
+                p = varint_get(p, &z);
+                residual += (uint64_t)zigzag_decode(z);
+            }
+            uint64_t v = grid_predict(g, r, start + (int64_t)i) + residual;
+            memcpy(arr + i * fs, &v, fs);
+        }
+        g->used[r] = ++g->clock;
+    }
+
+    // zlib binaries: restore the deflate parameters recorded by algo_decode_grid
+    if(a_args->zlib_params == ZLIB_AUTO)
+        zlib_set_params(a_args->z, params);
+
+    // Encode using specified encoding format
+    char* enc_src = res;
+    a_args->enc_fun(a_args->z, &enc_src, a_args->src_len, a_args->dest, a_args->dest_len);
+
+    // Move to next array
+    *a_args->src = (char*)p;
+
+    scratch_free(res);
+}
+
 /*
     @section Algo switch
 */
@@ -2787,6 +4534,8 @@ set_compress_algo(int algo, int accession)
     switch(algo)
     {
         case _lossless_ :       return algo_decode_lossless;
+        case _sparse_ :         return algo_decode_sparse;
+        case _grid_ :           return algo_decode_grid;
         case _log2_transform_ :
         {
             switch(accession)
@@ -2867,6 +4616,30 @@ set_compress_algo(int algo, int accession)
                 case _64d_ :    return algo_decode_bitpack_64d;
             }
         } ;
+        case _abs_bound_ :
+        {
+            switch(accession)
+            {
+                case _32f_ :    return algo_decode_abs_32f;
+                case _64d_ :    return algo_decode_abs_64d;
+            }
+        } ;
+        case _ppm_bound_ :
+        {
+            switch(accession)
+            {
+                case _32f_ :    return algo_decode_ppm_32f;
+                case _64d_ :    return algo_decode_ppm_64d;
+            }
+        } ;
+        case _rel_bound_ :
+        {
+            switch(accession)
+            {
+                case _32f_ :    return algo_decode_rel_32f;
+                case _64d_ :    return algo_decode_rel_64d;
+            }
+        } ;
         default:                error("set_compress_algo: Unknown compression algorithm");
     }
 }
@@ -2877,6 +4650,8 @@ set_decompress_algo(int algo, int accession)
     switch(algo)
     {
         case _lossless_ :       return algo_encode_lossless;
+        case _sparse_ :         return algo_encode_sparse;
+        case _grid_ :           return algo_encode_grid;
         case _log2_transform_ : 
         {
             switch(accession)
@@ -2957,6 +4732,30 @@ set_decompress_algo(int algo, int accession)
                 case _64d_ :    return algo_encode_bitpack_64d;
             }
         } ;
+        case _abs_bound_ :
+        {
+            switch(accession)
+            {
+                case _32f_ :    return algo_encode_abs_32f;
+                case _64d_ :    return algo_encode_abs_64d;
+            }
+        } ;
+        case _ppm_bound_ :
+        {
+            switch(accession)
+            {
+                case _32f_ :    return algo_encode_ppm_32f;
+                case _64d_ :    return algo_encode_ppm_64d;
+            }
+        } ;
+        case _rel_bound_ :
+        {
+            switch(accession)
+            {
+                case _32f_ :    return algo_encode_rel_32f;
+                case _64d_ :    return algo_encode_rel_64d;
+            }
+        } ;
         default:                error("set_decompress_algo: Unknown compression algorithm");
     }
 }
@@ -2988,6 +4787,25 @@ get_algo_type(char* arg)
         return _vbr_;
     else if(strcmp(arg, "bitpack") == 0)
         return _bitpack_;
+    else if(strcmp(arg, "abs") == 0)
+        return _abs_bound_;
+    else if(strcmp(arg, "ppm") == 0)
+        return _ppm_bound_;
+    else if(strcmp(arg, "rel") == 0)
+        return _rel_bound_;
+    else if(strcmp(arg, "sparse") == 0)
+        return _sparse_;
+    else if(strcmp(arg, "grid") == 0)
+        return _grid_;
     else
         error("get_algo_type: Unknown compression algorithm");
+}
+
+int
+is_lossless_algo(int algo)
+/**
+ * @brief Determines if a transform restores the binary arrays it was given exactly.
+ */
+{
+    return algo == _lossless_ || algo == _sparse_ || algo == _grid_;
 }
\ No newline at end of file
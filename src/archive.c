@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+#include "mscompress.h"
+
+/*
+    Multi-run archives (--archive).
+
+    Runs of the same method share most of their XML: the cvList, instrument and processing sections and the
+    element and attribute sequence of every spectrum. An archive stores the XML of the first run once, as a
+    raw content zstd dictionary, and compresses the XML stream of every run against it (_ZSTD_dict_). Each run is
+    otherwise a complete msz, with positions relative to its own start, so a run is decompressed, queried or
+    listed in place once the dictionary is loaded.
+
+    Layout: header (ARCHIVE_HEADER_SIZE), dictionary, runs (8-byte aligned), directory (archive_entry_t per run),
+    archive_footer_t.
+*/
+
+static char* shared_dict = NULL;
+static size_t shared_dict_size = 0;
+static ZSTD_DDict* shared_ddict = NULL;
+
+static void
+load_dictionary(char* dict, size_t dict_size)
+/**
+ * @brief Loads the shared dictionary of an archive for _ZSTD_dict_ blocks.
+ */
+{
+    free(shared_dict);
+    if(shared_ddict)
+        ZSTD_freeDDict(shared_ddict);
+
+    shared_dict = malloc(dict_size);
+    shared_ddict = ZSTD_createDDict(dict, dict_size);
+    if(shared_dict == NULL || shared_ddict == NULL)
+        error("load_dictionary: failed to load a dictionary of %ld bytes.\n", (long)dict_size);
+
+    memcpy(shared_dict, dict, dict_size);
+    shared_dict_size = dict_size;
+}
+
+void*
+zstd_dict_compress(ZSTD_CCtx* cctx, void* src_buff, size_t src_len, size_t* out_len, int compression_level)
+/**
+ * @brief Compresses a block with the shared dictionary of the archive being written.
+ *        Same function signature as zstd_compress.
+ */
+{
+    void* out_buff;
+    size_t buff_len;
+
+    if(shared_dict == NULL)
+        error("zstd_dict_compress: no dictionary loaded.\n");
+
+    if(src_len == 0)
+    {
+        *out_len = 0;
+        return NULL;
+    }
+
+    buff_len = ZSTD_compressBound(src_len);
+    out_buff = malloc(buff_len);
+    if(out_buff == NULL)
+        error("zstd_dict_compress: malloc() error.\n");
+
+    // Loading the dictionary per block lets zstd fit its parameters to the block, unlike a ZSTD_CDict.
+    *out_len = ZSTD_compress_usingDict(cctx, out_buff, buff_len, src_buff, src_len, shared_dict, shared_dict_size, compression_level);
+    if(ZSTD_isError(*out_len))
+        error("zstd_dict_compress: ZSTD_compress_usingDict() error: %s\n", ZSTD_getErrorName(*out_len));
+
+    return out_buff;
+}
+
+void*
+zstd_dict_decompress(ZSTD_DCtx* dctx, void* src_buff, size_t src_len, size_t org_len)
+/**
+ * @brief Decompresses a block of zstd_dict_compress with the dictionary of the open archive.
+ */
+{
+    void* out_buff;
+    size_t decmp_len;
+
+    if(shared_ddict == NULL)
+        error("zstd_dict_decompress: block requires the dictionary of its archive.\n");
+
+    out_buff = malloc(org_len);
+    if(out_buff == NULL)
+        error("zstd_dict_decompress: malloc() error.\n");
+
+    decmp_len = ZSTD_decompress_usingDDict(dctx, out_buff, org_len, src_buff, src_len, shared_ddict);
+    if(decmp_len != org_len)
+        error("zstd_dict_decompress: ZSTD_decompress_usingDDict() error: %s\n", ZSTD_getErrorName(decmp_len));
+
+    return out_buff;
+}
+
+static char*
+sample_xml(char* input_map, divisions_t* divisions, size_t max_size, size_t* out_size)
+/**
+ * @brief Concatenates the XML segments of a run, in file order, up to max_size bytes.
+ */
+{
+    char* r = malloc(max_size);
+    size_t n = 0;
+    int d;
+    long i;
+
+    if(r == NULL)
+        error("sample_xml: malloc() error.\n");
+
+    for(d = 0; d < divisions->n_divisions && n < max_size; d++)
+    {
+        data_positions_t* xml = divisions->divisions[d]->xml;
+        for(i = 0; i < xml->total_spec && n < max_size; i++)
+        {
+            size_t len = xml->end_positions[i] - xml->start_positions[i];
+            if(len > max_size - n)
+                len = max_size - n;
+            memcpy(r + n, input_map + xml->start_positions[i], len);
+            n += len;
+        }
+    }
+
+    *out_size = n;
+    return r;
+}
+
+static void
+pad_to_8(int fd)
+{
+    char padding[8] = {0};
+    long pos = get_offset(fd);
+
+    if(pos % 8)
+        write_to_file(fd, padding, 8 - pos % 8);
+}
+
+static const char*
+base_name(const char* path)
+{
+    const char* r = path;
+
+    for(const char* p = path; *p; p++)
+        if(*p == '/' || *p == '\\')
+            r = p + 1;
+
+    return r;
+}
+
+void
+archive_mzml(char** inputs, int n_inputs, struct Arguments* arguments, int output_fd)
+/**
+ * @brief Compresses n_inputs mzML files into one archive written to output_fd.
+ *        The XML stream of every run is compressed against the XML of the first run if it targets ZSTD.
+ */
+{
+    char header[ARCHIVE_HEADER_SIZE] = {0};
+    uint32_t version[3] = {ARCHIVE_MAGIC, FORMAT_VERSION_MAJOR, FORMAT_VERSION_MINOR};
+    archive_footer_t footer = {0};
+    long blocksize = arguments->blocksize;
+    int i;
+
+    archive_entry_t* directory = calloc(n_inputs, sizeof(archive_entry_t));
+    if(directory == NULL)
+        error("archive_mzml: failed to allocate memory.\n");
+
+    memcpy(header, version, sizeof(version));
+    write_to_file(output_fd, header, ARCHIVE_HEADER_SIZE);
+
+    for(i = 0; i < n_inputs; i++)
+    {
+        data_format_t* df;
+        divisions_t* divisions;
+
+        int fd = open_file(inputs[i]);
+        if(fd < 0)
+            error("archive_mzml: cannot open %s.\n", inputs[i]);
+        long input_filesize = get_filesize(inputs[i]);
+        char* input_map = get_mapping(fd);
+        if(input_map == NULL || !is_mzml(input_map, input_filesize))
+            error("archive_mzml: %s is not an mzML file.\n", inputs[i]);
+
+        print("\n=== Run %d/%d: %s ===\n", i + 1, n_inputs, inputs[i]);
+
+        arguments->blocksize = blocksize;
+        preprocess_mzml(input_map, input_filesize, &arguments->blocksize, arguments, &df, &divisions);
+
+        if(i == 0 && arguments->target_xml_format == _ZSTD_compression_)
+        {
+            size_t dict_size;
+            char* dict = sample_xml(input_map, divisions, ARCHIVE_DICT_SIZE, &dict_size);
+
+            size_t cmp_size = ZSTD_compressBound(dict_size);
+            char* cmp_dict = malloc(cmp_size);
+            if(cmp_dict == NULL)
+                error("archive_mzml: failed to allocate memory.\n");
+            cmp_size = ZSTD_compress(cmp_dict, cmp_size, dict, dict_size, ARCHIVE_DICT_LEVEL);
+            if(ZSTD_isError(cmp_size))
+                error("archive_mzml: ZSTD_compress() error: %s\n", ZSTD_getErrorName(cmp_size));
+
+            footer.dict_pos = get_offset(output_fd);
+            footer.dict_size = cmp_size;
+            footer.dict_original_size = dict_size;
+            write_to_file(output_fd, cmp_dict, cmp_size);
+            load_dictionary(dict, dict_size);
+            free(cmp_dict);
+            free(dict);
+
+            arguments->target_xml_format = _ZSTD_dict_;
+            print("\tShared XML dictionary: %ld bytes (%ld compressed)\n", (long)dict_size, (long)cmp_size);
+        }
+
+        pad_to_8(output_fd);
+        directory[i].offset = get_offset(output_fd);
+        directory[i].original_size = input_filesize;
+        strncpy(directory[i].name, base_name(inputs[i]), ARCHIVE_NAME_SIZE - 1);
+
+        // Positions within a run are relative to its start.
+        set_offset(output_fd, 0);
+        compress_mzml(input_map, input_filesize, arguments, df, divisions, output_fd);
+        directory[i].size = get_offset(output_fd);
+        set_offset(output_fd, directory[i].offset + directory[i].size);
+
+        dealloc_divisions(divisions);
+        free(df);
+        remove_mapping(input_map, fd);
+        close_file(fd);
+    }
+
+    pad_to_8(output_fd);
+    footer.directory_pos = get_offset(output_fd);
+    footer.n_runs = n_inputs;
+    footer.magic = ARCHIVE_MAGIC;
+    write_to_file(output_fd, (char*)directory, n_inputs * sizeof(archive_entry_t));
+    write_to_file(output_fd, (char*)&footer, sizeof(footer));
+
+    print("\nArchived %d runs (%ld bytes).\n", n_inputs, get_offset(output_fd));
+
+    free(directory);
+}
+
+int
+is_archive(void* input_map, size_t input_length)
+/**
+ * @brief Determines if the file mapped in input_map is an archive of archive_mzml.
+ */
+{
+    if(input_length < ARCHIVE_HEADER_SIZE + sizeof(archive_footer_t))
+        return 0;
+
+    return *(uint32_t*)input_map == ARCHIVE_MAGIC;
+}
+
+static archive_footer_t*
+read_archive_footer(void* input_map, size_t input_length)
+{
+    archive_footer_t* footer = (archive_footer_t*)((char*)input_map + input_length - sizeof(archive_footer_t));
+
+    check_format_version(input_map, "read_archive_footer");
+    if(footer->magic != ARCHIVE_MAGIC ||
+       footer->directory_pos + footer->n_runs * sizeof(archive_entry_t) + sizeof(archive_footer_t) != input_length ||
+       footer->dict_pos + footer->dict_size > footer->directory_pos || footer->dict_original_size > ARCHIVE_DICT_SIZE)
+        error("read_archive_footer: invalid archive footer.\n");
+
+    return footer;
+}
+
+void
+list_runs(void* input_map, size_t input_length, FILE* stream)
+/**
+ * @brief Lists the runs of an archive.
+ */
+{
+    archive_footer_t* footer = read_archive_footer(input_map, input_length);
+    archive_entry_t* directory = (archive_entry_t*)((char*)input_map + footer->directory_pos);
+
+    fprintf(stream, "run\tname\tmzML_size\tmsz_size\n");
+    for(uint32_t i = 0; i < footer->n_runs; i++)
+        fprintf(stream, "%u\t%s\t%lu\t%lu\n", i, directory[i].name, directory[i].original_size, directory[i].size);
+}
+
+char*
+open_run(void* input_map, size_t input_length, char* run, size_t* run_size)
+/**
+ * @brief Loads the dictionary of an archive and finds one of its runs, by name or index.
+ *
+ * @return Pointer to the msz of the run within input_map, its size in run_size.
+ */
+{
+    archive_footer_t* footer = read_archive_footer(input_map, input_length);
+    archive_entry_t* directory = (archive_entry_t*)((char*)input_map + footer->directory_pos);
+    char* end;
+    uint32_t i;
+
+    for(i = 0; i < footer->n_runs; i++)
+        if(strncmp(directory[i].name, run, ARCHIVE_NAME_SIZE) == 0)
+            break;
+
+    if(i == footer->n_runs)
+    {
+        i = (uint32_t)strtoul(run, &end, 10);
+        if(*run == '\0' || *end != '\0' || i >= footer->n_runs)
+            error("open_run: no run %s in archive.\n", run);
+    }
+
+    if(directory[i].offset % 8 || directory[i].offset + directory[i].size > footer->directory_pos)
+        error("open_run: run %u out of bounds.\n", i);
+
+    if(footer->dict_size)
+    {
+        char* dict = malloc(footer->dict_original_size);
+        if(dict == NULL)
+            error("open_run: failed to allocate memory.\n");
+        size_t dict_size = ZSTD_decompress(dict, footer->dict_original_size, (char*)input_map + footer->dict_pos, footer->dict_size);
+        if(dict_size != footer->dict_original_size)
+            error("open_run: corrupt archive dictionary.\n");
+        load_dictionary(dict, dict_size);
+        free(dict);
+    }
+
+    print("\tRun %u: %s\n", i, directory[i].name);
+
+    *run_size = directory[i].size;
+    return (char*)input_map + directory[i].offset;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
 #include "mscompress.h"
 
 static int validate_algo_name(const char* name) {
@@ -14,7 +15,12 @@ static int validate_algo_name(const char* name) {
       strcmp(name, "vdelta16") != 0 &&
       strcmp(name, "vdelta24") != 0 &&
       strcmp(name, "vbr")     != 0 &&
-      strcmp(name, "bitpack") != 0 )
+      strcmp(name, "bitpack") != 0 &&
+      strcmp(name, "abs")     != 0 &&
+      strcmp(name, "ppm")     != 0 &&
+      strcmp(name, "rel")     != 0 &&
+      strcmp(name, "sparse")  != 0 &&
+      strcmp(name, "grid")    != 0 )
   {
     fprintf(stderr, "Invalid lossy compression type: %s\n", name);
     return 1; // Indicate error
@@ -31,6 +37,7 @@ void init_args(struct Arguments* args)
     args->mz_lossy         = "lossless"; // default
     args->int_lossy        = "lossless"; // default
     args->blocksize        = 1e+8;
+    args->max_memory       = 0; // no limit
     args->input_file       = NULL;
     args->output_file      = NULL;
     args->mz_scale_factor  = 1000; // initialize scale factor to default value
@@ -46,6 +53,20 @@ void init_args(struct Arguments* args)
     args->target_inten_format = _ZSTD_compression_; // default
 
     args->zstd_compression_level = 3; // default
+
+    args->zlib_compression_level = ZLIB_AUTO; // default, restore parameters recorded at compression
+    args->zlib_strategy          = ZLIB_AUTO; // default
+
+    args->list = 0;
+    args->checksum = 0;
+    args->archive = NULL;
+    args->input_files = NULL;
+    args->n_input_files = 0;
+    args->run = NULL;
+    args->transcode = 0;
+    args->verify = 0;
+    args->verify_source = NULL;
+    args->query = NULL;
 }
 
 int set_threads(struct Arguments* args, int threads)
@@ -82,6 +103,12 @@ int set_mz_lossy(struct Arguments* args, const char* mz_lossy) {
     args->mz_scale_factor = 10000.0;
   else if (strcmp(mz_lossy, "cast16") == 0)
     args->mz_scale_factor = 11.801;
+  else if (strcmp(mz_lossy, "abs") == 0)
+    args->mz_scale_factor = 0.001; // maximum absolute error (m/z)
+  else if (strcmp(mz_lossy, "ppm") == 0)
+    args->mz_scale_factor = 1.0;   // maximum relative error (ppm)
+  else if (strcmp(mz_lossy, "sparse") == 0 || strcmp(mz_lossy, "grid") == 0)
+    ; // lossless, no scale factor
   else {
     fprintf(stderr, "Invalid mz lossy compression type: %s\n", mz_lossy);
     return 1;  // Indicate error
@@ -101,6 +128,10 @@ int set_int_lossy(struct Arguments* args, const char* int_lossy) {
     args->int_scale_factor = 72.0;
   else if(strcmp(args->int_lossy, "vbr") == 0)
     args->int_scale_factor = 1.0;
+  else if(strcmp(args->int_lossy, "rel") == 0)
+    args->int_scale_factor = 0.01; // maximum relative error (1%)
+  else if(strcmp(args->int_lossy, "sparse") == 0)
+    ; // lossless, no scale factor
   else {
     fprintf(stderr, "Invalid int lossy compression type: %s\n", int_lossy);
     return 1; // Indicate error
@@ -144,18 +175,131 @@ int set_int_scale_factor(struct Arguments* args, const char* scale_factor_str) {
   return 0;
 }
 
+int set_zlib_compression_level(struct Arguments* args, const char* level_str) {
+  if(level_str == NULL || !isdigit(level_str[0])) {
+    fprintf(stderr, "%s\n", "Missing zlib compression level.");
+    return 1;
+  }
+
+  int level = atoi(level_str);
+  if(level < Z_NO_COMPRESSION || level > Z_BEST_COMPRESSION) {
+    fprintf(stderr, "Invalid zlib compression level: %d\n", level);
+    return 1;
+  }
+
+  args->zlib_compression_level = level;
+  return 0;
+}
+
+int set_zlib_strategy(struct Arguments* args, const char* strategy) {
+  if(strcmp(strategy, "default") == 0)
+    args->zlib_strategy = Z_DEFAULT_STRATEGY;
+  else if(strcmp(strategy, "filtered") == 0)
+    args->zlib_strategy = Z_FILTERED;
+  else if(strcmp(strategy, "huffman") == 0)
+    args->zlib_strategy = Z_HUFFMAN_ONLY;
+  else if(strcmp(strategy, "rle") == 0)
+    args->zlib_strategy = Z_RLE;
+  else if(strcmp(strategy, "fixed") == 0)
+    args->zlib_strategy = Z_FIXED;
+  else {
+    fprintf(stderr, "Invalid zlib strategy: %s\n", strategy);
+    return 1;
+  }
+  return 0;
+}
+
+static int parse_window(const char* str, double* lo, double* hi) {
+  // "lo-hi", either bound may be omitted ("lo-", "-hi").
+  char* end;
+
+  *lo = 0;
+  *hi = HUGE_VAL;
+
+  if (*str != '-') {
+    *lo = strtod(str, &end);
+    if (end == str) return 1;
+    str = end;
+  }
+  if (*str++ != '-') return 1;
+  if (*str != '\0') {
+    *hi = strtod(str, &end);
+    if (end == str) return 1;
+    str = end;
+  }
+  return *str != '\0' || *lo > *hi;
+}
+
+int set_query(struct Arguments* args, const char* query) {
+  // Terms separated by ';': rt=lo-hi (seconds), ms=level (1, 2, n), scans=[range], mz=lo-hi (precursor m/z).
+  query_t* q = calloc(1, sizeof(query_t));
+  char* str = strdup(query);
+  char* term;
+
+  if (q == NULL || str == NULL) {
+    fprintf(stderr, "%s\n", "set_query: malloc() error.");
+    return 1;
+  }
+
+  for (term = strtok(str, ";"); term != NULL; term = strtok(NULL, ";")) {
+    while (isspace((unsigned char)*term)) term++;
+    char* value = strchr(term, '=');
+    if (value == NULL) {
+      fprintf(stderr, "Invalid query term: %s\n", term);
+      return 1;
+    }
+    *value++ = '\0';
+
+    if (strcmp(term, "rt") == 0) {
+      if (parse_window(value, &q->rt_min, &q->rt_max)) {
+        fprintf(stderr, "Invalid retention time window: %s\n", value);
+        return 1;
+      }
+      q->has_rt = 1;
+    }
+    else if (strcmp(term, "mz") == 0) {
+      if (parse_window(value, &q->mz_min, &q->mz_max)) {
+        fprintf(stderr, "Invalid precursor m/z window: %s\n", value);
+        return 1;
+      }
+      q->has_mz = 1;
+    }
+    else if (strcmp(term, "ms") == 0) {
+      if (strcmp(value, "n") == 0)
+        q->ms_level = -1;
+      else if ((q->ms_level = atol(value)) <= 0) {
+        fprintf(stderr, "Invalid ms level: %s\n", value);
+        return 1;
+      }
+    }
+    else if (strcmp(term, "scans") == 0)
+      q->scans = string_to_array(value, &q->scans_length);
+    else {
+      fprintf(stderr, "Unknown query term: %s\n", term);
+      return 1;
+    }
+  }
+
+  free(str);
+  args->query = q;
+  return 0;
+}
+
 void set_compress_runtime_variables(struct Arguments* args, data_format_t* df)
 {
   int mz_fmt = get_algo_type(args->mz_lossy);
   int inten_fmt = get_algo_type(args->int_lossy);
 
+  df->mz_algo = mz_fmt;
+  df->inten_algo = inten_fmt;
+
   // Set target compression functions.
   df->target_mz_fun    = set_compress_algo(mz_fmt, df->source_mz_fmt);
   df->target_inten_fun = set_compress_algo(inten_fmt, df->source_inten_fmt);
   
   // Set decoding function based on source compression format.
   df->decode_source_compression_mz_fun    = set_decode_fun(df->source_compression, mz_fmt, df->source_mz_fmt);
-  df->decode_source_compression_inten_fun = set_decode_fun(df->source_compression, inten_fmt, df->source_inten_fmt);
+  df->decode_source_compression_inten_fun = set_decode_fun(df->source_inten_compression, inten_fmt, df->source_inten_fmt);
 
   // Set target formats.
   df->target_xml_format   = args->target_xml_format;
@@ -180,9 +324,12 @@ void set_compress_runtime_variables(struct Arguments* args, data_format_t* df)
 
 void set_decompress_runtime_variables(struct Arguments* args, data_format_t* df, footer_t* msz_footer)
 {
+  df->mz_algo = msz_footer->mz_fmt;
+  df->inten_algo = msz_footer->inten_fmt;
+
   // Set target encoding and decompression functions.
   df->encode_source_compression_mz_fun    = set_encode_fun(df->source_compression, msz_footer->mz_fmt, df->source_mz_fmt);
-  df->encode_source_compression_inten_fun = set_encode_fun(df->source_compression, msz_footer->inten_fmt, df->source_mz_fmt);
+  df->encode_source_compression_inten_fun = set_encode_fun(df->source_inten_compression, msz_footer->inten_fmt, df->source_inten_fmt);
 
   df->target_mz_fun    = set_decompress_algo(msz_footer->mz_fmt, df->source_mz_fmt);
   df->target_inten_fun = set_decompress_algo(msz_footer->inten_fmt, df->source_inten_fmt);
@@ -192,5 +339,9 @@ void set_decompress_runtime_variables(struct Arguments* args, data_format_t* df,
   df->mz_decompression_fun    = set_decompress_fun(df->target_mz_format);
   df->inten_decompression_fun = set_decompress_fun(df->target_inten_format);
 
+  // Set deflate parameters used to restore zlib encoded binaries.
+  df->zlib_compression_level = args->zlib_compression_level;
+  df->zlib_strategy = args->zlib_strategy;
+
   return;
 }
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mscompress.h"
+
+/*
+    Integrity checksum of the original mzML (-c/--checksum).
+
+    Divisions are consecutive ranges of the mzML. Each division is hashed with XXH64 by the worker compressing
+    its XML, and by the worker decompressing it, so hashing runs in parallel without another pass over the file.
+    The checksum of the file is the XXH64 of the table of division checksums (offset, length, hash), stored in
+    the header; the table itself is written after the metadata table and located by the footer.
+*/
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t
+read64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = ROTL64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t
+xxh64(const void* src, size_t len, uint64_t seed)
+/**
+ * @brief XXH64 hash of len bytes of src.
+ */
+{
+    const uint8_t* p = (const uint8_t*)src;
+    const uint8_t* end = p + len;
+    uint64_t h;
+
+    if(len >= 32)
+    {
+        const uint8_t* limit = end - 32;
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+
+        do
+        {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while(p <= limit);
+
+        h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    }
+    else
+        h = seed + XXH_PRIME64_5;
+
+    h += (uint64_t)len;
+
+    for(; p + 8 <= end; p += 8)
+    {
+        h ^= xxh64_round(0, read64(p));
+        h = ROTL64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if(p + 4 <= end)
+    {
+        h ^= (uint64_t)read32(p) * XXH_PRIME64_1;
+        h = ROTL64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for(; p < end; p++)
+    {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = ROTL64(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+checksum_t*
+alloc_checksums(divisions_t* divisions, size_t filesize)
+/**
+ * @brief Allocates the checksum table of divisions, with the offset and length of each division in the mzML.
+ *        The hashes are filled in by the compression workers (see compress_routine).
+ *
+ * @return The table, or NULL if the divisions do not cover the file one after another (e.g. an extraction).
+ */
+{
+    uint64_t offset = 0;
+    int i;
+
+    checksum_t* r = calloc(divisions->n_divisions, sizeof(checksum_t));
+    if(r == NULL)
+        error("alloc_checksums: failed to allocate memory.\n");
+
+    for(i = 0; i < divisions->n_divisions; i++)
+    {
+        r[i].offset = offset;
+        r[i].length = divisions->divisions[i]->size;
+        offset += r[i].length;
+    }
+
+    if(offset != filesize)
+    {
+        free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+void
+format_checksum(checksum_t* checksums, int n, char* dest)
+/**
+ * @brief Writes the checksum of the file, the XXH64 of the checksum table, to dest as stored in the header:
+ *        16 hex digits padded with 'x' to CHECKSUM_SIZE bytes.
+ */
+{
+    char hex[17];
+
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)xxh64(checksums, n * sizeof(checksum_t), 0));
+    memset(dest, 'x', CHECKSUM_SIZE);
+    memcpy(dest, hex, 16);
+}
+
+void
+write_checksums(checksum_t* checksums, int n, int fd)
+/**
+ * @brief Writes the checksum table: the number of divisions followed by a checksum_t per division.
+ */
+{
+    uint64_t count = (uint64_t)n;
+
+    write_to_file(fd, (char*)&count, sizeof(count));
+    write_to_file(fd, (char*)checksums, n * sizeof(checksum_t));
+}
+
+checksum_t*
+read_checksums(void* input_map, footer_t* footer)
+/**
+ * @brief Maps the checksum table of an msz file and checks it against the checksum stored in the header.
+ *
+ * @return Pointer to footer->n_divisions checksum_t within input_map, NULL if the file has no checksums.
+ */
+{
+    char expected[CHECKSUM_SIZE];
+    uint64_t count;
+
+    if(footer->checksum_pos == 0)
+        return NULL;
+
+    memcpy(&count, (char*)input_map + footer->checksum_pos, sizeof(count));
+    if(count != (uint64_t)footer->n_divisions)
+        error("read_checksums: checksum table holds %lu divisions, footer %d.\n", count, footer->n_divisions);
+
+    checksum_t* r = (checksum_t*)((char*)input_map + footer->checksum_pos + sizeof(count));
+
+    format_checksum(r, footer->n_divisions, expected);
+    if(memcmp(expected, (char*)input_map + CHECKSUM_OFFSET, CHECKSUM_SIZE) != 0)
+        error("read_checksums: checksum table does not match the checksum in the header.\n");
+
+    return r;
+}
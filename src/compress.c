@@ -244,7 +244,7 @@ append_mem(data_block_t* data_block, char* mem, size_t buff_len)
 }
 
 compress_args_t*
-alloc_compress_args(char* input_map, data_positions_t* dp, data_format_t* df, compression_fun comp_fun, size_t cmp_blk_size, long blocksize, int mode)
+alloc_compress_args(char* input_map, data_positions_t* dp, data_positions_t* paired_dp, data_format_t* df, compression_fun comp_fun, size_t cmp_blk_size, long blocksize, int mode, int array)
 {
 /**
  * @brief Allocates and initializes a compress_args_t struct to be passed to compress_routine.
@@ -253,6 +253,10 @@ alloc_compress_args(char* input_map, data_positions_t* dp, data_format_t* df, co
  * 
  * @param dp  
  * 
+ * @param paired_dp Intensity positions of the same division when compressing m/z (see algo_decode_sparse). NULL otherwise.
+ * 
+ * @param array Index of the extra array when mode is _extra_, of the chromatogram array when _chrom_.
+ * 
  */
 
     compress_args_t* r;
@@ -266,11 +270,17 @@ alloc_compress_args(char* input_map, data_positions_t* dp, data_format_t* df, co
 
     r->input_map = input_map;
     r->dp = dp;
+    r->paired_dp = paired_dp;
     r->df = df;
     r->comp_fun = comp_fun;
     r->cmp_blk_size = cmp_blk_size;
     r->blocksize = blocksize;
     r->mode = mode;
+    r->array = array;
+    r->checksum = NULL;
+    r->arena = NULL;
+    r->ring = NULL;
+    r->division = 0;
 
     r->ret = NULL;
 
@@ -418,41 +428,86 @@ write_cmp_blk(cmp_block_t* blk, int fd)
 }
 
 void
-cmp_dump(cmp_blk_queue_t* cmp_buff,
-         block_len_queue_t* blk_len_queue,
+cmp_dump(cmp_block_t* blk,
+         toc_entry_t* entry,
          int fd)
 /**
- * @brief Pops cmp_block_t from queue, appends block_len to block_len_queue, and writes cmp_block_t to file.
+ * @brief Records the cmp_block_t of a division in its table of contents entry, writes it to file and deallocates it.
  *        Write to disk is timed to display write speed.
  * 
- * @param cmp_buff A cmp_blk_queue_t to pop from.
+ * @param blk Compressed block of the division. NULL if it has none.
  * 
- * @param blk_len_queue A block_len_queue_t to append a block_len_t to.
+ * @param entry The toc_entry_t of the division in the stream.
  * 
- * @param fd File descriptor to write cmp_blk to.
+ * @param fd File descriptor to write blk to.
  */
 {
-    cmp_block_t* front;
     double start, end;
 
-    if(cmp_buff == NULL) return; // Nothing to do.
+    if(blk == NULL) return; // Nothing to do.
 
-    while(cmp_buff->populated > 0)
-    {
-        front = pop_cmp_block(cmp_buff);
+    entry->offset = get_offset(fd);
+    entry->compressed_size = blk->size;
+    entry->original_size = blk->original_size;
+    entry->restored_size = blk->restored_size;
+    entry->hash = blk->hash;
+
+    start = get_time();
+    write_cmp_blk(blk, fd);
+    end = get_time();
+
+    print("\tWrote %ld bytes to disk (%1.2fmb/s)\n", blk->size, ((double)blk->size/1000000)/(end-start));
 
-        append_block_len(blk_len_queue, front->original_size, front->size);
+    dealloc_cmp_block(blk);
+}
+
+typedef struct
+{
+    block_ring_t* ring;
+    toc_entry_t* toc;
+    int divisions;
+    int fd;
+} cmp_writer_args_t;
+
+static void
+cmp_writer_routine(void* args)
+/**
+ * @brief Writer thread of compress_parallel. Takes the blocks the workers hand over through the ring,
+ *        in any order, and writes them to fd in division order.
+ */
+{
+    cmp_writer_args_t* w_args = (cmp_writer_args_t*)args;
+    cmp_block_t** pending = calloc(w_args->divisions, sizeof(cmp_block_t*));
+    char* arrived = calloc(w_args->divisions, 1);
+    int next = 0;
 
-        start = get_time();
-        write_cmp_blk(front, fd);
-        end = get_time();
+    if(pending == NULL || arrived == NULL)
+        error("cmp_writer_routine: malloc() error.\n");
 
-        print("\tWrote %ld bytes to disk (%1.2fmb/s)\n", front->size, ((double)front->size/1000000)/(end-start));
+    while(next < w_args->divisions)
+    {
+        ring_desc_t desc = ring_pop(w_args->ring);
+        pending[desc.index] = (cmp_block_t*)desc.data;
+        arrived[desc.index] = 1;
 
-        dealloc_cmp_block(front);
+        for(; next < w_args->divisions && arrived[next]; next++)
+        {
+            cmp_dump(pending[next], &w_args->toc[next], w_args->fd);
+            ring_done(w_args->ring);
+        }
     }
+
+    free(pending);
+    free(arrived);
 }
 
+#ifdef _WIN32
+DWORD WINAPI cmp_writer_routine_win(LPVOID lpParam) {
+    cmp_writer_routine(lpParam);
+    return 0;
+}
+#endif
+
 
 typedef void (*cmp_routine_func)(ZSTD_CCtx*, algo_args*, cmp_blk_queue_t*, data_block_t**, data_format_t*, char*, size_t, size_t*, size_t*);
 typedef cmp_routine_func (*cmp_routine_func_ptr)();
@@ -515,10 +570,8 @@ cmp_binary_routine(
     a_args->src_len = len;    
     a_args->dest = &binary_buff;
     a_args->dest_len = &binary_len;
-    a_args->src_format = df->source_mz_fmt; //TODO: This is a hack. Need to fix.
-
-    df->target_mz_fun((void*)a_args); //TODO: This is a hack. Need to fix.
 
+    a_args->target_fun((void*)a_args);
 
     if(binary_buff == NULL)
         error("cmp_binary_routine: binary_buff is NULL\n");
@@ -533,16 +586,131 @@ cmp_binary_routine(
                 binary_len,
                 tot_size, tot_cmp);
                 
-    free(binary_buff);
+    scratch_free(binary_buff);
 }
 
-#ifdef _WIN32
-DWORD WINAPI compress_routine_win(LPVOID lpParam) {
-    compress_args_t* args = (compress_args_t*)lpParam;
-    compress_routine(args);
-    return 0;
+static void
+set_binary_format(algo_args* a_args, data_format_t* df, int mode, int array, uint8_t desc, z_stream* deflate_z, size_t* format_size)
+/**
+ * @brief Points a_args to the decoding function and transform of a binary of the m/z (mode _mass_),
+ *        intensity, extra array array (mode _extra_) or chromatogram array array (mode _chrom_) with source
+ *        format desc (BINARY_DESC, 0 for the defaults of the array). Extra and chromatogram arrays are stored losslessly.
+ * 
+ * @param deflate_z z_stream used to find the deflate parameters of zlib binaries.
+ * 
+ * @param format_size Set to the size of one element of the binary.
+ */
+{
+    int algo, fmt, comp;
+
+    if(mode == _mass_)
+    {
+        algo = df->mz_algo;
+        fmt = df->source_mz_fmt;
+        comp = df->source_compression;
+    }
+    else if(mode == _intensity_)
+    {
+        algo = df->inten_algo;
+        fmt = df->source_inten_fmt;
+        comp = df->source_inten_compression;
+    }
+    else if(mode == _extra_)
+    {
+        algo = _lossless_;
+        fmt = df->extra_fmts[array];
+        comp = df->extra_compressions[array];
+    }
+    else
+    {
+        algo = _lossless_;
+        fmt = df->chrom_fmts[array];
+        comp = df->chrom_compressions[array];
+    }
+    if(desc != 0)
+    {
+        fmt = BINARY_DESC_FMT(desc);
+        comp = BINARY_DESC_COMP(desc);
+    }
+
+    a_args->src_format = fmt;
+    a_args->source_compression = comp;
+    a_args->dec_fun = set_decode_fun(comp, algo, fmt);
+    a_args->target_fun = set_compress_algo(algo, fmt);
+    a_args->deflate_z = (comp == _zlib_) ? deflate_z : NULL;
+    *format_size = get_format_size(fmt);
+}
+
+static void
+set_paired_format(algo_args* a_args, data_format_t* df, uint8_t desc)
+/**
+ * @brief Points a_args to the decoding function of the paired intensity binary with source format desc.
+ */
+{
+    a_args->paired_format = desc ? BINARY_DESC_FMT(desc) : df->source_inten_fmt;
+    a_args->paired_compression = desc ? BINARY_DESC_COMP(desc) : df->source_inten_compression;
+    a_args->paired_dec_fun = set_decode_fun(a_args->paired_compression, _sparse_, a_args->paired_format);
+}
+
+static void
+staging_sizes(data_positions_t* dp, size_t* total, size_t* largest)
+/**
+ * @brief Sizes of the source segments of a division: their sum, which the staged block starts at,
+ *        and the largest, which a_args->tmp starts at. Both grow if decoding needs more.
+ */
+{
+    *total = 0;
+    *largest = 0;
+
+    for(long i = 0; i < dp->total_spec; i++)
+    {
+        size_t len = (dp->end_positions[i] > dp->start_positions[i]) ? dp->end_positions[i] - dp->start_positions[i] : 0;
+        *total += len;
+        if(len > *largest)
+            *largest = len;
+    }
+
+    if(*total == 0)
+        *total = 1;
+    if(*largest == 0)
+        *largest = 1;
+}
+
+static long
+compress_cost(data_positions_t* dp)
+/**
+ * @brief Estimated memory of compressing a division of a stream (see budget_batch): its staged and compressed
+ *        blocks, the temporary block, and the fixed memory of a worker.
+ */
+{
+    size_t total, largest, decoded = 0;
+
+    staging_sizes(dp, &total, &largest);
+
+    // zlib sources inflate to their array lengths, at most 8 bytes an element.
+    if(dp->array_lengths != NULL)
+        for(long i = 0; i < dp->total_spec; i++)
+            decoded += (size_t)dp->array_lengths[i] * 8;
+    if(decoded < total)
+        decoded = total;
+
+    return (long)(2 * decoded + largest) + WORKER_MEMORY;
+}
+
+static size_t
+restored_length(algo_args* a_args, int algo, size_t len)
+/**
+ * @brief Length of the text a binary of len bytes is restored to on decompression. Exact if the transform restores
+ *        the binary (len), or if the source is not deflated, as its array is then base64 encoded to its source length.
+ *        A lossy transform of a zlib binary is deflated anew: bounded by the base64 of the deflate bound of its
+ *        array, as inflated by the transform (a_args->decoded_len).
+ */
+{
+    if(is_lossless_algo(algo) || a_args->source_compression != _zlib_)
+        return len;
+
+    return 4 * ((compressBound(a_args->decoded_len) + 2) / 3);
 }
-#endif
 
 void
 compress_routine(void* args)
@@ -557,49 +725,88 @@ compress_routine(void* args)
 {
     int tid = get_thread_id();
 
-    ZSTD_CCtx* czstd = alloc_cctx();
-
     compress_args_t* cb_args = (compress_args_t*)args;
-    algo_args* a_args = malloc(sizeof(algo_args));
-    a_args->tmp = alloc_data_block(cb_args->blocksize); // Allocate a temporary data_block to intermediately store data.
-    a_args->z = alloc_z_stream(); // Allocate a z_stream to intermediately store data.
 
     if(cb_args == NULL)
         error("compress_routine: Invalid compress_args_t\n");
 
+    if(cb_args->checksum != NULL) // Hash the division while its pages are mapped in by this pass
+        cb_args->checksum->hash = xxh64(cb_args->input_map + cb_args->checksum->offset, cb_args->checksum->length, 0);
+
     if(cb_args->dp->total_spec == 0) return; // No data to compress.
 
+    ZSTD_CCtx* czstd = alloc_cctx();
+
+    set_thread_arena(cb_args->arena);
+
+    size_t staged_size, largest_size;
+    staging_sizes(cb_args->dp, &staged_size, &largest_size);
+
+    algo_args* a_args = scratch_alloc(sizeof(algo_args));
+    a_args->tmp = alloc_data_block(largest_size); // Allocate a temporary data_block to intermediately store data.
+    a_args->z = alloc_inflate_z_stream(); // Allocate a z_stream to inflate source binaries.
+    a_args->expected_len = 0;
+    a_args->deflate_z = NULL;
+    a_args->zlib_params = ZLIB_PARAMS_DEFAULT;
+    a_args->zlib_misses = 0;
+    a_args->max_error = -1;
+    a_args->paired_dec_fun = NULL;
+    a_args->paired_src = NULL;
+    a_args->paired_src_len = 0;
+    a_args->paired_expected_len = 0;
+    a_args->grid = NULL;
+
     cmp_blk_queue_t* cmp_buff = alloc_cmp_buff();
-    data_block_t* curr_block = alloc_data_block(cb_args->blocksize); // Allocate a data_block to store data.
+    data_block_t* curr_block = alloc_data_block(staged_size); // Allocate a data_block to store data.
 
 
     size_t len = 0;
     size_t tot_size = 0;
     size_t tot_cmp = 0;
+    size_t restored = 0;
 
     int i = 0;
 
     cmp_routine_func_ptr cmp_fun = NULL;
+
+    size_t format_size = 0; // Size of one element of the source binaries, used to size inflate buffers exactly.
+    z_stream* deflate_z = NULL; // z_stream to search for the deflate parameters of zlib source binaries.
+    data_positions_t* paired_dp = cb_args->paired_dp;
+    uint8_t desc = 0, paired_desc = 0; // source formats (BINARY_DESC) a_args is currently set to.
     
     if(cb_args->mode == _xml_)
         cmp_fun = cmp_xml_routine;
     else
         cmp_fun = cmp_binary_routine;
 
+    int algo = _lossless_; // Extra and chromatogram arrays are stored losslessly.
+
     if(cb_args->mode == _mass_)
     {
-        a_args->dec_fun = cb_args->df->decode_source_compression_mz_fun;
         a_args->scale_factor = cb_args->df->mz_scale_factor;
+        algo = cb_args->df->mz_algo;
     }
     else if(cb_args->mode == _intensity_)
     {
-        a_args->dec_fun = cb_args->df->decode_source_compression_inten_fun;
         a_args->scale_factor = cb_args->df->int_scale_factor;
+        algo = cb_args->df->inten_algo;
     }
+    else if(cb_args->mode == _extra_ || cb_args->mode == _chrom_)
+        a_args->scale_factor = 0;
     else if(cb_args->mode == _xml_)
         a_args->dec_fun = NULL;
     else
         error("compress_routine: Invalid mode. Mode: %d\n", cb_args->mode);
+
+    if(cb_args->mode != _xml_)
+    {
+        deflate_z = alloc_z_stream();
+        set_binary_format(a_args, cb_args->df, cb_args->mode, cb_args->array, desc, deflate_z, &format_size);
+        if(paired_dp != NULL) // Paired intensity binaries, used by the sparse transform.
+            set_paired_format(a_args, cb_args->df, paired_desc);
+    }
+
+    arena_mark_t spectrum_mark = arena_mark(cb_args->arena); // Scratch memory of a binary is reclaimed after it.
     
     for(; i < cb_args->dp->total_spec; i++)
     {
@@ -616,66 +823,177 @@ compress_routine(void* args)
 
         if(len == 0) continue; // Skip empty data blocks (e.g. empty spectra)
 
+        if(cb_args->dp->formats != NULL && cb_args->dp->formats[i] != desc)
+        {
+            desc = cb_args->dp->formats[i];
+            set_binary_format(a_args, cb_args->df, cb_args->mode, cb_args->array, desc, deflate_z, &format_size);
+        }
+
+        if(cb_args->dp->array_lengths != NULL)
+            a_args->expected_len = cb_args->dp->array_lengths[i] * format_size;
+
+        if(paired_dp != NULL)
+        {
+            if(paired_dp->formats != NULL && paired_dp->formats[i] != paired_desc)
+            {
+                paired_desc = paired_dp->formats[i];
+                set_paired_format(a_args, cb_args->df, paired_desc);
+            }
+            a_args->paired_src_len = paired_dp->end_positions[i] - paired_dp->start_positions[i];
+            a_args->paired_src = (a_args->paired_src_len > 0) ? cb_args->input_map + paired_dp->start_positions[i] : NULL;
+            if(paired_dp->array_lengths != NULL)
+                a_args->paired_expected_len = paired_dp->array_lengths[i] * get_format_size(a_args->paired_format);
+        }
+
         cmp_fun(cb_args->comp_fun, czstd, a_args, cmp_buff, &curr_block, cb_args->df, 
                     map,
                     len, &tot_size, &tot_cmp);
+
+        restored += (cb_args->mode == _xml_) ? len : restored_length(a_args, algo, len);
+
+        arena_reset(cb_args->arena, spectrum_mark);
     }
 
     cmp_flush(cb_args->comp_fun, czstd, cb_args->df->zstd_compression_level, cmp_buff, &curr_block, &tot_size, &tot_cmp); /* Flush remainder datablocks */
+    cmp_buff->tail->restored_size = restored;
 
     print("\tThread %03d: Input size: %ld bytes. Compressed size: %ld bytes. (%1.2f%%)\n", tid, tot_size, tot_cmp, (double)tot_size/tot_cmp);
 
+    if(a_args->max_error >= 0)
+        print("\tThread %03d: Max error: %g (bound: %g)\n", tid, a_args->max_error, a_args->scale_factor);
+
     /* Cleanup (curr_block already freed by cmp_flush) */
     dealloc_cctx(czstd);
     dealloc_data_block(a_args->tmp);
-    dealloc_z_stream(a_args->z);
+    dealloc_inflate_z_stream(a_args->z);
+    if(deflate_z != NULL)
+        dealloc_z_stream(deflate_z);
+    dealloc_grid_refs(a_args->grid);
+    scratch_free(a_args);
+
+    arena_reset(cb_args->arena, (arena_mark_t){NULL, 0});
+    set_thread_arena(NULL);
 
     cb_args->ret = cmp_buff;
 }
 
-block_len_queue_t*
+static void
+compress_worker(void* args)
+/**
+ * @brief Worker thread of compress_parallel. Compresses a division and hands its block to the writer.
+ */
+{
+    compress_args_t* cb_args = (compress_args_t*)args;
+    cmp_block_t* blk = NULL;
+
+    compress_routine(cb_args);
+
+    if(cb_args->ret != NULL)
+    {
+        if(cb_args->ret->populated > 1)
+            error("compress_worker: %d blocks in a division, expected one.\n", cb_args->ret->populated);
+        blk = pop_cmp_block(cb_args->ret);
+    }
+
+    ring_push(cb_args->ring, cb_args->division, blk);
+}
+
+#ifdef _WIN32
+DWORD WINAPI compress_worker_win(LPVOID lpParam) {
+    compress_worker(lpParam);
+    return 0;
+}
+#endif
+
+void
 compress_parallel(char* input_map,
     data_positions_t** ddp,
+    data_positions_t** paired_ddp,
     data_format_t* df,
     compression_fun comp_fun,
-    size_t cmp_blk_size, long blocksize, int mode,
+    size_t cmp_blk_size, long blocksize, int mode, int array,
+    toc_entry_t* toc, uint32_t stream, uint32_t codec,
+    checksum_t* checksums,
     int divisions, int threads, int fd)
+/**
+ * @brief Compresses one stream of every division, up to threads divisions at a time within max_memory.
+ *        A writer thread writes the blocks to fd in division order while the next divisions are compressed.
+ *
+ * @param toc Table of contents entries of the stream, one per division, filled in with the blocks written.
+ *
+ * @param stream, codec Stream (TOC_XML, ...) and compression accession recorded in the entries.
+ *
+ * @param checksums Checksum table of the divisions (see alloc_checksums) to be hashed by the workers. NULL otherwise.
+ */
 {
-    block_len_queue_t* blk_len_queue;
     compress_args_t** args = malloc(sizeof(compress_args_t*) * divisions);
+    long* costs = malloc(sizeof(long) * divisions);
 
     #ifdef _WIN32
     HANDLE* ptid = malloc(sizeof(HANDLE) * divisions);
+    HANDLE writer;
     #else
     pthread_t* ptid = malloc(sizeof(pthread_t) * divisions);
+    pthread_t writer;
     #endif
 
     int i = 0;
 
-    blk_len_queue = alloc_block_len_queue();
-
     int divisions_used = 0;
     int divisions_left = divisions;
+    int batch = 0;
+
+    arena_t** arenas = get_arenas(threads); // One per worker of a batch
 
     for (i = divisions_used; i < divisions; i++)
-        args[i] = alloc_compress_args(input_map, ddp[i], df, comp_fun, cmp_blk_size, blocksize, mode);
+    {
+        args[i] = alloc_compress_args(input_map, ddp[i], paired_ddp ? paired_ddp[i] : NULL, df, comp_fun, cmp_blk_size, blocksize, mode, array);
+        args[i]->checksum = checksums ? &checksums[i] : NULL;
+        costs[i] = compress_cost(ddp[i]);
+        toc[i].stream = stream;
+        toc[i].codec = codec;
+    }
+
+    // Blocks go from the workers to the writer through a ring of one slot per worker.
+    block_ring_t* ring = alloc_ring(threads);
+    cmp_writer_args_t writer_args = {ring, toc, divisions, fd};
+
+    #ifdef _WIN32
+    writer = CreateThread(NULL, 0, cmp_writer_routine_win, &writer_args, 0, NULL);
+    if (writer == NULL)
+    {
+        perror("CreateThread");
+        exit(-1);
+    }
+    #else
+    if (pthread_create(&writer, NULL, (void*)cmp_writer_routine, (void*)&writer_args) != 0)
+    {
+        perror("pthread_create");
+        exit(-1);
+    }
+    #endif
 
     while (divisions_left > 0)
     {
-        if (divisions_left < threads)
-            threads = divisions_left;
+        batch = budget_batch(costs + divisions_used, divisions_left, threads);
 
-        for (i = divisions_used; i < divisions_used + threads; i++)
+        if (max_memory > 0) // Blocks waiting to be written count against the budget.
+            ring_wait(ring, divisions_used);
+
+        for (i = divisions_used; i < divisions_used + batch; i++)
         {
+            args[i]->arena = arenas[i - divisions_used];
+            args[i]->ring = ring;
+            args[i]->division = i;
             #ifdef _WIN32
-            ptid[i] = CreateThread(NULL, 0, compress_routine_win, args[i], 0, NULL);
+            ptid[i] = CreateThread(NULL, 0, compress_worker_win, args[i], 0, NULL);
             if (ptid[i] == NULL)
             {
                 perror("CreateThread");
                 exit(-1);
             }
             #else
-            int ret = pthread_create(&ptid[i], NULL, compress_routine, (void*)args[i]);
+            int ret = pthread_create(&ptid[i], NULL, (void*)compress_worker, (void*)args[i]);
             if (ret != 0)
             {
                 perror("pthread_create");
@@ -685,9 +1003,9 @@ compress_parallel(char* input_map,
         }
 
         #ifdef _WIN32
-        WaitForMultipleObjects(threads, ptid + divisions_used, TRUE, INFINITE);
+        WaitForMultipleObjects(batch, ptid + divisions_used, TRUE, INFINITE);
         #else
-        for (i = divisions_used; i < divisions_used + threads; i++)
+        for (i = divisions_used; i < divisions_used + batch; i++)
         {
             int ret = pthread_join(ptid[i], NULL);
             if (ret != 0)
@@ -698,15 +1016,28 @@ compress_parallel(char* input_map,
         }
         #endif
 
-        for (i = divisions_used; i < divisions_used + threads; i++)
-        {
-            cmp_dump(args[i]->ret, blk_len_queue, fd);
-            dealloc_compress_args(args[i]);
-        }
-        divisions_used += threads;
-        divisions_left -= threads;
+        for (i = divisions_used; i < divisions_used + batch; i++)
+            dealloc_compress_args(args[i]); // Blocks were handed to the writer.
+
+        divisions_used += batch;
+        divisions_left -= batch;
     }
-    return blk_len_queue;
+
+    #ifdef _WIN32
+    WaitForSingleObject(writer, INFINITE);
+    CloseHandle(writer);
+    #else
+    if (pthread_join(writer, NULL) != 0)
+    {
+        perror("pthread_join");
+        exit(-1);
+    }
+    #endif
+
+    dealloc_ring(ring);
+    free(args);
+    free(costs);
+    free(ptid);
 }
 
 void 
@@ -720,8 +1051,6 @@ compress_mzml(char* input_map,
     // Initialize footer to all 0's to not write garbage to file.
     footer_t* footer = calloc(1, sizeof(footer_t));   
 
-    block_len_queue_t *xml_block_lens, *mz_binary_block_lens, *inten_binary_block_lens;
-
     data_positions_t **xml_divisions = join_xml(divisions),
                      **mz_divisions  = join_mz(divisions),
                      **inten_divisions = join_inten(divisions); 
@@ -739,42 +1068,98 @@ compress_mzml(char* input_map,
     long blocksize = arguments->blocksize;
     int threads = arguments->threads;
 
-    //Write df header to file.
+    //Write df header to file. The checksum is filled in once the divisions are hashed.
     write_header(fds[1], df, blocksize, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
 
+    checksum_t* checksums = NULL;
+    if(arguments->checksum)
+    {
+        // The checksum covers the mzML, lossy transforms do not restore it.
+        if(!is_lossless_algo(footer->mz_fmt) || !is_lossless_algo(footer->inten_fmt))
+            warning("Lossy transforms do not restore the input file, no checksum written.\n");
+        else if((checksums = alloc_checksums(divisions, input_filesize)) == NULL)
+            warning("Divisions do not cover the input file, no checksum written.\n");
+    }
+
+    // One table of contents entry per stream and division: xml, m/z, intensity, extra arrays, chromatogram arrays
+    int n_divisions = divisions->n_divisions;
+    footer->n_extra_arrays = df->n_extra_arrays;
+    footer->n_chrom_arrays = (df->chrom_fmts[0] != 0) ? CHROM_ARRAYS : 0;
+    int n_streams = 3 + footer->n_extra_arrays + footer->n_chrom_arrays;
+    toc_entry_t* toc = alloc_toc(divisions, n_streams);
+    toc_entry_t* toc_stream = toc;
+
     print("\nDecoding and compression...\n");
 
     print("\t===XML===\n");
     footer->xml_pos = get_offset(output_fd);
-    xml_block_lens = compress_parallel((char*)input_map, xml_divisions, df, df->xml_compression_fun, blocksize, blocksize/3, _xml_, divisions->n_divisions, threads, output_fd);  /* Compress XML */
+    compress_parallel((char*)input_map, xml_divisions, NULL, df, df->xml_compression_fun, blocksize, blocksize/3, _xml_, 0,
+                      toc_stream, TOC_XML, df->target_xml_format, checksums, n_divisions, threads, output_fd);  /* Compress XML */
+    toc_stream += n_divisions;
     free(xml_divisions);
 
     print("\t===m/z binary===\n");
     footer->mz_binary_pos = get_offset(output_fd);
-    df->target_mz_fun = set_compress_algo(footer->mz_fmt, df->source_mz_fmt); //TODO, rename target_mz_fun
-    mz_binary_block_lens = compress_parallel((char*)input_map, mz_divisions, df, df->mz_compression_fun, blocksize, blocksize/3, _mass_, divisions->n_divisions, threads, output_fd); /* Compress m/z binary */
+    compress_parallel((char*)input_map, mz_divisions, inten_divisions, df, df->mz_compression_fun, blocksize, blocksize/3, _mass_, 0,
+                      toc_stream, TOC_MZ, df->target_mz_format, NULL, n_divisions, threads, output_fd); /* Compress m/z binary */
+    toc_stream += n_divisions;
     free(mz_divisions);
 
     print("\t===int binary===\n");
     footer->inten_binary_pos = get_offset(output_fd);
-    df->target_mz_fun = set_compress_algo(footer->inten_fmt, df->source_mz_fmt);//TODO, rename target_mz_fun
-    inten_binary_block_lens = compress_parallel((char*)input_map, inten_divisions, df, df->inten_compression_fun, blocksize, blocksize/3, _intensity_, divisions->n_divisions, threads, output_fd); /* Compress int binary */
+    compress_parallel((char*)input_map, inten_divisions, NULL, df, df->inten_compression_fun, blocksize, blocksize/3, _intensity_, 0,
+                      toc_stream, TOC_INTEN, df->target_inten_format, NULL, n_divisions, threads, output_fd); /* Compress int binary */
+    toc_stream += n_divisions;
     free(inten_divisions);
 
-    // Dump block_len_queue to msz file.
-    footer->xml_blk_pos = get_offset(output_fd);
-    dump_block_len_queue(xml_block_lens, output_fd);
+    // Binary arrays beyond m/z and intensity, each in its own stream
+    for(uint32_t k = 0; k < df->n_extra_arrays; k++)
+    {
+        data_positions_t** extra_divisions = join_extra(divisions, k);
+        print("\t===extra binary %u (MS:%07d)===\n", k, df->extra_types[k]);
+        footer->extra_binary_pos[k] = get_offset(output_fd);
+        compress_parallel((char*)input_map, extra_divisions, NULL, df, df->inten_compression_fun, blocksize, blocksize/3, _extra_, k,
+                          toc_stream, TOC_EXTRA + k, df->target_inten_format, NULL, n_divisions, threads, output_fd); /* Compress extra binary */
+        toc_stream += n_divisions;
+        free(extra_divisions);
+    }
 
-    footer->mz_binary_blk_pos = get_offset(output_fd);
-    dump_block_len_queue(mz_binary_block_lens, output_fd);
+    // Time and intensity arrays of the chromatograms, each in its own stream
+    for(int k = 0; k < footer->n_chrom_arrays; k++)
+    {
+        data_positions_t** chrom_divisions = join_chrom(divisions, k);
+        print("\t===chromatogram %s binary===\n", (k == 0) ? "time" : "int");
+        footer->chrom_binary_pos[k] = get_offset(output_fd);
+        compress_parallel((char*)input_map, chrom_divisions, NULL, df, df->inten_compression_fun, blocksize, blocksize/3, _chrom_, k,
+                          toc_stream, TOC_CHROM + k, df->target_inten_format, NULL, n_divisions, threads, output_fd); /* Compress chromatogram binary */
+        toc_stream += n_divisions;
+        free(chrom_divisions);
+    }
 
-    footer->inten_binary_blk_pos = get_offset(output_fd);
-    dump_block_len_queue(inten_binary_block_lens, output_fd);
+    // Write table of contents to msz file.
+    footer->toc_pos = write_toc(toc, n_streams, n_divisions, output_fd);
+    free(toc);
 
     // Write divisions to file.
     footer->divisions_t_pos = get_offset(fds[1]);
     write_divisions(divisions, fds[1]);
 
+    // Write spectrum metadata table to file.
+    footer->metadata_pos = get_offset(fds[1]);
+    write_metadata(divisions, df->zstd_compression_level, fds[1]);
+
+    // Write checksum table to file and its checksum to the header.
+    if(checksums != NULL)
+    {
+        char checksum[CHECKSUM_SIZE];
+        footer->checksum_pos = get_offset(fds[1]);
+        write_checksums(checksums, divisions->n_divisions, fds[1]);
+        format_checksum(checksums, divisions->n_divisions, checksum);
+        write_header_checksum(fds[1], checksum);
+        print("\tChecksum: %.16s\n", checksum);
+        free(checksums);
+    }
+
     // Write footer to file.
     footer->original_filesize = input_filesize;
     footer->n_divisions = divisions->n_divisions; // Set number of divisions in footer.                
@@ -782,6 +1167,7 @@ compress_mzml(char* input_map,
     write_footer(footer, fds[1]);
 
     free(footer);
+    dealloc_arenas();
 
     end = get_time();
 
@@ -795,6 +1181,8 @@ set_compress_fun(int accession)
     {
         case _ZSTD_compression_ :       return zstd_compress;
         case _LZ4_compression_ :        return lz4_compress;
+        case _xml_struct_ :             return xml_struct_compress;
+        case _ZSTD_dict_ :              return zstd_dict_compress;
         case _no_comp_ :                return no_compress;
         default :                       error("Compression type not supported.");
     }
@@ -811,4 +1199,6 @@ get_compress_type(char* arg)
         return _LZ4_compression_;
     if(strcmp(arg, "nocomp") == 0 || strcmp(arg, "none") == 0)
         return _no_comp_;
+    if(strcmp(arg, "struct") == 0)
+        return _xml_struct_;
 }
\ No newline at end of file
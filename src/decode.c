@@ -24,7 +24,7 @@ base64_alloc(size_t size)
 {
     char* r;
 
-    r = malloc(sizeof(char) * size);
+    r = scratch_alloc(sizeof(char) * size);
     
     if(r == NULL)
         error("base64_alloc: failed to allocate memory.\n");
@@ -54,13 +54,15 @@ decode_base64(char* src, char* dest, size_t src_len, size_t* out_len)
 }
 
 void
-decode_zlib_fun(z_stream* z, char* src, size_t src_len, char** dest, size_t* out_len, data_block_t* tmp)
+decode_zlib_fun(z_stream* z, char* src, size_t src_len, char** dest, size_t* out_len, data_block_t* tmp, size_t expected_len)
 /**
  * @brief Decodes an mzML binary block with "zlib" encoding.
  *        Decodes base64 string, zlib decodes the string, and appends resulting binary
  *        buffer with the length of the buffer stored within the first ZLIB_SIZE_OFFSET
- *        bytes of the buffer.
- *        Decoded binary data starts at b64_out_buff + ZLIB_SIZE_OFFSET.
+ *        bytes of the buffer, followed by the deflate parameters of the source stream
+ *        (ZLIB_PARAMS_DEFAULT until set by the caller, see zlib_find_params).
+ *        Decoded binary data starts at b64_out_buff + ZLIB_HEADER_SIZE.
+ *        The base64 decoded source stream is left in tmp->mem (tmp->size bytes).
  * 
  * @param input_map Pointer representing mmap'ed mzML file.
  * 
@@ -72,8 +74,11 @@ decode_zlib_fun(z_stream* z, char* src, size_t src_len, char** dest, size_t* out
  * 
  * @param tmp Pointer to data_block_t struct used for temporary storage.
  * 
- * @return A malloc'ed buffer with first ZLIB_SIZE_OFFSET bytes containing length of decoded binary
- *         and resulting decoded binary buffer.
+ * @param expected_len Expected length of the decoded binary in bytes (0 if unknown).
+ *                     Used to size the inflate buffer exactly.
+ * 
+ * @return A malloc'ed buffer with first ZLIB_HEADER_SIZE bytes containing length of decoded binary
+ *         and deflate parameters, and resulting decoded binary buffer.
  */
 {
     if(src == NULL)
@@ -108,23 +113,26 @@ decode_zlib_fun(z_stream* z, char* src, size_t src_len, char** dest, size_t* out
     if (b64_out_buff == NULL)
         error("decode_zlib_fun: base64_decode returned with an error.\n");
 
-    zlib_block_t* decmp_output = zlib_alloc(ZLIB_SIZE_OFFSET);
+    tmp->size = b64_out_len;
+
+    zlib_block_t* decmp_output = zlib_alloc_sized(ZLIB_HEADER_SIZE, expected_len);
 
     ZLIB_TYPE decmp_size = (ZLIB_TYPE)zlib_decompress(z, b64_out_buff, decmp_output, b64_out_len);
 
     zlib_append_header(decmp_output, &decmp_size, ZLIB_SIZE_OFFSET);
+    *(ZLIB_PARAMS_TYPE*)(decmp_output->mem + ZLIB_SIZE_OFFSET) = ZLIB_PARAMS_DEFAULT;
 
     // free(b64_out_buff);
     
-    *out_len = decmp_size + ZLIB_SIZE_OFFSET;
+    *out_len = decmp_size + ZLIB_HEADER_SIZE;
     
     *dest = (char*)decmp_output->mem;
 
-    free(decmp_output);
+    scratch_free(decmp_output);
 }
 
 void
-decode_zlib_fun_no_header(z_stream* z, char* src, size_t src_len, char** dest, size_t* out_len, data_block_t* tmp)
+decode_zlib_fun_no_header(z_stream* z, char* src, size_t src_len, char** dest, size_t* out_len, data_block_t* tmp, size_t expected_len)
 {
 /**
  * @brief Decodes a zlib compressed buffer without header and stores the output in a new buffer.
@@ -138,6 +146,7 @@ decode_zlib_fun_no_header(z_stream* z, char* src, size_t src_len, char** dest, s
  * @param dest Pointer to the destination buffer where the decompressed data will be stored.
  * @param out_len Pointer to a variable where the size of the decompressed data will be stored.
  * @param tmp Pointer to a data_block_t object used as a temporary buffer.
+ * @param expected_len Expected size of the decompressed data in bytes, or 0 if unknown.
  * 
  * @return None.
  *
@@ -172,7 +181,9 @@ decode_zlib_fun_no_header(z_stream* z, char* src, size_t src_len, char** dest, s
     if (b64_out_buff == NULL)
         error("decode_zlib_fun_no_header: base64_decode returned with an error.\n");
 
-    zlib_block_t* decmp_output = zlib_alloc(0);
+    tmp->size = b64_out_len;
+
+    zlib_block_t* decmp_output = zlib_alloc_sized(0, expected_len);
 
     ZLIB_TYPE decmp_size = (ZLIB_TYPE)zlib_decompress(z, b64_out_buff, decmp_output, b64_out_len);
 
@@ -182,11 +193,11 @@ decode_zlib_fun_no_header(z_stream* z, char* src, size_t src_len, char** dest, s
     
     *dest = (char*)decmp_output->mem;
 
-    free(decmp_output);
+    scratch_free(decmp_output);
 }
 
 void
-decode_no_comp_fun_w_header(z_stream* z, char* src, size_t src_len, char** dest, size_t* out_len, data_block_t* tmp)
+decode_no_comp_fun_w_header(z_stream* z, char* src, size_t src_len, char** dest, size_t* out_len, data_block_t* tmp, size_t expected_len)
 /**
  * @brief Decodes an mzML binary block with "no comp" encoding.
  *        Decodes base64 string and appends a binary buffer with the length of the 
@@ -201,6 +212,8 @@ decode_no_comp_fun_w_header(z_stream* z, char* src, size_t src_len, char** dest,
  * 
  * @param out_len Contains resulting buffer size on return.
  * 
+ * @param expected_len Unused: the decoded length follows from src_len.
+ * 
  * @return A malloc'ed buffer with first ZLIB_SIZE_OFFSET bytes containing length of decoded binary
  *         and resulting decoded binary buffer.
  */
@@ -210,6 +223,8 @@ decode_no_comp_fun_w_header(z_stream* z, char* src, size_t src_len, char** dest,
 
     size_t header;
 
+    (void)expected_len;
+
     b64_out_buff = base64_alloc(src_len + ZLIB_SIZE_OFFSET);
 
     decode_base64(src, b64_out_buff + ZLIB_SIZE_OFFSET, src_len, out_len);
@@ -224,11 +239,13 @@ decode_no_comp_fun_w_header(z_stream* z, char* src, size_t src_len, char** dest,
 }
 
 void
-decode_no_comp_fun_no_header(z_stream* z, char* src, size_t src_len, char** dest, size_t* out_len, data_block_t* tmp)
+decode_no_comp_fun_no_header(z_stream* z, char* src, size_t src_len, char** dest, size_t* out_len, data_block_t* tmp, size_t expected_len)
 {
 
     char* b64_out_buff;
 
+    (void)expected_len; // the decoded length follows from src_len
+
     b64_out_buff = base64_alloc(src_len);
 
     decode_base64(src, b64_out_buff, src_len, out_len);
@@ -236,6 +253,31 @@ decode_no_comp_fun_no_header(z_stream* z, char* src, size_t src_len, char** dest
     *dest = b64_out_buff;
 }
 
+size_t
+get_format_size(int accession)
+/**
+ * @brief Returns the size in bytes of a single element of a binary array.
+ * 
+ * @param accession Integer representing accession value of binary data format.
+ * 
+ * @return Size of one element in bytes. 0 if the format is unknown.
+ */
+{
+    switch (accession)
+    {
+    case _16e_:
+        return 2;
+    case _32i_:
+    case _32f_:
+        return 4;
+    case _64i_:
+    case _64d_:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
 decode_fun_ptr
 set_decode_fun(int compression_method, int algo, int accession)
 /**
@@ -252,12 +294,12 @@ set_decode_fun(int compression_method, int algo, int accession)
     switch (compression_method)
     {
     case _zlib_:
-        if(algo == _lossless_ || (algo == _cast_64_to_32_ && accession == _32f_))
+        if(algo == _lossless_ || algo == _sparse_ || algo == _grid_ || (algo == _cast_64_to_32_ && accession == _32f_))
             return decode_zlib_fun;
         else
             return decode_zlib_fun_no_header;
     case _no_comp_:
-        if(algo == _lossless_ || (algo == _cast_64_to_32_ && accession == _32f_))
+        if(algo == _lossless_ || algo == _sparse_ || algo == _grid_ || (algo == _cast_64_to_32_ && accession == _32f_))
             return decode_no_comp_fun_w_header;
         else
             return decode_no_comp_fun_no_header;
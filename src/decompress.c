@@ -109,23 +109,26 @@ no_decompress(ZSTD_DCtx* dctx, void* src_buff, size_t src_len, size_t org_len)
 }
 
 void *
-decmp_block(decompression_fun decompress_fun, ZSTD_DCtx* dctx, void* input_map, long offset, block_len_t* blk)
+decmp_block(decompression_fun decompress_fun, ZSTD_DCtx* dctx, void* input_map, toc_entry_t* blk)
+/**
+ * @brief Checks a block against the hash of its table of contents entry and decompresses it.
+ */
 {
     if(blk == NULL) // Empty block, return null.
         return NULL; 
-    return decompress_fun(dctx, (uint8_t*)input_map+offset, blk->compressed_size, blk->original_size);
+    if(!verify_block(input_map, blk))
+        error("decmp_block: checksum mismatch in block of stream %u division %u (msz bytes %lu-%lu).\n",
+              blk->stream, blk->division, blk->offset, blk->offset + blk->compressed_size);
+    return decompress_fun(dctx, (uint8_t*)input_map+blk->offset, blk->compressed_size, blk->original_size);
 }
 
 decompress_args_t*
 alloc_decompress_args(char* input_map,
                       data_format_t* df,
-                      block_len_t* xml_blk,
-                      block_len_t* mz_binary_blk,
-                      block_len_t* inten_binary_blk,
-                      division_t* division,
-                      uint64_t footer_xml_off,
-                      uint64_t footer_mz_bin_off,
-                      uint64_t footer_inten_bin_off)
+                      toc_entry_t* xml_blk,
+                      toc_entry_t* mz_binary_blk,
+                      toc_entry_t* inten_binary_blk,
+                      division_t* division)
 {
     decompress_args_t* r;
     
@@ -139,12 +142,19 @@ alloc_decompress_args(char* input_map,
     r->mz_binary_blk = mz_binary_blk;
     r->inten_binary_blk = inten_binary_blk;
     r->division = division;
-    r->footer_xml_off = footer_xml_off;
-    r->footer_mz_bin_off = footer_mz_bin_off;
-    r->footer_inten_bin_off = footer_inten_bin_off;
-
+    memset(r->extra_binary_blk, 0, sizeof(r->extra_binary_blk)); // set by prepare_decompress_args
+    memset(r->chrom_binary_blk, 0, sizeof(r->chrom_binary_blk));
+
+    r->checksum = NULL;
+    r->expected = NULL;
+    r->expected_len = 0;
+    r->arena = NULL;
+    r->ring = NULL;
+    r->index = 0;
     r->ret = NULL;
     r->ret_len = 0;
+    r->checksum_ok = 0;
+    r->expected_ok = 0;
 
     return r;
 }
@@ -174,6 +184,105 @@ get_lowest(int i_0, int i_1, int i_2)
     return ret;
 }
 
+static Algo_ptr
+set_binary_format(algo_args* a_args, data_format_t* df, int mode, int array, uint8_t desc)
+/**
+ * @brief Points a_args to the encoding function of a binary of the m/z (mode _mass_), intensity, extra array array
+ *        (mode _extra_) or chromatogram array array (mode _chrom_) with source format desc (BINARY_DESC, 0 for the defaults of the array).
+ * 
+ * @return The transform restoring the binary.
+ */
+{
+    int algo, fmt, comp;
+
+    if(mode == _mass_)
+    {
+        algo = df->mz_algo;
+        fmt = df->source_mz_fmt;
+        comp = df->source_compression;
+    }
+    else if(mode == _intensity_)
+    {
+        algo = df->inten_algo;
+        fmt = df->source_inten_fmt;
+        comp = df->source_inten_compression;
+    }
+    else if(mode == _extra_)
+    {
+        algo = _lossless_;
+        fmt = df->extra_fmts[array];
+        comp = df->extra_compressions[array];
+    }
+    else
+    {
+        algo = _lossless_;
+        fmt = df->chrom_fmts[array];
+        comp = df->chrom_compressions[array];
+    }
+    if(desc != 0)
+    {
+        fmt = BINARY_DESC_FMT(desc);
+        comp = BINARY_DESC_COMP(desc);
+    }
+
+    a_args->src_format = fmt;
+    a_args->source_compression = comp;
+    a_args->enc_fun = set_encode_fun(comp, algo, fmt);
+
+    // Restore the deflate parameters recorded per binary unless overridden by the user.
+    if(comp == _zlib_ && df->zlib_compression_level == ZLIB_AUTO && df->zlib_strategy == ZLIB_AUTO)
+        a_args->zlib_params = ZLIB_AUTO;
+    else
+        a_args->zlib_params = 0;
+
+    return set_decompress_algo(algo, fmt);
+}
+
+static int
+division_blocks(decompress_args_t* args, toc_entry_t** blks)
+/**
+ * @brief Fills blks with the blocks of every stream of a division, NULL where it has none.
+ *
+ * @return Number of entries of blks.
+ */
+{
+    blks[0] = args->xml_blk;
+    blks[1] = args->mz_binary_blk;
+    blks[2] = args->inten_binary_blk;
+    memcpy(blks + 3, args->extra_binary_blk, sizeof(args->extra_binary_blk));
+    memcpy(blks + 3 + MAX_EXTRA_ARRAYS, args->chrom_binary_blk, sizeof(args->chrom_binary_blk));
+
+    return 3 + MAX_EXTRA_ARRAYS + CHROM_ARRAYS;
+}
+
+static int
+zlib_overridden(data_format_t* df)
+{
+    return df->zlib_compression_level != ZLIB_AUTO || df->zlib_strategy != ZLIB_AUTO;
+}
+
+static long
+restored_capacity(decompress_args_t* args)
+/**
+ * @brief Length of the buffer a division is restored to: the sum of the restored lengths of its blocks, exact unless
+ *        lossy binaries are deflated anew (see restored_length). Deflate parameters other than the recorded ones
+ *        change the length of zlib binaries, which is then only estimated at twice the original size of the division.
+ */
+{
+    toc_entry_t* blks[3 + MAX_EXTRA_ARRAYS + CHROM_ARRAYS];
+    long r = 0;
+    int n = division_blocks(args, blks), k;
+
+    if(zlib_overridden(args->df))
+        return args->division->size * 2;
+
+    for(k = 0; k < n; k++)
+        if(blks[k] != NULL)
+            r += blks[k]->restored_size;
+
+    return r;
+}
+
 #ifdef _WIN32
 DWORD WINAPI decompress_routine_win(LPVOID lpParam) {
     decompress_args_t* args = (decompress_args_t*)lpParam;
@@ -196,31 +305,41 @@ decompress_routine(void* args)
         error("decompress_routine: ZSTD Context failed.\n");
 
     decompress_args_t* db_args = (decompress_args_t*)args;
-    division_t* division = db_args->division;
 
     if(db_args == NULL)
         error("decompress_routine: Decompression arguments are null.\n");
 
+    division_t* division = db_args->division;
+
     // Decompress each block of data
     char
-        *decmp_xml = (char*)decmp_block(db_args->df->xml_decompression_fun, dctx, db_args->input_map, db_args->footer_xml_off, db_args->xml_blk),
-        *decmp_mz_binary = (char*)decmp_block(db_args->df->mz_decompression_fun, dctx, db_args->input_map, db_args->footer_mz_bin_off, db_args->mz_binary_blk),
-        *decmp_inten_binary = (char*)decmp_block(db_args->df->inten_decompression_fun, dctx, db_args->input_map, db_args->footer_inten_bin_off, db_args->inten_binary_blk);
+        *decmp_xml = (char*)decmp_block(db_args->df->xml_decompression_fun, dctx, db_args->input_map, db_args->xml_blk),
+        *decmp_mz_binary = (char*)decmp_block(db_args->df->mz_decompression_fun, dctx, db_args->input_map, db_args->mz_binary_blk),
+        *decmp_inten_binary = (char*)decmp_block(db_args->df->inten_decompression_fun, dctx, db_args->input_map, db_args->inten_binary_blk);
+
+    // Binaries numbered as by get_division_array: m/z, intensity, the extra arrays, then the chromatogram arrays
+    int n_arrays = 2 + division->n_extra, array = 0, k;
+    char* decmp_binary[2 + MAX_EXTRA_ARRAYS + CHROM_ARRAYS];
+    int64_t bin_i[2 + MAX_EXTRA_ARRAYS + CHROM_ARRAYS] = {0};
 
-    size_t binary_len = 0;
+    decmp_binary[0] = decmp_mz_binary;
+    decmp_binary[1] = decmp_inten_binary;
+    for(k = 0; k < division->n_extra; k++)
+        decmp_binary[k + 2] = (char*)decmp_block(db_args->df->inten_decompression_fun, dctx, db_args->input_map, db_args->extra_binary_blk[k]);
+    for(k = 0; k < CHROM_ARRAYS; k++)
+        decmp_binary[n_arrays + k] = (char*)decmp_block(db_args->df->inten_decompression_fun, dctx, db_args->input_map, db_args->chrom_binary_blk[k]);
 
-    int64_t buff_off = 0,
-            xml_off = 0, mz_off = 0, inten_off = 0;
-    int64_t xml_i = 0,   mz_i = 0,   inten_i = 0;        
+    char* decmp_blocks[2 + MAX_EXTRA_ARRAYS + CHROM_ARRAYS]; // decmp_binary is advanced as the binaries are encoded
+    memcpy(decmp_blocks, decmp_binary, sizeof(decmp_binary));
 
-    int block = 0;
+    int64_t buff_off = 0, xml_off = 0, xml_i = 0;
 
-    long len = division->size;
+    long len = restored_capacity(db_args);
 
     if(len <= 0)
         error("decompress_routine: Error determining decompression buffer size.\n");
 
-    char* buff = malloc(len*2);
+    char* buff = malloc(len);
 
     if(buff == NULL)
         error("decompress_routine: Failed to allocate buffer for decompression.\n");
@@ -229,108 +348,295 @@ decompress_routine(void* args)
 
     int64_t curr_len = 0;
 
-    algo_args* a_args = malloc(sizeof(algo_args));
+    set_thread_arena(db_args->arena);
 
-    a_args->z = alloc_z_stream();
+    algo_args* a_args = scratch_alloc(sizeof(algo_args));
 
     if(a_args == NULL)
         error("decompress_routine: Failed to allocate algo_args.\n");
 
+    a_args->z = alloc_deflate_z_stream(db_args->df->zlib_compression_level, db_args->df->zlib_strategy);
+
+    if(a_args->z == NULL)
+        error("decompress_routine: Failed to allocate z_stream.\n");
+
+    a_args->grid = NULL;
+
+    Algo_ptr target_fun;
+
     size_t algo_output_len = 0;
     a_args->dest_len = &algo_output_len;
+
+    // Binaries of lossless transforms restore to their source length, unless deflated with other parameters.
+    int lossless_mz = is_lossless_algo(db_args->df->mz_algo), lossless_inten = is_lossless_algo(db_args->df->inten_algo);
+    int exact;
     
 
     data_positions_t* curr_dp;
 
-    while(block != -1)
+    arena_mark_t binary_mark = arena_mark(db_args->arena); // Scratch memory of a binary is reclaimed after it.
+
+    // Each spectrum alternates xml and binaries: xml, m/z, xml, intensity, [xml, extra array]...
+    // then each chromatogram: xml, time, xml, intensity. Once the binaries are exhausted, only the remaining xml follows.
+    while(xml_i < division->xml->total_spec)
     {
-        switch (block)
+        curr_dp = division->xml;
+        curr_len = curr_dp->end_positions[xml_i] - curr_dp->start_positions[xml_i];
+        if(curr_len > 0)
         {
-        case 0: // xml
-            curr_dp = division->xml;
-            if(xml_i == curr_dp->total_spec) {
-                block = -1; break;}
-            curr_len = curr_dp->end_positions[xml_i] - curr_dp->start_positions[xml_i];
-            if(curr_len == 0){
-                xml_i++; block++; break;}
-            assert(curr_len > 0 && curr_len <= len);
+            assert(curr_len <= len);
             memcpy(buff + buff_off, decmp_xml + xml_off, curr_len);
             xml_off += curr_len;
             buff_off += curr_len;
-            xml_i++;
-            block++;
-            break;
-        case 1: // mz
-            curr_dp = division->mz;
-            if(mz_i == curr_dp->total_spec) {
-                block = 0; break;}
-            curr_len = curr_dp->end_positions[mz_i] - curr_dp->start_positions[mz_i];
-            if(curr_len == 0){
-                mz_i++; block++; break;}
-            assert(curr_len > 0 && curr_len < len);
-            a_args->src = (char**)&decmp_mz_binary;
-            a_args->src_len = curr_len;
-            a_args->dest = buff+buff_off;
-            a_args->src_format = db_args->df->source_mz_fmt;
-            a_args->enc_fun = db_args->df->encode_source_compression_mz_fun;
-            a_args->scale_factor = db_args->df->mz_scale_factor;
-            db_args->df->target_mz_fun((void*)a_args);
-            buff_off += *a_args->dest_len;
-            mz_i++;
-            block++;
-            break;
-        case 2: // xml
-            curr_dp = division->xml;
-            if(xml_i == curr_dp->total_spec) {
-                block = -1; break;}
-            curr_len = curr_dp->end_positions[xml_i] - curr_dp->start_positions[xml_i];
-            if(curr_len == 0){
-                xml_i++; block++; break;}
-            assert(curr_len > 0 && curr_len < len);
-            memcpy(buff + buff_off, decmp_xml + xml_off, curr_len);
-            xml_off += curr_len;
-            buff_off += curr_len;
-            xml_i++;
-            block++;
-            break;
-        case 3: // int
-            curr_dp = division->inten;
-            if(inten_i == curr_dp->total_spec) {
-                block = 0; break;}
-            curr_len = curr_dp->end_positions[inten_i] - curr_dp->start_positions[inten_i];
-            if(curr_len == 0){
-                inten_i++; block=0; break;}
-            assert(curr_len > 0 && curr_len < len);
-            a_args->src = (char**)&decmp_inten_binary;
+        }
+        xml_i++;
+
+        if(array < 0 || (array = resolve_division_array(division, array, bin_i)) < 0)
+            continue;
+        curr_dp = get_division_array(division, array);
+        curr_len = curr_dp->end_positions[bin_i[array]] - curr_dp->start_positions[bin_i[array]];
+        if(curr_len > 0)
+        {
+            assert(curr_len < len);
+            int mode = (array == 0) ? _mass_ : (array == 1) ? _intensity_ : (array < n_arrays) ? _extra_ : _chrom_;
+            target_fun = set_binary_format(a_args, db_args->df, mode, (array < n_arrays) ? array - 2 : array - n_arrays,
+                                           curr_dp->formats ? curr_dp->formats[bin_i[array]] : 0);
+            a_args->src = (char**)&decmp_binary[array];
             a_args->src_len = curr_len;
             a_args->dest = buff+buff_off;
-            a_args->src_format = db_args->df->source_inten_fmt;
-            a_args->enc_fun = db_args->df->encode_source_compression_inten_fun;
-            a_args->scale_factor = db_args->df->int_scale_factor;
-            db_args->df->target_inten_fun((void*)a_args);
+            a_args->scale_factor = (mode == _mass_) ? db_args->df->mz_scale_factor : db_args->df->int_scale_factor;
+            target_fun((void*)a_args);
+
+            exact = (mode == _mass_) ? lossless_mz : (mode == _intensity_) ? lossless_inten : 1;
+            if(exact && (a_args->zlib_params == ZLIB_AUTO || a_args->source_compression != _zlib_) &&
+               *a_args->dest_len != (size_t)curr_len)
+                error("decompress_routine: binary %ld of array %d restored to %ld bytes, expected %ld.\n",
+                      (long)bin_i[array], array, (long)*a_args->dest_len, (long)curr_len);
+
             buff_off += *a_args->dest_len;
-            inten_i++;
-            block = 0;
-            break;
-        case -1:
-            break;
+            if(buff_off > len)
+                error("decompress_routine: division restored past its %ld byte buffer.\n", len);
+            arena_reset(db_args->arena, binary_mark);
         }
+        bin_i[array]++;
+        array = next_division_array(division, array);
     }
 
     db_args->ret_len = buff_off;
 
+    if(db_args->checksum != NULL)
+        db_args->checksum_ok = (uint64_t)buff_off == db_args->checksum->length &&
+                               xxh64(buff, buff_off, 0) == db_args->checksum->hash;
+
+    if(db_args->expected != NULL)
+        db_args->expected_ok = (size_t)buff_off == db_args->expected_len &&
+                               memcmp(buff, db_args->expected, buff_off) == 0;
+
     dealloc_z_stream(a_args->z);
+    dealloc_grid_refs(a_args->grid);
+    scratch_free(a_args);
+
+    arena_reset(db_args->arena, (arena_mark_t){NULL, 0});
+    set_thread_arena(NULL);
+
+    free(decmp_xml);
+    for(k = 0; k < n_arrays + CHROM_ARRAYS; k++)
+        free(decmp_blocks[k]);
+    ZSTD_freeDCtx(dctx);
+
+    if(db_args->ring != NULL) // Last use of db_args, the writer owns it from here.
+        ring_push(db_args->ring, db_args->index, db_args);
 
     return;
 }
 
+decompress_args_t**
+prepare_decompress_args(char* input_map,
+                        data_format_t* df,
+                        toc_t* toc,
+                        divisions_t* divisions)
+/**
+ * @brief Looks up the blocks of every division in the table of contents read by parse_footer.
+ * 
+ * @return An array of divisions->n_divisions decompression arguments, in division order.
+ */
+{
+    decompress_args_t** args = malloc(sizeof(decompress_args_t*) * divisions->n_divisions);
+
+    if(args == NULL)
+        error("prepare_decompress_args: malloc() error.\n");
+
+    int i, k;
+
+    for (i = 0; i < divisions->n_divisions; i++)
+    {
+        args[i] = alloc_decompress_args(input_map,
+            df,
+            toc_block(toc, TOC_XML, i),
+            toc_block(toc, TOC_MZ, i),
+            toc_block(toc, TOC_INTEN, i),
+            divisions->divisions[i]);
+        args[i]->index = i;
+
+        for (k = 0; k < MAX_EXTRA_ARRAYS; k++)
+            args[i]->extra_binary_blk[k] = toc_block(toc, TOC_EXTRA + k, i);
+        for (k = 0; k < CHROM_ARRAYS; k++)
+            args[i]->chrom_binary_blk[k] = toc_block(toc, TOC_CHROM + k, i);
+    }
+
+    return args;
+}
+
+void
+run_decompress_routines(decompress_args_t** args, int n)
+/**
+ * @brief Runs decompress_routine on args[0..n-1], one thread each with an arena of its own, and waits for all of them.
+ */
+{
+    int i;
+    arena_t** arenas = get_arenas(n);
+
+    #ifdef _WIN32
+    HANDLE* ptid = (HANDLE*)malloc(sizeof(HANDLE) * n);
+    #else
+    pthread_t* ptid = (pthread_t*)malloc(sizeof(pthread_t) * n);
+    #endif
+
+    if(ptid == NULL)
+        error("run_decompress_routines: malloc() error.\n");
+
+    for (i = 0; i < n; i++)
+    {
+        args[i]->arena = arenas[i];
+        #ifdef _WIN32
+        ptid[i] = CreateThread(NULL, 0, decompress_routine_win, args[i], 0, NULL);
+        if (ptid[i] == NULL)
+        {
+            perror("CreateThread");
+            exit(-1);
+        }
+        #else
+        int ret = pthread_create(&ptid[i], NULL, decompress_routine, (void*)args[i]);
+        if (ret != 0)
+        {
+            perror("pthread_create");
+            exit(-1);
+        }
+        #endif
+    }
+
+    #ifdef _WIN32
+    WaitForMultipleObjects(n, ptid, TRUE, INFINITE);
+    #else
+    for (i = 0; i < n; i++)
+    {
+        int ret = pthread_join(ptid[i], NULL);
+        if (ret != 0)
+        {
+            perror("pthread_join");
+            exit(-1);
+        }
+    }
+    #endif
+
+    free(ptid);
+}
+
+long
+decompress_cost(decompress_args_t* args)
+/**
+ * @brief Estimated memory of decompressing a division (see budget_batch): its decompressed blocks,
+ *        the buffer its text is restored to, and the fixed memory of a worker.
+ */
+{
+    toc_entry_t* blks[3 + MAX_EXTRA_ARRAYS + CHROM_ARRAYS];
+    long r = restored_capacity(args) + WORKER_MEMORY;
+    int n = division_blocks(args, blks), k;
+
+    for(k = 0; k < n; k++)
+        if(blks[k] != NULL)
+            r += blks[k]->original_size;
+
+    return r;
+}
+
+static long*
+decompress_costs(decompress_args_t** args, int n)
+{
+    long* r = malloc(sizeof(long) * n);
+
+    if(r == NULL)
+        error("decompress_costs: malloc() error.\n");
+
+    for(int i = 0; i < n; i++)
+        r[i] = decompress_cost(args[i]);
+
+    return r;
+}
+
+typedef struct
+{
+    block_ring_t* ring;
+    decompress_args_t** args;
+    int divisions;
+    int fd;
+} decmp_writer_args_t;
+
+static void
+decmp_writer_routine(void* args)
+/**
+ * @brief Writer thread of decompress_msz. Takes the divisions the workers hand over through the ring,
+ *        in any order, checks them against the checksum table and writes them to fd in division order.
+ */
+{
+    decmp_writer_args_t* w_args = (decmp_writer_args_t*)args;
+    char* arrived = calloc(w_args->divisions, 1);
+    double start, stop;
+    int next = 0;
+
+    if(arrived == NULL)
+        error("decmp_writer_routine: malloc() error.\n");
+
+    while(next < w_args->divisions)
+    {
+        arrived[ring_pop(w_args->ring).index] = 1;
+
+        for(; next < w_args->divisions && arrived[next]; next++)
+        {
+            decompress_args_t* a = w_args->args[next];
+
+            if(a->checksum != NULL && !a->checksum_ok)
+                error("decompress_msz: checksum mismatch in division %d (original bytes %lu-%lu).\n",
+                      next, a->checksum->offset, a->checksum->offset + a->checksum->length);
+
+            start = get_time();
+            write_to_file(w_args->fd, a->ret, a->ret_len);
+            stop = get_time();
+
+            print("\tWrote %ld bytes to disk (%1.2fmb/s)\n", a->ret_len, (float)a->ret_len / (stop - start) / 1024 / 1024);
+
+            dealloc_decompress_args(a);
+            ring_done(w_args->ring);
+        }
+    }
+
+    free(arrived);
+}
+
+#ifdef _WIN32
+DWORD WINAPI decmp_writer_routine_win(LPVOID lpParam) {
+    decmp_writer_routine(lpParam);
+    return 0;
+}
+#endif
+
 void
 decompress_msz(char* input_map,
     size_t input_filesize,
     struct Arguments* arguments,
     int fd)
 {
-    block_len_queue_t *xml_block_lens, *mz_binary_block_lens, *inten_binary_block_lens;
+    toc_t* toc;
     footer_t* msz_footer;
 
     int n_divisions = 0;
@@ -340,120 +646,226 @@ decompress_msz(char* input_map,
     
     print("\tDetected .msz file, reading header and footer...\n");
 
+    check_format_version(input_map, "decompress_msz");
+
     df = get_header_df(input_map);
 
-    parse_footer(&msz_footer, input_map, input_filesize,
-            &xml_block_lens, 
-            &mz_binary_block_lens,
-            &inten_binary_block_lens,
-            &divisions,
-            &n_divisions);
+    parse_footer(&msz_footer, input_map, input_filesize, &toc, &divisions, &n_divisions);
 
     if(n_divisions == 0)
     {
         warning("No divisions found in file, aborting...\n");
+        dealloc_read_divisions(divisions);
+        dealloc_toc(toc);
+        free(df);
         return;
     }
 
     set_decompress_runtime_variables(arguments, df, msz_footer);
     
-    decompress_args_t** args = malloc(sizeof(decompress_args_t*) * divisions->n_divisions);
-
-    #ifdef _WIN32
-    HANDLE* ptid = (HANDLE*)malloc(sizeof(HANDLE) * divisions->n_divisions);
-    #else
-    pthread_t* ptid = (pthread_t*)malloc(sizeof(pthread_t) * divisions->n_divisions);
-    #endif
-
-
-    block_len_t* xml_blk, * mz_binary_blk, * inten_binary_blk;
-
-    uint64_t footer_xml_off = 0, footer_mz_bin_off = 0, footer_inten_bin_off = 0; // offset within corresponding data_block.
+    decompress_args_t** args = prepare_decompress_args(input_map, df, toc, divisions);
 
     int i;
 
+    // Each worker verifies its division against the checksum table, if the file has one
+    checksum_t* checksums = read_checksums(input_map, msz_footer);
+    if(checksums != NULL)
+    {
+        print("\tVerifying checksum %.16s\n", (char*)input_map + CHECKSUM_OFFSET);
+        for (i = 0; i < divisions->n_divisions; i++)
+            args[i]->checksum = &checksums[i];
+    }
+
     int divisions_used = 0;
     int divisions_left = divisions->n_divisions;
+    int batch;
+    long* costs = decompress_costs(args, divisions->n_divisions);
 
-    double start, stop;
+    // Divisions go from the workers to a writer thread through a ring of one slot per worker.
+    block_ring_t* ring = alloc_ring(threads);
+    decmp_writer_args_t writer_args = {ring, args, divisions->n_divisions, fd};
+
+    #ifdef _WIN32
+    HANDLE writer = CreateThread(NULL, 0, decmp_writer_routine_win, &writer_args, 0, NULL);
+    if (writer == NULL)
+    {
+        perror("CreateThread");
+        exit(-1);
+    }
+    #else
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, (void*)decmp_writer_routine, (void*)&writer_args) != 0)
+    {
+        perror("pthread_create");
+        exit(-1);
+    }
+    #endif
 
     for (i = 0; i < divisions->n_divisions; i++)
+        args[i]->ring = ring;
+
+    while (divisions_left > 0)
     {
-        xml_blk = pop_block_len(xml_block_lens);
-        mz_binary_blk = pop_block_len(mz_binary_block_lens);
-        inten_binary_blk = pop_block_len(inten_binary_block_lens);
+        batch = budget_batch(costs + divisions_used, divisions_left, threads);
 
-        args[i] = alloc_decompress_args(input_map,
-            df,
-            xml_blk,
-            mz_binary_blk,
-            inten_binary_blk,
-            divisions->divisions[i],
-            footer_xml_off + msz_footer->xml_pos,
-            footer_mz_bin_off + msz_footer->mz_binary_pos,
-            footer_inten_bin_off + msz_footer->inten_binary_pos);
-
-        if (xml_blk != NULL) footer_xml_off += xml_blk->compressed_size;
-        if (mz_binary_blk != NULL) footer_mz_bin_off += mz_binary_blk->compressed_size;
-        if (inten_binary_blk != NULL) footer_inten_bin_off += inten_binary_blk->compressed_size;
+        if (max_memory > 0) // Divisions waiting to be written count against the budget.
+            ring_wait(ring, divisions_used);
+
+        run_decompress_routines(args + divisions_used, batch); // The writer deallocates the arguments.
+
+        divisions_left -= batch;
+        divisions_used += batch;
     }
 
-    while (divisions_left > 0)
+    #ifdef _WIN32
+    WaitForSingleObject(writer, INFINITE);
+    CloseHandle(writer);
+    #else
+    if (pthread_join(writer, NULL) != 0)
     {
-        if (divisions_left < threads)
-            threads = divisions_left;
+        perror("pthread_join");
+        exit(-1);
+    }
+    #endif
+
+    dealloc_ring(ring);
+    free(args);
+    free(costs);
+    free(df);
+    dealloc_toc(toc);
+    dealloc_read_divisions(divisions);
+    dealloc_arenas();
+}
+
+static size_t
+first_difference(char* a, char* b, size_t len)
+{
+    size_t i;
+
+    for(i = 0; i < len && a[i] == b[i]; i++);
+
+    return i;
+}
+
+void
+verify_msz(char* input_map, size_t input_filesize, struct Arguments* arguments)
+/**
+ * @brief Decompresses an msz over all threads without writing it (--verify). The workers check every block
+ *        against the table of contents, every division against the checksum table, if the file has one, and
+ *        against the mzML of arguments->verify_source, if given. Exits on the first mismatch.
+ */
+{
+    toc_t* toc;
+    footer_t* msz_footer;
+    divisions_t* divisions;
+    int n_divisions = 0, threads = arguments->threads;
+    int i, n_blocks = 0;
+    char* source = arguments->verify_source;
+    char* source_map = NULL;
+    int source_fd = -1;
+    size_t restored = 0;
+    double start = get_time();
+
+    check_format_version(input_map, "verify_msz");
+
+    data_format_t* df = get_header_df(input_map);
+
+    parse_footer(&msz_footer, input_map, input_filesize, &toc, &divisions, &n_divisions);
+    if(n_divisions == 0)
+        error("verify_msz: no divisions found in file.\n");
+
+    set_decompress_runtime_variables(arguments, df, msz_footer);
+
+    decompress_args_t** args = prepare_decompress_args(input_map, df, toc, divisions);
 
-        for (i = divisions_used; i < divisions_used + threads; i++)
+    for(i = 0; i < (int)toc->header->n_streams * n_divisions; i++)
+        if(toc->entries[i].offset != 0)
+            n_blocks++;
+
+    checksum_t* checksums = read_checksums(input_map, msz_footer);
+    if(checksums != NULL)
+        for(i = 0; i < n_divisions; i++)
+            args[i]->checksum = &checksums[i];
+
+    if(source != NULL)
+    {
+        if(!is_lossless_algo(msz_footer->mz_fmt) || !is_lossless_algo(msz_footer->inten_fmt))
+            error("verify_msz: lossy transforms do not restore %s, it cannot be compared.\n", source);
+
+        source_fd = open_file(source);
+        if(source_fd < 0)
+            error("verify_msz: cannot open %s.\n", source);
+        size_t source_size = get_filesize(source);
+
+        // The divisions tile the mzML they were compressed from.
+        size_t pos = 0;
+        for(i = 0; i < n_divisions; i++)
+            pos += divisions->divisions[i]->size;
+        if(pos != source_size)
+            error("verify_msz: %s is %ld bytes, the msz restores %ld.\n", source, (long)source_size, (long)pos);
+
+        source_map = get_mapping(source_fd);
+        for(pos = 0, i = 0; i < n_divisions; i++)
         {
-            #ifdef _WIN32
-            ptid[i] = CreateThread(NULL, 0, decompress_routine_win, args[i], 0, NULL);
-            if (ptid[i] == NULL)
-            {
-                perror("CreateThread");
-                exit(-1);
-            }
-            #else
-            int ret = pthread_create(&ptid[i], NULL, decompress_routine, (void*)args[i]);
-            if (ret != 0)
-            {
-                perror("pthread_create");
-                exit(-1);
-            }
-            #endif
+            args[i]->expected = source_map + pos;
+            args[i]->expected_len = divisions->divisions[i]->size;
+            pos += args[i]->expected_len;
         }
+    }
 
-        #ifdef _WIN32
-        WaitForMultipleObjects(threads, ptid + divisions_used, TRUE, INFINITE);
-        #else
-        for (i = divisions_used; i < divisions_used + threads; i++)
+    print("\tVerifying %d blocks of %d divisions over %d threads%s%s.\n", n_blocks, n_divisions, threads,
+          checksums ? ", checksum table" : "", source ? ", source mzML" : "");
+
+    int divisions_used = 0;
+    int divisions_left = n_divisions;
+    int batch;
+    long* costs = decompress_costs(args, n_divisions);
+
+    while(divisions_left > 0)
+    {
+        batch = budget_batch(costs + divisions_used, divisions_left, threads);
+
+        run_decompress_routines(args + divisions_used, batch);
+
+        for(i = divisions_used; i < divisions_used + batch; i++)
         {
-            int ret = pthread_join(ptid[i], NULL);
-            if (ret != 0)
+            decompress_args_t* a = args[i];
+
+            if(a->checksum != NULL && !a->checksum_ok)
+                error("verify_msz: checksum mismatch in division %d (original bytes %lu-%lu).\n",
+                      i, a->checksum->offset, a->checksum->offset + a->checksum->length);
+
+            if(a->expected != NULL && !a->expected_ok)
             {
-                perror("pthread_join");
-                exit(-1);
+                size_t len = (a->ret_len < a->expected_len) ? a->ret_len : a->expected_len;
+                error("verify_msz: division %d differs from %s at byte %ld.\n",
+                      i, source, (long)(a->expected - source_map + first_difference(a->ret, a->expected, len)));
             }
-        }
-        #endif
 
-        for (i = divisions_used; i < divisions_used + threads; i++)
-        {
-            start = get_time();
-            write_to_file(fd, args[i]->ret, args[i]->ret_len);
-            stop = get_time();
+            restored += a->ret_len;
+            dealloc_decompress_args(a);
+        }
 
-            print("\tWrote %ld bytes to disk (%1.2fmb/s)\n", args[i]->ret_len, (float)args[i]->ret_len / (stop - start) / 1024 / 1024);
+        divisions_left -= batch;
+        divisions_used += batch;
+    }
 
-            dealloc_decompress_args(args[i]);
-        }
+    printf("%s: OK, %d blocks, %d divisions, %ld bytes restored%s%s (%1.2fs)\n", arguments->input_file, n_blocks,
+           n_divisions, (long)restored, checksums ? ", checksum verified" : "", source ? ", identical to source" : "",
+           get_time() - start);
 
-        divisions_left -= threads;
-        divisions_used += threads;
+    if(source_map != NULL)
+    {
+        remove_mapping(source_map, source_fd);
+        close_file(source_fd);
     }
 
     free(args);
-    free(ptid);
-
+    free(costs);
+    free(df);
+    dealloc_toc(toc);
+    dealloc_read_divisions(divisions);
+    dealloc_arenas();
 }
 
 decompression_fun
@@ -463,7 +875,9 @@ set_decompress_fun(int accession)
     {
         case _ZSTD_compression_ :       return zstd_decompress;
         case _LZ4_compression_ :        return lz4_decompress;
+        case _xml_struct_ :             return xml_struct_decompress;
+        case _ZSTD_dict_ :              return zstd_dict_decompress;
         case _no_comp_ :                return no_decompress;
         default :                       error("Compression type not supported.");
     }
-}
\ No newline at end of file
+}
@@ -55,7 +55,7 @@ encode_base64(zlib_block_t* zblk, char* dest, size_t src_len, size_t* out_len)
 
 
     // zlib_dealloc(zblk);
-    free(zblk);
+    scratch_free(zblk);
 
     // return b64_out_buff;
 }
@@ -67,7 +67,7 @@ encode_zlib_fun_no_header(z_stream* z, char** src, size_t src_len, char* dest, s
     if(src == NULL || *src == NULL)
         error("encode_zlib_fun: src is NULL");
 
-    if (src_len <= 0 || src_len > ZLIB_BUFF_FACTOR)
+    if (src_len > ZLIB_BUFF_FACTOR) // empty arrays still deflate to a valid stream
         error("encode_zlib_fun: src_len is invalid");
 
     if (dest == NULL)
@@ -87,11 +87,12 @@ encode_zlib_fun_no_header(z_stream* z, char** src, size_t src_len, char* dest, s
 
     zlib_block_t* cmp_output;
  
-    decmp_input = zlib_alloc(0);
+    decmp_input = scratch_alloc(sizeof(zlib_block_t));
+    decmp_input->offset = 0;
     decmp_input->mem = *src;
     decmp_input->buff = decmp_input->mem + decmp_input->offset;
 
-    cmp_output = zlib_alloc(0);
+    cmp_output = zlib_alloc_sized(0, deflateBound(z, src_len));
 
     // void* decmp_header = zlib_pop_header(decmp_input);
 
@@ -101,16 +102,26 @@ encode_zlib_fun_no_header(z_stream* z, char** src, size_t src_len, char* dest, s
     // zlib_len = (size_t)zlib_compress(((Bytef*)*src) + ZLIB_SIZE_OFFSET, cmp_output, src_len);
 
 
-    free(decmp_input);
+    scratch_free(decmp_input);
     // free(decmp_header);
 
+    zlib_encoded = cmp_output->mem;
+
     encode_base64(cmp_output, dest, zlib_len, out_len);
+
+    scratch_free(zlib_encoded);
     
     *src += src_len;
 }
 
 void
 encode_zlib_fun_w_header(z_stream* z, char** src, size_t src_len, char* dest, size_t* out_len)
+/**
+ * @brief Re-encodes a lossless binary stored by decode_zlib_fun.
+ *        The binary is deflated with the parameters the z_stream is set to (see zlib_set_params),
+ *        unless its header is marked ZLIB_PARAMS_RAW, in which case it holds the original
+ *        zlib stream and is only base64 encoded.
+ */
 {
     if(src == NULL || *src == NULL)
         error("encode_zlib_fun: src is NULL");
@@ -135,28 +146,40 @@ encode_zlib_fun_w_header(z_stream* z, char** src, size_t src_len, char* dest, si
 
     zlib_block_t* cmp_output;
  
-    decmp_input = malloc(sizeof(zlib_block_t));
-    decmp_input->offset = ZLIB_SIZE_OFFSET;
+    decmp_input = scratch_alloc(sizeof(zlib_block_t));
+    decmp_input->offset = ZLIB_HEADER_SIZE;
     decmp_input->mem = *src;
     decmp_input->buff = decmp_input->mem + decmp_input->offset;
     decmp_input->len = src_len + decmp_input->offset;
 
-    cmp_output = zlib_alloc(0);
-
     void* decmp_header = zlib_pop_header(decmp_input);
 
     ZLIB_TYPE org_len = *(ZLIB_TYPE*)decmp_header;
 
-    zlib_len = (size_t)zlib_compress(z, ((Bytef*)*src) + ZLIB_SIZE_OFFSET, cmp_output, org_len);
-    // zlib_len = (size_t)zlib_compress(((Bytef*)*src) + ZLIB_SIZE_OFFSET, cmp_output, src_len);
+    ZLIB_PARAMS_TYPE params = *(ZLIB_PARAMS_TYPE*)((char*)decmp_header + ZLIB_SIZE_OFFSET);
+
+    scratch_free(decmp_header);
+
+    if(params == ZLIB_PARAMS_RAW) // original stream stored as-is
+    {
+        encode_base64(decmp_input, dest, org_len, out_len);
+        *src += (ZLIB_HEADER_SIZE + org_len);
+        return;
+    }
+
+    cmp_output = zlib_alloc_sized(0, deflateBound(z, org_len));
+
+    zlib_len = (size_t)zlib_compress(z, ((Bytef*)*src) + ZLIB_HEADER_SIZE, cmp_output, org_len);
 
+    scratch_free(decmp_input);
 
-    free(decmp_input);
-    free(decmp_header);
+    zlib_encoded = cmp_output->mem;
 
     encode_base64(cmp_output, dest, zlib_len, out_len);
+
+    scratch_free(zlib_encoded);
     
-    *src += (ZLIB_SIZE_OFFSET + org_len);
+    *src += (ZLIB_HEADER_SIZE + org_len);
 }
 
 void
@@ -174,11 +197,7 @@ encode_no_comp_fun_w_header(z_stream* z, char** src, size_t src_len, char* dest,
     if (out_len == NULL)
         error("encode_zlib_fun: out_len is NULL");
 
-    Bytef* zlib_encoded;
-
-    size_t zlib_len = 0;
-    
-    zlib_block_t* decmp_input = malloc(sizeof(zlib_block_t));
+    zlib_block_t* decmp_input = scratch_alloc(sizeof(zlib_block_t));
     if(decmp_input == NULL)
         error("encode_no_comp_fun: malloc failed");
  
@@ -208,11 +227,7 @@ encode_no_comp_fun_no_header(z_stream* z, char** src, size_t src_len, char* dest
     if (out_len == NULL)
         error("encode_zlib_fun: out_len is NULL");
 
-    Bytef* zlib_encoded;
-
-    size_t zlib_len = 0;
-    
-    zlib_block_t* decmp_input = malloc(sizeof(zlib_block_t));
+    zlib_block_t* decmp_input = scratch_alloc(sizeof(zlib_block_t));
     if(decmp_input == NULL)
         error("encode_no_comp_fun: malloc failed");
  
@@ -236,12 +251,12 @@ set_encode_fun(int compression_method, int algo, int accession)
     switch(compression_method)
     {
         case _zlib_:
-            if(algo == _lossless_ || (algo == _cast_64_to_32_ && accession == _32f_))
+            if(algo == _lossless_ || algo == _sparse_ || algo == _grid_ || (algo == _cast_64_to_32_ && accession == _32f_))
                 return encode_zlib_fun_w_header;
             else
                 return encode_zlib_fun_no_header;    
         case _no_comp_:
-            if(algo == _lossless_ || (algo == _cast_64_to_32_ && accession == _32f_))
+            if(algo == _lossless_ || algo == _sparse_ || algo == _grid_ || (algo == _cast_64_to_32_ && accession == _32f_))
                 return encode_no_comp_fun_w_header;
             else
                 return encode_no_comp_fun_no_header;
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zstd.h>
 #include "mscompress.h"
 
 void
@@ -10,19 +11,19 @@ extract_mzml(char* input_map, divisions_t* divisions, int output_fd)
     {
         division_t* division = divisions->divisions[i];
 
-        long total_spec = division->mz->total_spec;
-
-        long j = 0;
-
         char* buff = malloc(division->size);
 
         long len = 0;
 
         long out_len = 0;
 
-        int64_t xml_i = 0,   mz_i = 0,   inten_i = 0;
+        // Binaries numbered as by get_division_array: m/z, intensity, the extra arrays, then the chromatogram arrays
+        int array = 0;
+        data_positions_t* bin_dp;
+        int64_t bin_i[2 + MAX_EXTRA_ARRAYS + CHROM_ARRAYS] = {0};
+        int64_t xml_i = 0;
 
-        while(j <= total_spec)
+        while(xml_i < division->xml->total_spec)
         {
             //XML
             len = division->xml->end_positions[xml_i] - division->xml->start_positions[xml_i];
@@ -30,34 +31,302 @@ extract_mzml(char* input_map, divisions_t* divisions, int output_fd)
             out_len += len;
             xml_i++;
 
-            //mz
-            len = division->mz->end_positions[mz_i] - division->mz->start_positions[mz_i];
-            memcpy(buff+out_len, input_map+division->mz->start_positions[mz_i], len);
+            //binary, until only the remaining XML is left
+            if(array < 0 || (array = resolve_division_array(division, array, bin_i)) < 0)
+                continue;
+            bin_dp = get_division_array(division, array);
+            len = bin_dp->end_positions[bin_i[array]] - bin_dp->start_positions[bin_i[array]];
+            memcpy(buff+out_len, input_map+bin_dp->start_positions[bin_i[array]], len);
             out_len += len;
-            mz_i++;
+            bin_i[array]++;
+            array = next_division_array(division, array);
+        }
 
-            //XML
-            len = division->xml->end_positions[xml_i] - division->xml->start_positions[xml_i];
-            memcpy(buff+out_len, input_map+division->xml->start_positions[xml_i], len);
-            out_len += len;
-            xml_i++;
+        write_to_file(output_fd, buff, out_len);
+    }
+    return;
+}
+static int
+compare_scans(const void* a, const void* b)
+{
+    long x = *(const long*)a, y = *(const long*)b;
+    return (x > y) - (x < y);
+}
 
-            //inten
-            len = division->inten->end_positions[inten_i] - division->inten->start_positions[inten_i];
-            memcpy(buff+out_len, input_map+division->inten->start_positions[inten_i], len);
-            out_len += len;
-            inten_i++;
+int
+match_query(query_t* query, division_t* div, long i)
+/**
+ * @brief Tests the metadata of spectrum i of a division (see read_metadata) against query.
+ * 
+ * @return 1 if the spectrum matches every criterion of the query, 0 otherwise or for padding spectra.
+ */
+{
+    if(div->indices[i] < 0)
+        return 0;
+    if(query->ms_level == -1 && div->ms_levels[i] <= 2)
+        return 0;
+    if(query->ms_level > 0 && div->ms_levels[i] != query->ms_level)
+        return 0;
+    // Retention times are stored in seconds as floats: compare against the window rounded the same way
+    if(query->has_rt && (div->ret_times[i] < (float)query->rt_min || div->ret_times[i] > (float)query->rt_max))
+        return 0;
+    if(query->has_mz && (div->precursor_mzs[i] < query->mz_min || div->precursor_mzs[i] > query->mz_max))
+        return 0;
+    if(query->scans_length > 0 &&
+       bsearch(&div->scans[i], query->scans, query->scans_length, sizeof(long), compare_scans) == NULL)
+        return 0;
+    return 1;
+}
+
+/* Position of the query walk within the mzML text */
+#define QUERY_HEADER  0 /* before the first spectrum */
+#define QUERY_EMIT    1 /* within a matching spectrum */
+#define QUERY_BETWEEN 2 /* after a matching spectrum, before the next */
+#define QUERY_SKIP    3 /* within or after a spectrum not matching */
+#define QUERY_TAIL    4 /* after the last spectrum */
+
+typedef struct
+{
+    int state;
+    long spec_k;     // spectra started so far
+    long n_spec;
+    long n_matched;
+    char* matched;   // per spectrum, in file order
+    int fd;
+} query_walk_t;
 
-            j++;
+static char*
+find_tag(char* p, char* end, const char* tag)
+{
+    size_t len = strlen(tag);
+
+    while(end - p >= (long)len)
+    {
+        p = memchr(p, '<', end - p);
+        if(p == NULL || end - p < (long)len)
+            return NULL;
+        if(memcmp(p, tag, len) == 0)
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
+static void
+write_query_header(int fd, char* p, char* end, long n_matched)
+/**
+ * @brief Writes the mzML preceding the first spectrum with the count of spectrumList set to n_matched.
+ */
+{
+    char* list = find_tag(p, end, "<spectrumList");
+    char* count = NULL;
+    char buff[32];
+
+    for(char* c = list; c != NULL && c < end - 7 && *c != '>'; c++)
+        if(memcmp(c, " count=\"", 8) == 0)
+        {
+            count = c + 8;
+            break;
         }
-        
-        //end case
-        len = division->xml->end_positions[xml_i] - division->xml->start_positions[xml_i];
-        memcpy(buff+out_len, input_map+division->xml->start_positions[xml_i], len);
-        out_len += len;
-        xml_i++;
 
-        write_to_file(output_fd, buff, out_len);
+    if(count == NULL)
+    {
+        write_to_file(fd, p, end - p);
+        return;
     }
-    return;
-}
\ No newline at end of file
+
+    write_to_file(fd, p, count - p);
+    write_to_file(fd, buff, snprintf(buff, sizeof(buff), "%ld", n_matched));
+    while(count < end && *count >= '0' && *count <= '9')
+        count++;
+    write_to_file(fd, count, end - count);
+}
+
+static void
+walk_query_text(query_walk_t* w, char* p, char* end)
+/**
+ * @brief Feeds the text of a division to the query walk, writing the header, the matching spectra
+ *        with the whitespace following them and everything after the last spectrum.
+ *        Binaries hold no markup, so divisions only passed through may be fed their xml alone.
+ */
+{
+    char* tag;
+
+    while(p < end)
+    {
+        switch(w->state)
+        {
+            case QUERY_HEADER:
+            case QUERY_BETWEEN:
+            case QUERY_SKIP:
+                if(w->spec_k == w->n_spec) // only the end of the last spectrum is left
+                {
+                    if((tag = find_tag(p, end, "</spectrum>")) == NULL)
+                        return;
+                    p = tag + strlen("</spectrum>");
+                    w->state = QUERY_TAIL;
+                    break;
+                }
+                if((tag = find_tag(p, end, "<spectrum ")) == NULL)
+                    tag = end;
+                if(w->state == QUERY_HEADER)
+                    write_query_header(w->fd, p, tag, w->n_matched);
+                else if(w->state == QUERY_BETWEEN)
+                    write_to_file(w->fd, p, tag - p);
+                if(tag == end)
+                    return;
+                w->state = w->matched[w->spec_k++] ? QUERY_EMIT : QUERY_SKIP;
+                p = (w->state == QUERY_EMIT) ? tag : tag + strlen("<spectrum ");
+                break;
+            case QUERY_EMIT:
+                if((tag = find_tag(p, end, "</spectrum>")) == NULL)
+                {
+                    write_to_file(w->fd, p, end - p);
+                    return;
+                }
+                tag += strlen("</spectrum>");
+                write_to_file(w->fd, p, tag - p);
+                p = tag;
+                w->state = (w->spec_k == w->n_spec) ? QUERY_TAIL : QUERY_BETWEEN;
+                break;
+            case QUERY_TAIL:
+                write_to_file(w->fd, p, end - p);
+                return;
+        }
+    }
+}
+
+long
+query_msz(char* input_map, size_t input_filesize, query_t* query, struct Arguments* arguments, int output_fd)
+/**
+ * @brief Writes the spectra of an msz matching query as mzML: the header, with its spectrumList count
+ *        updated, the matching spectra, then the rest of the file (chromatograms and index, as extract_mzml).
+ *        Matches are found in the metadata table alone. Only divisions holding matching spectra, or
+ *        following the last spectrum, are decompressed; of the others, at most the xml is.
+ * 
+ * @return The number of spectra written.
+ */
+{
+    toc_t* toc;
+    footer_t* msz_footer;
+    divisions_t* divisions;
+    data_format_t* df;
+    int n_divisions = 0;
+    int d, k, n_decmp = 0, n_full = 0;
+    long i;
+
+    check_format_version(input_map, "query_msz");
+
+    df = get_header_df(input_map);
+
+    parse_footer(&msz_footer, input_map, input_filesize, &toc, &divisions, &n_divisions);
+    read_metadata(input_map, msz_footer, divisions);
+
+    set_decompress_runtime_variables(arguments, df, msz_footer);
+
+    decompress_args_t** args = prepare_decompress_args(input_map, df, toc, divisions);
+
+    query_walk_t w = {QUERY_HEADER, 0, 0, 0, NULL, output_fd};
+    long* n_spec = calloc(n_divisions, sizeof(long));
+    char* plan = malloc(n_divisions);   // 2: decompress, 1: xml only, 0: skip
+    int last = -1;                      // last division holding a spectrum
+
+    for(d = 0; d < n_divisions; d++)
+        for(i = 0; i < divisions->divisions[d]->mz->total_spec; i++)
+            if(divisions->divisions[d]->indices[i] >= 0)
+                w.n_spec++;
+
+    w.matched = malloc(w.n_spec + 1);
+    if(n_spec == NULL || plan == NULL || w.matched == NULL)
+        error("query_msz: malloc() error.\n");
+
+    if(w.n_spec == 0)
+        error("query_msz: No spectra found in file.\n");
+
+    for(d = 0, k = 0; d < n_divisions; d++)
+    {
+        division_t* div = divisions->divisions[d];
+        for(i = 0; i < div->mz->total_spec; i++)
+        {
+            if(div->indices[i] < 0)
+                continue;
+            w.matched[k] = (char)match_query(query, div, i);
+            w.n_matched += w.matched[k++];
+            n_spec[d]++;
+        }
+        if(n_spec[d] > 0)
+            last = d;
+    }
+
+    // A division is passed through while the walk is in a spectrum not matching: the division's own
+    // spectra neither match nor end the file, and the spectrum preceding it did not match either.
+    for(d = 0, k = 0; d < n_divisions; d++)
+    {
+        int matches = 0, entering_match = (k == 0) || w.matched[k - 1];
+        for(i = 0; i < n_spec[d]; i++)
+            matches |= w.matched[k + i];
+        k += n_spec[d];
+
+        if(matches || d > last)
+            plan[d] = 2;
+        else
+            plan[d] = (d == last || entering_match) ? 1 : 0;
+        n_decmp += plan[d] != 0;
+        n_full += plan[d] == 2;
+    }
+
+    print("\tMatched %ld of %ld spectra, decompressing %d of %d divisions (%d xml only).\n",
+          w.n_matched, w.n_spec, n_full, n_divisions, n_decmp - n_full);
+
+    ZSTD_DCtx* dctx = alloc_dctx();
+    decompress_args_t** batch = malloc(sizeof(decompress_args_t*) * arguments->threads);
+    int decompressed = 0; // divisions up to which the full decompressions were started
+
+    if(batch == NULL)
+        error("query_msz: malloc() error.\n");
+
+    for(d = 0; d < n_divisions; d++)
+    {
+        if(plan[d] == 2)
+        {
+            if(decompressed <= d) // decompress the next divisions needed in full, up to one per thread within max_memory
+            {
+                int n = 0;
+                long in_flight = 0;
+                for(decompressed = d; decompressed < n_divisions && n < arguments->threads; decompressed++)
+                {
+                    if(plan[decompressed] != 2)
+                        continue;
+                    long cost = decompress_cost(args[decompressed]);
+                    if(!within_budget(in_flight, cost, n))
+                        break;
+                    in_flight += cost;
+                    batch[n++] = args[decompressed];
+                }
+                run_decompress_routines(batch, n);
+            }
+            walk_query_text(&w, args[d]->ret, args[d]->ret + args[d]->ret_len);
+        }
+        else if(plan[d] == 1 && args[d]->xml_blk != NULL)
+        {
+            char* xml = (char*)decmp_block(df->xml_decompression_fun, dctx, input_map, args[d]->xml_blk);
+            walk_query_text(&w, xml, xml + args[d]->xml_blk->original_size);
+            free(xml);
+        }
+        else
+            w.spec_k += n_spec[d];
+        dealloc_decompress_args(args[d]);
+    }
+
+    ZSTD_freeDCtx(dctx);
+    free(batch);
+    free(args);
+    free(df);
+    dealloc_toc(toc);
+    dealloc_read_divisions(divisions);
+    free(plan);
+    free(n_spec);
+    free(w.matched);
+
+    return w.n_matched;
+}
@@ -171,6 +171,24 @@ read_from_file(int fd, void* buff, size_t n)
     return total_read;
 }
 
+void
+set_offset(int fd, long offset)
+/**
+ * @brief Sets the position get_offset reports for fd, e.g. to make the positions of an msz written
+ *        within an archive relative to its start (see archive_mzml).
+ */
+{
+  for(int i = 0; i < 3; i++)
+  {
+    if(fds[i] == fd)
+    {
+      fd_pos[i] = offset;
+      return;
+    }
+  }
+  error("set_offset: invalid fd\n");
+}
+
 long
 get_offset(int fd)
 {
@@ -261,7 +279,7 @@ data_format_t* deserialize_df(char* buff)
 }
 
 void
-write_header(int fd, data_format_t* df, long blocksize, char* md5)
+write_header(int fd, data_format_t* df, long blocksize, char* checksum)
 /**
  * @brief Writes .msz header to file descriptor.
  * Header format:
@@ -274,7 +292,7 @@ write_header(int fd, data_format_t* df, long blocksize, char* md5)
  *              | Message Tag               | 128  bytes |     12    |
  *              | Source m/z format         |   4  bytes |    140    |
  *              | Source intensity format   |   4  bytes |    144    |
- *              | Source compression format |   4  bytes |    148    |
+ *              | Source m/z compression    |   4  bytes |    148    |
  *              | Source spectrum count     |   4  bytes |    152    |
  *              | Target XML format         |   4  bytes |    156    |
  *              | Target m/z format         |   4  bytes |    160    |
@@ -282,8 +300,15 @@ write_header(int fd, data_format_t* df, long blocksize, char* md5)
  *              | mz scale factor           |   4  bytes |    168    |
  *              | int scale factor          |   4  bytes |    172    |
  *              | Blocksize                 |   8  bytes |    176    |
- *              | MD5                       |  32  bytes |    184    |
- *              | Reserved                  |  296 bytes |    216    |
+ *              | Checksum                  |  32  bytes |    184    |
+ *              | Source inten. compression |   4  bytes |    216    |
+ *              | Extra array count         |   4  bytes |    220    |
+ *              | Extra array types         |  32  bytes |    224    |
+ *              | Extra array formats       |  32  bytes |    256    |
+ *              | Extra array compressions  |  32  bytes |    288    |
+ *              | Chromatogram formats      |   8  bytes |    320    |
+ *              | Chromatogram compressions |   8  bytes |    328    |
+ *              | Reserved                  |  176 bytes |    336    |
  *              |====================================================|
  *              | Total Size                |  512 bytes |           |
  *              |====================================================|
@@ -306,16 +331,51 @@ write_header(int fd, data_format_t* df, long blocksize, char* md5)
 
     char* df_buff = serialize_df(df);
     memcpy(header_buff + DATA_FORMAT_T_OFFSET, df_buff, DATA_FORMAT_T_SIZE);
+    free(df_buff);
 
     memcpy(header_buff + BLOCKSIZE_OFFSET, &blocksize, sizeof(blocksize));
 
-    memcpy(header_buff + MD5_OFFSET, md5, MD5_SIZE);
+    memcpy(header_buff + CHECKSUM_OFFSET, checksum, CHECKSUM_SIZE);
+
+    memcpy(header_buff + INTEN_COMPRESSION_OFFSET, &df->source_inten_compression, sizeof(uint32_t));
+
+    char* extra_buff = header_buff + EXTRA_ARRAYS_OFFSET;
+    memcpy(extra_buff, &df->n_extra_arrays, sizeof(uint32_t));
+    extra_buff += sizeof(uint32_t);
+    memcpy(extra_buff, df->extra_types, sizeof(df->extra_types));
+    extra_buff += sizeof(df->extra_types);
+    memcpy(extra_buff, df->extra_fmts, sizeof(df->extra_fmts));
+    extra_buff += sizeof(df->extra_fmts);
+    memcpy(extra_buff, df->extra_compressions, sizeof(df->extra_compressions));
+
+    memcpy(header_buff + CHROM_ARRAYS_OFFSET, df->chrom_fmts, sizeof(df->chrom_fmts));
+    memcpy(header_buff + CHROM_ARRAYS_OFFSET + sizeof(df->chrom_fmts), df->chrom_compressions, sizeof(df->chrom_compressions));
 
     write_to_file(fd, header_buff, HEADER_SIZE);
 
 
 }
 
+void
+write_header_checksum(int fd, char* checksum)
+/**
+ * @brief Overwrites the checksum of the header written by write_header, once it is known.
+ *        The header is at get_offset(fd) bytes before the position of fd, which is left unchanged.
+ */
+{
+    #ifdef _WIN32
+        __int64 pos = _lseeki64(fd, 0, SEEK_CUR);
+        __int64 base = pos - get_offset(fd);
+        if (pos < 0 || base < 0 || _lseeki64(fd, base + CHECKSUM_OFFSET, SEEK_SET) < 0 ||
+            write(fd, checksum, CHECKSUM_SIZE) != CHECKSUM_SIZE || _lseeki64(fd, pos, SEEK_SET) < 0)
+            error("write_header_checksum: failed to update header.\n");
+    #else
+        off_t base = lseek(fd, 0, SEEK_CUR) - get_offset(fd);
+        if (base < 0 || pwrite(fd, checksum, CHECKSUM_SIZE, base + CHECKSUM_OFFSET) != CHECKSUM_SIZE)
+            error("write_header_checksum: failed to update header.\n");
+    #endif
+}
+
 long
 get_header_blocksize(void* input_map)
 /**
@@ -338,6 +398,23 @@ get_header_df(void* input_map)
   
   r = deserialize_df((char*)((uint8_t*)input_map + DATA_FORMAT_T_OFFSET));
 
+  memcpy(&r->source_inten_compression, (uint8_t*)input_map + INTEN_COMPRESSION_OFFSET, sizeof(uint32_t));
+
+  uint8_t* extra_buff = (uint8_t*)input_map + EXTRA_ARRAYS_OFFSET;
+  memcpy(&r->n_extra_arrays, extra_buff, sizeof(uint32_t));
+  extra_buff += sizeof(uint32_t);
+  memcpy(r->extra_types, extra_buff, sizeof(r->extra_types));
+  extra_buff += sizeof(r->extra_types);
+  memcpy(r->extra_fmts, extra_buff, sizeof(r->extra_fmts));
+  extra_buff += sizeof(r->extra_fmts);
+  memcpy(r->extra_compressions, extra_buff, sizeof(r->extra_compressions));
+
+  memcpy(r->chrom_fmts, (uint8_t*)input_map + CHROM_ARRAYS_OFFSET, sizeof(r->chrom_fmts));
+  memcpy(r->chrom_compressions, (uint8_t*)input_map + CHROM_ARRAYS_OFFSET + sizeof(r->chrom_fmts), sizeof(r->chrom_compressions));
+
+  if(r->n_extra_arrays > MAX_EXTRA_ARRAYS)
+    error("get_header_df: invalid extra array count %d.\n", r->n_extra_arrays);
+
   r->populated = 2;
 
   return r;
@@ -405,6 +482,42 @@ is_msz(void* input_map, size_t input_length)
     return 0;
 }
 
+int
+is_supported_version(void* input_map)
+/**
+ * @brief Determines if the msz file mapped in input_map was written with the format version
+ *        of this build. The version is stored after the magic tag (see write_header).
+ * 
+ * @param input_map Pointer to the memory-mapped file.
+ * 
+ * @return 1 if the format version matches. 0 otherwise.
+ */
+{
+    int* header = (int*)input_map;
+
+    return header[1] == FORMAT_VERSION_MAJOR && header[2] == FORMAT_VERSION_MINOR;
+}
+
+void
+check_format_version(void* input_map, const char* caller)
+/**
+ * @brief Exits with an error naming caller if the msz file or archive mapped in input_map was not written with
+ *        the format version of this build. Files of an older format are recompressed from their mzML.
+ */
+{
+    int* header = (int*)input_map;
+
+    if(is_supported_version(input_map))
+        return;
+
+    if(header[1] < FORMAT_VERSION_MAJOR || (header[1] == FORMAT_VERSION_MAJOR && header[2] < FORMAT_VERSION_MINOR))
+        error("%s: msz format version %d.%d was written by an older mscompress, re-compress with mscompress %s (format %d.%d).\n",
+              caller, header[1], header[2], VERSION, FORMAT_VERSION_MAJOR, FORMAT_VERSION_MINOR);
+
+    error("%s: Unsupported msz format version %d.%d (expected %d.%d), written by a newer mscompress.\n",
+          caller, header[1], header[2], FORMAT_VERSION_MAJOR, FORMAT_VERSION_MINOR);
+}
+
 int
 is_mzml(void* input_map, size_t input_length)
 /**
@@ -438,6 +551,7 @@ determine_filetype(void* input_map, size_t input_length)
  * 
  * @return COMPRESS (1) if file is a mzML file.
  *         DECOMPRESS (2) if file is a msz file.
+ *         ARCHIVE (6) if file is an archive of msz files.
  *         -1 on error.
  */
 {
@@ -450,7 +564,12 @@ determine_filetype(void* input_map, size_t input_length)
     {
         print("\t.msz file detected.\n");
         return DECOMPRESS;
-    }  
+    }
+    else if(is_archive(input_map, input_length))
+    {
+        print("\tArchive detected.\n");
+        return ARCHIVE;
+    }
     else
     {
         warning("Invalid input file.\n");
@@ -512,9 +631,9 @@ open_output_file(char* path)
   if (path)
   {
     #ifdef _WIN32
-        fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_APPEND | _O_BINARY, 0666); // open in binary mode to avoid newline translation in Windows. 
+        fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0666); // open in binary mode to avoid newline translation in Windows. Not appending, so the header can be updated (see write_header_checksum).
     #else 
-        fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0666);
+        fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
     #endif
     if(fd < 0)
       warning("Error in opening output file descriptor. (%s)\n", strerror(errno));
@@ -552,6 +671,7 @@ prepare_fds(char* input_path,
  * 
  * @param output_path Reference to output path. 
  *                    If empty, output_path will equals input_path with changed extension.
+ *                    If NULL, no output file is opened and fds[1] is set to -1.
  * 
  * @param debug_output Path of debug dump file. (Optional)
  * 
@@ -567,6 +687,7 @@ prepare_fds(char* input_path,
  * 
  * @return COMPRESS (1) if file is a mzML file.
  *         DECOMPRESS (2) if file is a msz file.
+ *         ARCHIVE (6) if file is an archive of msz files.
  *         Exit (Errno: 1) on error.
  */
 {
@@ -599,9 +720,15 @@ prepare_fds(char* input_path,
 
   type = determine_filetype(*input_map, *input_filesize);
 
-  if(type != COMPRESS && type != DECOMPRESS)
+  if(type != COMPRESS && type != DECOMPRESS && type != ARCHIVE)
     error("Cannot determine file type.\n");
 
+  if(output_path == NULL)
+  {
+    fds[1] = -1;
+    return type;
+  }
+
   if(*output_path)
   {
     output_fd = open_output_file(*output_path);
@@ -611,7 +738,7 @@ prepare_fds(char* input_path,
 
   if(type == COMPRESS)
     *output_path = change_extension(input_path, ".msz\0");
-  else if(type == DECOMPRESS)
+  else if(type == DECOMPRESS || type == ARCHIVE)
     *output_path = change_extension(input_path, ".mzML\0");
 
    output_fd = open_output_file(*output_path);
@@ -1,5 +1,6 @@
 #include "mscompress.h"
 
 int verbose = 0;
+long max_memory = 0;
 int fds[3] = {-1, -1, -1};
 long fd_pos[3] = {0, 0, 0};
\ No newline at end of file
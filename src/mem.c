@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "mscompress.h"
 
 data_block_t*
@@ -84,7 +85,7 @@ alloc_cmp_block(char* mem, size_t size, size_t original_size)
  * 
  * @param size Length of the compressed block.
  * 
- * @returns A populated cmp_block_t struct with contents of compressed block.
+ * @returns A populated cmp_block_t struct with contents of compressed block and its hash (see toc_entry_t).
  * 
  */
 {
@@ -107,6 +108,8 @@ alloc_cmp_block(char* mem, size_t size, size_t original_size)
     r->size = size;
     r->max_size = size;
     r->original_size = original_size;
+    r->restored_size = original_size;
+    r->hash = xxh64(mem, size, 0);
     return r;
 }
 
@@ -125,3 +128,333 @@ dealloc_cmp_block(cmp_block_t* blk)
         error("dealloc_cmp_block: NULL pointer passed to dealloc_cmp_block.\n");
     return;
 }
+
+
+/*
+    Worker arenas.
+
+    The compress and decompress routines decode, transform and encode every binary into short-lived buffers.
+    Each worker gets an arena of its own (get_arenas) and makes it the arena of its thread (set_thread_arena):
+    the scratch_* functions used by the algo, decode, encode and zlib layers then bump-allocate from it, and
+    the routine resets it after every binary and at the end of its division. Without an arena, scratch_*
+    fall back to malloc and free.
+*/
+
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define CHUNK_DATA(c) ((char*)(c) + ARENA_ROUND(sizeof(arena_chunk_t)))
+
+#ifdef _WIN32
+static __declspec(thread) arena_t* thread_arena = NULL;
+#else
+static __thread arena_t* thread_arena = NULL;
+#endif
+
+static arena_t** arenas = NULL;
+static int n_arenas = 0;
+
+arena_t*
+alloc_arena()
+{
+    arena_t* r = calloc(1, sizeof(arena_t));
+
+    if(r == NULL)
+        error("alloc_arena: Failed to allocate arena.\n");
+
+    return r;
+}
+
+void
+dealloc_arena(arena_t* arena)
+{
+    arena_chunk_t *c, *next;
+
+    if(arena == NULL)
+        return;
+
+    for(c = arena->first; c != NULL; c = next)
+    {
+        next = c->next;
+        free(c);
+    }
+    free(arena);
+}
+
+void*
+arena_alloc(arena_t* arena, size_t size)
+/**
+ * @brief Allocates size bytes from arena, aligned to ARENA_ALIGN. The size is stored in the ARENA_ALIGN bytes
+ *        in front of the allocation (see scratch_realloc).
+ */
+{
+    size_t need = ARENA_ROUND(size) + ARENA_ALIGN;
+    arena_chunk_t* c = arena->current;
+
+    if(c == NULL || c->used + need > c->size)
+    {
+        // Chunks after the current one are empty: reuse the next one if it is large enough.
+        if(c != NULL && c->next != NULL && c->next->size >= need)
+            c = c->next;
+        else
+        {
+            size_t chunk_size = (need > ARENA_CHUNK_SIZE) ? need : ARENA_CHUNK_SIZE;
+            arena_chunk_t* n = malloc(ARENA_ROUND(sizeof(arena_chunk_t)) + chunk_size);
+            if(n == NULL)
+                error("arena_alloc: Failed to allocate %ld bytes.\n", (long)chunk_size);
+            n->size = chunk_size;
+            n->used = 0;
+            if(c == NULL)
+            {
+                n->next = arena->first;
+                arena->first = n;
+            }
+            else
+            {
+                n->next = c->next;
+                c->next = n;
+            }
+            c = n;
+        }
+        arena->current = c;
+    }
+
+    char* r = CHUNK_DATA(c) + c->used;
+    *(size_t*)r = size;
+    c->used += need;
+
+    return r + ARENA_ALIGN;
+}
+
+arena_mark_t
+arena_mark(arena_t* arena)
+/**
+ * @brief Current position of arena, to be passed to arena_reset. arena may be NULL.
+ */
+{
+    arena_mark_t r = {NULL, 0};
+
+    if(arena != NULL && arena->current != NULL)
+    {
+        r.chunk = arena->current;
+        r.used = arena->current->used;
+    }
+    return r;
+}
+
+void
+arena_reset(arena_t* arena, arena_mark_t mark)
+/**
+ * @brief Frees everything allocated from arena since mark was taken, keeping its chunks.
+ *        An empty mark ({NULL, 0}) empties the arena. arena may be NULL.
+ */
+{
+    arena_chunk_t* c;
+
+    if(arena == NULL)
+        return;
+
+    if(mark.chunk == NULL)
+    {
+        for(c = arena->first; c != NULL; c = c->next)
+            c->used = 0;
+        arena->current = arena->first;
+        return;
+    }
+
+    mark.chunk->used = mark.used;
+    for(c = mark.chunk->next; c != NULL; c = c->next)
+        c->used = 0;
+    arena->current = mark.chunk;
+}
+
+arena_t**
+get_arenas(int n)
+/**
+ * @brief Arenas of the first n workers, allocated on first use and kept until dealloc_arenas.
+ *        Only called by the thread that starts the workers, between batches.
+ */
+{
+    if(n > n_arenas)
+    {
+        arena_t** r = realloc(arenas, sizeof(arena_t*) * n);
+        if(r == NULL)
+            error("get_arenas: Failed to allocate arenas.\n");
+        arenas = r;
+        for(; n_arenas < n; n_arenas++)
+            arenas[n_arenas] = alloc_arena();
+    }
+    return arenas;
+}
+
+void
+dealloc_arenas()
+{
+    for(int i = 0; i < n_arenas; i++)
+        dealloc_arena(arenas[i]);
+    free(arenas);
+    arenas = NULL;
+    n_arenas = 0;
+}
+
+void
+set_thread_arena(arena_t* arena)
+/**
+ * @brief Makes arena the arena of the calling thread for scratch_* (NULL for malloc and free).
+ */
+{
+    thread_arena = arena;
+}
+
+static arena_chunk_t*
+arena_owner(arena_t* arena, void* ptr)
+{
+    for(arena_chunk_t* c = arena->first; c != NULL; c = c->next)
+        if((char*)ptr >= CHUNK_DATA(c) && (char*)ptr < CHUNK_DATA(c) + c->size)
+            return c;
+    return NULL;
+}
+
+static int
+is_last_alloc(arena_chunk_t* c, void* ptr)
+{
+    return (char*)ptr + ARENA_ROUND(*(size_t*)((char*)ptr - ARENA_ALIGN)) == CHUNK_DATA(c) + c->used;
+}
+
+void*
+scratch_alloc(size_t size)
+/**
+ * @brief malloc() from the arena of the calling thread, if it has one.
+ */
+{
+    if(thread_arena != NULL)
+        return arena_alloc(thread_arena, size);
+    return malloc(size);
+}
+
+void*
+scratch_calloc(size_t n, size_t size)
+{
+    if(thread_arena == NULL)
+        return calloc(n, size);
+
+    void* r = arena_alloc(thread_arena, n * size);
+    memset(r, 0, n * size);
+    return r;
+}
+
+void*
+scratch_realloc(void* ptr, size_t size)
+/**
+ * @brief realloc() of a buffer of scratch_alloc. The last allocation of a chunk grows in place.
+ */
+{
+    arena_chunk_t* c;
+
+    if(ptr == NULL)
+        return scratch_alloc(size);
+    if(thread_arena == NULL || (c = arena_owner(thread_arena, ptr)) == NULL)
+        return realloc(ptr, size);
+
+    size_t* header = (size_t*)((char*)ptr - ARENA_ALIGN);
+    size_t old_size = *header;
+
+    if(is_last_alloc(c, ptr) && c->used - ARENA_ROUND(old_size) + ARENA_ROUND(size) <= c->size)
+    {
+        c->used = c->used - ARENA_ROUND(old_size) + ARENA_ROUND(size);
+        *header = size;
+        return ptr;
+    }
+    if(size <= old_size)
+        return ptr;
+
+    void* r = arena_alloc(thread_arena, size);
+    memcpy(r, ptr, old_size);
+    return r;
+}
+
+void
+scratch_free(void* ptr)
+/**
+ * @brief free() of a buffer of scratch_alloc. Arena memory is reclaimed when the arena is reset, or at once
+ *        if ptr is the last allocation of its chunk.
+ */
+{
+    arena_chunk_t* c;
+
+    if(ptr == NULL)
+        return;
+    if(thread_arena == NULL || (c = arena_owner(thread_arena, ptr)) == NULL)
+    {
+        free(ptr);
+        return;
+    }
+    if(is_last_alloc(c, ptr))
+        c->used -= ARENA_ROUND(*(size_t*)((char*)ptr - ARENA_ALIGN)) + ARENA_ALIGN;
+}
+
+/*
+    Memory budget (--max-memory).
+
+    The memory of an operation is dominated by the divisions in flight: each worker holds the staged and
+    compressed blocks of its division, or the decompressed blocks and the restored text, until the batch is
+    written. Callers estimate the cost of each division (see compress_cost, decompress_cost) and budget_batch
+    starts no more divisions at once than fit max_memory, so a smaller budget runs fewer workers at a time
+    instead of failing. Compression also shrinks the divisions to keep all threads busy (see budget_blocksize).
+*/
+
+long
+budget_blocksize(long blocksize, int threads)
+/**
+ * @brief Largest blocksize, up to blocksize, of which threads divisions fit max_memory at once.
+ *        Divisions are not made smaller than MIN_BUDGET_BLOCKSIZE; budget_batch then runs fewer at a time.
+ */
+{
+    long fit;
+
+    if(max_memory <= 0 || threads < 1)
+        return blocksize;
+
+    // A division is staged, decoded and compressed: about three copies of it (see compress_cost).
+    fit = (max_memory / threads - WORKER_MEMORY) / 3;
+    if(fit < MIN_BUDGET_BLOCKSIZE)
+        fit = MIN_BUDGET_BLOCKSIZE;
+
+    return (fit < blocksize) ? fit : blocksize;
+}
+
+int
+within_budget(long in_flight, long cost, int n)
+/**
+ * @brief Whether a division costing cost bytes can join a batch of n divisions costing in_flight bytes.
+ *        The first division of a batch always can, so a division over the budget runs alone.
+ */
+{
+    static int warned = 0; // budgets are only checked by the thread starting the workers
+
+    if(n == 0 && max_memory > 0 && cost > max_memory && !warned)
+    {
+        warning("A division needs about %ld bytes, over --max-memory, running such divisions alone.\n", cost);
+        warned = 1;
+    }
+
+    return n == 0 || max_memory <= 0 || in_flight + cost <= max_memory;
+}
+
+int
+budget_batch(long* costs, int n, int threads)
+/**
+ * @brief Number of the next n divisions, costing costs[0..n-1] bytes, to run at once: at most threads,
+ *        and as many as fit max_memory.
+ */
+{
+    long in_flight = 0;
+    int r;
+
+    for(r = 0; r < n && r < threads; r++)
+    {
+        if(!within_budget(in_flight, costs[r], r))
+            break;
+        in_flight += costs[r];
+    }
+
+    return r;
+}
@@ -1,16 +1,17 @@
 #include <zstd.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include "../vendor/zlib/zlib.h"
 
-#define VERSION "0.0.1"
+#define VERSION "0.1.0"
 #define STATUS "Dev"
-#define MIN_SUPPORT "0.1"
-#define MAX_SUPPORT "0.1"
+#define MIN_SUPPORT "1.1"
+#define MAX_SUPPORT "1.1"
 #define ADDRESS "chrisagrams@gmail.com"
 
 #define FORMAT_VERSION_MAJOR 1
-#define FORMAT_VERSION_MINOR 0
+#define FORMAT_VERSION_MINOR 1
 
 #define BUFSIZE 4096
 #define ZLIB_BUFF_FACTOR 1024000 //initial size of zlib buffer
@@ -18,8 +19,28 @@
 #define ZLIB_TYPE uint32_t // type and size of header used for encode/decode
 #define ZLIB_SIZE_OFFSET sizeof(ZLIB_TYPE)
 
+#define ZLIB_PARAMS_TYPE uint8_t // deflate parameters recorded with lossless zlib binaries
+#define ZLIB_PARAMS_OFFSET sizeof(ZLIB_PARAMS_TYPE)
+#define ZLIB_HEADER_SIZE (ZLIB_SIZE_OFFSET + ZLIB_PARAMS_OFFSET)
+#define ZLIB_PARAMS(level, strategy) (((strategy) << 4) | (level))
+#define ZLIB_PARAMS_LEVEL(params) ((params) & 0x0F)
+#define ZLIB_PARAMS_STRATEGY(params) (((params) >> 4) & 0x0F)
+#define ZLIB_PARAMS_DEFAULT ZLIB_PARAMS(6, Z_DEFAULT_STRATEGY)
+#define ZLIB_PARAMS_RAW 0xFF // no parameters reproduce the source stream, it is stored as-is
+#define ZLIB_PARAMS_MAX_MISSES 16 // stop searching after this many consecutive irreproducible streams
+#define ZLIB_AUTO -2 // restore the deflate parameters recorded at compression
+
 #define REALLOC_FACTOR 1.1 // realloc factor for zlib buffer
 
+#define ARENA_CHUNK_SIZE 4194304 // minimum size of a chunk of a worker arena (see mem.c)
+#define ARENA_ALIGN 16           // alignment of arena allocations, also the size of their header
+
+#define RING_SPINS 64            // times a thread waiting on a block_ring_t yields before sleeping
+#define RING_SLEEP_NS 100000     // sleep of a thread waiting on a block_ring_t (see queue.c)
+
+#define WORKER_MEMORY 16777216         // estimated fixed memory of a worker: zstd context, z_streams, arena chunk (see budget_batch)
+#define MIN_BUDGET_BLOCKSIZE 1000000   // smallest blocksize --max-memory shrinks divisions to
+
 #define MAGIC_TAG 0x035F51B5
 #define MESSAGE "MS Compress Format 1.0 Gao Laboratory at UIC"
 
@@ -28,10 +49,19 @@
 #define DATA_FORMAT_T_OFFSET 140
 #define DATA_FORMAT_T_SIZE   36   /* ignores private members (serialized)*/
 #define BLOCKSIZE_OFFSET     176
-#define MD5_OFFSET           184
-#define MD5_SIZE             32
+#define CHECKSUM_OFFSET      184
+#define CHECKSUM_SIZE        32
+#define INTEN_COMPRESSION_OFFSET 216
+#define EXTRA_ARRAYS_OFFSET  220
+#define CHROM_ARRAYS_OFFSET  320
 #define HEADER_SIZE          512
 
+#define ARCHIVE_MAGIC       0x035F51B6  /* multi-run archive (archive.c) */
+#define ARCHIVE_HEADER_SIZE 64
+#define ARCHIVE_NAME_SIZE   240
+#define ARCHIVE_DICT_SIZE   (128 * 1024) /* XML of the first run shared by the runs of an archive */
+#define ARCHIVE_DICT_LEVEL  19           /* zstd level of the stored dictionary */
+
 #define DEBUG 0
 
 #define _32i_ 1000519
@@ -46,6 +76,8 @@
 #define _intensity_ 1000515
 #define _mass_      1000514
 #define _xml_       1000513 //TODO: change this
+#define _extra_     1000786 // any other binary data array (ion mobility, charge, noise, ...)
+#define _chrom_     1000626 // time and intensity arrays of chromatograms
 
 #define _lossless_          4700000
 #define _ZSTD_compression_  4700001
@@ -61,22 +93,66 @@
 #define _cast_64_to_16_      4700011
 
 #define _LZ4_compression_   4700012
+#define _abs_bound_         4700013
+#define _ppm_bound_         4700014
+#define _rel_bound_         4700015
+#define _sparse_            4700016
+#define _grid_              4700017
+#define _xml_struct_        4700018 /* structural XML coding (xml.c) followed by ZSTD, XML stream only */
+#define _ZSTD_dict_         4700019 /* ZSTD with the shared dictionary of an archive (archive.c), XML stream only */
 
 #define ERROR_CHECK 1       /* If defined, runtime error checks will be enabled. */
 
+#define MAX_EXTRA_ARRAYS 8  /* binary arrays per spectrum, beyond m/z and intensity, stored in their own streams */
+#define CHROM_ARRAYS 2      /* binary arrays per chromatogram stored in their own streams: time and intensity */
+
+#define TOC_MAGIC   0x434F5453  /* "STOC" */
+#define TOC_XML     0
+#define TOC_MZ      1
+#define TOC_INTEN   2
+#define TOC_EXTRA   3                                   /* + extra array index */
+#define TOC_CHROM   (TOC_EXTRA + MAX_EXTRA_ARRAYS)      /* + chromatogram array index */
+#define TOC_STREAMS (TOC_CHROM + CHROM_ARRAYS)
+
 #define COMPRESS 1
 #define DECOMPRESS 2
 #define EXTRACT 3
+#define LIST 4
+#define QUERY 5
+#define ARCHIVE 6
+#define TRANSCODE 7
+#define VERIFY 8
+
+/* Source format and compression of a binary that differs from the defaults of its array in data_format_t,
+   stored per binary in data_positions_t formats. 0 stands for the defaults. */
+#define BINARY_DESC(fmt, comp) ((uint8_t)(((fmt) - _32i_ + 1) | ((comp) == _zlib_ ? 0x10 : 0)))
+#define BINARY_DESC_FMT(desc)  ((uint32_t)((desc) & 0x0F) + _32i_ - 1)
+#define BINARY_DESC_COMP(desc) (((desc) & 0x10) ? _zlib_ : _no_comp_)
 
 #define MSLEVEL 0x01
 #define SCANNUM 0x02
 #define RETTIME 0x04
+#define PRECURSOR 0x08
+#define METADATA (MSLEVEL|SCANNUM|RETTIME|PRECURSOR) /* spectrum metadata stored in msz (see write_metadata) */
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 extern int verbose;
+extern long max_memory; // memory budget of --max-memory in bytes, 0 for none
+
+/* Selection of spectra from an msz by their metadata (see query_msz). Criteria left unset match any spectrum. */
+typedef struct
+{
+    int has_rt;
+    double rt_min, rt_max;      // retention time window, in seconds
+    long ms_level;              // 0 for any, -1 for levels above 2
+    long* scans;                // ascending scan numbers, NULL for any
+    long scans_length;
+    int has_mz;
+    double mz_min, mz_max;      // precursor m/z window
+} query_t;
 
 struct Arguments {
     int verbose;
@@ -85,6 +161,7 @@ struct Arguments {
     char* mz_lossy;
     char* int_lossy;
     long blocksize;
+    long max_memory;    // --max-memory in bytes, 0 for no limit
     char* input_file;
     char* output_file;
     float mz_scale_factor;
@@ -100,6 +177,20 @@ struct Arguments {
     int target_inten_format;
 
     int zstd_compression_level;
+
+    int zlib_compression_level;
+    int zlib_strategy;
+
+    int list;
+    int checksum;
+    char* archive;      // output of --archive, whose inputs are input_files
+    char** input_files;
+    int n_input_files;
+    char* run;          // run of an archive, by name or index
+    int transcode;
+    int verify;
+    char* verify_source; // mzML compared to the output of --verify, NULL otherwise
+    query_t* query;
 };
 
 typedef void (*Algo)(void*);
@@ -122,8 +213,19 @@ typedef struct
     /* source information (source mzML) */
     uint32_t source_mz_fmt;
     uint32_t source_inten_fmt;
-    uint32_t source_compression;
+    uint32_t source_compression;        // compression of the m/z binaries
     uint32_t source_total_spec;
+    uint32_t source_inten_compression;  // compression of the intensity binaries (header INTEN_COMPRESSION_OFFSET)
+
+    /* binary arrays following m/z and intensity in the first spectrum (header EXTRA_ARRAYS_OFFSET) */
+    uint32_t n_extra_arrays;
+    uint32_t extra_types[MAX_EXTRA_ARRAYS];        // accession of the array type (e.g. MS:1002816 mean ion mobility array)
+    uint32_t extra_fmts[MAX_EXTRA_ARRAYS];
+    uint32_t extra_compressions[MAX_EXTRA_ARRAYS];
+
+    /* time and intensity arrays of the first chromatogram, 0 if none (header CHROM_ARRAYS_OFFSET) */
+    uint32_t chrom_fmts[CHROM_ARRAYS];
+    uint32_t chrom_compressions[CHROM_ARRAYS];
 
     /* target information (target msz)*/
     uint32_t target_xml_format;
@@ -136,6 +238,8 @@ typedef struct
 
     /* runtime variables, not written to disk. */
     int populated;
+    int mz_algo;    // algo of each array (footer mz_fmt and inten_fmt), to resolve the functions of binaries
+    int inten_algo; // whose format differs from the defaults (see BINARY_DESC).
     decode_fun_ptr decode_source_compression_mz_fun;
     decode_fun_ptr  decode_source_compression_inten_fun;
     encode_fun_ptr encode_source_compression_mz_fun;
@@ -151,6 +255,8 @@ typedef struct
     decompression_fun_ptr inten_decompression_fun;
 
     int zstd_compression_level; // no need to write to file since ZSTD_DCtx doesn't need it.
+    int zlib_compression_level; // deflate level used when restoring zlib binaries on decompression.
+    int zlib_strategy;          // deflate strategy used when restoring zlib binaries on decompression.
 
 } data_format_t;
 
@@ -159,6 +265,8 @@ typedef struct
 {
     uint64_t* start_positions;
     uint64_t* end_positions;
+    uint32_t* array_lengths; // decoded element count of each binary (defaultArrayLength), 0 if unknown.
+    uint8_t* formats;        // BINARY_DESC of each binary, 0 if it matches the data_format_t defaults. NULL if all do.
     int total_spec;
     size_t file_end; //TODO: remove this
 } data_positions_t;
@@ -170,12 +278,21 @@ typedef struct
     data_positions_t* xml;
     data_positions_t* mz;
     data_positions_t* inten;
+    data_positions_t** extra; // binaries 3 to n_extra + 2 of each spectrum, one data_positions_t per extra array.
+    int n_extra;              // Spectra lacking an array have an empty binary positioned after their last one.
+    data_positions_t* chrom[CHROM_ARRAYS]; // time and intensity binaries of the chromatograms following the spectra.
 
     uint64_t size;
 
     long* scans;
     long* ms_levels;
-    float* ret_times;
+    float* ret_times;           // scan start time, in seconds
+    long* indices;              // index of each spectrum within the mzML, -1 for the padding spectra of an extraction
+    double* precursor_mzs;      // selected ion m/z of the first precursor, 0 if none
+    long* charges;              // charge state of the first precursor, 0 if unknown
+    double* isolation_targets;  // isolation window target m/z of the first precursor, 0 if none
+    float* isolation_lower;     // isolation window lower and upper offsets
+    float* isolation_upper;
 
 } division_t;
 
@@ -195,6 +312,27 @@ typedef struct
     size_t max_size;
 } data_block_t;
 
+typedef struct arena_chunk_t
+{
+    struct arena_chunk_t* next;
+    size_t size;                // usable bytes
+    size_t used;
+} arena_chunk_t;
+
+/* Bump allocator of a worker. Chunks are kept when the arena is reset, so a worker reuses its memory from
+   one spectrum and division to the next. */
+typedef struct
+{
+    arena_chunk_t* first;
+    arena_chunk_t* current;
+} arena_t;
+
+typedef struct
+{
+    arena_chunk_t* chunk;
+    size_t used;
+} arena_mark_t;
+
 
 typedef struct cmp_block_t
 {
@@ -202,6 +340,8 @@ typedef struct cmp_block_t
     size_t size;
     size_t original_size;
     size_t max_size;
+    uint64_t hash;             // XXH64 of the compressed block.
+    size_t restored_size;      // length of the text the block restores to (see toc_entry_t).
 
     struct cmp_block_t* next;
 } cmp_block_t;
@@ -215,23 +355,30 @@ typedef struct
     int populated;
 } cmp_blk_queue_t;
 
-
-typedef struct block_len_t
+/* Block handed from a worker to the writer thread through a block_ring_t. */
+typedef struct
 {
-    size_t original_size;
-    size_t compressed_size;
-    struct block_len_t* next;
-
-} block_len_t;
+    long index;         // division of the block
+    void* data;         // block or arguments of the division, owned by the consumer once popped
+} ring_desc_t;
 
-
-typedef struct 
+typedef struct
 {
-    block_len_t* head;
-    block_len_t* tail;
+    uint64_t sequence;  // position the slot is ready for: to be filled at pos, to be read at pos + 1
+    ring_desc_t desc;
+} ring_slot_t;
 
-    int populated;
-} block_len_queue_t;
+/* Bounded multi-producer single-consumer ring of block descriptors (see queue.c). */
+typedef struct
+{
+    ring_slot_t* slots;
+    uint64_t mask;       // capacity - 1, capacity being a power of 2
+    char pad0[64];
+    uint64_t head;       // next position claimed by a producer
+    char pad1[64];
+    uint64_t tail;       // next position read by the consumer
+    uint64_t consumed;   // descriptors the consumer is done with (see ring_done, ring_wait)
+} block_ring_t;
 
 
 typedef struct
@@ -239,9 +386,7 @@ typedef struct
     uint64_t xml_pos;          // msz file position of start of compressed XML data.
     uint64_t mz_binary_pos;    // msz file position of start of compressed m/z binary data.
     uint64_t inten_binary_pos;   // msz file position of start of compressed int binary data.
-    uint64_t xml_blk_pos;
-    uint64_t mz_binary_blk_pos;
-    uint64_t inten_binary_blk_pos;
+    uint64_t toc_pos;            // msz file position of the table of contents of the blocks (see write_toc).
     uint64_t divisions_t_pos;
     size_t num_spectra;
     uint64_t original_filesize;
@@ -249,8 +394,76 @@ typedef struct
     int magic_tag;
     int mz_fmt;
     int inten_fmt;
+    int n_extra_arrays;
+    uint64_t extra_binary_pos[MAX_EXTRA_ARRAYS];     // msz file position of start of compressed binary data of each extra array.
+    int n_chrom_arrays;                              // CHROM_ARRAYS if the file has chromatograms, 0 otherwise.
+    uint64_t chrom_binary_pos[CHROM_ARRAYS];         // msz file position of start of compressed chromatogram binary data.
+    uint64_t metadata_pos;                           // msz file position of the spectrum metadata table.
+    uint64_t checksum_pos;                           // msz file position of the checksum table, 0 without checksums.
 } footer_t;
 
+typedef struct
+{
+    uint64_t offset;   // position of the division in the original mzML.
+    uint64_t length;
+    uint64_t hash;     // XXH64 of the division.
+} checksum_t;
+
+/*
+    Table of contents: a toc_header_t followed by one toc_entry_t per stream and division, streams in
+    the order they are written (xml, m/z, intensity, extra arrays, chromatogram arrays). Fields are
+    little-endian and 8-byte aligned in the file, so little-endian hosts read the table in place from the
+    mapping (see toc.c).
+*/
+typedef struct
+{
+    uint32_t magic;        // TOC_MAGIC
+    uint32_t entry_size;   // sizeof(toc_entry_t)
+    uint32_t n_streams;
+    uint32_t n_divisions;
+} toc_header_t;
+
+typedef struct
+{
+    uint64_t offset;            // msz file position of the compressed block, 0 if the division has none in this stream.
+    uint64_t compressed_size;
+    uint64_t original_size;
+    uint64_t restored_size;     // length of the text the block restores to (see restored_length).
+    uint64_t first_spectrum;    // index of the first spectrum of the division.
+    uint64_t hash;              // XXH64 of the compressed block.
+    uint32_t stream;            // TOC_XML, TOC_MZ, TOC_INTEN, TOC_EXTRA + array, TOC_CHROM + array.
+    uint32_t codec;             // accession of the compression of the block (e.g. _ZSTD_compression_).
+    uint32_t division;
+    uint32_t n_spectra;
+} toc_entry_t;
+
+typedef struct
+{
+    toc_header_t* header;
+    toc_entry_t* entries;
+    int slots[TOC_STREAMS];     // position of each stream in the table, -1 if absent.
+    void* copy;                 // byte-swapped copy of the table on big-endian hosts, NULL when read in place.
+} toc_t;
+
+/* Run of an archive: a complete msz whose positions are relative to offset. */
+typedef struct
+{
+    uint64_t offset;
+    uint64_t size;
+    uint64_t original_size;     // size of the mzML
+    char name[ARCHIVE_NAME_SIZE];
+} archive_entry_t;
+
+typedef struct
+{
+    uint64_t dict_pos;          // shared XML dictionary compressed with zstd, dict_size 0 if none.
+    uint64_t dict_size;
+    uint64_t dict_original_size;
+    uint64_t directory_pos;     // archive_entry_t of each run
+    uint32_t n_runs;
+    uint32_t magic;
+} archive_footer_t;
+
 
 typedef struct
 {
@@ -270,6 +483,9 @@ int set_mz_lossy(struct Arguments* args, const char* mz_lossy);
 int set_int_lossy(struct Arguments* args, const char* int_lossy);
 int set_mz_scale_factor(struct Arguments* args, const char* scale_factor_str);
 int set_int_scale_factor(struct Arguments* args, const char* scale_factor_str);
+int set_zlib_compression_level(struct Arguments* args, const char* level_str);
+int set_zlib_strategy(struct Arguments* args, const char* strategy);
+int set_query(struct Arguments* args, const char* query);
 void set_compress_runtime_variables(struct Arguments* args, data_format_t* df);
 void set_decompress_runtime_variables(struct Arguments* args, data_format_t* df, footer_t* msz_footer);
 
@@ -282,8 +498,10 @@ int remove_mapping(void* addr, int fd);
 size_t get_filesize(char* path);
 size_t write_to_file(int fd, char* buff, size_t n);
 size_t read_from_file(int fd, void* buff, size_t n);
-void write_header(int fd, data_format_t* df, long blocksize, char* md5);
+void write_header(int fd, data_format_t* df, long blocksize, char* checksum);
+void write_header_checksum(int fd, char* checksum);
 long get_offset(int fd);
+void set_offset(int fd, long offset);
 long get_header_blocksize(void* input_map);
 data_format_t* get_header_df(void* input_map);
 void write_footer(footer_t* footer, int fd);
@@ -295,6 +513,8 @@ int open_file(char* path);
 int open_output_file(char* path);
 int is_mzml(void* input_map, size_t input_length);
 int is_msz(void* input_map, size_t input_length);
+int is_supported_version(void* input_map);
+void check_format_version(void* input_map, const char* caller);
 int close_file(int fd);
 
 /* mem.c */
@@ -304,6 +524,21 @@ data_block_t* realloc_data_block(data_block_t* db, size_t new_size);
 void dealloc_data_block(data_block_t* db);
 cmp_block_t* alloc_cmp_block(char* mem, size_t size, size_t original_size);
 void dealloc_cmp_block(cmp_block_t* blk);
+arena_t* alloc_arena();
+void dealloc_arena(arena_t* arena);
+void* arena_alloc(arena_t* arena, size_t size);
+arena_mark_t arena_mark(arena_t* arena);
+void arena_reset(arena_t* arena, arena_mark_t mark);
+arena_t** get_arenas(int n);
+void dealloc_arenas();
+void set_thread_arena(arena_t* arena);
+void* scratch_alloc(size_t size);
+void* scratch_calloc(size_t n, size_t size);
+void* scratch_realloc(void* ptr, size_t size);
+void scratch_free(void* ptr);
+long budget_blocksize(long blocksize, int threads);
+int within_budget(long in_flight, long cost, int n);
+int budget_batch(long* costs, int n, int threads);
 
 /* preprocess.c */
 
@@ -321,17 +556,27 @@ void dump_ddp(data_positions_t** ddp, int divisions, int fd);
 data_positions_t** read_ddp(void* input_map, long position);
 void dealloc_df(data_format_t* df);
 void dealloc_dp(data_positions_t* dp);
+void dealloc_divisions(divisions_t* divisions);
 void write_divisions(divisions_t* divisions, int fd);
+void write_metadata(divisions_t* divisions, int compression_level, int fd);
+void read_metadata(void* input_map, footer_t* footer, divisions_t* divisions);
 divisions_t* read_divisions(void* input_map, long position, int n_divisions);
+void dealloc_read_divisions(divisions_t* divisions);
 divisions_t* create_divisions(division_t* div, long n_divisions);
 data_positions_t** join_xml(divisions_t* divisions);
 data_positions_t** join_mz(divisions_t* divisions);
 data_positions_t** join_inten(divisions_t* divisions);
+data_positions_t** join_extra(divisions_t* divisions, int array);
+data_positions_t** join_chrom(divisions_t* divisions, int array);
+data_positions_t* get_division_array(division_t* div, int array);
+int resolve_division_array(division_t* div, int array, int64_t* bin_i);
+int next_division_array(division_t* div, int array);
 long* string_to_array(char* str, long* size);
 void map_scan_to_index(struct Arguments* arguments, division_t* div);
 division_t* scan_mzml(char* input_map, data_format_t* df, long end, int flags);
+division_t* scan_mzml_parallel(char* input_map, data_format_t* df, long end, int flags, int threads);
 int preprocess_mzml(char* input_map, long  input_filesize, long* blocksize, struct Arguments* arguments, data_format_t** df, divisions_t** divisions);
-void parse_footer(footer_t** footer, void* input_map, long input_filesize, block_len_queue_t**xml_block_lens, block_len_queue_t** mz_binary_block_lens, block_len_queue_t** inten_binary_block_lens, divisions_t** divisions, int* n_divisions);
+void parse_footer(footer_t** footer, void* input_map, long input_filesize, toc_t** toc, divisions_t** divisions, int* n_divisions);
 
 /* sys.c */
 
@@ -347,6 +592,7 @@ long parse_blocksize(char* arg);
 /* decode.c */
 
 void decode_base64(char* src, char* dest, size_t src_len, size_t* out_len);
+size_t get_format_size(int accession);
 decode_fun_ptr set_decode_fun(int compression_method, int algo, int accession);
 // Bytef* decode_binary(char* input_map, int start_position, int end_position, int compression_method, size_t* out_len);
 
@@ -358,18 +604,56 @@ void encode_base64(zlib_block_t* zblk, char* dest, size_t src_len, size_t* out_l
 
 // char* encode_binary(char** src, int compression_method, size_t* out_len);
 
+/* checksum.c */
+uint64_t xxh64(const void* src, size_t len, uint64_t seed);
+checksum_t* alloc_checksums(divisions_t* divisions, size_t filesize);
+void format_checksum(checksum_t* checksums, int n, char* dest);
+void write_checksums(checksum_t* checksums, int n, int fd);
+checksum_t* read_checksums(void* input_map, footer_t* footer);
+
+/* toc.c */
+toc_entry_t* alloc_toc(divisions_t* divisions, int n_streams);
+uint64_t write_toc(toc_entry_t* entries, int n_streams, int n_divisions, int fd);
+toc_t* read_toc(void* input_map, footer_t* footer);
+void dealloc_toc(toc_t* toc);
+toc_entry_t* toc_block(toc_t* toc, int stream, int division);
+int verify_block(void* input_map, toc_entry_t* blk);
+
+/* archive.c */
+void* zstd_dict_compress(ZSTD_CCtx* cctx, void* src_buff, size_t src_len, size_t* out_len, int compression_level);
+void* zstd_dict_decompress(ZSTD_DCtx* dctx, void* src_buff, size_t src_len, size_t org_len);
+void archive_mzml(char** inputs, int n_inputs, struct Arguments* arguments, int output_fd);
+int is_archive(void* input_map, size_t input_length);
+void list_runs(void* input_map, size_t input_length, FILE* stream);
+char* open_run(void* input_map, size_t input_length, char* run, size_t* run_size);
+
+/* transcode.c */
+void transcode_msz(char* input_map, size_t input_filesize, struct Arguments* arguments, int output_fd);
+
+/* xml.c */
+void* xml_struct_compress(ZSTD_CCtx* cctx, void* src_buff, size_t src_len, size_t* out_len, int compression_level);
+void* xml_struct_decompress(ZSTD_DCtx* dctx, void* src_buff, size_t src_len, size_t org_len);
+
 /* extract.c */
 void extract_mzml(char* input_map, divisions_t* divisions, int output_fd);
+int match_query(query_t* query, division_t* div, long i);
+long query_msz(char* input_map, size_t input_filesize, query_t* query, struct Arguments* arguments, int output_fd);
 
 /* compress.c */
 typedef struct 
 {
     char* input_map;
     data_positions_t* dp;
+    data_positions_t* paired_dp; // intensity positions paired with dp when compressing m/z, NULL otherwise.
     data_format_t* df;
     size_t cmp_blk_size;
     long blocksize;
     int mode;
+    int array; // index of the extra array (data_format_t extra_*) when mode is _extra_, of the chromatogram array when _chrom_.
+    checksum_t* checksum; // division checksum to compute, NULL otherwise.
+    arena_t* arena;       // scratch memory of the worker (see get_arenas), NULL for malloc.
+    block_ring_t* ring;   // ring the block is handed to the writer through (see compress_parallel), NULL to leave it in ret.
+    int division;         // index of the division in the ring.
 
     cmp_blk_queue_t* ret;
     compression_fun comp_fun;
@@ -378,8 +662,11 @@ typedef struct
     
 ZSTD_CCtx* alloc_cctx();
 void * zstd_compress(ZSTD_CCtx* cctx, void* src_buff, size_t src_len, size_t* out_len, int compression_level);
+compress_args_t* alloc_compress_args(char* input_map, data_positions_t* dp, data_positions_t* paired_dp, data_format_t* df, compression_fun comp_fun, size_t cmp_blk_size, long blocksize, int mode, int array);
+void dealloc_compress_args(compress_args_t* args);
+void dealloc_cctx(ZSTD_CCtx* cctx);
+void write_cmp_blk(cmp_block_t* blk, int fd);
 void compress_routine(void* args);
-void dump_block_len_queue(block_len_queue_t* queue, int fd); 
 void compress_mzml(char* input_map, size_t input_filesize, struct Arguments* arguments, data_format_t* df, divisions_t* divisions, int output_fd);
 int get_compress_type(char* arg);
 compression_fun set_compress_fun(int accession);
@@ -390,27 +677,41 @@ typedef struct
     char* input_map;
     int binary_encoding;
     data_format_t* df;
-    block_len_t* xml_blk;
-    block_len_t* mz_binary_blk;
-    block_len_t* inten_binary_blk;
+    toc_entry_t* xml_blk;
+    toc_entry_t* mz_binary_blk;
+    toc_entry_t* inten_binary_blk;
+    toc_entry_t* extra_binary_blk[MAX_EXTRA_ARRAYS];
+    toc_entry_t* chrom_binary_blk[CHROM_ARRAYS];
     division_t* division;
-    uint64_t footer_xml_off;
-    uint64_t footer_mz_bin_off;
-    uint64_t footer_inten_bin_off;
+    checksum_t* checksum; // expected checksum of the division, NULL to skip verification.
+    char* expected;       // expected output of the division (--verify), NULL to skip comparison.
+    size_t expected_len;
+    arena_t* arena;       // scratch memory of the worker (see get_arenas), NULL for malloc.
+    block_ring_t* ring;   // ring the worker hands its arguments to the writer through (see decompress_msz), NULL otherwise.
+    long index;           // index of the division in the ring.
 
     char* ret;
     size_t ret_len;
+    int checksum_ok;
+    int expected_ok;
 
 
 } decompress_args_t;
 
 ZSTD_DCtx* alloc_dctx();
 void * zstd_decompress(ZSTD_DCtx* dctx, void* src_buff, size_t src_len, size_t org_len);
+void * decmp_block(decompression_fun decompress_fun, ZSTD_DCtx* dctx, void* input_map, toc_entry_t* blk);
+decompress_args_t* alloc_decompress_args(char* input_map, data_format_t* df, toc_entry_t* xml_blk, toc_entry_t* mz_binary_blk, toc_entry_t* inten_binary_blk, division_t* division);
 void decompress_routine(void* args);
+void dealloc_decompress_args(decompress_args_t* args);
+decompress_args_t** prepare_decompress_args(char* input_map, data_format_t* df, toc_t* toc, divisions_t* divisions);
+void run_decompress_routines(decompress_args_t** args, int n);
+long decompress_cost(decompress_args_t* args);
 void decompress_msz(char* input_map,
     size_t input_filesize,
     struct Arguments* args,
     int fd);
+void verify_msz(char* input_map, size_t input_filesize, struct Arguments* arguments);
 decompression_fun set_decompress_fun(int accession);
 
 
@@ -427,37 +728,59 @@ typedef struct
     data_block_t* tmp;
     z_stream* z;
     float scale_factor;
+    size_t expected_len; // expected length of the decoded binary in bytes, 0 if unknown.
+    size_t decoded_len;  // compression: length of the binary last decoded by a lossy transform, in bytes.
+    z_stream* deflate_z; // compression only: deflate stream used to find the parameters of zlib binaries. NULL if not zlib.
+    int zlib_params;     // compression: last parameters found. decompression: ZLIB_AUTO to restore recorded parameters.
+    int zlib_misses;     // compression: consecutive binaries no parameters were found for.
+    double max_error;    // compression: largest error introduced by error-bounded modes (abs, ppm, rel), -1 if none.
+    int source_compression;         // accession of the source binary compression (_zlib_ or _no_comp_).
+    decode_fun_ptr paired_dec_fun;  // compression, m/z only: decodes the paired intensity binary (with header). NULL otherwise.
+    char* paired_src;               // compression, m/z only: paired intensity binary, NULL if empty.
+    size_t paired_src_len;
+    size_t paired_expected_len;
+    int paired_format;              // data format of the paired intensity binary.
+    int paired_compression;         // source compression of the paired intensity binary.
+    struct grid_refs* grid;         // m/z reference grids of the current division (see algo_decode_grid). NULL until first used.
+    Algo_ptr target_fun;            // compression: transform applied by cmp_binary_routine to the current binary.
 } algo_args;
 
 Algo_ptr set_compress_algo(int algo, int accession);
+void dealloc_grid_refs(struct grid_refs* grid);
 Algo_ptr set_decompress_algo(int algo, int accession);
 int get_algo_type(char* arg);
+int is_lossless_algo(int algo);
 
 /* queue.c */
 cmp_blk_queue_t* alloc_cmp_buff();
 void dealloc_cmp_buff(cmp_blk_queue_t* queue);
 void append_cmp_block(cmp_blk_queue_t* queue, cmp_block_t* blk);
 cmp_block_t* pop_cmp_block(cmp_blk_queue_t* queue);
-block_len_t* alloc_block_len(size_t original_size, size_t compressed_size);
-void dealloc_block_len(block_len_t* blk);
-block_len_queue_t* alloc_block_len_queue();
-void dealloc_block_len_queue(block_len_queue_t* queue);
-void append_block_len(block_len_queue_t* queue, size_t original_size, size_t compressed_size);
-block_len_t* pop_block_len(block_len_queue_t* queue);
-void dump_block_len_queue(block_len_queue_t* queue, int fd);
-block_len_queue_t* read_block_len_queue(void* input_map, long offset, long end);
+block_ring_t* alloc_ring(int capacity);
+void dealloc_ring(block_ring_t* ring);
+void ring_push(block_ring_t* ring, long index, void* data);
+int ring_try_pop(block_ring_t* ring, ring_desc_t* desc);
+ring_desc_t ring_pop(block_ring_t* ring);
+void ring_done(block_ring_t* ring);
+void ring_wait(block_ring_t* ring, uint64_t n);
 
 /* zl.c */
 
 zlib_block_t* zlib_alloc(int offset);
+zlib_block_t* zlib_alloc_sized(int offset, size_t len);
 z_stream* alloc_z_stream();
+z_stream* alloc_deflate_z_stream(int level, int strategy);
 void dealloc_z_stream(z_stream* z);
+z_stream* alloc_inflate_z_stream();
+void dealloc_inflate_z_stream(z_stream* z);
 void zlib_realloc(zlib_block_t* old_block, size_t new_size);
 void zlib_dealloc(zlib_block_t* blk);
 int zlib_append_header(zlib_block_t* blk, void* content, size_t size);
 void* zlib_pop_header(zlib_block_t* blk);
 uInt zlib_compress(z_stream* z, Bytef* input, zlib_block_t* output, uInt input_len);
 uInt zlib_decompress(z_stream* z, Bytef* input, zlib_block_t* output, uInt input_len);
+void zlib_set_params(z_stream* z, int params);
+int zlib_find_params(z_stream* z, Bytef* inflated, size_t inflated_len, Bytef* deflated, size_t deflated_len, int hint);
 
 
 /* debug.c */
@@ -10,18 +10,35 @@
  */
 
 #include <assert.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 #include <ctype.h> // for isspace
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "yxml.h"
 #include "mscompress.h"
 
 #define parse_acc_to_int(attrbuff) atoi(attrbuff+3)     /* Convert an accession to an integer by removing 'MS:' substring and calling atoi() */
 
+#define SCAN_CHUNK_MIN (1 << 20)                        /* Smallest byte range scan_mzml_parallel scans in its own thread */
+#define INDEX_TAIL_MAX 4096                             /* Bytes at the end of an indexedmzML searched for <indexListOffset> */
+
 /* === Start of allocation and deallocation helper functions === */
 
 yxml_t*
@@ -39,11 +56,10 @@ alloc_yxml()
 data_format_t*
 alloc_df()
 {
-    data_format_t* df = malloc(sizeof(data_format_t));
+    data_format_t* df = calloc(1, sizeof(data_format_t));
 
     if(df == NULL)
         error("alloc_df: malloc failure.\n");
-    df->populated = 0;
     return df;
 }
 
@@ -90,14 +106,18 @@ alloc_dp(int total_spec)
         dp->file_end = 0;
         dp->start_positions = NULL;
         dp->end_positions = NULL;
+        dp->array_lengths = NULL;
+        dp->formats = NULL;
     }
 
     dp->total_spec = total_spec;
     dp->file_end = 0;
-    dp->start_positions = malloc(sizeof(uint64_t)*total_spec*2);
-    dp->end_positions = malloc(sizeof(uint64_t)*total_spec*2);
+    dp->start_positions = calloc(total_spec*2, sizeof(uint64_t)); // unused entries must read as empty (see extract_n_spectra)
+    dp->end_positions = calloc(total_spec*2, sizeof(uint64_t));
+    dp->array_lengths = calloc(total_spec*2, sizeof(uint32_t));
+    dp->formats = calloc(total_spec*2, sizeof(uint8_t));
 
-    if(dp->start_positions == NULL || dp->end_positions == NULL)
+    if(dp->start_positions == NULL || dp->end_positions == NULL || dp->array_lengths == NULL || dp->formats == NULL)
         error("alloc_dp: malloc failure.\n");
 
     return dp;
@@ -116,6 +136,10 @@ dealloc_dp(data_positions_t* dp)
             free(dp->end_positions);
         else
             error("dealloc_dp: dp->end_positions is null.\n");
+        if(dp->array_lengths)
+            free(dp->array_lengths);
+        if(dp->formats)
+            free(dp->formats);
         free(dp);
     }
     else
@@ -173,8 +197,110 @@ free_ddp(data_positions_t** ddp, int divisions)
 
 }
 
+static void
+alloc_division_metadata(division_t* div, long n)
+/**
+ * @brief Allocates the spectrum metadata arrays of a division of n spectra, zeroed.
+ */
+{
+    div->scans = (long*)calloc(n + 1, sizeof(long));
+    div->ms_levels = (long*)calloc(n + 1, sizeof(long));
+    div->ret_times = (float*)calloc(n + 1, sizeof(float));
+    div->indices = (long*)calloc(n + 1, sizeof(long));
+    div->precursor_mzs = (double*)calloc(n + 1, sizeof(double));
+    div->charges = (long*)calloc(n + 1, sizeof(long));
+    div->isolation_targets = (double*)calloc(n + 1, sizeof(double));
+    div->isolation_lower = (float*)calloc(n + 1, sizeof(float));
+    div->isolation_upper = (float*)calloc(n + 1, sizeof(float));
+
+    if(div->scans == NULL || div->ms_levels == NULL || div->ret_times == NULL || div->indices == NULL ||
+       div->precursor_mzs == NULL || div->charges == NULL || div->isolation_targets == NULL ||
+       div->isolation_lower == NULL || div->isolation_upper == NULL)
+        error("alloc_division_metadata: failed to allocate memory.\n");
+}
+
+static void
+grow_division_metadata(division_t* div, long n)
+{
+    div->scans = realloc(div->scans, sizeof(long) * n);
+    div->ms_levels = realloc(div->ms_levels, sizeof(long) * n);
+    div->ret_times = realloc(div->ret_times, sizeof(float) * n);
+    div->indices = realloc(div->indices, sizeof(long) * n);
+    div->precursor_mzs = realloc(div->precursor_mzs, sizeof(double) * n);
+    div->charges = realloc(div->charges, sizeof(long) * n);
+    div->isolation_targets = realloc(div->isolation_targets, sizeof(double) * n);
+    div->isolation_lower = realloc(div->isolation_lower, sizeof(float) * n);
+    div->isolation_upper = realloc(div->isolation_upper, sizeof(float) * n);
+
+    if(div->scans == NULL || div->ms_levels == NULL || div->ret_times == NULL || div->indices == NULL ||
+       div->precursor_mzs == NULL || div->charges == NULL || div->isolation_targets == NULL ||
+       div->isolation_lower == NULL || div->isolation_upper == NULL)
+        error("grow_division_metadata: realloc failure.\n");
+}
+
+static void
+dealloc_division_metadata(division_t* div)
+{
+    free(div->scans);
+    free(div->ms_levels);
+    free(div->ret_times);
+    free(div->indices);
+    free(div->precursor_mzs);
+    free(div->charges);
+    free(div->isolation_targets);
+    free(div->isolation_lower);
+    free(div->isolation_upper);
+}
+
+static void
+dealloc_division(division_t* div)
+{
+    if(div->spectra)
+        dealloc_dp(div->spectra);
+    if(div->xml)
+        dealloc_dp(div->xml);
+    dealloc_dp(div->mz);
+    dealloc_dp(div->inten);
+    for(int k = 0; k < div->n_extra; k++)
+        dealloc_dp(div->extra[k]);
+    free(div->extra);
+    for(int k = 0; k < CHROM_ARRAYS; k++)
+        dealloc_dp(div->chrom[k]);
+    dealloc_division_metadata(div);
+    free(div);
+}
+
+void
+dealloc_divisions(divisions_t* divisions)
+/**
+ * @brief Frees the divisions of preprocess_mzml.
+ */
+{
+    for(int i = 0; i < divisions->n_divisions; i++)
+        dealloc_division(divisions->divisions[i]);
+    free(divisions->divisions);
+    free(divisions);
+}
+
+static void
+copy_division_metadata(division_t* dst, long dst_i, division_t* src, long src_i, long n)
+/**
+ * @brief Copies the metadata of spectra src_i to src_i + n of src to spectra dst_i to dst_i + n of dst.
+ */
+{
+    memcpy(dst->scans + dst_i, src->scans + src_i, n * sizeof(long));
+    memcpy(dst->ms_levels + dst_i, src->ms_levels + src_i, n * sizeof(long));
+    memcpy(dst->ret_times + dst_i, src->ret_times + src_i, n * sizeof(float));
+    memcpy(dst->indices + dst_i, src->indices + src_i, n * sizeof(long));
+    memcpy(dst->precursor_mzs + dst_i, src->precursor_mzs + src_i, n * sizeof(double));
+    memcpy(dst->charges + dst_i, src->charges + src_i, n * sizeof(long));
+    memcpy(dst->isolation_targets + dst_i, src->isolation_targets + src_i, n * sizeof(double));
+    memcpy(dst->isolation_lower + dst_i, src->isolation_lower + src_i, n * sizeof(float));
+    memcpy(dst->isolation_upper + dst_i, src->isolation_upper + src_i, n * sizeof(float));
+}
+
 division_t*
-alloc_division(size_t n_xml, size_t n_mz, size_t n_inten)
+alloc_division(size_t n_xml, size_t n_mz, size_t n_inten, int n_extra, size_t n_chrom)
 {
     division_t* d = malloc(sizeof(division_t));
 
@@ -187,9 +313,33 @@ alloc_division(size_t n_xml, size_t n_mz, size_t n_inten)
     d->inten = alloc_dp(n_inten);
     d->size = 0;
 
+    // Extra arrays have a binary for each spectrum, like the intensity array.
+    d->n_extra = n_extra;
+    d->extra = malloc(sizeof(data_positions_t*) * (n_extra + 1));
+    if(d->extra == NULL)
+        error("alloc_division: malloc failure.\n");
+    for(int k = 0; k < n_extra; k++)
+    {
+        d->extra[k] = alloc_dp(n_inten);
+        d->extra[k]->total_spec = 0;
+    }
+
+    for(int k = 0; k < CHROM_ARRAYS; k++)
+    {
+        d->chrom[k] = alloc_dp(n_chrom);
+        d->chrom[k]->total_spec = 0;
+    }
+
+    // Spectrum metadata, if any, is set by the caller (see split_division)
     d->scans = NULL;
     d->ms_levels = NULL;
     d->ret_times = NULL;
+    d->indices = NULL;
+    d->precursor_mzs = NULL;
+    d->charges = NULL;
+    d->isolation_targets = NULL;
+    d->isolation_lower = NULL;
+    d->isolation_upper = NULL;
 
     if(d->xml == NULL || d->mz == NULL || d->inten == NULL)
         error("alloc_division: malloc failure.\n");
@@ -207,59 +357,74 @@ alloc_division(size_t n_xml, size_t n_mz, size_t n_inten)
 /* === Start of XML traversal functions === */
 
 int
-map_to_df(int acc, int* current_type, data_format_t* df)
+map_to_df(int acc, int array, int* current_type, int* current_fmt, int* current_comp, data_format_t* df)
 /**
  * @brief Map a accession number to the data_format_t struct.
- * This function populates the original compression method, m/z data array format, and 
- * intensity data array format. 
+ * This function populates the original compression method and data array format of the m/z and
+ * intensity arrays, and of the arrays following them (extra arrays). The cvParams of a binaryDataArray
+ * come in any order (usually the format first and the array type last), so they are collected until all
+ * three are known, then assigned to the array.
  * 
  * @param acc A parsed integer of an accession attribute. (Expanded by parse_acc_to_int)
  * 
- * @param current_type A pass-by-reference variable to indicate if the traversal is within an m/z or intensity array.
+ * @param array Index of the current binaryDataArray within its spectrum.
+ *              The first two are the m/z and intensity arrays, any other accession of the rest is their type.
+ * 
+ * @param current_type Pass-by-reference array type (m/z or intensity) of the current binaryDataArray, 0 if not yet known.
+ * 
+ * @param current_fmt Pass-by-reference data format of the current binaryDataArray, 0 if not yet known.
+ * 
+ * @param current_comp Pass-by-reference compression method of the current binaryDataArray, 0 if not yet known.
  * 
  * @param df An allocated unpopulated data_format_t struct to be populated by this function
  * 
  * @return 1 if data_format_t struct is fully populated, 0 otherwise.
  */
 {
-    if (acc >= _mass_ && acc <= _no_comp_) 
+    if (acc == _zlib_ || acc == _no_comp_)
+        *current_comp = acc;
+    else if (acc >= _32i_ && acc <= _64d_)
+        *current_fmt = acc;
+    else if (acc == _mass_ || acc == _intensity_ || array >= 2)
+        *current_type = acc;
+
+    // Extra arrays are assigned at the end of their binaryDataArray (see map_extra_to_df)
+    if(array >= 2 || *current_type == 0 || *current_fmt == 0 || *current_comp == 0)
+        return 0;
+
+    if(*current_type == _mass_ && df->source_mz_fmt == 0)
     {
-        switch (acc) 
-        {
-            case _intensity_:
-                *current_type = _intensity_;
-                break;
-            case _mass_:
-                *current_type = _mass_;
-                break;
-            case _zlib_:
-                df->source_compression = _zlib_;
-                break;
-            case _no_comp_:
-                df->source_compression = _no_comp_;
-                break;
-            default:
-                if(acc >= _32i_ && acc <= _64d_) {
-                    if (*current_type == _intensity_) 
-                    {
-                        df->source_inten_fmt = acc;
-                        df->populated++;
-                    }
-                    else if (*current_type == _mass_) 
-                    {
-                        df->source_mz_fmt = acc;
-                        df->populated++;
-                    }
-                    if (df->populated >= 2)
-                    {
-                        return 1;
-                    }
-                }
-                break;
-        }
+        df->source_mz_fmt = *current_fmt;
+        df->source_compression = *current_comp;
+        df->populated++;
     }
-    return 0;
+    else if(*current_type == _intensity_ && df->source_inten_fmt == 0)
+    {
+        df->source_inten_fmt = *current_fmt;
+        df->source_inten_compression = *current_comp;
+        df->populated++;
+    }
+    *current_type = 0; // assigned, ignore the rest of the array
+
+    return df->populated >= 2;
+}
+
+static void
+map_extra_to_df(int array, int type, int fmt, int comp, data_format_t* df)
+/**
+ * @brief Assigns the type, format and compression collected by map_to_df to extra array array - 2
+ *        at the end of its binaryDataArray. Arrays beyond MAX_EXTRA_ARRAYS are left within the XML.
+ */
+{
+    uint32_t k = (uint32_t)(array - 2);
+
+    if(k != df->n_extra_arrays || k >= MAX_EXTRA_ARRAYS || type == 0 || fmt == 0 || comp == 0)
+        return;
 
+    df->extra_types[k] = type;
+    df->extra_fmts[k] = fmt;
+    df->extra_compressions[k] = comp;
+    df->n_extra_arrays++;
 }
 
 
@@ -269,7 +434,9 @@ pattern_detect(char* input_map)
 /**
  * @brief Detect the data type and encoding within .mzML file.
  * As the data types and encoding is consistent througout the entire .mzML document,
- * the function stops its traversal once all fields of the data_format_t struct are filled.
+ * the function stops its traversal at the end of the binaryDataArrayList of the spectrum completing
+ * the m/z and intensity fields of the data_format_t struct. The arrays following them in that list
+ * are the extra arrays.
  * 
  * @param input_map A mmap pointer to the .mzML file.
  * 
@@ -283,7 +450,9 @@ pattern_detect(char* input_map)
     char attrbuf[11] = {NULL}, *attrcur = NULL, *tmp = NULL; /* Length of a accession tag is at most 10 characters, leave room for null terminator. */
     
     int in_cvParam = 0;                      /* Boolean representing if currently inside of cvParam tag. */
-    int current_type = 0;                    /* A pass-by-reference variable to indicate to map_to_df of current binary data array type (m/z or intensity) */
+    int current_type = 0;                    /* Pass-by-reference variables to collect the type (m/z or intensity), format, */
+    int current_fmt = 0, current_comp = 0;   /* and compression of the current binary data array for map_to_df */
+    int array = -1;                          /* Index of the current binary data array within its spectrum. */
 
     for(; *input_map; input_map++)
     {
@@ -299,11 +468,25 @@ pattern_detect(char* input_map)
             case YXML_ELEMSTART:
                 if(strcmp(xml->elem, "cvParam") == 0)
                     in_cvParam = 1;
+                else if(strcmp(xml->elem, "binaryDataArray") == 0)
+                {
+                    current_type = current_fmt = current_comp = 0;
+                    array++;
+                }
+                else if(strcmp(xml->elem, "binaryDataArrayList") == 0)
+                    array = -1;
                 break;
                     
-            case YXML_ELEMEND:
+            case YXML_ELEMEND: /* xml->elem is the parent of the element ending */
                 if(strcmp(xml->elem, "cvParam") == 0)
                     in_cvParam = 0;
+                else if(strcmp(xml->elem, "binaryDataArrayList") == 0)
+                    map_extra_to_df(array, current_type, current_fmt, current_comp, df);
+                else if(df->populated >= 2 && strcmp(xml->elem, "spectrum") == 0)
+                {
+                    free(xml);
+                    return df;
+                }
                 break;
             
             case YXML_ATTRSTART:
@@ -336,11 +519,7 @@ pattern_detect(char* input_map)
                 }
                 else if(in_cvParam && attrcur) 
                 {
-                    if (map_to_df(parse_acc_to_int(attrbuf), &current_type, df))
-                    {
-                        free(xml);
-                        return df;
-                    }
+                    map_to_df(parse_acc_to_int(attrbuf), array, &current_type, &current_fmt, &current_comp, df);
                     attrcur = NULL;
                 }
                 break;
@@ -368,390 +547,1080 @@ validate_positions(uint64_t* arr, int len)
     }
 }
 
-char*
-get_spectrum_start(char* ptr)
+/* === Tag scanner === */
+
+/*
+    The input map is not null-terminated, so every search below is bounded by an explicit end pointer.
+    find_char skips the base64 binaries and find_tag_start the XML between them, 32 to 64 bytes per iteration
+    (SSE2, or AVX2 when built with it). The scalar code only looks at the few tags they stop at.
+*/
+
+static inline int
+tag_ctz(unsigned int mask)
 {
-    char* res = strstr(ptr, "<spectrum ");
-    if(res == NULL)
-        warning("Could not find next spectrum.\n");
-    return res;
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward(&r, mask);
+    return (int)r;
+#else
+    return __builtin_ctz(mask);
+#endif
 }
 
-char*
-get_spectrum_end(char* ptr)
+static inline int
+tag_ctz64(uint64_t mask)
 {
-    char* res = strstr(ptr, "</spectrum>") + strlen("</spectrum>");
-        if(res == NULL)
-        warning("Could not find end of spectrum.\n");
-    return res;
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward64(&r, mask);
+    return (int)r;
+#else
+    return __builtin_ctzll(mask);
+#endif
 }
 
-char*
-get_binary_start(char* ptr)
+static inline char*
+find_char(char* ptr, char* limit, char c)
+/**
+ * @brief Finds the first c in [ptr, limit). Scans 64 bytes per iteration.
+ * 
+ * @return Pointer to c. NULL if not found.
+ */
 {
-    char* res = strstr(ptr, "<binary>") + strlen("<binary>");
-    if(res == NULL)
-        warning("Could not find start of binary.\n");
-    return res;
+#ifdef __AVX2__
+    __m256i c32 = _mm256_set1_epi8(c);
+    for(; ptr + 64 <= limit; ptr += 64)
+    {
+        __m256i m0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)ptr), c32);
+        __m256i m1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(ptr + 32)), c32);
+        if(!_mm256_testz_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m0, m1)))
+        {
+            unsigned int mask = (unsigned int)_mm256_movemask_epi8(m0);
+            return mask ? ptr + tag_ctz(mask) : ptr + 32 + tag_ctz((unsigned int)_mm256_movemask_epi8(m1));
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i c16 = _mm_set1_epi8(c);
+    for(; ptr + 64 <= limit; ptr += 64)
+    {
+        __m128i m0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)ptr), c16);
+        __m128i m1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(ptr + 16)), c16);
+        __m128i m2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(ptr + 32)), c16);
+        __m128i m3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(ptr + 48)), c16);
+        if(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(m0, m1), _mm_or_si128(m2, m3))))
+        {
+            uint64_t mask = (uint64_t)(unsigned int)_mm_movemask_epi8(m0)
+                          | (uint64_t)(unsigned int)_mm_movemask_epi8(m1) << 16
+                          | (uint64_t)(unsigned int)_mm_movemask_epi8(m2) << 32
+                          | (uint64_t)(unsigned int)_mm_movemask_epi8(m3) << 48;
+            return ptr + tag_ctz64(mask);
+        }
+    }
+#endif
+    for(; ptr < limit; ptr++)
+        if(*ptr == c)
+            return ptr;
+    return NULL;
 }
 
-char*
-get_binary_end(char* ptr)
+static inline char*
+find_tag_start(char* ptr, char* limit)
+/**
+ * @brief Finds the next tag scan_spectrum may act on: '<' followed by 'b' (<binary>) or '/' (</spectrum>).
+ *        Other tags, most of the XML, are skipped within the vector loop.
+ * 
+ * @return Pointer to '<'. NULL if not found before limit.
+ */
 {
-    char* res = strstr(ptr, "</binary>");
-    if(res == NULL)
-        warning("Could not find end of binary.\n");
-    return res;
+#ifdef __AVX2__
+    __m256i lt = _mm256_set1_epi8('<'), b = _mm256_set1_epi8('b'), sl = _mm256_set1_epi8('/');
+    for(; ptr + 33 <= limit; ptr += 32)
+    {
+        __m256i x0 = _mm256_loadu_si256((const __m256i*)ptr);
+        __m256i x1 = _mm256_loadu_si256((const __m256i*)(ptr + 1));
+        __m256i next = _mm256_or_si256(_mm256_cmpeq_epi8(x1, b), _mm256_cmpeq_epi8(x1, sl));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(x0, lt), next));
+        if(mask)
+            return ptr + tag_ctz(mask);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i lt = _mm_set1_epi8('<'), b = _mm_set1_epi8('b'), sl = _mm_set1_epi8('/');
+    for(; ptr + 33 <= limit; ptr += 32)
+    {
+        __m128i lt0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)ptr), lt);
+        __m128i lt1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(ptr + 16)), lt);
+        if(!_mm_movemask_epi8(_mm_or_si128(lt0, lt1)))
+            continue; // no tag at all, the common case
+        __m128i x0 = _mm_loadu_si128((const __m128i*)(ptr + 1));
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(ptr + 17));
+        __m128i n0 = _mm_or_si128(_mm_cmpeq_epi8(x0, b), _mm_cmpeq_epi8(x0, sl));
+        __m128i n1 = _mm_or_si128(_mm_cmpeq_epi8(x1, b), _mm_cmpeq_epi8(x1, sl));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(lt0, n0))
+                          | (unsigned int)_mm_movemask_epi8(_mm_and_si128(lt1, n1)) << 16;
+        if(mask)
+            return ptr + tag_ctz(mask);
+    }
+#endif
+    for(; (ptr = find_char(ptr, limit, '<')) != NULL; ptr++)
+        if(ptr + 1 < limit && (ptr[1] == 'b' || ptr[1] == '/'))
+            return ptr;
+    return NULL;
 }
 
-long
-get_ms_level(char* spectrum_start)
+static inline int
+starts_with(const char* ptr, const char* limit, const char* s, size_t len)
 {
-    char* ptr = strstr(spectrum_start, "\"ms level\"") + sizeof("\"ms level\"");
-    if(ptr == NULL)
-        return 0;
-    ptr = strstr(ptr, "value=\"") + sizeof("value=\"") - 1;
-    char* e = strstr(ptr, "\"");
-    if(e == NULL)
-        return 0;
-    return strtol(ptr, &e, 10);
+    return ptr + len <= limit && memcmp(ptr, s, len) == 0;
 }
 
-long 
-get_scan(char* spectrum_start)
+#define STARTS_WITH(ptr, limit, s) starts_with(ptr, limit, s, sizeof(s) - 1)
+
+static char*
+find_str(char* ptr, char* limit, const char* s)
+/**
+ * @brief Finds the first occurrence of s within [ptr, limit).
+ *        Candidates are filtered on the first and last character of s together, which rules out nearly
+ *        every position of XML text in the vector loop.
+ * 
+ * @return Pointer to s. NULL if not found.
+ */
 {
-    char* ptr = strstr(spectrum_start, "scan=") + sizeof("scan=") - 1;
-    char* e = strstr(ptr, "\"");
-    if(e == NULL)
-        return 0;
-    return strtol(ptr, &e, 10);
+    size_t len = strlen(s);
+
+#ifdef __AVX2__
+    __m256i first = _mm256_set1_epi8(s[0]), last = _mm256_set1_epi8(s[len - 1]);
+    for(; ptr + len + 31 <= limit; ptr += 32)
+    {
+        __m256i f = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)ptr), first);
+        __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(ptr + len - 1)), last);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(f, l));
+        for(; mask; mask &= mask - 1)
+            if(memcmp(ptr + tag_ctz(mask), s, len) == 0)
+                return ptr + tag_ctz(mask);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i first = _mm_set1_epi8(s[0]), last = _mm_set1_epi8(s[len - 1]);
+    for(; ptr + len + 15 <= limit; ptr += 16)
+    {
+        __m128i f = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)ptr), first);
+        __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(ptr + len - 1)), last);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(f, l));
+        for(; mask; mask &= mask - 1)
+            if(memcmp(ptr + tag_ctz(mask), s, len) == 0)
+                return ptr + tag_ctz(mask);
+    }
+#endif
+    while((ptr = find_char(ptr, limit, s[0])) != NULL)
+    {
+        if(starts_with(ptr, limit, s, len))
+            return ptr;
+        ptr++;
+    }
+    return NULL;
 }
 
-float
-get_ret_time(char* spectrum_start)
+static char*
+find_tag(char* ptr, char* limit, char* file_end, const char* tag)
+/**
+ * @brief Finds the first occurrence of tag starting before limit, reading no further than file_end.
+ * 
+ * @return Pointer to the tag. NULL if not found.
+ */
 {
-    char* ptr = strstr(spectrum_start, "accession=\"MS:1000016\"") + sizeof("accession=\"MS:1000016\"");
+    size_t len = strlen(tag);
+
+    while((ptr = find_char(ptr, limit, '<')) != NULL)
+    {
+        if(starts_with(ptr, file_end, tag, len))
+            return ptr;
+        ptr++;
+    }
+    return NULL;
+}
+
+static char*
+find_attr_value(char* tag, char* tag_end, const char* key)
+/**
+ * @brief Finds key within a tag and returns the start of the first value="..." following it.
+ *        If key ends with = or =" (e.g. defaultArrayLength="), returns what follows key.
+ * 
+ * @return Pointer to the value. NULL if not found.
+ */
+{
+    size_t len = strlen(key);
+    char* ptr = find_str(tag, tag_end, key);
+
     if(ptr == NULL)
+        return NULL;
+    ptr += len;
+    if(key[len - 1] == '=' || (len > 1 && key[len - 2] == '=' && key[len - 1] == '"'))
+        return ptr;
+
+    ptr = find_str(ptr, tag_end, "value=\"");
+    return ptr ? ptr + sizeof("value=\"") - 1 : NULL;
+}
+
+static char*
+skip_space(char* ptr, char* limit)
+/**
+ * @brief Skips whitespace. Some writers index the indentation before a tag rather than the tag itself.
+ */
+{
+    while(ptr < limit && (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n'))
+        ptr++;
+    return ptr;
+}
+
+static char*
+find_cv_value(char* ptr, char* limit, const char* acc)
+/**
+ * @brief Finds the value of the first cvParam with accession acc (quote included, e.g. "MS:1000511\"") in [ptr, limit).
+ * 
+ * @return Pointer to the value. NULL if not found.
+ */
+{
+    char* tag_end;
+
+    if((ptr = find_str(ptr, limit, acc)) == NULL || (tag_end = find_char(ptr, limit, '>')) == NULL)
+        return NULL;
+    return find_attr_value(ptr, tag_end, "value=\"");
+}
+
+static uint8_t
+scan_binary_desc(char* ptr, char* limit, int default_fmt, int default_comp)
+/**
+ * @brief Reads the data format and compression cvParams of the binaryDataArray header [ptr, limit).
+ * 
+ * @return BINARY_DESC of the binary, 0 if it matches the defaults or either cvParam is missing.
+ */
+{
+    int fmt = 0, comp = 0;
+    long acc;
+
+    while((ptr = find_str(ptr, limit, "\"MS:")) != NULL)
+    {
+        acc = strtol(ptr + sizeof("\"MS:") - 1, &ptr, 10);
+        if(acc >= _32i_ && acc <= _64d_)
+            fmt = acc;
+        else if(acc == _zlib_ || acc == _no_comp_)
+            comp = acc;
+    }
+
+    if(fmt == 0 || comp == 0 || (fmt == default_fmt && comp == default_comp))
         return 0;
-    ptr = strstr(ptr, "value=\"") + sizeof("value=\"") - 1;
-    char* e = strstr(ptr, "\"");
-    if(e == NULL)
-        return 0;
-    return strtof(ptr, &e);
+    return BINARY_DESC(fmt, comp);
 }
 
-division_t*
-scan_mzml(char* input_map, data_format_t* df, long end, int flags)
+static char*
+scan_binaries(char* ptr, char* file_end, char* input_map, data_positions_t** dps, uint32_t* fmts, uint32_t* comps,
+              int n_dps, int i, const char* end_tag, int* n_binary)
+/**
+ * @brief Records the positions of the binaries following ptr as entry i of dps, up to end_tag.
+ *        Binaries are jumped over by the encodedLength of their <binaryDataArray> when it lands on </binary>,
+ *        otherwise skipped with find_char. The format of binaries differing from fmts/comps is recorded in formats.
+ *        Only the first n_dps binaries are recorded; any further binary stays within the xml.
+ * 
+ * @param n_binary Set to the number of binaries found.
+ * @return Pointer past end_tag. NULL on error.
+ */
 {
-    if(input_map == NULL || df == NULL)
+    char *tag_end, *value, *array = NULL;
+    size_t end_tag_len = strlen(end_tag);
+    long encoded_len = -1;
+    data_positions_t* dp;
+
+    *n_binary = 0;
+
+    while((ptr = find_tag_start(ptr, file_end)) != NULL)
     {
-        warning("scan_mzml: NULL pointer passed in.\n");
-        return NULL;
+        if(STARTS_WITH(ptr, file_end, "<binary>"))
+        {
+            char* start = ptr + sizeof("<binary>") - 1;
+            if(encoded_len >= 0 && encoded_len < file_end - start && STARTS_WITH(start + encoded_len, file_end, "</binary>"))
+                ptr = start + encoded_len;
+            else
+                ptr = find_char(start, file_end, '<'); // base64 never contains '<'
+            encoded_len = -1;
+            if(ptr == NULL || !STARTS_WITH(ptr, file_end, "</binary>"))
+            {
+                warning("Could not find end of binary.\n");
+                return NULL;
+            }
+            if(*n_binary < n_dps)
+            {
+                dp = dps[*n_binary];
+                dp->start_positions[i] = start - input_map;
+                dp->end_positions[i] = ptr - input_map;
+                if(array != NULL)
+                    dp->formats[i] = scan_binary_desc(array, start, fmts[*n_binary], comps[*n_binary]);
+            }
+            (*n_binary)++;
+            array = NULL;
+            ptr += sizeof("</binary>") - 1;
+        }
+        else if(STARTS_WITH(ptr, file_end, "<binaryDataArray "))
+        {
+            array = ptr;
+            ptr += sizeof("<binaryDataArray ") - 1;
+            if(STARTS_WITH(ptr, file_end, "encodedLength=\"")) // usually the first attribute
+                value = ptr + sizeof("encodedLength=\"") - 1;
+            else if((tag_end = find_char(ptr, file_end, '>')) != NULL)
+                value = find_attr_value(ptr, tag_end, "encodedLength=\"");
+            else
+                value = NULL;
+            if(value != NULL)
+                encoded_len = strtol(value, NULL, 10);
+        }
+        else if(starts_with(ptr, file_end, end_tag, end_tag_len))
+            return ptr + end_tag_len;
+        else
+            ptr++;
     }
-    if(end < 0)
+
+    warning("Could not find %s.\n", end_tag);
+    return NULL;
+}
+
+static char*
+scan_spectrum(char* ptr, char* file_end, char* input_map, data_format_t* df, division_t* div, int i, int flags)
+/**
+ * @brief Records the positions and requested metadata of the spectrum starting at ptr as entry i of div,
+ *        in one forward sweep over its tags, reading no further than file_end (see scan_binaries).
+ *        The binaries following m/z and intensity go to the extra arrays of div, up to div->n_extra;
+ *        any further binary stays within the xml.
+ *        xml positions are derived from the binary positions afterwards (see scan_mzml_parallel).
+ * 
+ * @return Pointer past </spectrum>. NULL on error.
+ */
+{
+    char *tag_end, *value, *header, *acc, *acc_end, *unit;
+    int n_binary, k;
+    data_positions_t* dp;
+    data_positions_t* dps[2 + MAX_EXTRA_ARRAYS];
+    uint32_t fmts[2 + MAX_EXTRA_ARRAYS], comps[2 + MAX_EXTRA_ARRAYS];
+    uint32_t array_length = 0;
+
+    div->spectra->start_positions[i] = ptr - input_map;
+    div->mz->formats[i] = div->inten->formats[i] = 0;
+    div->scans[i] = div->ms_levels[i] = div->charges[i] = 0; // 0 if not requested or not found
+    div->ret_times[i] = div->isolation_lower[i] = div->isolation_upper[i] = 0;
+    div->precursor_mzs[i] = div->isolation_targets[i] = 0;
+
+    // <spectrum id="... scan=N" defaultArrayLength="N" ...>
+    tag_end = find_char(ptr, file_end, '>');
+    if(tag_end == NULL) return NULL;
+
+    // Decoded length of the binaries, used to size inflate buffers exactly
+    if((value = find_attr_value(ptr, tag_end, "defaultArrayLength=\"")) != NULL)
+        array_length = (uint32_t)strtoul(value, NULL, 10);
+    div->mz->array_lengths[i] = div->inten->array_lengths[i] = array_length;
+
+    dps[0] = div->mz;
+    fmts[0] = df->source_mz_fmt;
+    comps[0] = df->source_compression;
+    dps[1] = div->inten;
+    fmts[1] = df->source_inten_fmt;
+    comps[1] = df->source_inten_compression;
+    for(k = 0; k < div->n_extra; k++)
     {
-        error("scan_mzml: end position is negative.\n");
+        div->extra[k]->array_lengths[i] = array_length;
+        div->extra[k]->formats[i] = 0;
+        dps[k + 2] = div->extra[k];
+        fmts[k + 2] = df->extra_fmts[k];
+        comps[k + 2] = df->extra_compressions[k];
+    }
+
+    if((flags & SCANNUM) && (value = find_attr_value(ptr, tag_end, "scan=")) != NULL)
+        div->scans[i] = strtol(value, NULL, 10);
+
+    header = tag_end;
+
+    ptr = scan_binaries(tag_end, file_end, input_map, dps, fmts, comps, 2 + div->n_extra, i, "</spectrum>", &n_binary);
+    if(ptr == NULL)
         return NULL;
+    if(n_binary < 2)
+    {
+        warning("Could not find start of binary.\n");
+        return NULL;
+    }
+
+    // Extra arrays missing from this spectrum are empty binaries after its last one
+    for(k = (n_binary > 2 ? n_binary - 2 : 0); k < div->n_extra; k++)
+    {
+        dp = (k == 0) ? div->inten : div->extra[k - 1];
+        div->extra[k]->start_positions[i] = div->extra[k]->end_positions[i] = dp->end_positions[i];
+        div->extra[k]->array_lengths[i] = 0;
     }
 
-    data_positions_t *spectra_dp, *mz_dp, *inten_dp, *xml_dp;
+    div->spectra->end_positions[i] = ptr - input_map;
 
-    spectra_dp = alloc_dp(df->source_total_spec);
-    xml_dp = alloc_dp(df->source_total_spec * 2);
-    mz_dp = alloc_dp(df->source_total_spec);
-    inten_dp = alloc_dp(df->source_total_spec);
+    // ms level, scan start time and precursors are cvParams of the spectrum header, before the first binary
+    char* header_end = input_map + div->mz->start_positions[i];
 
-    long* scans = (long*)calloc(df->source_total_spec, sizeof(long));
-    long* ms_levels = (long*)calloc(df->source_total_spec, sizeof(long));
-    float* ret_times = (float*)calloc(df->source_total_spec, sizeof(float));
+    if((flags & MSLEVEL) && (value = find_cv_value(header, header_end, "MS:1000511\"")) != NULL)
+        div->ms_levels[i] = strtol(value, NULL, 10);
 
-    if(xml_dp == NULL || mz_dp == NULL || inten_dp == NULL)
+    // Scan start time in seconds: unitAccession UO:0000010 (second) or UO:0000031 (minute), seconds if missing
+    if((flags & RETTIME) && (acc = find_str(header, header_end, "MS:1000016\"")) != NULL &&
+       (acc_end = find_char(acc, header_end, '>')) != NULL && (value = find_attr_value(acc, acc_end, "value=\"")) != NULL)
     {
-        warning("scan_mzml: failed to allocate memory.\n");
+        double rt = strtod(value, NULL);
+        unit = find_attr_value(acc, acc_end, "unitAccession=\"");
+        if(unit != NULL && STARTS_WITH(unit, acc_end, "UO:0000031\""))
+            rt *= 60;
+        div->ret_times[i] = (float)rt;
+    }
+
+    // Of the first precursor: isolation window target and offsets, selected ion m/z and charge
+    if((flags & PRECURSOR) && (header = find_str(header, header_end, "<precursor")) != NULL)
+    {
+        if((value = find_cv_value(header, header_end, "MS:1000827\"")) != NULL)
+            div->isolation_targets[i] = strtod(value, NULL);
+        if((value = find_cv_value(header, header_end, "MS:1000828\"")) != NULL)
+            div->isolation_lower[i] = strtof(value, NULL);
+        if((value = find_cv_value(header, header_end, "MS:1000829\"")) != NULL)
+            div->isolation_upper[i] = strtof(value, NULL);
+        if((value = find_cv_value(header, header_end, "MS:1000744\"")) != NULL)
+            div->precursor_mzs[i] = strtod(value, NULL);
+        if((value = find_cv_value(header, header_end, "MS:1000041\"")) != NULL)
+            div->charges[i] = strtol(value, NULL, 10);
+    }
+
+    return ptr;
+}
+
+static division_t*
+alloc_scan_division(int n, int n_extra)
+/**
+ * @brief Allocates the spectra, mz, inten and n_extra extra array positions and metadata arrays of a division of n spectra.
+ *        The xml positions are left NULL, the chromatogram positions empty.
+ */
+{
+    division_t* div = (division_t*)malloc(sizeof(division_t));
+    if(div == NULL)
+        error("alloc_scan_division: failed to allocate division_t.\n");
+
+    div->spectra = alloc_dp(n);
+    div->xml = NULL;
+    div->mz = alloc_dp(n);
+    div->inten = alloc_dp(n);
+    div->size = 0;
+
+    div->n_extra = n_extra;
+    div->extra = (data_positions_t**)malloc(sizeof(data_positions_t*) * (n_extra + 1));
+    if(div->extra == NULL)
+        error("alloc_scan_division: failed to allocate memory.\n");
+    for(int k = 0; k < n_extra; k++)
+        div->extra[k] = alloc_dp(n);
+
+    // Chromatograms are found after the spectra (see scan_chromatograms)
+    for(int k = 0; k < CHROM_ARRAYS; k++)
+        div->chrom[k] = alloc_dp(0);
+
+    alloc_division_metadata(div, n);
+
+    return div;
+}
+
+static void
+dealloc_scan_division(division_t* div)
+{
+    dealloc_dp(div->spectra);
+    dealloc_dp(div->mz);
+    dealloc_dp(div->inten);
+    for(int k = 0; k < div->n_extra; k++)
+        dealloc_dp(div->extra[k]);
+    free(div->extra);
+    for(int k = 0; k < CHROM_ARRAYS; k++)
+        dealloc_dp(div->chrom[k]);
+    dealloc_division_metadata(div);
+    free(div);
+}
+
+static void
+grow_dp(data_positions_t* dp, int n)
+{
+    dp->start_positions = realloc(dp->start_positions, sizeof(uint64_t) * n);
+    dp->end_positions = realloc(dp->end_positions, sizeof(uint64_t) * n);
+    dp->array_lengths = realloc(dp->array_lengths, sizeof(uint32_t) * n);
+    dp->formats = realloc(dp->formats, sizeof(uint8_t) * n);
+    if(dp->start_positions == NULL || dp->end_positions == NULL || dp->array_lengths == NULL || dp->formats == NULL)
+        error("grow_dp: realloc failure.\n");
+    dp->total_spec = n;
+}
+
+static void
+grow_scan_division(division_t* div, int n)
+{
+    grow_dp(div->spectra, n);
+    grow_dp(div->mz, n);
+    grow_dp(div->inten, n);
+    for(int k = 0; k < div->n_extra; k++)
+        grow_dp(div->extra[k], n);
+    grow_division_metadata(div, n);
+}
+
+typedef struct
+{
+    char* input_map;
+    char* file_end;
+    data_format_t* df;  // defaults binary formats are recorded against
+    char* start;        // first <spectrum tag of the range
+    char* stop;         // first <spectrum tag of the next range, or the end of the file
+    uint64_t* offsets;  // spectrum offsets read from the index, NULL to search [start, stop) instead
+    int first;          // index of the first spectrum of the range in offsets
+    int flags;
+    int max_spec;       // stop after this many spectra
+    division_t* div;    // spectra found in the range (xml positions unused)
+    int n_spec;
+    int ret;            // 0 on success, -1 if a spectrum could not be parsed
+} scan_chunk_args_t;
+
+static void*
+scan_chunk_routine(void* args)
+/**
+ * @brief Scans the spectra starting within [start, stop) into a division local to the range.
+ *        With offsets, scans spectra first to first + max_spec of the index instead. Each must start at its
+ *        offset and end before the next one, else the index is inconsistent and ret is set.
+ */
+{
+    scan_chunk_args_t* sc = (scan_chunk_args_t*)args;
+    char* ptr = sc->start;
+    int cap = sc->div->spectra->total_spec;
+
+    if(sc->offsets != NULL)
+    {
+        for(; sc->n_spec < sc->max_spec; sc->n_spec++)
+        {
+            int i = sc->first + sc->n_spec;
+            char* limit = sc->input_map + sc->offsets[i + 1];
+
+            ptr = skip_space(sc->input_map + sc->offsets[i], limit);
+            if(!STARTS_WITH(ptr, limit, "<spectrum ") ||
+               scan_spectrum(ptr, limit, sc->input_map, sc->df, sc->div, sc->n_spec, sc->flags) == NULL)
+            {
+                sc->ret = -1;
+                break;
+            }
+        }
         return NULL;
     }
 
-    char* ptr = input_map;
+    while(sc->n_spec < sc->max_spec && (ptr = find_tag(ptr, sc->stop, sc->file_end, "<spectrum ")) != NULL)
+    {
+        if(sc->n_spec == cap)
+        {
+            cap *= 2;
+            grow_scan_division(sc->div, cap);
+        }
+        ptr = scan_spectrum(ptr, sc->file_end, sc->input_map, sc->df, sc->div, sc->n_spec, sc->flags);
+        if(ptr == NULL)
+        {
+            sc->ret = -1;
+            break;
+        }
+        sc->n_spec++;
+    }
+    return NULL;
+}
 
-    int spec_curr = 0, mz_curr = 0, inten_curr = 0, xml_curr = 0;
+#ifdef _WIN32
+DWORD WINAPI scan_chunk_routine_win(LPVOID lpParam) {
+    scan_chunk_routine(lpParam);
+    return 0;
+}
+#endif
 
-    long curr_scan = 0;
-    long curr_ms_level = 0;
+static uint64_t*
+read_spectrum_index(char* input_map, long end, int total)
+/**
+ * @brief Reads the spectrum offsets of an indexedmzML <indexList>, found through the <indexListOffset>
+ *        at the end of the file.
+ * 
+ * @return total + 1 offsets: those of the spectra in file order, then that of the <indexList>.
+ *         NULL if the file has no index, or it does not list total spectra at increasing offsets.
+ */
+{
+    char* file_end = input_map + end;
+    char* ptr = input_map + (end > INDEX_TAIL_MAX ? end - INDEX_TAIL_MAX : 0);
+    char* index_end;
+    uint64_t list_offset;
+    uint64_t* offsets;
+    int n = 0;
+
+    if(total <= 0 || (ptr = find_str(ptr, file_end, "<indexListOffset>")) == NULL)
+        return NULL;
 
-    char* e;
+    list_offset = strtoull(ptr + sizeof("<indexListOffset>") - 1, NULL, 10);
+    if(list_offset == 0 || list_offset >= (uint64_t)end || !STARTS_WITH(skip_space(input_map + list_offset, file_end), file_end, "<indexList"))
+        return NULL;
 
-    int bound = df->source_total_spec * 2;
+    if((ptr = find_str(input_map + list_offset, file_end, "<index name=\"spectrum\"")) == NULL ||
+       (index_end = find_str(ptr, file_end, "</index>")) == NULL)
+        return NULL;
 
-    // xml base case
-    xml_dp->start_positions[xml_curr] = 0;
+    offsets = (uint64_t*)malloc(sizeof(uint64_t) * (total + 1));
+    if(offsets == NULL)
+        error("read_spectrum_index: failed to allocate memory.\n");
 
-    while (ptr)
-    {   
-        if(mz_curr + inten_curr == bound)
+    // <offset idRef="...">N</offset>
+    while((ptr = find_str(ptr, index_end, "<offset")) != NULL)
+    {
+        if(n == total || (ptr = find_char(ptr, index_end, '>')) == NULL)
             break;
-        
-        if(xml_curr >= bound || mz_curr >= df->source_total_spec || inten_curr >= df->source_total_spec) // We cannot continue if we have reached the end of the array
+        offsets[n] = strtoull(ptr + 1, &ptr, 10);
+        if(offsets[n] >= list_offset || (n > 0 && offsets[n] <= offsets[n - 1]))
+            break;
+        n++;
+    }
+
+    if(ptr != NULL || n != total)
+    {
+        free(offsets);
+        return NULL;
+    }
+    offsets[total] = list_offset; // bounds the last spectrum
+
+    return offsets;
+}
+
+static int
+scan_chromatograms(char* ptr, char* file_end, char* input_map, data_format_t* df, division_t* div)
+/**
+ * @brief Records the time and intensity binaries of each chromatogram following ptr in div->chrom (see scan_binaries).
+ *        The formats of the first chromatogram become the chromatogram defaults of df.
+ *        Any further binary of a chromatogram stays within the xml.
+ * 
+ * @return Number of chromatograms found. 0 if there are none or one could not be parsed; all chromatograms then stay within the xml.
+ */
+{
+    char *tag_end, *value;
+    int n = 0, n_binary, k, ok = 1;
+    uint32_t array_length;
+
+    memset(df->chrom_fmts, 0, sizeof(df->chrom_fmts));
+    memset(df->chrom_compressions, 0, sizeof(df->chrom_compressions));
+
+    while((ptr = find_tag(ptr, file_end, file_end, "<chromatogram ")) != NULL)
+    {
+        if(n == div->chrom[0]->total_spec)
+            for(k = 0; k < CHROM_ARRAYS; k++)
+                grow_dp(div->chrom[k], n ? 2 * n : 16);
+
+        // <chromatogram index="N" id="..." defaultArrayLength="N">
+        if((tag_end = find_char(ptr, file_end, '>')) == NULL)
         {
-            warning("scan_mzml: index out of bounds. xml_curr: %d, mz_curr: %d, inten_curr: %d\n", xml_curr, mz_curr, inten_curr);
-            return NULL;
+            ok = 0;
+            break;
         }
-            
-        ptr = get_spectrum_start(ptr); // Ptr now points to start of spectrum on successs.
-        if(ptr == NULL) return NULL;
-        
-        spectra_dp->start_positions[spec_curr] = ptr - input_map;
-
-        // From here, get any metadata we want to extract from the spectrum
-        if(flags & SCANNUM) { // If we want to extract scan numbers
-            scans[spec_curr] = get_scan(ptr);
-            if(ptr == NULL) return NULL;
+        array_length = 0;
+        if((value = find_attr_value(ptr, tag_end, "defaultArrayLength=\"")) != NULL)
+            array_length = (uint32_t)strtoul(value, NULL, 10);
+        for(k = 0; k < CHROM_ARRAYS; k++)
+        {
+            div->chrom[k]->array_lengths[n] = array_length;
+            div->chrom[k]->formats[n] = 0;
+        }
+
+        ptr = scan_binaries(tag_end, file_end, input_map, div->chrom, df->chrom_fmts, df->chrom_compressions,
+                            CHROM_ARRAYS, n, "</chromatogram>", &n_binary);
+        if(ptr == NULL || n_binary < CHROM_ARRAYS)
+        {
+            ok = 0;
+            break;
+        }
+
+        // Against zero defaults, the first chromatogram records its own formats
+        if(n == 0)
+        {
+            for(k = 0; k < CHROM_ARRAYS && div->chrom[k]->formats[0] != 0; k++)
+            {
+                df->chrom_fmts[k] = BINARY_DESC_FMT(div->chrom[k]->formats[0]);
+                df->chrom_compressions[k] = BINARY_DESC_COMP(div->chrom[k]->formats[0]);
+                div->chrom[k]->formats[0] = 0;
+            }
+            if(k < CHROM_ARRAYS) // no cvParams, e.g. referenceableParamGroupRef
+            {
+                ok = 0;
+                break;
+            }
+        }
+        n++;
+    }
+
+    if(!ok)
+    {
+        warning("scan_mzml: could not parse chromatogram %d, chromatograms are kept within the XML.\n", n);
+        memset(df->chrom_fmts, 0, sizeof(df->chrom_fmts));
+        memset(df->chrom_compressions, 0, sizeof(df->chrom_compressions));
+        n = 0;
+    }
+    for(k = 0; k < CHROM_ARRAYS; k++)
+    {
+        div->chrom[k]->total_spec = n;
+        div->chrom[k]->file_end = file_end - input_map;
+    }
+    return n;
+}
+
+static division_t*
+scan_chunks(char* input_map, data_format_t* df, long end, int total, int flags, int threads, uint64_t* offsets)
+/**
+ * @brief Scans the spectra of an mzML file in threads ranges concurrently and merges them in file order.
+ *        Without offsets, the ranges are byte ranges aligned to <spectrum tags.
+ *        With offsets (see read_spectrum_index), they are runs of consecutive spectra of the index.
+ * 
+ * @return A division encapsulating the entire file. NULL on error.
+ */
+{
+    char* file_end = input_map + end;
+
+    scan_chunk_args_t* chunks = calloc(threads, sizeof(scan_chunk_args_t));
+    if(chunks == NULL)
+        error("scan_mzml: failed to allocate memory.\n");
+
+    int i;
+    if(offsets != NULL)
+    {
+        for(i = 0; i < threads; i++)
+        {
+            chunks[i].offsets = offsets;
+            chunks[i].first = (int)((long)total * i / threads);
+            chunks[i].max_spec = (int)((long)total * (i + 1) / threads) - chunks[i].first;
+            chunks[i].div = alloc_scan_division(chunks[i].max_spec + 1, df->n_extra_arrays);
+        }
+    }
+    else
+    {
+        // Split the file into ranges beginning at a <spectrum tag
+        for(i = 0; i < threads; i++)
+        {
+            char* from = input_map + (long)((double)end * i / threads);
+            chunks[i].start = find_tag(from, file_end, file_end, "<spectrum ");
+            if(chunks[i].start == NULL)
+                chunks[i].start = file_end;
+        }
+        for(i = 0; i < threads; i++)
+        {
+            chunks[i].stop = (i + 1 < threads) ? chunks[i + 1].start : file_end;
+            chunks[i].max_spec = total;
+            chunks[i].div = alloc_scan_division(16 + (int)((double)total * (chunks[i].stop - chunks[i].start) / (end + 1)), df->n_extra_arrays);
+        }
+    }
+    for(i = 0; i < threads; i++)
+    {
+        chunks[i].input_map = input_map;
+        chunks[i].file_end = file_end;
+        chunks[i].df = df;
+        chunks[i].flags = flags;
+    }
+
+    if(threads == 1)
+        scan_chunk_routine(&chunks[0]);
+    else
+    {
+        #ifdef _WIN32
+        HANDLE* ptid = malloc(sizeof(HANDLE) * threads);
+        #else
+        pthread_t* ptid = malloc(sizeof(pthread_t) * threads);
+        #endif
+
+        for(i = 0; i < threads; i++)
+        {
+            #ifdef _WIN32
+            ptid[i] = CreateThread(NULL, 0, scan_chunk_routine_win, &chunks[i], 0, NULL);
+            if (ptid[i] == NULL)
+            {
+                perror("CreateThread");
+                exit(-1);
+            }
+            #else
+            int ret = pthread_create(&ptid[i], NULL, scan_chunk_routine, &chunks[i]);
+            if (ret != 0)
+            {
+                perror("pthread_create");
+                exit(-1);
+            }
+            #endif
         }
 
-        if(flags & MSLEVEL) { // If we want to extract ms levels
-            ms_levels[spec_curr] = get_ms_level(ptr);
-            if(ptr == NULL) return NULL;
+        for(i = 0; i < threads; i++)
+        {
+            #ifdef _WIN32
+            WaitForSingleObject(ptid[i], INFINITE);
+            CloseHandle(ptid[i]);
+            #else
+            int ret = pthread_join(ptid[i], NULL);
+            if (ret != 0)
+            {
+                perror("pthread_join");
+                exit(-1);
+            }
+            #endif
         }
 
-        if(flags & RETTIME) { // If we want to extract ret_times
-            ret_times[spec_curr] = get_ret_time(ptr); 
-            if(ptr == NULL) return NULL;
+        free(ptid);
+    }
+
+    // Merge the ranges in file order, keeping the first source_total_spec spectra as the serial scan did
+    int n_arrays = 2 + df->n_extra_arrays, n_chrom, k;
+    data_positions_t *xml_dp;
+    division_t* div = alloc_scan_division(total, df->n_extra_arrays);
+    int found = 0, ok = 1;
+
+    for(i = 0; i < threads; i++)
+    {
+        scan_chunk_args_t* sc = &chunks[i];
+        int n = sc->n_spec;
+
+        if(sc->ret != 0)
+            ok = 0;
+        if(n > total - found)
+            n = total - found;
+
+        memcpy(div->spectra->start_positions + found, sc->div->spectra->start_positions, n * sizeof(uint64_t));
+        memcpy(div->spectra->end_positions + found, sc->div->spectra->end_positions, n * sizeof(uint64_t));
+        memcpy(div->mz->start_positions + found, sc->div->mz->start_positions, n * sizeof(uint64_t));
+        memcpy(div->mz->end_positions + found, sc->div->mz->end_positions, n * sizeof(uint64_t));
+        memcpy(div->mz->array_lengths + found, sc->div->mz->array_lengths, n * sizeof(uint32_t));
+        memcpy(div->mz->formats + found, sc->div->mz->formats, n * sizeof(uint8_t));
+        memcpy(div->inten->start_positions + found, sc->div->inten->start_positions, n * sizeof(uint64_t));
+        memcpy(div->inten->end_positions + found, sc->div->inten->end_positions, n * sizeof(uint64_t));
+        memcpy(div->inten->array_lengths + found, sc->div->inten->array_lengths, n * sizeof(uint32_t));
+        memcpy(div->inten->formats + found, sc->div->inten->formats, n * sizeof(uint8_t));
+        for(k = 0; k < div->n_extra; k++)
+        {
+            memcpy(div->extra[k]->start_positions + found, sc->div->extra[k]->start_positions, n * sizeof(uint64_t));
+            memcpy(div->extra[k]->end_positions + found, sc->div->extra[k]->end_positions, n * sizeof(uint64_t));
+            memcpy(div->extra[k]->array_lengths + found, sc->div->extra[k]->array_lengths, n * sizeof(uint32_t));
+            memcpy(div->extra[k]->formats + found, sc->div->extra[k]->formats, n * sizeof(uint8_t));
         }
+        copy_division_metadata(div, found, sc->div, 0, n);
+        found += n;
 
-        // Now, get the binaries and set the start and end positions
-        ptr = get_binary_start(ptr);
-        if(ptr == NULL) return NULL;
-        mz_dp->start_positions[mz_curr] = ptr - input_map;
-        xml_dp->end_positions[xml_curr++] = mz_dp->start_positions[mz_curr];
-        
-        ptr = get_binary_end(ptr);
-        if(ptr == NULL) return NULL;
-        mz_dp->end_positions[mz_curr] = ptr - input_map;
-        xml_dp->start_positions[xml_curr] = mz_dp->end_positions[mz_curr];
-
-        mz_curr++;
-
-        ptr = get_binary_start(ptr);
-        if(ptr == NULL) return NULL;
-        inten_dp->start_positions[inten_curr] = ptr - input_map;
-        xml_dp->end_positions[xml_curr++] = inten_dp->start_positions[inten_curr];
-
-        
-        ptr = get_binary_end(ptr);
-        if(ptr == NULL) return NULL;
-        inten_dp->end_positions[inten_curr] = ptr - input_map;
-        xml_dp->start_positions[xml_curr] = inten_dp->end_positions[inten_curr];
-        
-        inten_curr++;
-
-        ptr = get_spectrum_end(ptr);
-        if(ptr == NULL) return NULL;
-        
-        spectra_dp->end_positions[spec_curr] = ptr - input_map;
-        spec_curr++;
-    
+        dealloc_scan_division(sc->div);
     }
+    free(chunks);
 
-    if(xml_curr != bound || mz_curr != df->source_total_spec || inten_curr != df->source_total_spec) // If we haven't found all the binary data, we have a problem
+    if(!ok || found != total)
     {
-        warning("scan_mzml: did not find all binary data. xml_curr: %d, mz_curr: %d, inten_curr: %d\n", xml_curr, mz_curr, inten_curr);
+        dealloc_scan_division(div);
+        if(ok) // If we haven't found all the binary data, we have a problem
+            warning("scan_mzml: did not find all binary data. Found %d of %d spectra.\n", found, total);
         return NULL;
     }
-    // xml base case
-    xml_dp->end_positions[xml_curr] = end;
-    xml_curr++;
-    xml_dp->total_spec = xml_curr;
 
-    mz_dp->total_spec = df->source_total_spec;
-    inten_dp->total_spec = df->source_total_spec;
+    for(i = 0; i < total; i++)
+        div->indices[i] = i;
 
-    mz_dp->file_end = inten_dp->file_end = xml_dp->file_end = end;
+    n_chrom = scan_chromatograms(input_map + (total > 0 ? div->spectra->end_positions[total - 1] : 0), input_map + end, input_map, df, div);
 
-    // Sanity check
-    validate_positions(mz_dp->start_positions, mz_dp->total_spec);
-    validate_positions(mz_dp->end_positions, mz_dp->total_spec);
-    validate_positions(inten_dp->start_positions, inten_dp->total_spec);
-    validate_positions(inten_dp->end_positions, inten_dp->total_spec);
-    validate_positions(xml_dp->start_positions, xml_dp->total_spec);
-    validate_positions(xml_dp->end_positions, xml_dp->total_spec);
+    // xml is everything between the binaries: n_arrays segments per spectrum, each followed by one of its binaries,
+    // then CHROM_ARRAYS segments per chromatogram
+    xml_dp = alloc_dp((n_arrays * total + CHROM_ARRAYS * n_chrom + 2) / 2); // alloc_dp allocates twice total_spec entries
+    xml_dp->start_positions[0] = 0;
+    for(i = 0; i < total; i++)
+    {
+        uint64_t* xml_start = xml_dp->start_positions + n_arrays * i;
+        uint64_t* xml_end = xml_dp->end_positions + n_arrays * i;
+
+        xml_end[0] = div->mz->start_positions[i];
+        xml_start[1] = div->mz->end_positions[i];
+        xml_end[1] = div->inten->start_positions[i];
+        xml_start[2] = div->inten->end_positions[i];
+        for(k = 0; k < div->n_extra; k++)
+        {
+            xml_end[k + 2] = div->extra[k]->start_positions[i];
+            xml_start[k + 3] = div->extra[k]->end_positions[i];
+        }
+    }
+    for(i = 0; i < n_chrom; i++)
+    {
+        uint64_t* xml_start = xml_dp->start_positions + n_arrays * total + CHROM_ARRAYS * i;
+        uint64_t* xml_end = xml_dp->end_positions + n_arrays * total + CHROM_ARRAYS * i;
 
-    // Create division_t 
+        for(k = 0; k < CHROM_ARRAYS; k++)
+        {
+            xml_end[k] = div->chrom[k]->start_positions[i];
+            xml_start[k + 1] = div->chrom[k]->end_positions[i];
+        }
+    }
+    xml_dp->end_positions[n_arrays * total + CHROM_ARRAYS * n_chrom] = end;
+    xml_dp->total_spec = n_arrays * total + CHROM_ARRAYS * n_chrom + 1;
 
-    division_t* div = (division_t*)malloc(sizeof(division_t));
-    if(div == NULL)
+    div->mz->file_end = div->inten->file_end = xml_dp->file_end = end;
+
+    // Sanity check
+    validate_positions(div->mz->start_positions, div->mz->total_spec);
+    validate_positions(div->mz->end_positions, div->mz->total_spec);
+    validate_positions(div->inten->start_positions, div->inten->total_spec);
+    validate_positions(div->inten->end_positions, div->inten->total_spec);
+    for(k = 0; k < div->n_extra; k++)
     {
-        warning("scan_mzml: failed to allocate division_t.\n");
-        return NULL;
+        div->extra[k]->file_end = end;
+        validate_positions(div->extra[k]->start_positions, div->extra[k]->total_spec);
+        validate_positions(div->extra[k]->end_positions, div->extra[k]->total_spec);
+    }
+    for(k = 0; k < CHROM_ARRAYS; k++)
+    {
+        validate_positions(div->chrom[k]->start_positions, n_chrom);
+        validate_positions(div->chrom[k]->end_positions, n_chrom);
     }
-    div->spectra = spectra_dp;
+    validate_positions(xml_dp->start_positions, xml_dp->total_spec);
+    validate_positions(xml_dp->end_positions, xml_dp->total_spec);
+
     div->xml = xml_dp;
-    div->mz = mz_dp;
-    div->inten = inten_dp;
     div->size = end; // Size is the end of the file
 
-    div->scans = scans;
-    div->ms_levels = ms_levels;
-    div->ret_times = ret_times;
-
-    return div;    
+    return div;
 }
 
 division_t*
-extract_one_spectra(division_t* div, long index)
+scan_mzml_parallel(char* input_map, data_format_t* df, long end, int flags, int threads)
+/**
+ * @brief Locates every spectrum and its binaries in an mzML file.
+ *        An indexedmzML is scanned by jumping to the offset of each spectrum listed in its <indexList>.
+ *        Otherwise, or if the index is inconsistent with the file, the file is split into byte ranges aligned
+ *        to <spectrum tags. Either way the ranges are scanned concurrently and merged in file order,
+ *        so the division is identical to a serial scan.
+ * 
+ * @param threads Number of ranges scanned concurrently. Ranges are at least SCAN_CHUNK_MIN bytes.
+ * 
+ * @return A division encapsulating the entire file. NULL on error.
+ */
 {
-    data_positions_t *spectra_dp, *mz_dp, *inten_dp, *xml_dp;
-
-    division_t* new_div = (division_t*)malloc(sizeof(division_t));
-    if(new_div == NULL)
-        error("extract_one_spectra: failed to allocate division_t.\n");
-
-    xml_dp = alloc_dp(6);
-    mz_dp = alloc_dp(2);
-    inten_dp = alloc_dp(2);
-
-    //Copy over xml from start to first spectra
-
-    xml_dp->start_positions[0] = div->xml->start_positions[0];
-    xml_dp->end_positions[0] = div->spectra->start_positions[0];
-
-    new_div->size += xml_dp->end_positions[0] - xml_dp->start_positions[0];
-    // mz and inten of zero for position 0
-    mz_dp->start_positions[0] = 0;
-    mz_dp->end_positions[0] = 0;
-    inten_dp->start_positions[0] = 0;
-    inten_dp->end_positions[0] = 0;
-
-    xml_dp->start_positions[1] = 0;
-    xml_dp->end_positions[1] = 0;
-
-
-    //Copy over xml from index start till mz start
-    xml_dp->start_positions[2] = div->spectra->start_positions[index];
-    xml_dp->end_positions[2] = div->mz->start_positions[index];
-    new_div->size += xml_dp->end_positions[2] - xml_dp->start_positions[2];
-
-    //Copy over mz from index start till mz end
-    mz_dp->start_positions[1] = div->mz->start_positions[index];
-    mz_dp->end_positions[1] = div->mz->end_positions[index];
-    new_div->size += mz_dp->end_positions[1] - mz_dp->start_positions[1];
-
-    //Copy over xml from index start till int start
-    xml_dp->start_positions[3] = div->mz->end_positions[index];
-    xml_dp->end_positions[3] = div->inten->start_positions[index];
-    new_div->size += xml_dp->end_positions[3] - xml_dp->start_positions[3];
+    if(input_map == NULL || df == NULL)
+    {
+        warning("scan_mzml: NULL pointer passed in.\n");
+        return NULL;
+    }
+    if(end < 0)
+    {
+        error("scan_mzml: end position is negative.\n");
+        return NULL;
+    }
 
-    //Copy over int from index start till int end
-    inten_dp->start_positions[1] = div->inten->start_positions[index];
-    inten_dp->end_positions[1] = div->inten->end_positions[index];
-    new_div->size += inten_dp->end_positions[1] - inten_dp->start_positions[1];
+    int total = df->source_total_spec;
+    division_t* div;
+    uint64_t* offsets;
 
-    //Copy over xml from inden end till next spectra
-    xml_dp->start_positions[4] = div->inten->end_positions[index];
-    xml_dp->end_positions[4] = div->spectra->start_positions[index+1];
-    new_div->size += xml_dp->end_positions[4] - xml_dp->start_positions[4];
+    if(threads > end / SCAN_CHUNK_MIN)
+        threads = end / SCAN_CHUNK_MIN;
+    if(threads < 1)
+        threads = 1;
 
-    //Copy over xml from last spectra till end
-    xml_dp->start_positions[5] = div->spectra->end_positions[div->mz->total_spec-1];
-    xml_dp->end_positions[5] = div->xml->end_positions[div->xml->total_spec-1];
-    new_div->size += xml_dp->end_positions[5] - xml_dp->start_positions[5];
+    offsets = read_spectrum_index(input_map, end, total);
+    if(offsets != NULL)
+    {
+        div = scan_chunks(input_map, df, end, total, flags, threads, offsets);
+        free(offsets);
+        if(div != NULL)
+            return div;
+        warning("scan_mzml: spectrum index is inconsistent with the file, scanning linearly.\n");
+    }
 
-    new_div->spectra = div->spectra;
-    new_div->xml = xml_dp;
-    new_div->mz = mz_dp;
-    new_div->inten = inten_dp;
+    return scan_chunks(input_map, df, end, total, flags, threads, NULL);
+}
 
-    return new_div;
+division_t*
+scan_mzml(char* input_map, data_format_t* df, long end, int flags)
+/**
+ * @brief Serial scan_mzml_parallel.
+ */
+{
+    return scan_mzml_parallel(input_map, df, end, flags, 1);
 }
 
 division_t*
 extract_n_spectra(division_t* div, long* indicies, long n)
 /*
-    Further pipeline expects the following structure:
+    Further pipeline expects the following structure for each spectrum:
         1. xml
         2. mz
         3. xml
         4. inten
-    Thus, we need padding of 0's for mz and inten between xml blocks.
+        5. xml and binary of each extra array
+    The xml before, between, and after the selected spectra is held by padding spectra with empty binaries.
+    Chromatograms are left within the xml after the last spectrum.
 */
 {
-    data_positions_t *spectra_dp, *mz_dp, *inten_dp, *xml_dp;
+    int n_arrays = 2 + div->n_extra, k;
+    data_positions_t *xml_dp, *src_dp[2 + MAX_EXTRA_ARRAYS], *dst_dp[2 + MAX_EXTRA_ARRAYS];
 
-    division_t* new_div = (division_t*)malloc(sizeof(division_t));
+    division_t* new_div = (division_t*)calloc(1, sizeof(division_t));
     if(new_div == NULL)
-        error("extract_one_spectra: failed to allocate division_t.\n");
-
-    xml_dp = alloc_dp(((n*5)+3));
-    mz_dp = alloc_dp(n*2);
-    inten_dp = alloc_dp(n*2);
+        error("extract_n_spectra: failed to allocate division_t.\n");
 
-    //base case
-    //Copy over xml from start to first spectra
-
-    xml_dp->start_positions[0] = div->xml->start_positions[0];
-    xml_dp->end_positions[0] = div->spectra->start_positions[0];
+    xml_dp = alloc_dp(n_arrays * (n + 1)); // alloc_dp allocates twice total_spec entries, all empty
+    new_div->xml = xml_dp;
+    new_div->mz = alloc_dp(n + 1);
+    new_div->inten = alloc_dp(n + 1);
+    new_div->n_extra = div->n_extra;
+    new_div->extra = malloc(sizeof(data_positions_t*) * (div->n_extra + 1));
+    if(new_div->extra == NULL)
+        error("extract_n_spectra: failed to allocate memory.\n");
+
+    src_dp[0] = div->mz;
+    src_dp[1] = div->inten;
+    dst_dp[0] = new_div->mz;
+    dst_dp[1] = new_div->inten;
+    for(k = 0; k < div->n_extra; k++)
+    {
+        src_dp[k + 2] = div->extra[k];
+        dst_dp[k + 2] = new_div->extra[k] = alloc_dp(n + 1);
+    }
+    for(k = 0; k < CHROM_ARRAYS; k++)
+    {
+        new_div->chrom[k] = alloc_dp(0);
+        new_div->chrom[k]->total_spec = 0;
+    }
 
-    new_div->size += xml_dp->end_positions[0] - xml_dp->start_positions[0];
-    // mz and inten of zero for position 0
-    mz_dp->start_positions[0] = 0;
-    mz_dp->end_positions[0] = 0;
-    inten_dp->start_positions[0] = 0;
-    inten_dp->end_positions[0] = 0;
+    long xml_curr = 0;
+    long bin_curr = 0;
 
-    xml_dp->start_positions[1] = 0;
-    xml_dp->end_positions[1] = 0;
+    // Padding spectra have an index of -1 in the metadata
+    alloc_division_metadata(new_div, 2 * n + 1);
 
-    long xml_curr = 2;
-    long mz_curr = 1;
-    long inten_curr = 1;
+    //base case
+    //Padding spectrum holding the xml from start to first spectra
+    xml_dp->start_positions[xml_curr] = div->xml->start_positions[0];
+    xml_dp->end_positions[xml_curr] = div->spectra->start_positions[0];
+    new_div->size += xml_dp->end_positions[xml_curr] - xml_dp->start_positions[xml_curr];
+    xml_curr += n_arrays;
+    new_div->indices[bin_curr] = -1;
+    bin_curr++;
 
     for(long i = 0; i < n; i++)
     {
         long index = indicies[i];
+        uint64_t prev_end = div->spectra->start_positions[index];
 
-        //Copy over xml from index start till mz start
-        xml_dp->start_positions[xml_curr] = div->spectra->start_positions[index];
-        xml_dp->end_positions[xml_curr] = div->mz->start_positions[index];
-        new_div->size += xml_dp->end_positions[xml_curr] - xml_dp->start_positions[xml_curr];
-
-        xml_curr++;
-
-        //Copy over mz from index start till mz end
-        mz_dp->start_positions[mz_curr] = div->mz->start_positions[index];
-        mz_dp->end_positions[mz_curr] = div->mz->end_positions[index];
-        new_div->size += mz_dp->end_positions[mz_curr] - mz_dp->start_positions[mz_curr];
-
-        mz_curr++;
-
-        //Copy over xml from index start till int start
-        xml_dp->start_positions[xml_curr] = div->mz->end_positions[index];
-        xml_dp->end_positions[xml_curr] = div->inten->start_positions[index];
-        new_div->size += xml_dp->end_positions[xml_curr] - xml_dp->start_positions[xml_curr];
-
-        xml_curr++;
-
-        //Copy over int from index start till int end
-        inten_dp->start_positions[inten_curr] = div->inten->start_positions[index];
-        inten_dp->end_positions[inten_curr] = div->inten->end_positions[index];
-        new_div->size += inten_dp->end_positions[inten_curr] - inten_dp->start_positions[inten_curr];
-
-        inten_curr++;
+        for(k = 0; k < n_arrays; k++)
+        {
+            //Copy over xml from the previous binary (or spectrum start) till the binary start
+            xml_dp->start_positions[xml_curr] = prev_end;
+            xml_dp->end_positions[xml_curr] = src_dp[k]->start_positions[index];
+            new_div->size += xml_dp->end_positions[xml_curr] - xml_dp->start_positions[xml_curr];
+            xml_curr++;
+
+            //Copy over the binary
+            dst_dp[k]->start_positions[bin_curr] = src_dp[k]->start_positions[index];
+            dst_dp[k]->end_positions[bin_curr] = src_dp[k]->end_positions[index];
+            dst_dp[k]->array_lengths[bin_curr] = src_dp[k]->array_lengths[index];
+            dst_dp[k]->formats[bin_curr] = src_dp[k]->formats[index];
+            new_div->size += dst_dp[k]->end_positions[bin_curr] - dst_dp[k]->start_positions[bin_curr];
+            prev_end = src_dp[k]->end_positions[index];
+        }
+        copy_division_metadata(new_div, bin_curr, div, index, 1);
+        bin_curr++;
 
-        //Copy over xml from inden end till next spectra
-        xml_dp->start_positions[xml_curr] = div->inten->end_positions[index];
-        xml_dp->end_positions[xml_curr] = div->spectra->start_positions[index+1];
+        //Padding spectrum holding the xml from the last binary till next spectra
+        xml_dp->start_positions[xml_curr] = prev_end;
+        xml_dp->end_positions[xml_curr] = (index + 1 < div->mz->total_spec) ? div->spectra->start_positions[index+1] : div->spectra->end_positions[index];
         new_div->size += xml_dp->end_positions[xml_curr] - xml_dp->start_positions[xml_curr];
-        
-        xml_curr++;
-
-        // padding for mz and inten
-        mz_dp->start_positions[mz_curr] = 0;
-        mz_dp->end_positions[mz_curr] = 0;
-        mz_curr++;
-        xml_dp->start_positions[xml_curr] = 0;
-        xml_dp->end_positions[xml_curr] = 0;
-        xml_curr++;
-        inten_dp->start_positions[inten_curr] = 0;
-        inten_dp->end_positions[inten_curr] = 0;
-        inten_curr++;
+        xml_curr += n_arrays;
+        new_div->indices[bin_curr] = -1;
+        bin_curr++;
     }
 
     //end case
@@ -762,14 +1631,21 @@ extract_n_spectra(division_t* div, long* indicies, long n)
     new_div->size += xml_dp->end_positions[xml_curr] - xml_dp->start_positions[xml_curr];
     xml_curr++;
 
+    xml_dp->total_spec = xml_curr;
+    for(k = 0; k < n_arrays; k++)
+        dst_dp[k]->total_spec = bin_curr;
+
     new_div->spectra = div->spectra;
-    new_div->xml = xml_dp;
-    new_div->mz = mz_dp;
-    new_div->inten = inten_dp;
 
     return new_div;
 }
 
+division_t*
+extract_one_spectra(division_t* div, long index)
+{
+    return extract_n_spectra(div, &index, 1);
+}
+
 long
 encodedLength_sum(data_positions_t* dp)
 {
@@ -1067,6 +1943,25 @@ write_dp(data_positions_t* dp, int fd)
     buff = (char*)dp->end_positions;
     write_to_file(fd, buff, sizeof(uint64_t)*dp->total_spec);
 
+    // Write binary formats, only if some differ from the defaults (padded to 8 bytes)
+    int i, n_formats = 0;
+    if(dp->formats != NULL)
+        for(i = 0; i < dp->total_spec && n_formats == 0; i++)
+            if(dp->formats[i] != 0)
+                n_formats = dp->total_spec;
+
+    *((uint64_t*)num_buff) = n_formats;
+    write_to_file(fd, num_buff, sizeof(uint64_t));
+    if(n_formats > 0)
+    {
+        buff = calloc(1, (n_formats + 7) & ~7);
+        if(buff == NULL)
+            error("write_dp: failed to allocate memory.\n");
+        memcpy(buff, dp->formats, n_formats);
+        write_to_file(fd, buff, (n_formats + 7) & ~7);
+        free(buff);
+    }
+
     free(num_buff);
 
     return;
@@ -1090,6 +1985,14 @@ read_dp(void* input_map, long* position)
     r->end_positions = (uint64_t*)((uint8_t*)input_map + *position);
     *position += sizeof(uint64_t)*r->total_spec;
 
+    r->array_lengths = NULL; // Not stored within msz.
+
+    // Read binary formats, if stored
+    uint64_t n_formats = *((uint64_t*)((uint8_t*)input_map + *position));
+    *position += sizeof(uint64_t);
+    r->formats = (n_formats > 0) ? (uint8_t*)input_map + *position : NULL;
+    *position += (n_formats + 7) & ~7;
+
     return r;
 }
 
@@ -1107,8 +2010,18 @@ write_division(division_t* div, int fd)
     num_buff = malloc(sizeof(uint64_t));
     *((uint64_t*)num_buff) = (uint64_t)div->size;
     write_to_file(fd, num_buff, sizeof(uint64_t));
+
+    // Write extra arrays
+    *((uint64_t*)num_buff) = (uint64_t)div->n_extra;
+    write_to_file(fd, num_buff, sizeof(uint64_t));
+    for(int k = 0; k < div->n_extra; k++)
+        write_dp(div->extra[k], fd);
     free(num_buff);
 
+    // Write chromatogram arrays
+    for(int k = 0; k < CHROM_ARRAYS; k++)
+        write_dp(div->chrom[k], fd);
+
     return;
 }
 
@@ -1135,6 +2048,24 @@ read_division(void* input_map, long* position)
     r->size = *((uint64_t*)((uint8_t*)input_map + *position));
     *position += sizeof(uint64_t);
 
+    r->n_extra = (int)*((uint64_t*)((uint8_t*)input_map + *position));
+    *position += sizeof(uint64_t);
+    if(r->n_extra < 0 || r->n_extra > MAX_EXTRA_ARRAYS)
+        error("read_division: invalid extra array count %d.\n", r->n_extra);
+    r->extra = malloc(sizeof(data_positions_t*) * (r->n_extra + 1));
+    if(r->extra == NULL) return NULL;
+    for(int k = 0; k < r->n_extra; k++)
+        r->extra[k] = read_dp(input_map, position);
+
+    for(int k = 0; k < CHROM_ARRAYS; k++)
+        r->chrom[k] = read_dp(input_map, position);
+
+    // Spectrum metadata is stored apart (see read_metadata)
+    r->spectra = NULL;
+    r->scans = r->ms_levels = r->indices = r->charges = NULL;
+    r->ret_times = r->isolation_lower = r->isolation_upper = NULL;
+    r->precursor_mzs = r->isolation_targets = NULL;
+
     return r;
 }
 
@@ -1156,6 +2087,174 @@ read_divisions(void* input_map, long position, int n_divisions)
     return r;
 }
 
+void
+dealloc_read_divisions(divisions_t* divisions)
+/**
+ * @brief Frees the divisions of read_divisions. Their positions and formats stay within input_map.
+ */
+{
+    for(int i = 0; i < divisions->n_divisions; i++)
+    {
+        division_t* div = divisions->divisions[i];
+        free(div->xml);
+        free(div->mz);
+        free(div->inten);
+        for(int k = 0; k < div->n_extra; k++)
+            free(div->extra[k]);
+        free(div->extra);
+        for(int k = 0; k < CHROM_ARRAYS; k++)
+            free(div->chrom[k]);
+        dealloc_division_metadata(div);
+        free(div);
+    }
+    free(divisions->divisions);
+    free(divisions);
+}
+
+
+/*
+    Spectrum metadata table, one row per spectrum of the divisions in order (see write_metadata):
+        Row count          uint64
+        Columns size       uint64
+        Compressed size    uint64
+        zstd frame of the columns, each contiguous over all rows, widest first to keep them aligned:
+            index            int64, delta to the previous row
+            scan             int64, delta to the previous row
+            precursor m/z    float64
+            isolation target float64
+            retention time   float32
+            isolation lower and upper offsets  float32
+            MS level         uint8
+            charge           int8
+*/
+
+#define METADATA_ROW_SIZE (2 * sizeof(int64_t) + 2 * sizeof(double) + 3 * sizeof(float) + 2 * sizeof(uint8_t))
+
+void
+write_metadata(divisions_t* divisions, int compression_level, int fd)
+/**
+ * @brief Writes the metadata of the spectra of divisions as a compressed columnar table.
+ *        Retention times are stored in seconds, whatever the unit of the mzML (see scan_spectrum).
+ *        Divisions scanned without metadata contribute rows of zeros with an index of -1.
+ */
+{
+    uint64_t n_rows = 0, header[3];
+    int64_t prev_index = 0, prev_scan = 0;
+    size_t cmp_len = 0;
+    long i, j;
+
+    for(i = 0; i < divisions->n_divisions; i++)
+        n_rows += divisions->divisions[i]->mz->total_spec;
+
+    char* columns = malloc(n_rows * METADATA_ROW_SIZE + 1);
+    if(columns == NULL)
+        error("write_metadata: failed to allocate memory.\n");
+
+    int64_t* index_col = (int64_t*)columns;
+    int64_t* scan_col = index_col + n_rows;
+    double* prec_col = (double*)(scan_col + n_rows);
+    double* iso_target_col = prec_col + n_rows;
+    float* rt_col = (float*)(iso_target_col + n_rows);
+    float* iso_lower_col = rt_col + n_rows;
+    float* iso_upper_col = iso_lower_col + n_rows;
+    uint8_t* ms_level_col = (uint8_t*)(iso_upper_col + n_rows);
+    int8_t* charge_col = (int8_t*)(ms_level_col + n_rows);
+
+    memset(columns, 0, n_rows * METADATA_ROW_SIZE);
+
+    uint64_t row = 0;
+    for(i = 0; i < divisions->n_divisions; i++)
+    {
+        division_t* div = divisions->divisions[i];
+        for(j = 0; j < div->mz->total_spec; j++, row++)
+        {
+            int64_t index = (div->scans != NULL) ? div->indices[j] : -1;
+            int64_t scan = (div->scans != NULL) ? div->scans[j] : 0;
+
+            index_col[row] = index - prev_index;
+            scan_col[row] = scan - prev_scan;
+            prev_index = index;
+            prev_scan = scan;
+            if(div->scans == NULL)
+                continue;
+            rt_col[row] = div->ret_times[j];
+            prec_col[row] = div->precursor_mzs[j];
+            iso_target_col[row] = div->isolation_targets[j];
+            iso_lower_col[row] = div->isolation_lower[j];
+            iso_upper_col[row] = div->isolation_upper[j];
+            ms_level_col[row] = (uint8_t)div->ms_levels[j];
+            charge_col[row] = (int8_t)div->charges[j];
+        }
+    }
+
+    ZSTD_CCtx* cctx = alloc_cctx();
+    char* cmp = zstd_compress(cctx, columns, n_rows * METADATA_ROW_SIZE, &cmp_len, compression_level);
+    ZSTD_freeCCtx(cctx);
+
+    header[0] = n_rows;
+    header[1] = n_rows * METADATA_ROW_SIZE;
+    header[2] = cmp_len;
+    write_to_file(fd, (char*)header, sizeof(header));
+    write_to_file(fd, cmp, cmp_len);
+
+    free(columns);
+    free(cmp);
+}
+
+void
+read_metadata(void* input_map, footer_t* footer, divisions_t* divisions)
+/**
+ * @brief Reads the spectrum metadata table of an msz file (see write_metadata) into the metadata arrays of divisions.
+ */
+{
+    uint64_t header[3], n_rows = 0, row = 0;
+    int64_t index = 0, scan = 0;
+    long i, j;
+
+    memcpy(header, (char*)input_map + footer->metadata_pos, sizeof(header));
+
+    for(i = 0; i < divisions->n_divisions; i++)
+        n_rows += divisions->divisions[i]->mz->total_spec;
+    if(header[0] != n_rows || header[1] != n_rows * METADATA_ROW_SIZE)
+        error("read_metadata: metadata table holds %lu spectra, divisions %lu.\n", header[0], n_rows);
+
+    ZSTD_DCtx* dctx = alloc_dctx();
+    char* columns = (n_rows > 0) ? zstd_decompress(dctx, (char*)input_map + footer->metadata_pos + sizeof(header), header[2], header[1]) : NULL;
+    ZSTD_freeDCtx(dctx);
+
+    int64_t* index_col = (int64_t*)columns;
+    int64_t* scan_col = index_col + n_rows;
+    double* prec_col = (double*)(scan_col + n_rows);
+    double* iso_target_col = prec_col + n_rows;
+    float* rt_col = (float*)(iso_target_col + n_rows);
+    float* iso_lower_col = rt_col + n_rows;
+    float* iso_upper_col = iso_lower_col + n_rows;
+    uint8_t* ms_level_col = (uint8_t*)(iso_upper_col + n_rows);
+    int8_t* charge_col = (int8_t*)(ms_level_col + n_rows);
+
+    for(i = 0; i < divisions->n_divisions; i++)
+    {
+        division_t* div = divisions->divisions[i];
+        alloc_division_metadata(div, div->mz->total_spec);
+        for(j = 0; j < div->mz->total_spec; j++, row++)
+        {
+            index += index_col[row];
+            scan += scan_col[row];
+            div->indices[j] = index;
+            div->scans[j] = scan;
+            div->ret_times[j] = rt_col[row];
+            div->precursor_mzs[j] = prec_col[row];
+            div->isolation_targets[j] = iso_target_col[row];
+            div->isolation_lower[j] = iso_lower_col[row];
+            div->isolation_upper[j] = iso_upper_col[row];
+            div->ms_levels[j] = ms_level_col[row];
+            div->charges[j] = charge_col[row];
+        }
+    }
+
+    free(columns);
+}
+
 
 data_positions_t**
 join_xml(divisions_t* divisions)
@@ -1190,15 +2289,167 @@ join_inten(divisions_t* divisions)
     return r;    
 }
 
+data_positions_t**
+join_extra(divisions_t* divisions, int array)
+{
+    data_positions_t** r;
+    r = malloc(sizeof(data_positions_t*) * divisions->n_divisions);
+    if(r == NULL) return NULL;
+    for(int i = 0; i < divisions->n_divisions; i++)
+        r[i] = divisions->divisions[i]->extra[array];
+    return r;    
+}
+
+data_positions_t**
+join_chrom(divisions_t* divisions, int array)
+{
+    data_positions_t** r;
+    r = malloc(sizeof(data_positions_t*) * divisions->n_divisions);
+    if(r == NULL) return NULL;
+    for(int i = 0; i < divisions->n_divisions; i++)
+        r[i] = divisions->divisions[i]->chrom[array];
+    return r;    
+}
+
+/*
+    The binaries of a division in file order: those of each spectrum (m/z, intensity, extra arrays),
+    then those of each chromatogram (time, intensity), each preceded by an xml segment.
+    Arrays are numbered in that order: 0 m/z, 1 intensity, 2 to n_extra + 1 extra arrays, then the chromatogram arrays.
+*/
+
+data_positions_t*
+get_division_array(division_t* div, int array)
+{
+    if(array == 0)
+        return div->mz;
+    if(array == 1)
+        return div->inten;
+    if(array < 2 + div->n_extra)
+        return div->extra[array - 2];
+    return div->chrom[array - 2 - div->n_extra];
+}
+
+int
+resolve_division_array(division_t* div, int array, int64_t* bin_i)
+/**
+ * @brief Checks the array of the next binary of a division walk (see next_division_array) for exhaustion.
+ * 
+ * @param bin_i Number of binaries of each array already walked.
+ * 
+ * @return array, the first chromatogram array once the spectra are exhausted, -1 once the chromatograms are too.
+ */
+{
+    int n_spec_arrays = 2 + div->n_extra;
+
+    if(array == 0 && bin_i[0] == div->mz->total_spec)
+        array = n_spec_arrays;
+    if(array == n_spec_arrays && (div->chrom[0] == NULL || bin_i[array] == div->chrom[0]->total_spec))
+        return -1;
+    return array;
+}
+
+int
+next_division_array(division_t* div, int array)
+/**
+ * @brief Array of the binary following one of array within its spectrum or chromatogram, wrapping to the next one.
+ */
+{
+    int n_spec_arrays = 2 + div->n_extra;
+
+    if(array < n_spec_arrays)
+        return (array + 1) % n_spec_arrays;
+    return n_spec_arrays + (array - n_spec_arrays + 1) % CHROM_ARRAYS;
+}
+
+static void
+copy_dp_entries(data_positions_t* dst, data_positions_t* src, long src_i, long n, uint64_t* size)
+/**
+ * @brief Appends entries src_i to src_i + n of src to dst, adding their lengths to size.
+ */
+{
+    for(long j = 0; j < n; j++, src_i++)
+    {
+        dst->start_positions[dst->total_spec] = src->start_positions[src_i];
+        dst->end_positions[dst->total_spec] = src->end_positions[src_i];
+        if(src->array_lengths != NULL)
+            dst->array_lengths[dst->total_spec] = src->array_lengths[src_i];
+        if(src->formats != NULL)
+            dst->formats[dst->total_spec] = src->formats[src_i];
+        dst->total_spec++;
+        *size += src->end_positions[src_i] - src->start_positions[src_i];
+    }
+}
+
+static division_t*
+split_division(division_t* div, long spec_i, long n_spec)
+/**
+ * @brief Allocates a division holding spectra spec_i to spec_i + n_spec of div (binaries and xml).
+ */
+{
+    int n_arrays = 2 + div->n_extra;
+    division_t* r = alloc_division(n_spec * n_arrays, n_spec, n_spec, div->n_extra, 0);
+
+    copy_dp_entries(r->mz, div->mz, spec_i, n_spec, &r->size);
+    copy_dp_entries(r->inten, div->inten, spec_i, n_spec, &r->size);
+    for(int k = 0; k < div->n_extra; k++)
+        copy_dp_entries(r->extra[k], div->extra[k], spec_i, n_spec, &r->size);
+    copy_dp_entries(r->xml, div->xml, spec_i * n_arrays, n_spec * n_arrays, &r->size);
+
+    if(div->scans != NULL)
+    {
+        alloc_division_metadata(r, n_spec);
+        copy_division_metadata(r, 0, div, spec_i, n_spec);
+    }
+
+    return r;
+}
+
+static division_t*
+split_chromatograms(division_t* div, long chrom_i, long n_chrom, int last)
+/**
+ * @brief Allocates a division holding chromatograms chrom_i to chrom_i + n_chrom of div (binaries and xml).
+ *        The last one also holds the xml following the last chromatogram.
+ */
+{
+    long xml_i = (long)div->mz->total_spec * (2 + div->n_extra) + chrom_i * CHROM_ARRAYS;
+    long n_xml = n_chrom * CHROM_ARRAYS + (last ? div->xml->total_spec - xml_i - n_chrom * CHROM_ARRAYS : 0);
+    division_t* r = alloc_division(n_xml, 0, 0, div->n_extra, n_chrom);
+
+    for(int k = 0; k < CHROM_ARRAYS; k++)
+        copy_dp_entries(r->chrom[k], div->chrom[k], chrom_i, n_chrom, &r->size);
+    copy_dp_entries(r->xml, div->xml, xml_i, n_xml, &r->size);
+
+    return r;
+}
+
 divisions_t*
 create_divisions(division_t* div, long n_divisions)
+/**
+ * @brief Splits div into n_divisions divisions of spectra, followed by divisions of chromatograms
+ *        of about the same size (at most n_divisions), the last holding the remaining xml.
+ *        Without chromatograms, a last division holds only the remaining xml.
+ */
 {
     divisions_t* r;
 
     r = malloc(sizeof(divisions_t));
     if(r == NULL) return NULL;
 
-    r->divisions = malloc(sizeof(division_t*) * (n_divisions + 1));
+    long n_chrom = div->chrom[0]->total_spec, n_chrom_div = 0;
+    if(n_chrom > 0)
+    {
+        uint64_t chrom_size = 0;
+        for(int k = 0; k < CHROM_ARRAYS; k++)
+            for(long j = 0; j < n_chrom; j++)
+                chrom_size += div->chrom[k]->end_positions[j] - div->chrom[k]->start_positions[j];
+        n_chrom_div = chrom_size / (div->size / n_divisions + 1) + 1;
+        if(n_chrom_div > n_divisions)
+            n_chrom_div = n_divisions;
+        if(n_chrom_div > n_chrom)
+            n_chrom_div = n_chrom;
+    }
+
+    r->divisions = malloc(sizeof(division_t*) * (n_divisions + n_chrom_div + 1));
     if(r->divisions == NULL) return NULL;
 
     // r->n_divisions = n_threads;
@@ -1210,88 +2461,40 @@ create_divisions(division_t* div, long n_divisions)
     // Determine how many spectra will be left over
     long n_spec_leftover = div->mz->total_spec % n_divisions;
 
-    int spec_i = 0;
-    int xml_i = 0;
+    long spec_i = 0;
     for(int i = 0; i < n_divisions - 1; i++)
     {
-        r->divisions[i] = alloc_division(n_spec_per_div*2, n_spec_per_div, n_spec_per_div);
-
-        for(int j = 0; j < n_spec_per_div; j++)
-        {
-            // Copy MZ
-            r->divisions[i]->mz->start_positions[j] = div->mz->start_positions[spec_i];
-            r->divisions[i]->mz->end_positions[j] = div->mz->end_positions[spec_i];
-            r->divisions[i]->mz->total_spec++;
-            r->divisions[i]->size += div->mz->end_positions[spec_i] - div->mz->start_positions[spec_i];
-
-            // Copy Inten
-            r->divisions[i]->inten->start_positions[j] = div->inten->start_positions[spec_i];
-            r->divisions[i]->inten->end_positions[j] = div->inten->end_positions[spec_i];
-            r->divisions[i]->inten->total_spec++;
-            r->divisions[i]->size += div->inten->end_positions[spec_i] - div->inten->start_positions[spec_i];
-
-            spec_i++;
-        }
-
-        for(int j = 0; j < n_spec_per_div * 2; j++)
-        {
-            // Copy XML
-            r->divisions[i]->xml->start_positions[j] = div->xml->start_positions[xml_i];
-            r->divisions[i]->xml->end_positions[j] = div->xml->end_positions[xml_i];
-            r->divisions[i]->xml->total_spec++;
-            r->divisions[i]->size += div->xml->end_positions[xml_i] - div->xml->start_positions[xml_i];
-            xml_i++;
-        }
+        r->divisions[i] = split_division(div, spec_i, n_spec_per_div);
+        spec_i += n_spec_per_div;
     }
 
     // End case: take the remaining spectra and put them in the last division
-    // TODO: factor this out into a function
-    int i = n_divisions - 1;
-    n_spec_per_div += n_spec_leftover;
-
-    r->divisions[i] = alloc_division(n_spec_per_div*2, n_spec_per_div, n_spec_per_div);
+    r->divisions[n_divisions - 1] = split_division(div, spec_i, n_spec_per_div + n_spec_leftover);
+    spec_i += n_spec_per_div + n_spec_leftover;
 
-    for(int j = 0; j < n_spec_per_div; j++)
+    // Chromatograms, the last division taking the remaining XML
+    if(n_chrom_div > 0)
     {
-        // Copy MZ
-        r->divisions[i]->mz->start_positions[j] = div->mz->start_positions[spec_i];
-        r->divisions[i]->mz->end_positions[j] = div->mz->end_positions[spec_i];
-        r->divisions[i]->mz->total_spec++;
-        r->divisions[i]->size += div->mz->end_positions[spec_i] - div->mz->start_positions[spec_i];
-
-        // Copy Inten
-        r->divisions[i]->inten->start_positions[j] = div->inten->start_positions[spec_i];
-        r->divisions[i]->inten->end_positions[j] = div->inten->end_positions[spec_i];
-        r->divisions[i]->inten->total_spec++;
-        r->divisions[i]->size += div->inten->end_positions[spec_i] - div->inten->start_positions[spec_i];
-
-        spec_i++;
-    }
-
-    for(int j = 0; j < n_spec_per_div * 2; j++)
-    {
-        // Copy XML
-        r->divisions[i]->xml->start_positions[j] = div->xml->start_positions[xml_i];
-        r->divisions[i]->xml->end_positions[j] = div->xml->end_positions[xml_i];
-        r->divisions[i]->xml->total_spec++;
-        r->divisions[i]->size += div->xml->end_positions[xml_i] - div->xml->start_positions[xml_i];
-        xml_i++;
+        long chrom_i = 0;
+        for(int i = 0; i < n_chrom_div; i++)
+        {
+            long n = (i < n_chrom_div - 1) ? n_chrom / n_chrom_div : n_chrom - chrom_i;
+            r->divisions[n_divisions + i] = split_chromatograms(div, chrom_i, n, i == n_chrom_div - 1);
+            chrom_i += n;
+        }
+        r->n_divisions = n_divisions + n_chrom_div;
+        return r;
     }
 
     // End case: remaining XML
+    long xml_i = spec_i * (2 + div->n_extra);
     int remaining_xml = div->xml->total_spec - xml_i;
     assert(remaining_xml >= 0);
     if(remaining_xml == 0)
         return r;
 
-    r->divisions[n_divisions] = alloc_division(remaining_xml, 0, 0);
-    for(int j = 0; j < remaining_xml; j++) {
-        r->divisions[n_divisions]->xml->start_positions[j] = div->xml->start_positions[xml_i];
-        r->divisions[n_divisions]->xml->end_positions[j] = div->xml->end_positions[xml_i];
-        r->divisions[n_divisions]->xml->total_spec++;
-        r->divisions[n_divisions]->size += div->xml->end_positions[xml_i] - div->xml->start_positions[xml_i];
-        xml_i++;
-    }
+    r->divisions[n_divisions] = alloc_division(remaining_xml, 0, 0, div->n_extra, 0);
+    copy_dp_entries(r->divisions[n_divisions]->xml, div->xml, xml_i, remaining_xml, &r->divisions[n_divisions]->size);
 
     return r;
 }
@@ -1435,34 +2638,62 @@ string_to_array(char* str, long* size)
     return arr;
 }
 
+static int
+compare_scan_index(const void* a, const void* b)
+{
+    const long* x = (const long*)a;
+    const long* y = (const long*)b;
+
+    if(x[0] != y[0])
+        return (x[0] > y[0]) - (x[0] < y[0]);
+    return (x[1] > y[1]) - (x[1] < y[1]);
+}
+
 void
 map_scan_to_index(struct Arguments* arguments, division_t* div)
+/**
+ * @brief Maps the scans to extract to the indices of their spectra, the first spectrum of a scan if repeated.
+ *        The (scan, index) pairs of the file are sorted once and each scan is found by binary search.
+ */
 {
-    long i, j, k;
+    long i, lo, hi, mid;
+    long n = div->spectra->total_spec;
     long* indicies = malloc(arguments->scans_length * sizeof(long));
+    long* pairs = malloc(n * 2 * sizeof(long)); // scan, index
+
+    if(indicies == NULL || pairs == NULL)
+        error("map_scan_to_index: malloc() error.\n");
 
-    j = 0;
+    for(i = 0; i < n; i++)
+    {
+        pairs[i * 2] = div->scans[i];
+        pairs[i * 2 + 1] = i;
+    }
+    qsort(pairs, n, 2 * sizeof(long), compare_scan_index);
 
-    for(long i = 0; i < arguments->scans_length; i++)
+    for(i = 0; i < arguments->scans_length; i++)
     {
-        for(k = 0; k < div->spectra->total_spec; k++)
+        lo = 0, hi = n; // first pair with a scan not below the one searched
+        while(lo < hi)
         {
-            if(arguments->scans[i] == div->scans[k])
-            {
-                indicies[j] = k;
-                j++;
-                break;
-            }
+            mid = lo + (hi - lo) / 2;
+            if(pairs[mid * 2] < arguments->scans[i])
+                lo = mid + 1;
+            else
+                hi = mid;
         }
-        if(k == div->spectra->total_spec)
+        if(lo == n || pairs[lo * 2] != arguments->scans[i])
             error("Scan %ld not found in file.\n", arguments->scans[i]);
+        indicies[i] = pairs[lo * 2 + 1];
     }
 
-    if(!is_monotonically_increasing(indicies, j))
+    free(pairs);
+
+    if(!is_monotonically_increasing(indicies, arguments->scans_length))
         error("map_scan_to_index: Scans must be monotonically increasing.\n");
 
     arguments->indices = indicies;
-    arguments->indices_length = j;
+    arguments->indices_length = arguments->scans_length;
 }
 
 void
@@ -1521,14 +2752,14 @@ preprocess_mzml(char* input_map,
     division_t* div = NULL;
     if(arguments->indices_length > 0)
     {
-        division_t* tmp = scan_mzml((char*)input_map, *df, input_filesize, MSLEVEL|SCANNUM); // A division encapsulating the entire file
+        division_t* tmp = scan_mzml_parallel((char*)input_map, *df, input_filesize, METADATA, arguments->threads); // A division encapsulating the entire file
         if (tmp == NULL)
             return -1;
         div = extract_n_spectra(tmp, arguments->indices, arguments->indices_length);
     }
     else if(arguments->scans_length > 0)
     {
-        division_t* tmp = scan_mzml((char*)input_map, *df, input_filesize, MSLEVEL|SCANNUM); // A division encapsulating the entire file
+        division_t* tmp = scan_mzml_parallel((char*)input_map, *df, input_filesize, METADATA, arguments->threads); // A division encapsulating the entire file
         if (tmp == NULL)
             return -1;
         map_scan_to_index(arguments, tmp);
@@ -1537,7 +2768,7 @@ preprocess_mzml(char* input_map,
     }
     else if(arguments->ms_level > 0 || arguments->ms_level == -1)
     {
-        division_t* tmp = scan_mzml((char*)input_map, *df, input_filesize, MSLEVEL|SCANNUM); // A division encapsulating the entire file
+        division_t* tmp = scan_mzml_parallel((char*)input_map, *df, input_filesize, METADATA, arguments->threads); // A division encapsulating the entire file
         if (tmp == NULL)
             return -1;
         map_ms_level_to_index(arguments, tmp);
@@ -1545,7 +2776,7 @@ preprocess_mzml(char* input_map,
     }
     else if(arguments->indices_length == 0 && arguments->scans_length == 0)
     {
-        div = scan_mzml((char*)input_map, *df, input_filesize, NULL); // A division encapsulating the entire file
+        div = scan_mzml_parallel((char*)input_map, *df, input_filesize, METADATA, arguments->threads); // A division encapsulating the entire file
     }
     else
         error("Invalid indicies_size: %ld\n", arguments->indices_length);
@@ -1553,6 +2784,13 @@ preprocess_mzml(char* input_map,
     if (div == NULL)
         return -1;
 
+    long budgeted = budget_blocksize(*blocksize, arguments->threads);
+    if(budgeted < *blocksize)
+    {
+        print("\tUsing blocksize %ld bytes to fit --max-memory (%ld bytes) over %d threads.\n", budgeted, max_memory, arguments->threads);
+        *blocksize = budgeted;
+    }
+
     if(arguments->threads == -1) // force divisions to be only 1
     {
         arguments->threads = 1;
@@ -1585,6 +2823,9 @@ preprocess_mzml(char* input_map,
             *divisions = create_divisions(div, arguments->threads);
             *blocksize = get_division_size_max(*divisions); // If we have more threads than divisions, we need to increase the blocksize to the max division size
         }
+
+        if(*divisions != NULL)
+            dealloc_division(div); // copied into the divisions
     }
 
     if (*divisions == NULL)
@@ -1599,28 +2840,39 @@ preprocess_mzml(char* input_map,
 
 void
 parse_footer(footer_t** footer, void* input_map, long input_filesize,
-            block_len_queue_t**xml_block_lens,
-            block_len_queue_t** mz_binary_block_lens,
-            block_len_queue_t** inten_binary_block_lens,
+            toc_t** toc,
             divisions_t** divisions,
             int* n_divisions)
+/**
+ * @brief Reads the footer, table of contents and divisions of an msz file.
+ * 
+ * @param toc Set to the table of contents of the blocks (see read_toc).
+ */
 {
+    int k;
 
     *footer = read_footer(input_map, input_filesize);
 
     print("\tXML position: %ld\n", (*footer)->xml_pos);
     print("\tm/z binary position: %ld\n", (*footer)->mz_binary_pos);
     print("\tint binary position: %ld\n", (*footer)->inten_binary_pos);
-    print("\tXML blocks position: %ld\n", (*footer)->xml_blk_pos);
-    print("\tm/z binary blocks position: %ld\n", (*footer)->mz_binary_blk_pos);
-    print("\tinten binary blocks position: %ld\n", (*footer)->inten_binary_blk_pos);
+    for(k = 0; k < (*footer)->n_extra_arrays; k++)
+        print("\textra array %d binary position: %ld\n", k, (*footer)->extra_binary_pos[k]);
+    for(k = 0; k < (*footer)->n_chrom_arrays; k++)
+        print("\tchromatogram array %d binary position: %ld\n", k, (*footer)->chrom_binary_pos[k]);
+    print("\ttable of contents position: %ld\n", (*footer)->toc_pos);
     print("\tdivisions position: %ld\n", (*footer)->divisions_t_pos);
+    if((*footer)->checksum_pos != 0)
+        print("\tchecksum table position: %ld\n", (*footer)->checksum_pos);
     print("\tEOF position: %ld\n", input_filesize);
     print("\tOriginal filesize: %ld\n", (*footer)->original_filesize);
 
-    *xml_block_lens = read_block_len_queue(input_map, (*footer)->xml_blk_pos, (*footer)->mz_binary_blk_pos);
-    *mz_binary_block_lens = read_block_len_queue(input_map, (*footer)->mz_binary_blk_pos, (*footer)->inten_binary_blk_pos);
-    *inten_binary_block_lens = read_block_len_queue(input_map, (*footer)->inten_binary_blk_pos, (*footer)->divisions_t_pos);
+    if((*footer)->n_extra_arrays < 0 || (*footer)->n_extra_arrays > MAX_EXTRA_ARRAYS)
+        error("parse_footer: invalid extra array count %d.\n", (*footer)->n_extra_arrays);
+    if((*footer)->n_chrom_arrays != 0 && (*footer)->n_chrom_arrays != CHROM_ARRAYS)
+        error("parse_footer: invalid chromatogram array count %d.\n", (*footer)->n_chrom_arrays);
+
+    *toc = read_toc(input_map, *footer);
 
     *n_divisions = (*footer)->n_divisions;
 
@@ -1,3 +1,9 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#include <time.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include "mscompress.h"
@@ -118,175 +124,168 @@ pop_cmp_block(cmp_blk_queue_t* queue)
 
 }
 
-block_len_t*
-alloc_block_len(size_t original_size, size_t compressed_size)
-{
-    block_len_t* r;
-
-    r = malloc(sizeof(block_len_t));
-
-    r->original_size = original_size;
-    r->compressed_size = compressed_size;
-    r->next = NULL;
-
-    return r;
-}
+/*
+    Bounded multi-producer single-consumer ring of block descriptors (block_ring_t).
+
+    Workers hand their finished blocks to a writer thread through the ring. Each slot carries the position it is
+    ready for (Vyukov's bounded queue): a producer claims the position of the head with a compare-and-swap, fills
+    the slot and publishes it by advancing its sequence; the consumer reads slots in order without atomics of its
+    own. The slots are allocated once, so no memory is allocated per block. A producer finding the ring full
+    waits until the consumer frees a slot, which holds workers back when the writer lags. Waiting threads yield,
+    then sleep (RING_SLEEP_NS), so an idle writer does not take the time of the workers.
+*/
+
+#ifdef _WIN32
+    #define ring_load(p) ((uint64_t)InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0))
+    #define ring_store(p, v) InterlockedExchange64((volatile LONG64*)(p), (LONG64)(v))
+    #define ring_cas(p, expected, desired) \
+        (InterlockedCompareExchange64((volatile LONG64*)(p), (LONG64)(desired), (LONG64)(expected)) == (LONG64)(expected))
+    #define ring_sleep() Sleep(1)
+#else
+    #define ring_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+    #define ring_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+    static inline int
+    ring_cas(uint64_t* p, uint64_t expected, uint64_t desired)
+    {
+        return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+    #define ring_sleep() nanosleep(&(struct timespec){0, RING_SLEEP_NS}, NULL)
+#endif
 
-void
-dealloc_block_len(block_len_t* blk)
+static void
+ring_backoff(int* spins)
 {
-    if(blk)
+    if((*spins)++ < RING_SPINS)
     {
-        free(blk);
+        #ifdef _WIN32
+        SwitchToThread();
+        #else
+        sched_yield();
+        #endif
     }
+    else
+        ring_sleep();
 }
 
-block_len_queue_t*
-alloc_block_len_queue()
+block_ring_t*
+alloc_ring(int capacity)
+/**
+ * @brief Allocates a ring of at least capacity descriptors.
+ */
 {
-    block_len_queue_t* r;
+    uint64_t n = 2, i; // With one slot, the sequence of a filled slot and of a slot read would be the same.
 
-    r = malloc(sizeof(block_len_queue_t));
-    
+    while(n < (uint64_t)capacity)
+        n <<= 1;
+
+    block_ring_t* r = calloc(1, sizeof(block_ring_t));
     if(r == NULL)
-    {
-        fprintf(stderr, "alloc_block_len_queue: malloc failed\n");
-        exit(-1);
-    }
+        error("alloc_ring: malloc() error.\n");
 
-    r->head = NULL;
-    r->tail = NULL;
-    r->populated = 0;
+    r->slots = malloc(sizeof(ring_slot_t) * n);
+    if(r->slots == NULL)
+        error("alloc_ring: malloc() error.\n");
+
+    for(i = 0; i < n; i++)
+        r->slots[i].sequence = i;
+    r->mask = n - 1;
 
     return r;
 }
 
 void
-dealloc_block_len_queue(block_len_queue_t* queue)
+dealloc_ring(block_ring_t* ring)
 {
-    if(queue)
+    if(ring)
     {
-        if(queue->head)
-        {
-            block_len_t* curr_head = queue->head;
-            block_len_t* new_head = curr_head->next;
-            while(new_head)
-            {
-                free(curr_head);
-                curr_head = new_head;
-                new_head = curr_head->next;
-            }
-        }
-        free(queue);
+        free(ring->slots);
+        free(ring);
     }
 }
 
-
 void
-append_block_len(block_len_queue_t* queue, size_t original_size, size_t compressed_size)
+ring_push(block_ring_t* ring, long index, void* data)
+/**
+ * @brief Hands the block of division index to the consumer. Any thread may push; waits while the ring is full.
+ */
 {
-    block_len_t* old_tail;
-    block_len_t* blk;
-
-    blk = alloc_block_len(original_size, compressed_size);
+    uint64_t pos = ring_load(&ring->head);
+    ring_slot_t* slot;
+    int spins = 0;
 
-    old_tail = queue->tail;
-    if(old_tail)
+    for(;;)
     {
-        old_tail->next = blk;
-        queue->tail = blk;
-    }
-    else
-    {
-        queue->head = blk;
-        queue->tail = blk;
+        slot = &ring->slots[pos & ring->mask];
+        int64_t diff = (int64_t)ring_load(&slot->sequence) - (int64_t)pos;
+
+        if(diff == 0)
+        {
+            if(ring_cas(&ring->head, pos, pos + 1))
+                break;
+        }
+        else if(diff < 0) // full, the consumer has not read this slot yet
+            ring_backoff(&spins);
+
+        pos = ring_load(&ring->head);
     }
-    queue->populated++;
 
-    return;
+    slot->desc.index = index;
+    slot->desc.data = data;
+    ring_store(&slot->sequence, pos + 1);
 }
 
-block_len_t*
-pop_block_len(block_len_queue_t* queue)
+int
+ring_try_pop(block_ring_t* ring, ring_desc_t* desc)
+/**
+ * @brief Takes the next descriptor, in the order the producers claimed their positions. Consumer thread only.
+ *
+ * @return 1 if a descriptor was taken, 0 if the ring is empty.
+ */
 {
-    block_len_t* old_head;
+    ring_slot_t* slot = &ring->slots[ring->tail & ring->mask];
 
-    old_head = queue->head;
+    if(ring_load(&slot->sequence) != ring->tail + 1)
+        return 0;
 
-    if(old_head == NULL)
-        return NULL;
-    
-    if(queue->head == queue->tail)
-    {
-        queue->head = NULL;
-        queue->tail = NULL;
-    }
-    else
-        queue->head = old_head->next;
+    *desc = slot->desc;
+    ring_store(&slot->sequence, ring->tail + ring->mask + 1);
+    ring->tail++;
 
-    old_head->next = NULL;
+    return 1;
+}
 
-    queue->populated--;
+ring_desc_t
+ring_pop(block_ring_t* ring)
+/**
+ * @brief ring_try_pop, waiting for a descriptor if the ring is empty.
+ */
+{
+    ring_desc_t r;
+    int spins = 0;
 
-    return old_head;
+    while(!ring_try_pop(ring, &r))
+        ring_backoff(&spins);
 
+    return r;
 }
 
 void
-dump_block_len_queue(block_len_queue_t* queue, int fd)
+ring_done(block_ring_t* ring)
+/**
+ * @brief Marks one more descriptor as handled (e.g. its block written). Consumer thread only.
+ */
 {
-    block_len_t* curr;
-    block_len_t* prev; 
-    char buff[sizeof(size_t)];
-
-    size_t* buff_cast = (size_t*)(&buff[0]);
-
-    curr = queue->head;
-
-    while(curr != NULL)
-    {
-        *buff_cast = curr->original_size;
-        write_to_file(fd, buff, sizeof(size_t));
-
-        *buff_cast = curr->compressed_size;
-        write_to_file(fd, buff, sizeof(size_t));
-
-        prev = curr;
-        curr = curr->next;
-        dealloc_block_len(prev);
-    }
-
-    free(queue);
-
-    // dealloc_block_len_queue(queue);
+    ring_store(&ring->consumed, ring_load(&ring->consumed) + 1);
 }
 
-block_len_queue_t*
-read_block_len_queue(void* input_map, long offset, long end)
+void
+ring_wait(block_ring_t* ring, uint64_t n)
+/**
+ * @brief Waits until the consumer handled n descriptors.
+ */
 {
-    if(input_map == NULL)
-        error("read_block_len_queue: input_map is NULL");
-    if(offset < 0)
-        error("read_block_len_queue: offset is negative");
-    if(end < 0)
-        error("read_block_len_queue: end is negative");    
-    block_len_queue_t* r;
-    long diff;
-    int factor;
-    int i;
-
-    r = alloc_block_len_queue();
-
-    diff = end - offset;
-
-    factor = sizeof(size_t)*2;
+    int spins = 0;
 
-    char* input_ptr = (char*)(input_map);
-
-    input_ptr += offset;
-
-    for(i = 0; i < diff; i+=factor)
-        append_block_len(r, *(size_t*)(input_ptr+i), *(size_t*)(input_ptr+i+sizeof(size_t)));
-
-    return r;
-}
\ No newline at end of file
+    while(ring_load(&ring->consumed) < n)
+        ring_backoff(&spins);
+}
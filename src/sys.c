@@ -163,12 +163,15 @@ parse_blocksize(char* arg)
 {
     int num;
     int len;
-    char prefix[2];
+    char prefix[3] = {0};
     long res = -1;
 
     len = strlen(arg);
     num = atoi(arg);
 
+    if(len < 2)
+        return res;
+
     memcpy(prefix, arg+len-2, 2);
 
     if(!strcmp(prefix, "KB") || !strcmp(prefix, "kb"))
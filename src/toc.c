@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mscompress.h"
+
+/*
+    Table of contents of the compressed blocks of an msz file (see toc_entry_t).
+
+    Every division has one entry per stream, present or not, so the entry of a block is found by
+    position alone. Each entry holds the XXH64 of its compressed block, so blocks can be checked
+    without being decompressed.
+
+    The table is little-endian. Little-endian hosts read it in place from the mapping; big-endian hosts
+    write a byte-swapped copy and read one back (TOC_SWAP).
+*/
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #define TOC_SWAP 1
+#else
+    #define TOC_SWAP 0
+#endif
+
+#if TOC_SWAP
+static void
+swap_toc(toc_header_t* header, toc_entry_t* entries, size_t n)
+/**
+ * @brief Swaps the byte order of a table of contents header and its n entries.
+ */
+{
+    size_t i;
+
+    header->magic = __builtin_bswap32(header->magic);
+    header->entry_size = __builtin_bswap32(header->entry_size);
+    header->n_streams = __builtin_bswap32(header->n_streams);
+    header->n_divisions = __builtin_bswap32(header->n_divisions);
+
+    for(i = 0; i < n; i++)
+    {
+        toc_entry_t* e = &entries[i];
+        e->offset = __builtin_bswap64(e->offset);
+        e->compressed_size = __builtin_bswap64(e->compressed_size);
+        e->original_size = __builtin_bswap64(e->original_size);
+        e->restored_size = __builtin_bswap64(e->restored_size);
+        e->first_spectrum = __builtin_bswap64(e->first_spectrum);
+        e->hash = __builtin_bswap64(e->hash);
+        e->stream = __builtin_bswap32(e->stream);
+        e->codec = __builtin_bswap32(e->codec);
+        e->division = __builtin_bswap32(e->division);
+        e->n_spectra = __builtin_bswap32(e->n_spectra);
+    }
+}
+#endif
+
+toc_entry_t*
+alloc_toc(divisions_t* divisions, int n_streams)
+/**
+ * @brief Allocates the entries of the table of contents of n_streams streams of divisions, with the spectrum
+ *        range of each division filled in. The blocks are filled in by compress_parallel.
+ */
+{
+    int n = divisions->n_divisions, s, d;
+    uint64_t first = 0;
+
+    toc_entry_t* r = calloc((size_t)n_streams * n + 1, sizeof(toc_entry_t));
+    if(r == NULL)
+        error("alloc_toc: failed to allocate memory.\n");
+
+    for(d = 0; d < n; d++)
+    {
+        uint32_t n_spectra = (uint32_t)divisions->divisions[d]->mz->total_spec;
+        for(s = 0; s < n_streams; s++)
+        {
+            r[s * n + d].division = d;
+            r[s * n + d].first_spectrum = first;
+            r[s * n + d].n_spectra = n_spectra;
+        }
+        first += n_spectra;
+    }
+
+    return r;
+}
+
+uint64_t
+write_toc(toc_entry_t* entries, int n_streams, int n_divisions, int fd)
+/**
+ * @brief Writes the table of contents, aligned to 8 bytes.
+ *
+ * @return msz file position of the table of contents.
+ */
+{
+    char padding[8] = {0};
+    toc_header_t header = {TOC_MAGIC, sizeof(toc_entry_t), (uint32_t)n_streams, (uint32_t)n_divisions};
+
+    long pos = get_offset(fd);
+    if(pos % 8)
+        write_to_file(fd, padding, 8 - pos % 8);
+    pos = get_offset(fd);
+
+    size_t n = (size_t)n_streams * n_divisions;
+
+    #if TOC_SWAP
+    toc_entry_t* swapped = malloc(n * sizeof(toc_entry_t) + 1);
+    if(swapped == NULL)
+        error("write_toc: failed to allocate memory.\n");
+    memcpy(swapped, entries, n * sizeof(toc_entry_t));
+    swap_toc(&header, swapped, n);
+    entries = swapped;
+    #endif
+
+    write_to_file(fd, (char*)&header, sizeof(header));
+    write_to_file(fd, (char*)entries, n * sizeof(toc_entry_t));
+
+    #if TOC_SWAP
+    free(swapped);
+    #endif
+
+    return (uint64_t)pos;
+}
+
+toc_t*
+read_toc(void* input_map, footer_t* footer)
+/**
+ * @brief Maps the table of contents of an msz file and checks that its blocks lie before it.
+ */
+{
+    int s, i;
+
+    if(footer->toc_pos == 0 || footer->toc_pos % 8)
+        error("read_toc: invalid table of contents position %lu.\n", footer->toc_pos);
+
+    toc_t* r = malloc(sizeof(toc_t));
+    if(r == NULL)
+        error("read_toc: failed to allocate memory.\n");
+
+    r->header = (toc_header_t*)((char*)input_map + footer->toc_pos);
+    r->entries = (toc_entry_t*)(r->header + 1);
+    r->copy = NULL;
+
+    #if TOC_SWAP
+    {
+        // The header is swapped first to size the entries, which must lie before the footer.
+        toc_header_t header = *r->header;
+        swap_toc(&header, NULL, 0);
+        size_t len = sizeof(toc_header_t) + (size_t)header.n_streams * header.n_divisions * sizeof(toc_entry_t);
+        if(header.n_streams > TOC_STREAMS || footer->toc_pos + len > (uint64_t)((char*)footer - (char*)input_map))
+            error("read_toc: invalid table of contents.\n");
+
+        r->copy = malloc(len);
+        if(r->copy == NULL)
+            error("read_toc: failed to allocate memory.\n");
+        memcpy(r->copy, r->header, len);
+        r->header = (toc_header_t*)r->copy;
+        r->entries = (toc_entry_t*)(r->header + 1);
+        swap_toc(r->header, r->entries, (size_t)header.n_streams * header.n_divisions);
+    }
+    #endif
+
+    if(r->header->magic != TOC_MAGIC || r->header->entry_size != sizeof(toc_entry_t))
+        error("read_toc: invalid table of contents.\n");
+    if(r->header->n_divisions != (uint32_t)footer->n_divisions || r->header->n_streams > TOC_STREAMS)
+        error("read_toc: table of contents holds %u streams of %u divisions, footer %d divisions.\n",
+              r->header->n_streams, r->header->n_divisions, footer->n_divisions);
+
+    for(s = 0; s < TOC_STREAMS; s++)
+        r->slots[s] = -1;
+
+    long n = r->header->n_divisions;
+    for(s = 0; s < (int)r->header->n_streams && n > 0; s++)
+    {
+        uint32_t stream = r->entries[s * n].stream;
+        if(stream >= TOC_STREAMS || r->slots[stream] != -1)
+            error("read_toc: invalid stream %u.\n", stream);
+        r->slots[stream] = s;
+    }
+
+    for(i = 0; i < r->header->n_streams * n; i++)
+    {
+        toc_entry_t* e = &r->entries[i];
+        if(e->offset != 0 && (e->offset < HEADER_SIZE || e->offset + e->compressed_size > footer->toc_pos))
+            error("read_toc: block of stream %u division %u out of bounds.\n", e->stream, e->division);
+    }
+
+    return r;
+}
+
+void
+dealloc_toc(toc_t* toc)
+{
+    if(toc)
+        free(toc->copy);
+    free(toc);
+}
+
+toc_entry_t*
+toc_block(toc_t* toc, int stream, int division)
+/**
+ * @brief Entry of the block of stream (TOC_XML, ...) of a division.
+ *
+ * @return Pointer within the mapping, NULL if the division has no block in stream.
+ */
+{
+    int slot = toc->slots[stream];
+
+    if(slot < 0)
+        return NULL;
+
+    toc_entry_t* e = &toc->entries[(long)slot * toc->header->n_divisions + division];
+
+    return (e->offset != 0) ? e : NULL;
+}
+
+int
+verify_block(void* input_map, toc_entry_t* blk)
+/**
+ * @brief Checks a compressed block against the hash of its entry.
+ *
+ * @return 1 if the block is intact, 0 otherwise.
+ */
+{
+    return xxh64((char*)input_map + blk->offset, blk->compressed_size, 0) == blk->hash;
+}
@@ -0,0 +1,459 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+#include "mscompress.h"
+
+/*
+    msz to msz transcoding (--transcode).
+
+    Every block is decompressed with the codec it was written with and recompressed with the codecs and zstd
+    level of the arguments, a worker per division. The divisions, metadata and checksum tables do not depend on
+    the codecs and are copied as they are, so the checksum of the header still holds, unless a lossy re-transform
+    drops it.
+
+    -z/-i re-transform the m/z or intensity arrays of an msz storing them losslessly: the worker restores the
+    text of its division with decompress_routine and compresses the arrays again from it with compress_routine.
+    The blocks of a division are written together, in the stream order of the table of contents.
+*/
+
+typedef struct
+{
+    char* input_map;
+    data_format_t* src_df;      // decompression functions of the input
+    data_format_t* df;          // compression functions of the output
+    toc_t* toc;
+    division_t* division;
+    int d;                      // index of the division
+    uint64_t base;              // mzML position of the division, to re-transform from its restored text
+    int retransform_mz;
+    int retransform_inten;
+    long blocksize;
+    arena_t* arena;             // scratch memory of the worker, passed on to the routines it runs
+
+    cmp_block_t* ret[TOC_STREAMS]; // recompressed block of each stream, NULL if none
+} transcode_args_t;
+
+static decompression_fun
+stream_decompress_fun(data_format_t* df, int stream)
+{
+    if(stream == TOC_XML)
+        return (decompression_fun)df->xml_decompression_fun;
+    if(stream == TOC_MZ)
+        return (decompression_fun)df->mz_decompression_fun;
+    return (decompression_fun)df->inten_decompression_fun; // intensity, extra and chromatogram arrays
+}
+
+static compression_fun
+stream_compress_fun(data_format_t* df, int stream)
+{
+    if(stream == TOC_XML)
+        return (compression_fun)df->xml_compression_fun;
+    if(stream == TOC_MZ)
+        return (compression_fun)df->mz_compression_fun;
+    return (compression_fun)df->inten_compression_fun;
+}
+
+static uint32_t
+stream_codec(data_format_t* df, int stream)
+{
+    if(stream == TOC_XML)
+        return df->target_xml_format;
+    if(stream == TOC_MZ)
+        return df->target_mz_format;
+    return df->target_inten_format;
+}
+
+static uint64_t
+stream_pos(toc_entry_t* entries, toc_t* toc, int stream)
+/**
+ * @brief Position of the first block written in stream, 0 if none.
+ */
+{
+    int slot = toc->slots[stream];
+    uint32_t n = toc->header->n_divisions;
+
+    if(slot < 0)
+        return 0;
+    for(uint32_t d = 0; d < n; d++)
+        if(entries[(long)slot * n + d].offset != 0)
+            return entries[(long)slot * n + d].offset;
+    return 0;
+}
+
+static cmp_block_t*
+retransform_block(transcode_args_t* t_args, char* text, int mode)
+/**
+ * @brief Compresses the m/z (mode _mass_) or intensity binaries of a division from its restored text.
+ */
+{
+    division_t* div = t_args->division;
+    compress_args_t* c_args;
+    cmp_block_t* r = NULL;
+
+    c_args = alloc_compress_args(text - t_args->base,
+                                 (mode == _mass_) ? div->mz : div->inten,
+                                 (mode == _mass_) ? div->inten : NULL,
+                                 t_args->df,
+                                 stream_compress_fun(t_args->df, (mode == _mass_) ? TOC_MZ : TOC_INTEN),
+                                 t_args->blocksize, t_args->blocksize, mode, 0);
+    c_args->arena = t_args->arena;
+    compress_routine(c_args);
+
+    if(c_args->ret != NULL && c_args->ret->populated > 0)
+        r = pop_cmp_block(c_args->ret);
+    dealloc_compress_args(c_args);
+
+    return r;
+}
+
+static void
+transcode_routine(void* args)
+/**
+ * @brief Recompresses the blocks of a division.
+ */
+{
+    transcode_args_t* t_args = (transcode_args_t*)args;
+    ZSTD_CCtx* cctx = alloc_cctx();
+    ZSTD_DCtx* dctx = alloc_dctx();
+    division_t* div = t_args->division;
+    toc_t* toc = t_args->toc;
+    char* text = NULL;
+    int s, k;
+
+    if(t_args->retransform_mz || t_args->retransform_inten)
+    {
+        decompress_args_t* d_args = alloc_decompress_args(t_args->input_map, t_args->src_df,
+                                                          toc_block(toc, TOC_XML, t_args->d),
+                                                          toc_block(toc, TOC_MZ, t_args->d),
+                                                          toc_block(toc, TOC_INTEN, t_args->d), div);
+        for(k = 0; k < MAX_EXTRA_ARRAYS; k++)
+            d_args->extra_binary_blk[k] = toc_block(toc, TOC_EXTRA + k, t_args->d);
+        for(k = 0; k < CHROM_ARRAYS; k++)
+            d_args->chrom_binary_blk[k] = toc_block(toc, TOC_CHROM + k, t_args->d);
+        d_args->arena = t_args->arena;
+
+        decompress_routine(d_args);
+        if(d_args->ret_len != div->size)
+            error("transcode_routine: division %d restored to %ld bytes, expected %ld.\n",
+                  t_args->d, (long)d_args->ret_len, (long)div->size);
+
+        text = d_args->ret;
+        d_args->ret = NULL;
+        dealloc_decompress_args(d_args);
+    }
+
+    for(s = 0; s < TOC_STREAMS; s++)
+    {
+        toc_entry_t* blk = toc_block(toc, s, t_args->d);
+
+        if(s == TOC_MZ && t_args->retransform_mz)
+            t_args->ret[s] = retransform_block(t_args, text, _mass_);
+        else if(s == TOC_INTEN && t_args->retransform_inten)
+            t_args->ret[s] = retransform_block(t_args, text, _intensity_);
+        else if(blk != NULL)
+        {
+            size_t cmp_len = 0;
+            void* decmp = decmp_block(stream_decompress_fun(t_args->src_df, s), dctx, t_args->input_map, blk);
+            if(decmp == NULL)
+                error("transcode_routine: failed to decompress block of stream %d division %d.\n", s, t_args->d);
+            void* cmp = stream_compress_fun(t_args->df, s)(cctx, decmp, blk->original_size, &cmp_len,
+                                                           t_args->df->zstd_compression_level);
+            free(decmp);
+            t_args->ret[s] = alloc_cmp_block(cmp, cmp_len, blk->original_size);
+            t_args->ret[s]->restored_size = blk->restored_size;
+        }
+    }
+
+    free(text);
+    dealloc_cctx(cctx);
+    ZSTD_freeDCtx(dctx);
+}
+
+static long
+transcode_cost(transcode_args_t* t_args)
+/**
+ * @brief Estimated memory of transcoding a division (see budget_batch): each block decompressed and recompressed,
+ *        and its restored text and staged arrays if they are re-transformed.
+ */
+{
+    long r = WORKER_MEMORY;
+
+    for(int s = 0; s < TOC_STREAMS; s++)
+    {
+        toc_entry_t* blk = toc_block(t_args->toc, s, t_args->d);
+        if(blk != NULL)
+            r += blk->original_size + blk->compressed_size;
+    }
+
+    if(t_args->retransform_mz || t_args->retransform_inten)
+        r += 3 * t_args->division->size;
+
+    return r;
+}
+
+#ifdef _WIN32
+DWORD WINAPI transcode_routine_win(LPVOID lpParam) {
+    transcode_routine(lpParam);
+    return 0;
+}
+#endif
+
+static void
+run_transcode_routines(transcode_args_t** args, int n)
+/**
+ * @brief Runs transcode_routine on args[0..n-1], one thread each with an arena of its own, and waits for all of them.
+ */
+{
+    int i;
+    arena_t** arenas = get_arenas(n);
+
+    #ifdef _WIN32
+    HANDLE* ptid = malloc(sizeof(HANDLE) * n);
+    #else
+    pthread_t* ptid = malloc(sizeof(pthread_t) * n);
+    #endif
+
+    if(ptid == NULL)
+        error("run_transcode_routines: malloc() error.\n");
+
+    for(i = 0; i < n; i++)
+    {
+        args[i]->arena = arenas[i];
+        #ifdef _WIN32
+        ptid[i] = CreateThread(NULL, 0, transcode_routine_win, args[i], 0, NULL);
+        if(ptid[i] == NULL)
+        {
+            perror("CreateThread");
+            exit(-1);
+        }
+        #else
+        if(pthread_create(&ptid[i], NULL, (void*)transcode_routine, (void*)args[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(-1);
+        }
+        #endif
+    }
+
+    #ifdef _WIN32
+    WaitForMultipleObjects(n, ptid, TRUE, INFINITE);
+    for(i = 0; i < n; i++)
+        CloseHandle(ptid[i]);
+    #else
+    for(i = 0; i < n; i++)
+    {
+        if(pthread_join(ptid[i], NULL) != 0)
+        {
+            perror("pthread_join");
+            exit(-1);
+        }
+    }
+    #endif
+
+    free(ptid);
+}
+
+static int
+target_algo(char* lossy, int current, int tiled, char* array)
+/**
+ * @brief Transform of the m/z or intensity arrays of the output: the one of the input unless -z/-i asks for another.
+ */
+{
+    int algo = get_algo_type(lossy);
+
+    if(algo == _lossless_ || algo == current)
+        return current;
+    if(current != _lossless_)
+        error("transcode_msz: %s arrays are already transformed, only lossless arrays can be re-transformed.\n", array);
+    if(!tiled)
+        error("transcode_msz: %s arrays can only be re-transformed in an msz of a whole mzML.\n", array);
+
+    return algo;
+}
+
+void
+transcode_msz(char* input_map, size_t input_filesize, struct Arguments* arguments, int output_fd)
+/**
+ * @brief Rewrites the msz mapped in input_map to output_fd with the codecs, zstd level and transforms of arguments.
+ */
+{
+    footer_t* src_footer;
+    footer_t footer;
+    toc_t* toc;
+    divisions_t* divisions;
+    int n_divisions = 0, threads = arguments->threads;
+    int i, s;
+    double start = get_time();
+
+    check_format_version(input_map, "transcode_msz");
+
+    parse_footer(&src_footer, input_map, input_filesize, &toc, &divisions, &n_divisions);
+    if(n_divisions == 0)
+        error("transcode_msz: no divisions found in file.\n");
+
+    data_format_t* src_df = get_header_df(input_map);
+    set_decompress_runtime_variables(arguments, src_df, src_footer);
+
+    // Positions of the divisions in the mzML; re-transforming needs them to tile it.
+    uint64_t* bases = malloc(sizeof(uint64_t) * n_divisions);
+    if(bases == NULL)
+        error("transcode_msz: malloc() error.\n");
+    uint64_t pos = 0;
+    for(i = 0; i < n_divisions; i++)
+    {
+        bases[i] = pos;
+        pos += divisions->divisions[i]->size;
+    }
+    int tiled = (pos == src_footer->original_filesize);
+
+    data_format_t* df = get_header_df(input_map);
+    set_compress_runtime_variables(arguments, df);
+    df->mz_algo = target_algo(arguments->mz_lossy, src_footer->mz_fmt, tiled, "m/z");
+    df->inten_algo = target_algo(arguments->int_lossy, src_footer->inten_fmt, tiled, "intensity");
+    if(df->mz_algo == src_footer->mz_fmt)
+        df->mz_scale_factor = src_df->mz_scale_factor;
+    if(df->inten_algo == src_footer->inten_fmt)
+        df->int_scale_factor = src_df->int_scale_factor;
+
+    int retransform_mz = df->mz_algo != src_footer->mz_fmt;
+    int retransform_inten = df->inten_algo != src_footer->inten_fmt;
+    long blocksize = get_header_blocksize(input_map);
+
+    print("\tTranscoding %d divisions over %d threads%s%s.\n", n_divisions, threads,
+          retransform_mz ? ", re-transforming m/z" : "", retransform_inten ? ", re-transforming intensity" : "");
+
+    // The checksum covers the mzML: unchanged, unless the output no longer restores it.
+    int keep_checksum = src_footer->checksum_pos != 0 &&
+                        is_lossless_algo(df->mz_algo) && is_lossless_algo(df->inten_algo);
+    if(src_footer->checksum_pos != 0 && !keep_checksum)
+        warning("Lossy transforms do not restore the input file, checksum dropped.\n");
+    write_header(output_fd, df, blocksize,
+                 keep_checksum ? (char*)input_map + CHECKSUM_OFFSET : "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+
+    memcpy(&footer, src_footer, sizeof(footer_t));
+    footer.mz_fmt = df->mz_algo;
+    footer.inten_fmt = df->inten_algo;
+
+    // Same streams as the input, in the same order
+    int n_streams = toc->header->n_streams;
+    toc_entry_t* entries = alloc_toc(divisions, n_streams);
+    for(s = 0; s < TOC_STREAMS; s++)
+    {
+        if(toc->slots[s] < 0)
+            continue;
+        for(i = 0; i < n_divisions; i++)
+        {
+            entries[toc->slots[s] * n_divisions + i].stream = s;
+            entries[toc->slots[s] * n_divisions + i].codec = stream_codec(df, s);
+        }
+    }
+
+    transcode_args_t** args = malloc(sizeof(transcode_args_t*) * n_divisions);
+    if(args == NULL)
+        error("transcode_msz: malloc() error.\n");
+    for(i = 0; i < n_divisions; i++)
+    {
+        args[i] = calloc(1, sizeof(transcode_args_t));
+        if(args[i] == NULL)
+            error("transcode_msz: malloc() error.\n");
+        args[i]->input_map = input_map;
+        args[i]->src_df = src_df;
+        args[i]->df = df;
+        args[i]->toc = toc;
+        args[i]->division = divisions->divisions[i];
+        args[i]->d = i;
+        args[i]->base = bases[i];
+        args[i]->retransform_mz = retransform_mz;
+        args[i]->retransform_inten = retransform_inten;
+        args[i]->blocksize = blocksize;
+    }
+
+    long* costs = malloc(sizeof(long) * n_divisions);
+    if(costs == NULL)
+        error("transcode_msz: malloc() error.\n");
+    for(i = 0; i < n_divisions; i++)
+        costs[i] = transcode_cost(args[i]);
+
+    int divisions_used = 0, divisions_left = n_divisions, batch;
+    size_t in_size = 0, out_size = 0;
+
+    while(divisions_left > 0)
+    {
+        batch = budget_batch(costs + divisions_used, divisions_left, threads);
+
+        run_transcode_routines(args + divisions_used, batch);
+
+        for(i = divisions_used; i < divisions_used + batch; i++)
+        {
+            for(s = 0; s < TOC_STREAMS; s++)
+            {
+                cmp_block_t* blk = args[i]->ret[s];
+                if(blk == NULL)
+                    continue;
+
+                toc_entry_t* entry = &entries[toc->slots[s] * n_divisions + i];
+                toc_entry_t* src = toc_block(toc, s, i);
+                entry->offset = get_offset(output_fd);
+                entry->compressed_size = blk->size;
+                entry->original_size = blk->original_size;
+                entry->restored_size = blk->restored_size;
+                entry->hash = blk->hash;
+                write_cmp_blk(blk, output_fd);
+
+                in_size += src ? src->compressed_size : 0;
+                out_size += blk->size;
+                dealloc_cmp_block(blk);
+            }
+            free(args[i]);
+        }
+
+        divisions_used += batch;
+        divisions_left -= batch;
+    }
+
+    free(costs);
+
+    footer.xml_pos = stream_pos(entries, toc, TOC_XML);
+    footer.mz_binary_pos = stream_pos(entries, toc, TOC_MZ);
+    footer.inten_binary_pos = stream_pos(entries, toc, TOC_INTEN);
+    for(s = 0; s < MAX_EXTRA_ARRAYS; s++)
+        footer.extra_binary_pos[s] = stream_pos(entries, toc, TOC_EXTRA + s);
+    for(s = 0; s < CHROM_ARRAYS; s++)
+        footer.chrom_binary_pos[s] = stream_pos(entries, toc, TOC_CHROM + s);
+
+    footer.toc_pos = write_toc(entries, n_streams, n_divisions, output_fd);
+    free(entries);
+
+    // Divisions, metadata and checksum tables, up to the footer. The checksum table is the last of them.
+    uint64_t tables_end = input_filesize - sizeof(footer_t);
+    if(src_footer->checksum_pos != 0 && !keep_checksum)
+    {
+        tables_end = src_footer->checksum_pos;
+        footer.checksum_pos = 0;
+    }
+    int64_t shift = (int64_t)get_offset(output_fd) - (int64_t)src_footer->divisions_t_pos;
+    write_to_file(output_fd, input_map + src_footer->divisions_t_pos, tables_end - src_footer->divisions_t_pos);
+    footer.divisions_t_pos += shift;
+    footer.metadata_pos += shift;
+    if(footer.checksum_pos != 0)
+        footer.checksum_pos += shift;
+
+    write_footer(&footer, output_fd);
+
+    print("\tBlocks: %ld bytes -> %ld bytes (%1.2fx)\n", (long)in_size, (long)out_size, (double)in_size / out_size);
+    print("Transcoding time: %1.4fs\n", get_time() - start);
+
+    free(args);
+    free(bases);
+    free(src_df);
+    free(df);
+    dealloc_toc(toc);
+    dealloc_read_divisions(divisions);
+    dealloc_arenas();
+}
@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+#include "mscompress.h"
+
+/*
+    Structural coding of the XML stream (_xml_struct_).
+
+    Spectrum headers differ mostly in their numbers. Each XML block is split into a template, the text with
+    every number replaced by XML_TOKEN, and value columns holding the numbers. The column of a number is
+    chosen by the template preceding it, back to the last '<' within XML_CONTEXT bytes (e.g.
+    `name="scan start time" value="`), which the decoder has read before reaching the number, so no column
+    ids are stored and the text between numbers is copied as is.
+
+    Integers are stored as the difference to the previous integer of their column, decimals as a mantissa
+    (difference to the previous decimal of the column), a count of fractional digits and an optional exponent.
+    Numbers without an exact canonical rendering (leading zeros, "-0", ...) are left in the template.
+
+    Block: varint template length, varint column count, varint length of each column, the template,
+    then the columns; the whole compressed as one zstd frame.
+*/
+
+#define XML_TOKEN  0x01  /* a number, read from its column */
+#define XML_ESCAPE 0x02  /* the next template byte is literal text */
+
+#define XML_MAX_COLUMNS 128   /* numbers of further contexts share the last column */
+#define XML_HASH_SLOTS  256
+#define XML_CONTEXT     48    /* template bytes before a number choosing its column */
+#define XML_MAX_DIGITS  18    /* mantissa digits, fits an int64_t */
+
+#define XML_INT     0x00
+#define XML_DECIMAL 0x01
+#define XML_EXP     0x04      /* decimal with exponent */
+#define XML_EXP_UP  0x08      /* exponent written 'E' */
+#define XML_EXP_POS 0x10      /* exponent written with '+' */
+#define XML_EXP_NEG 0x20      /* exponent written with '-' */
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+typedef struct
+{
+    uint64_t hashes[XML_HASH_SLOTS];
+    uint8_t columns[XML_HASH_SLOTS];  // column + 1, 0 for an empty slot
+    int n_columns;
+    int64_t prev_int[XML_MAX_COLUMNS];
+    int64_t prev_mantissa[XML_MAX_COLUMNS];
+} xml_columns_t;
+
+typedef struct
+{
+    char* mem;
+    size_t size;
+    size_t max_size;
+} xml_buff_t;
+
+static const int64_t pow10_table[XML_MAX_DIGITS + 1] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL, 1000000000LL,
+    10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL, 100000000000000LL,
+    1000000000000000LL, 10000000000000000LL, 100000000000000000LL, 1000000000000000000LL
+};
+
+static int
+get_column(xml_columns_t* c, uint64_t hash)
+/**
+ * @brief Returns the column of a context, assigning the next free column to a new context.
+ */
+{
+    int slot = hash % XML_HASH_SLOTS;
+
+    while(c->columns[slot] != 0)
+    {
+        if(c->hashes[slot] == hash)
+            return c->columns[slot] - 1;
+        slot = (slot + 1) % XML_HASH_SLOTS;
+    }
+
+    if(c->n_columns == XML_MAX_COLUMNS)
+        return XML_MAX_COLUMNS - 1;
+
+    c->hashes[slot] = hash;
+    c->columns[slot] = ++c->n_columns;
+    return c->n_columns - 1;
+}
+
+static uint64_t
+context_hash(const char* template, const char* pos)
+/**
+ * @brief Hashes the template preceding pos, back to the last '<' within XML_CONTEXT bytes.
+ */
+{
+    const char* s = (pos - template > XML_CONTEXT) ? pos - XML_CONTEXT : template;
+    const char* tag = pos;
+    uint64_t hash = FNV_OFFSET;
+
+    while(tag > s && *(tag - 1) != '<')
+        tag--;
+    if(tag > s)
+        s = tag - 1;
+    for(; s < pos; s++)
+        hash = (hash ^ (uint8_t)*s) * FNV_PRIME;
+    return hash;
+}
+
+static void
+buff_reserve(xml_buff_t* b, size_t n)
+{
+    if(b->size + n <= b->max_size)
+        return;
+    while(b->size + n > b->max_size)
+        b->max_size = b->max_size ? b->max_size * 2 : 4096;
+    b->mem = realloc(b->mem, b->max_size);
+    if(b->mem == NULL)
+        error("buff_reserve: realloc() error.\n");
+}
+
+static void
+put_varint(xml_buff_t* b, uint64_t v)
+{
+    buff_reserve(b, 10);
+    while(v >= 0x80)
+    {
+        b->mem[b->size++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    b->mem[b->size++] = (char)v;
+}
+
+static uint64_t
+get_varint(const uint8_t** p, const uint8_t* end)
+{
+    uint64_t v = 0;
+    int shift = 0;
+
+    while(*p < end && shift < 64)
+    {
+        uint8_t byte = *(*p)++;
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80))
+            return v;
+        shift += 7;
+    }
+    error("get_varint: truncated structural XML block.\n");
+    return 0;
+}
+
+static uint64_t
+zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t
+unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int
+is_token_start(char c)
+{
+    return c == '"' || c == '=' || c == '>' || c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',';
+}
+
+static int
+is_token_end(char c)
+{
+    return c == '"' || c == '<' || c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',';
+}
+
+static int
+is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+typedef struct
+{
+    int tag;
+    int64_t mantissa;
+    int frac_digits;
+    int exp_digits;
+    int64_t exp;
+} xml_number_t;
+
+static size_t
+parse_number(const char* p, const char* end, xml_number_t* n)
+/**
+ * @brief Parses a number written canonically (as render_number writes it) at p, ended by is_token_end.
+ *
+ * @return The length of the number, 0 if p holds none.
+ */
+{
+    const char* s = p;
+    int negative = 0, int_digits = 0;
+    int64_t m = 0;
+
+    n->tag = XML_INT;
+    n->frac_digits = n->exp_digits = 0;
+    n->exp = 0;
+
+    if(s < end && *s == '-')
+    {
+        negative = 1;
+        s++;
+    }
+    for(; s < end && is_digit(*s); s++, int_digits++)
+    {
+        if(int_digits == XML_MAX_DIGITS)
+            return 0;
+        m = m * 10 + (*s - '0');
+    }
+    if(int_digits == 0 || (int_digits > 1 && s[-int_digits] == '0')) // no leading zeros
+        return 0;
+
+    if(s < end && *s == '.')
+    {
+        s++;
+        n->tag = XML_DECIMAL;
+        for(; s < end && is_digit(*s); s++, n->frac_digits++)
+        {
+            if(int_digits + n->frac_digits == XML_MAX_DIGITS)
+                return 0;
+            m = m * 10 + (*s - '0');
+        }
+        if(n->frac_digits == 0)
+            return 0;
+
+        if(s < end && (*s == 'e' || *s == 'E'))
+        {
+            n->tag |= XML_EXP | (*s == 'E' ? XML_EXP_UP : 0);
+            s++;
+            if(s < end && (*s == '+' || *s == '-'))
+                n->tag |= (*s++ == '+') ? XML_EXP_POS : XML_EXP_NEG;
+            for(; s < end && is_digit(*s); s++, n->exp_digits++)
+            {
+                if(n->exp_digits == 9)
+                    return 0;
+                n->exp = n->exp * 10 + (*s - '0');
+            }
+            if(n->exp_digits == 0)
+                return 0;
+        }
+    }
+
+    if(s == end || !is_token_end(*s))
+        return 0;
+    if(negative && m == 0) // "-0" would be written "0"
+        return 0;
+
+    n->mantissa = negative ? -m : m;
+    return s - p;
+}
+
+static char*
+render_number(char* out, xml_number_t* n)
+/**
+ * @brief Writes a number parsed by parse_number back to its original text.
+ *
+ * @return The position following the number.
+ */
+{
+    char digits[24];
+    uint64_t m = (n->mantissa < 0) ? -(uint64_t)n->mantissa : (uint64_t)n->mantissa;
+    uint64_t ip = m / pow10_table[n->frac_digits], fp = m % pow10_table[n->frac_digits];
+    int len = 0, k;
+
+    if(n->mantissa < 0)
+        *out++ = '-';
+
+    do
+    {
+        digits[len++] = '0' + ip % 10;
+        ip /= 10;
+    } while(ip > 0);
+    while(len > 0)
+        *out++ = digits[--len];
+
+    if(!(n->tag & XML_DECIMAL))
+        return out;
+
+    *out++ = '.';
+    for(k = n->frac_digits - 1; k >= 0; k--)
+    {
+        out[k] = '0' + fp % 10;
+        fp /= 10;
+    }
+    out += n->frac_digits;
+
+    if(n->tag & XML_EXP)
+    {
+        int64_t e = n->exp;
+        *out++ = (n->tag & XML_EXP_UP) ? 'E' : 'e';
+        if(n->tag & XML_EXP_POS)
+            *out++ = '+';
+        else if(n->tag & XML_EXP_NEG)
+            *out++ = '-';
+        for(k = n->exp_digits - 1; k >= 0; k--)
+        {
+            out[k] = '0' + e % 10;
+            e /= 10;
+        }
+        out += n->exp_digits;
+    }
+    return out;
+}
+
+void*
+xml_struct_compress(ZSTD_CCtx* cctx, void* src_buff, size_t src_len, size_t* out_len, int compression_level)
+/**
+ * @brief Structurally codes an XML block (see above) and compresses it with zstd_compress.
+ *        Same function signature as zstd_compress.
+ */
+{
+    const char* src = (const char*)src_buff;
+    const char* end = src + src_len;
+    const char* p = src;
+    xml_columns_t* cols = calloc(1, sizeof(xml_columns_t));
+    xml_buff_t template = {NULL, 0, 0}, values[XML_MAX_COLUMNS], block = {NULL, 0, 0};
+    xml_number_t n;
+    size_t len;
+    int k;
+
+    if(cols == NULL)
+        error("xml_struct_compress: calloc() error.\n");
+    memset(values, 0, sizeof(values));
+
+    buff_reserve(&template, src_len + 1);
+
+    while(p < end)
+    {
+        char c = *p;
+
+        if((c == '-' || is_digit(c)) && p > src && is_token_start(p[-1]) && (len = parse_number(p, end, &n)) > 0)
+        {
+            int col = get_column(cols, context_hash(template.mem, template.mem + template.size));
+            xml_buff_t* v = &values[col];
+
+            buff_reserve(v, 1);
+            v->mem[v->size++] = (char)n.tag;
+            if(n.tag & XML_DECIMAL)
+            {
+                put_varint(v, n.frac_digits);
+                put_varint(v, zigzag(n.mantissa - cols->prev_mantissa[col]));
+                cols->prev_mantissa[col] = n.mantissa;
+                if(n.tag & XML_EXP)
+                {
+                    put_varint(v, n.exp_digits);
+                    put_varint(v, n.exp);
+                }
+            }
+            else
+            {
+                put_varint(v, zigzag(n.mantissa - cols->prev_int[col]));
+                cols->prev_int[col] = n.mantissa;
+            }
+
+            buff_reserve(&template, 1);
+            template.mem[template.size++] = XML_TOKEN;
+            p += len;
+            continue;
+        }
+
+        buff_reserve(&template, 2);
+        if(c == XML_TOKEN || c == XML_ESCAPE)
+            template.mem[template.size++] = XML_ESCAPE;
+        template.mem[template.size++] = c;
+        p++;
+    }
+
+    put_varint(&block, template.size);
+    put_varint(&block, cols->n_columns);
+    for(k = 0; k < cols->n_columns; k++)
+        put_varint(&block, values[k].size);
+    buff_reserve(&block, template.size);
+    memcpy(block.mem + block.size, template.mem, template.size);
+    block.size += template.size;
+    for(k = 0; k < cols->n_columns; k++)
+    {
+        buff_reserve(&block, values[k].size);
+        memcpy(block.mem + block.size, values[k].mem, values[k].size);
+        block.size += values[k].size;
+        free(values[k].mem);
+    }
+
+    void* r = zstd_compress(cctx, block.mem, block.size, out_len, compression_level);
+
+    free(template.mem);
+    free(block.mem);
+    free(cols);
+
+    return r;
+}
+
+void*
+xml_struct_decompress(ZSTD_DCtx* dctx, void* src_buff, size_t src_len, size_t org_len)
+/**
+ * @brief Decompresses a block of xml_struct_compress back to its org_len bytes of XML.
+ *        Same function signature as zstd_decompress.
+ */
+{
+    unsigned long long block_len = ZSTD_getFrameContentSize(src_buff, src_len);
+
+    if(block_len == ZSTD_CONTENTSIZE_ERROR || block_len == ZSTD_CONTENTSIZE_UNKNOWN)
+        error("xml_struct_decompress: invalid zstd frame.\n");
+
+    uint8_t* block = zstd_decompress(dctx, src_buff, src_len, block_len);
+    const uint8_t* p = block;
+    const uint8_t* block_end = block + block_len;
+    const uint8_t *col_p[XML_MAX_COLUMNS], *col_end[XML_MAX_COLUMNS];
+    uint64_t col_len[XML_MAX_COLUMNS];
+    xml_columns_t* cols = calloc(1, sizeof(xml_columns_t));
+    char* out = malloc(org_len + 64); // room for a number overrunning a corrupt block
+    char* o = out;
+    char* out_end = out + org_len;
+    xml_number_t n;
+    int k, n_columns;
+
+    if(cols == NULL || out == NULL)
+        error("xml_struct_decompress: malloc() error.\n");
+
+    uint64_t template_len = get_varint(&p, block_end);
+    n_columns = (int)get_varint(&p, block_end);
+    if(n_columns > XML_MAX_COLUMNS)
+        error("xml_struct_decompress: invalid column count %d.\n", n_columns);
+    for(k = 0; k < n_columns; k++)
+        col_len[k] = get_varint(&p, block_end);
+
+    const uint8_t* t = p;
+    const uint8_t* t_end = t + template_len;
+    const uint8_t* c = t_end;
+    if(template_len > (uint64_t)(block_end - t))
+        error("xml_struct_decompress: truncated structural XML block.\n");
+    for(k = 0; k < n_columns; k++)
+    {
+        if(col_len[k] > (uint64_t)(block_end - c))
+            error("xml_struct_decompress: truncated structural XML block.\n");
+        col_p[k] = c;
+        col_end[k] = c + col_len[k];
+        c += col_len[k];
+    }
+
+    while(t < t_end)
+    {
+        // Copy the text up to the next number or escaped byte
+        const uint8_t* next = memchr(t, XML_TOKEN, t_end - t);
+        const uint8_t* esc = memchr(t, XML_ESCAPE, (next ? next : t_end) - t);
+        if(esc != NULL)
+            next = esc;
+        if(next == NULL)
+            next = t_end;
+        if(next - t > out_end - o)
+            error("xml_struct_decompress: corrupt structural XML block.\n");
+        memcpy(o, t, next - t);
+        o += next - t;
+        t = next;
+
+        if(t == t_end)
+            break;
+
+        if(*t == XML_ESCAPE)
+        {
+            if(t + 1 == t_end || o == out_end)
+                error("xml_struct_decompress: corrupt structural XML block.\n");
+            *o++ = (char)t[1];
+            t += 2;
+            continue;
+        }
+
+        int col = get_column(cols, context_hash((const char*)p, (const char*)t));
+        if(col >= n_columns || col_p[col] >= col_end[col] || o >= out_end)
+            error("xml_struct_decompress: corrupt structural XML block.\n");
+
+        n.tag = *col_p[col]++;
+        n.frac_digits = n.exp_digits = 0;
+        n.exp = 0;
+        if(n.tag & XML_DECIMAL)
+        {
+            n.frac_digits = (int)get_varint(&col_p[col], col_end[col]);
+            n.mantissa = cols->prev_mantissa[col] + unzigzag(get_varint(&col_p[col], col_end[col]));
+            cols->prev_mantissa[col] = n.mantissa;
+            if(n.tag & XML_EXP)
+            {
+                n.exp_digits = (int)get_varint(&col_p[col], col_end[col]);
+                n.exp = (int64_t)get_varint(&col_p[col], col_end[col]);
+            }
+            if(n.frac_digits > XML_MAX_DIGITS || n.exp_digits > 9)
+                error("xml_struct_decompress: corrupt structural XML block.\n");
+        }
+        else
+        {
+            n.mantissa = cols->prev_int[col] + unzigzag(get_varint(&col_p[col], col_end[col]));
+            cols->prev_int[col] = n.mantissa;
+        }
+        o = render_number(o, &n);
+        t++;
+    }
+
+    if(o != out_end)
+        error("xml_struct_decompress: decoded %ld bytes, expected %ld.\n", (long)(o - out), (long)org_len);
+
+    free(block);
+    free(cols);
+
+    return out;
+}
@@ -9,22 +9,39 @@
 
 zlib_block_t*
 zlib_alloc(int offset)
+{
+    return zlib_alloc_sized(offset, ZLIB_BUFF_FACTOR);
+}
+
+zlib_block_t*
+zlib_alloc_sized(int offset, size_t len)
+/**
+ * @brief Allocates a zlib_block_t with room for len bytes after a header of offset bytes.
+ *        Used when the decompressed size is known beforehand (e.g. defaultArrayLength * element size)
+ *        so the output buffer is allocated exactly once.
+ * 
+ * @param offset Number of bytes to reserve for a header in front of the buffer.
+ * 
+ * @param len Expected length of the buffer. A len of 0 falls back to ZLIB_BUFF_FACTOR.
+ * 
+ * @return A malloc'ed zlib_block_t on success. NULL on error.
+ */
 {
     if(offset < 0) {
         warning("zlib_alloc: offset must be >= 0");
         return NULL;
     }
     
-    zlib_block_t* r = malloc(sizeof(zlib_block_t));
+    zlib_block_t* r = scratch_alloc(sizeof(zlib_block_t));
 
     if(r == NULL) {
         warning("zlib_alloc: malloc error");
         return NULL;
     }
-    r->len = ZLIB_BUFF_FACTOR;
+    r->len = len > 0 ? len : ZLIB_BUFF_FACTOR;
     r->size = r->len + offset;
     r->offset = offset;
-    r->mem = malloc(r->size);
+    r->mem = scratch_alloc(r->size);
     if(r->mem == NULL) {
         warning("zlib_alloc: malloc error");
         return NULL;
@@ -39,7 +56,7 @@ zlib_realloc(zlib_block_t* old_block, size_t new_size)
 {
     old_block->len = new_size;
     old_block->size = old_block->len + old_block->offset;
-    old_block->mem = realloc(old_block->mem, old_block->size);
+    old_block->mem = scratch_realloc(old_block->mem, old_block->size > 0 ? old_block->size : 1); // realloc of 0 bytes may return NULL
     if(!old_block->mem)
     {
         fprintf(stderr, "realloc() error");
@@ -53,8 +70,8 @@ zlib_dealloc(zlib_block_t* blk)
 {
     if(blk)
     {
-        free(blk->mem);
-        free(blk);
+        scratch_free(blk->mem);
+        scratch_free(blk);
     }
 
 }
@@ -72,24 +89,46 @@ void*
 zlib_pop_header(zlib_block_t* blk)
 {
     void* r;
-    r = malloc(blk->offset);
+    r = scratch_alloc(blk->offset);
     memcpy(r, blk->mem, blk->offset);
     return r;
 }
 
 z_stream*
 alloc_z_stream()
+{
+    return alloc_deflate_z_stream(Z_DEFAULT_COMPRESSION, Z_DEFAULT_STRATEGY);
+}
+
+z_stream*
+alloc_deflate_z_stream(int level, int strategy)
+/**
+ * @brief Allocates a z_stream initialized for deflate with the given level and strategy.
+ *        Z_DEFAULT_COMPRESSION and Z_DEFAULT_STRATEGY reproduce the output of zlib's compress().
+ *        Lower levels, Z_HUFFMAN_ONLY and Z_RLE trade compression ratio for speed.
+ * 
+ * @param level Deflate compression level (Z_DEFAULT_COMPRESSION or 0-9). ZLIB_AUTO selects the default.
+ * 
+ * @param strategy Deflate strategy (Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED).
+ *                 ZLIB_AUTO selects the default.
+ */
 {
     z_stream* z;
 
+    if(level == ZLIB_AUTO)
+        level = Z_DEFAULT_COMPRESSION;
+    if(strategy == ZLIB_AUTO)
+        strategy = Z_DEFAULT_STRATEGY;
+
     z = calloc(1, sizeof(z_stream));
 
     if(z == NULL) {
-        warning("alloc_z_stream: calloc error\n");
+        warning("alloc_deflate_z_stream: calloc error\n");
         return NULL;
     }
-    if (deflateInit(z, Z_DEFAULT_COMPRESSION) != Z_OK) {
-        warning("alloc_z_stream: deflateInit error\n");
+    if (deflateInit2(z, level, Z_DEFLATED, MAX_WBITS, 8, strategy) != Z_OK) {
+        warning("alloc_deflate_z_stream: deflateInit error\n");
+        free(z);
         return NULL;
     }
 
@@ -106,89 +145,224 @@ dealloc_z_stream(z_stream* z)
     }
 }
 
+z_stream*
+alloc_inflate_z_stream()
+/**
+ * @brief Allocates a z_stream initialized for inflate.
+ *        The stream is meant to be reused for every array decoded by a thread (see zlib_decompress)
+ *        and released with dealloc_inflate_z_stream.
+ */
+{
+    z_stream* z;
+
+    z = calloc(1, sizeof(z_stream));
+
+    if(z == NULL) {
+        warning("alloc_inflate_z_stream: calloc error\n");
+        return NULL;
+    }
+    if (inflateInit(z) != Z_OK) {
+        warning("alloc_inflate_z_stream: inflateInit error\n");
+        free(z);
+        return NULL;
+    }
+
+    return z;
+}
+
+void
+dealloc_inflate_z_stream(z_stream* z)
+{
+    if(z)
+    {
+        inflateEnd(z);
+        free(z);
+    }
+}
+
 uInt 
 zlib_compress(z_stream* z, Bytef* input, zlib_block_t* output, uInt input_len)
+/**
+ * @brief Deflates input into output in a single Z_FINISH call.
+ *        output is grown to deflateBound() beforehand if needed, so allocating it with
+ *        zlib_alloc_sized(offset, deflateBound(z, input_len)) avoids any reallocation.
+ *        The z_stream is reset on return, ready for the next array.
+ * 
+ * @return Length of the deflated data. output->len is set to it (the buffer is not shrunk).
+ */
 {
     uInt r;
 
-    uInt output_len = output->len;
-    
     if(z == NULL)
         error("zlib_compress: z_stream is NULL");
-    
+
+    uLong bound = deflateBound(z, input_len);
+
+    if(output->len < bound)
+        zlib_realloc(output, bound);
     
     z->avail_in = input_len;
     z->next_in = input;
-    z->avail_out = output_len;
+    z->avail_out = output->len;
     z->next_out = output->buff;
-    z->total_out = 0;
 
-    int ret;
+    int ret = deflate(z, Z_FINISH);
 
-    do 
-    {
-        z->avail_out = output_len-z->total_out;
-        z->next_out = output->buff+z->total_out;
-
-        ret = deflate(z, Z_FINISH);
-
-        if(ret != Z_OK)
-            break;
-
-        output_len += ZLIB_BUFF_FACTOR;
-        zlib_realloc(output, output_len);
-
-    } while(z->avail_out == 0);
+    if(ret != Z_STREAM_END)
+        error("zlib_compress: deflate error (%d).\n", ret);
 
     r = z->total_out;
     
     deflateReset(z); // reset the z_stream
 
-    zlib_realloc(output, r); // shrink the buffer down to only what is in use
+    output->len = r;
 
     return r;
 } 
 
 uInt 
 zlib_decompress(z_stream* z, Bytef* input, zlib_block_t* output, uInt input_len)
+/**
+ * @brief Inflates input into output using a z_stream allocated by alloc_inflate_z_stream.
+ *        The stream is inflated in a single Z_FINISH call when output is large enough
+ *        (see zlib_alloc_sized). Otherwise, output is grown by ZLIB_BUFF_FACTOR until the stream ends.
+ *        The z_stream is reset on return, ready for the next array.
+ * 
+ * @return Length of the inflated data. output is resized to fit it exactly.
+ */
 {
     uInt r;
 
-    uInt output_len = output->len;
-
     if(z == NULL)
         error("zlib_decompress: z_stream is NULL");
 
     z->avail_in = input_len;
     z->next_in = input;
-    z->avail_out = output_len;
+    z->avail_out = output->len;
     z->next_out = output->buff;
-    z->total_out = 0;
-
-    inflateInit(z);
 
     int ret;
 
-    do
+    while((ret = inflate(z, Z_FINISH)) != Z_STREAM_END)
     {
-        z->avail_out = output_len-z->total_out;
-        z->next_out = output->buff+z->total_out;
+        if(ret != Z_BUF_ERROR || z->avail_out != 0)
+            error("zlib_decompress: inflate error (%d).\n", ret);
 
-        ret = inflate(z, Z_NO_FLUSH);
-        
-        if(ret != Z_OK)
-            break;
-    
-        output_len += ZLIB_BUFF_FACTOR;
-        zlib_realloc(output, output_len);
-
-    } while (z->avail_out == 0);
+        // Output buffer is full, grow it and resume.
+        zlib_realloc(output, output->len + ZLIB_BUFF_FACTOR);
+        z->next_out = output->buff + z->total_out;
+        z->avail_out = output->len - z->total_out;
+    }
 
     r = z->total_out;
 
     inflateReset(z);
 
-    zlib_realloc(output, r); // shrink the buffer down to only what is in use
+    if(r != output->len)
+        zlib_realloc(output, r); // shrink the buffer down to only what is in use
+
+    return r;
+}
+
+void
+zlib_set_params(z_stream* z, int params)
+/**
+ * @brief Applies deflate parameters (see ZLIB_PARAMS) to a deflate z_stream that has no pending input.
+ *        ZLIB_PARAMS_RAW is ignored.
+ */
+{
+    if(params == ZLIB_PARAMS_RAW)
+        return;
+
+    if(deflateParams(z, ZLIB_PARAMS_LEVEL(params), ZLIB_PARAMS_STRATEGY(params)) != Z_OK)
+        error("zlib_set_params: deflateParams error.\n");
+}
+
+static int
+zlib_params_match(z_stream* z, int params, Bytef* inflated, size_t inflated_len, Bytef* deflated, size_t deflated_len, Bytef* scratch)
+{
+    int ret, match;
+
+    zlib_set_params(z, params);
+
+    z->next_in = inflated;
+    z->avail_in = inflated_len;
+    z->next_out = scratch;
+    z->avail_out = deflated_len;
+
+    ret = deflate(z, Z_FINISH);
+
+    match = (ret == Z_STREAM_END && z->total_out == deflated_len && memcmp(scratch, deflated, deflated_len) == 0);
+
+    deflateReset(z);
+
+    return match;
+}
+
+int
+zlib_find_params(z_stream* z, Bytef* inflated, size_t inflated_len, Bytef* deflated, size_t deflated_len, int hint)
+/**
+ * @brief Finds the deflate parameters that reproduce a zlib stream byte for byte from its inflated data.
+ *        Streams are recreated by re-deflating with this library, so only streams written with a 32K window
+ *        and the default memLevel (zlib's compress(), most mzML writers) can be matched.
+ *        The hint (usually the parameters of the previous binary) is tried first, then the levels
+ *        announced by the FLEVEL bits of the zlib header, across the strategies that share them.
+ * 
+ * @param z Deflate z_stream (see alloc_z_stream) used for the trials.
+ * 
+ * @param inflated Inflated data.
+ * 
+ * @param deflated Original zlib stream.
+ * 
+ * @param hint Parameters to try first, or ZLIB_PARAMS_RAW.
+ * 
+ * @return Parameters (see ZLIB_PARAMS) reproducing the stream, or ZLIB_PARAMS_RAW if none do.
+ */
+{
+    /* Candidates grouped by the FLEVEL (header compression level) they produce */
+    static const int candidates[4][10] = {
+        { ZLIB_PARAMS(1, Z_DEFAULT_STRATEGY), ZLIB_PARAMS(6, Z_HUFFMAN_ONLY), ZLIB_PARAMS(6, Z_RLE),
+          ZLIB_PARAMS(0, Z_DEFAULT_STRATEGY), ZLIB_PARAMS(1, Z_FIXED), -1 },
+        { ZLIB_PARAMS(5, Z_DEFAULT_STRATEGY), ZLIB_PARAMS(4, Z_DEFAULT_STRATEGY), ZLIB_PARAMS(3, Z_DEFAULT_STRATEGY),
+          ZLIB_PARAMS(2, Z_DEFAULT_STRATEGY), ZLIB_PARAMS(5, Z_FILTERED), ZLIB_PARAMS(4, Z_FILTERED),
+          ZLIB_PARAMS(5, Z_FIXED), ZLIB_PARAMS(3, Z_FIXED), ZLIB_PARAMS(2, Z_FIXED), -1 },
+        { ZLIB_PARAMS(6, Z_DEFAULT_STRATEGY), ZLIB_PARAMS(6, Z_FILTERED), ZLIB_PARAMS(6, Z_FIXED), -1 },
+        { ZLIB_PARAMS(9, Z_DEFAULT_STRATEGY), ZLIB_PARAMS(7, Z_DEFAULT_STRATEGY), ZLIB_PARAMS(8, Z_DEFAULT_STRATEGY),
+          ZLIB_PARAMS(9, Z_FILTERED), ZLIB_PARAMS(7, Z_FILTERED), ZLIB_PARAMS(8, Z_FILTERED),
+          ZLIB_PARAMS(9, Z_FIXED), ZLIB_PARAMS(7, Z_FIXED), ZLIB_PARAMS(8, Z_FIXED), -1 }
+    };
+
+    int r = ZLIB_PARAMS_RAW;
+    const int* c;
+
+    if(z == NULL)
+        error("zlib_find_params: z_stream is NULL");
+
+    // Deflate method with a 32K window, no preset dictionary
+    if(deflated_len < 2 || deflated[0] != 0x78 || (deflated[1] & 0x20))
+        return ZLIB_PARAMS_RAW;
+
+    Bytef* scratch = scratch_alloc(deflated_len);
+    if(scratch == NULL)
+        error("zlib_find_params: malloc error.\n");
+
+    if(hint != ZLIB_PARAMS_RAW && zlib_params_match(z, hint, inflated, inflated_len, deflated, deflated_len, scratch))
+        r = hint;
+    else
+    {
+        for(c = candidates[deflated[1] >> 6]; *c != -1; c++)
+        {
+            if(*c == hint)
+                continue;
+            if(zlib_params_match(z, *c, inflated, inflated_len, deflated, deflated_len, scratch))
+            {
+                r = *c;
+                break;
+            }
+        }
+    }
+
+    scratch_free(scratch);
 
     return r;
 }